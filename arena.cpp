@@ -0,0 +1,140 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: 
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+
+
+// arena.c
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+#include "goldsrc_standin.h"
+#include "arena.h"
+
+#define	ARENA_ALIGN			16
+#define	ARENA_MIN_BLOCK		(64*1024)
+#define	BLOCK_HEADER		((sizeof(arenablock_t) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+
+// malloc only promises 8 byte alignment on 32 bit Windows
+static void *AlignedAlloc (size_t size)
+{
+#ifdef _WIN32
+	return _aligned_malloc (size, ARENA_ALIGN);
+#else
+	void	*p;
+
+	if (posix_memalign (&p, ARENA_ALIGN, size))
+		return NULL;
+	return p;
+#endif
+}
+
+static void AlignedFree (void *p)
+{
+#ifdef _WIN32
+	_aligned_free (p);
+#else
+	free (p);
+#endif
+}
+
+static arenablock_t *NewBlock (arena_t *arena, size_t size)
+{
+	arenablock_t	*block;
+
+	block = (arenablock_t *)AlignedAlloc (BLOCK_HEADER + size);
+	if (!block)
+		Error ("Arena_Alloc: out of memory for %u bytes", (unsigned)size);
+	block->next = arena->blocks;
+	block->size = size;
+	block->used = 0;
+	arena->blocks = block;
+	arena->heapallocs++;
+	return block;
+}
+
+static void FreeBlocks (arena_t *arena)
+{
+	arenablock_t	*block, *next;
+
+	for (block = arena->blocks ; block ; block = next)
+	{
+		next = block->next;
+		AlignedFree (block);
+	}
+	arena->blocks = NULL;
+}
+
+
+void Arena_Init (arena_t *arena)
+{
+	memset (arena, 0, sizeof(*arena));
+}
+
+void Arena_Free (arena_t *arena)
+{
+	FreeBlocks (arena);
+	arena->used = 0;
+}
+
+
+/*
+=============
+Arena_Alloc
+=============
+*/
+void *Arena_Alloc (arena_t *arena, size_t size)
+{
+	arenablock_t	*block;
+	size_t			blocksize;
+	byte			*p;
+
+	size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	arena->allocs++;
+
+	block = arena->blocks;
+	if (!block || block->size - block->used < size)
+	{
+		// at least double, so a run of growing jobs settles quickly
+		blocksize = block ? block->size * 2 : ARENA_MIN_BLOCK;
+		if (blocksize < size)
+			blocksize = size;
+		block = NewBlock (arena, blocksize);
+	}
+
+	p = (byte *)block + BLOCK_HEADER + block->used;
+	block->used += size;
+	arena->used += size;
+	if (arena->used > arena->peak)
+		arena->peak = arena->used;
+	return p;
+}
+
+
+/*
+=============
+Arena_Reset
+
+Everything allocated since the last reset is given back.  If that took more
+than one block they're swapped for one that would have held it all.
+=============
+*/
+void Arena_Reset (arena_t *arena)
+{
+	if (arena->blocks && arena->blocks->next)
+	{
+		FreeBlocks (arena);
+		NewBlock (arena, arena->peak);
+	}
+	if (arena->blocks)
+		arena->blocks->used = 0;
+	arena->used = 0;
+}
@@ -0,0 +1,52 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: 
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+
+
+// arena.h
+
+#ifndef ARENA_H
+#define ARENA_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+
+//
+// Scratch memory for work that's thrown away all at once.  Arena_Alloc hands
+// out pieces of one block and Arena_Reset takes them all back.  Whatever
+// doesn't fit comes from a new block off the heap, and the next reset
+// replaces them all with a single block as big as everything since the last,
+// so once the largest job has been seen the arena stops touching the heap.
+// There is no size limit beyond what the heap will give.
+//
+
+typedef struct arenablock_s
+{
+	struct arenablock_s	*next;		// older, only until the next reset
+	size_t				size;
+	size_t				used;
+} arenablock_t;
+
+typedef struct
+{
+	arenablock_t	*blocks;		// the newest first
+	size_t			used;			// since the last reset
+	size_t			peak;			// the most used between any two resets
+	int				allocs;			// Arena_Alloc calls
+	int				heapallocs;		// blocks it had to get from the heap
+} arena_t;
+
+void	Arena_Init (arena_t *arena);
+void	Arena_Free (arena_t *arena);
+
+// 16 byte aligned and not cleared.
+void	*Arena_Alloc (arena_t *arena, size_t size);
+void	Arena_Reset (arena_t *arena);
+
+
+#endif // ARENA_H
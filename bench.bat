@@ -0,0 +1,4 @@
+set CC=g++
+set OUTPUT=xwadbench.exe
+%CC% -O2 xwadbench.cpp wadlib.cpp wadindex.cpp threads.cpp procpool.cpp lzsslib.cpp goldsrc_standin.cpp -lpsapi -o %OUTPUT%
+%CC% -O2 kernelbench.cpp texlib.cpp dxtlib.cpp threads.cpp arena.cpp lbmlib.cpp wadlib.cpp lzsslib.cpp goldsrc_standin.cpp -o kernelbench.exe
@@ -1,4 +1,4 @@
 set CC=g++
 set OUTPUT=xwad.exe
-%CC% xwad.cpp wadlib.cpp goldsrc_standin.cpp -o %OUTPUT%
+%CC% xwad.cpp wadlib.cpp wadcheck.cpp wadindex.cpp wadrepack.cpp lzsslib.cpp checksum.cpp threads.cpp workqueue.cpp arena.cpp texlib.cpp procpool.cpp dxtlib.cpp vtflib.cpp goldsrc_standin.cpp -lpsapi -o %OUTPUT%
 
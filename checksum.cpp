@@ -0,0 +1,135 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: 
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+
+// checksum.c
+
+#include <stdio.h>
+#include <string.h>
+#include "goldsrc_standin.h"
+#include "checksum.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <nmmintrin.h>
+#define CRC32C_HARDWARE
+#endif
+
+#define	CRC32C_POLY		0x82F63B78		// reversed Castagnoli polynomial
+
+static unsigned	crctable[8][256];		// slicing by 8
+static qboolean	hardwarecrc;
+
+
+/*
+================
+CRC32C_Init
+
+Builds the tables and checks the processor before main runs, so there is
+nothing to race over when threads start checksumming.
+================
+*/
+static struct CRC32CInit_t
+{
+	CRC32CInit_t ()
+	{
+		unsigned	c;
+		int			i, j;
+
+		for (i = 0 ; i < 256 ; i++)
+		{
+			c = i;
+			for (j = 0 ; j < 8 ; j++)
+				c = (c >> 1) ^ (CRC32C_POLY & (0 - (c & 1)));
+			crctable[0][i] = c;
+		}
+		for (i = 0 ; i < 256 ; i++)
+		{
+			for (j = 1 ; j < 8 ; j++)
+				crctable[j][i] = (crctable[j-1][i] >> 8) ^ crctable[0][crctable[j-1][i] & 255];
+		}
+
+#ifdef CRC32C_HARDWARE
+		__builtin_cpu_init ();
+		hardwarecrc = __builtin_cpu_supports ("sse4.2") ? true : false;
+#endif
+	}
+} crc32cinit;
+
+
+/*
+================
+CRC32C_Software
+================
+*/
+static unsigned CRC32C_Software (unsigned crc, const byte *p, int length)
+{
+	unsigned	lo, hi;
+
+	for ( ; length >= 8 ; p += 8, length -= 8)
+	{
+		lo = crc ^ (p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24));
+		hi = p[4] | (p[5] << 8) | (p[6] << 16) | ((unsigned)p[7] << 24);
+		crc = crctable[7][lo & 255] ^ crctable[6][(lo >> 8) & 255] ^
+			crctable[5][(lo >> 16) & 255] ^ crctable[4][lo >> 24] ^
+			crctable[3][hi & 255] ^ crctable[2][(hi >> 8) & 255] ^
+			crctable[1][(hi >> 16) & 255] ^ crctable[0][hi >> 24];
+	}
+	for ( ; length > 0 ; p++, length--)
+		crc = (crc >> 8) ^ crctable[0][(crc ^ *p) & 255];
+
+	return crc;
+}
+
+
+#ifdef CRC32C_HARDWARE
+/*
+================
+CRC32C_Hardware
+================
+*/
+__attribute__((target("sse4.2")))
+static unsigned CRC32C_Hardware (unsigned crc, const byte *p, int length)
+{
+#ifdef __x86_64__
+	unsigned long long	c = crc, v;
+
+	for ( ; length >= 8 ; p += 8, length -= 8)
+	{
+		memcpy (&v, p, 8);
+		c = _mm_crc32_u64 (c, v);
+	}
+	crc = (unsigned)c;
+#endif
+	for ( ; length >= 4 ; p += 4, length -= 4)
+	{
+		unsigned	v32;
+
+		memcpy (&v32, p, 4);
+		crc = _mm_crc32_u32 (crc, v32);
+	}
+	for ( ; length > 0 ; p++, length--)
+		crc = _mm_crc32_u8 (crc, *p);
+
+	return crc;
+}
+#endif
+
+
+/*
+================
+CRC32C
+================
+*/
+unsigned CRC32C (unsigned crc, const void *data, int length)
+{
+	crc = ~crc;
+#ifdef CRC32C_HARDWARE
+	if (hardwarecrc)
+		return ~CRC32C_Hardware (crc, (const byte *)data, length);
+#endif
+	return ~CRC32C_Software (crc, (const byte *)data, length);
+}
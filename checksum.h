@@ -0,0 +1,24 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: 
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+
+// checksum.h
+
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+
+// CRC-32C (Castagnoli).  Pass 0 to start and the previous result to carry on
+// over more data, the same way zlib's crc32() works.  Uses the SSE4.2 crc32
+// instruction when the processor has it.
+unsigned	CRC32C (unsigned crc, const void *data, int length);
+
+
+#endif // CHECKSUM_H
@@ -0,0 +1,1208 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: 
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+
+// dxtlib.c
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <float.h>
+#include <limits.h>
+#include "goldsrc_standin.h"
+#include "arena.h"
+#include "texlib.h"
+#include "threads.h"
+#include "dxtlib.h"
+
+// The SSE4.1 and AVX2 functions are compiled for those on their own, and
+// only called once texlib has checked the CPU has them.
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define DXTLIB_X86
+#define DXTLIB_SSE41	__attribute__ ((target ("sse4.1")))
+#define DXTLIB_AVX2		__attribute__ ((target ("avx2")))
+#include <immintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#define DXTLIB_X86
+#define DXTLIB_SSE41
+#define DXTLIB_AVX2
+#include <immintrin.h>
+#endif
+
+#define	DXT_STRIP_BLOCKS	1024	// about how many blocks a thread takes at a time
+#define	FIT_LANES			8		// the most partitions scored at once, with AVX2
+#define	FIT_MAX_LINES		153		// (i, j) pairs for sixteen pixels in four clusters
+
+// the grid each channel of an end point is snapped to, where it goes in the
+// 565 colour and how it's widened back out to 8 bits
+static const float	grid565[3] = { 31.0f / 255.0f, 63.0f / 255.0f, 31.0f / 255.0f };
+static const int	shift565[3] = { 11, 5, 0 };
+static const int	widenup[3] = { 3, 2, 3 };
+static const int	widendown[3] = { 2, 4, 2 };
+
+
+/*
+============================================================================
+
+						BLOCKS
+
+============================================================================
+*/
+
+/*
+==================
+GetBlock
+
+Copies out the 4x4 block at bx,by, repeating the edge for any part of it
+that's off the image
+==================
+*/
+static void GetBlock (const byte *rgba, int width, int height, int bx, int by, byte block[64])
+{
+	int		x, y, sx, sy;
+
+	for (y = 0 ; y < 4 ; y++)
+	{
+		sy = by + y < height ? by + y : height - 1;
+		for (x = 0 ; x < 4 ; x++)
+		{
+			sx = bx + x < width ? bx + x : width - 1;
+			memcpy (block + (y * 4 + x) * 4, rgba + (sy * width + sx) * 4, 4);
+		}
+	}
+}
+
+// a bit for each pixel DXT1's one bit alpha makes transparent
+static int TransparentPixels (const byte block[64])
+{
+	int		i, transparent;
+
+	transparent = 0;
+	for (i = 0 ; i < 16 ; i++)
+		if (block[i * 4 + 3] < 128)
+			transparent |= 1 << i;
+	return transparent;
+}
+
+
+static inline int To565 (const int rgb[3])
+{
+	return ((rgb[0] >> 3) << 11) | ((rgb[1] >> 2) << 5) | (rgb[2] >> 3);
+}
+
+static inline void From565 (int c, int rgb[3])
+{
+	rgb[0] = (c >> 11) & 31;
+	rgb[1] = (c >> 5) & 63;
+	rgb[2] = c & 31;
+	rgb[0] = (rgb[0] << 3) | (rgb[0] >> 2);
+	rgb[1] = (rgb[1] << 2) | (rgb[1] >> 4);
+	rgb[2] = (rgb[2] << 3) | (rgb[2] >> 2);
+}
+
+/*
+==================
+ColorPalette
+
+The colours the decoder makes from c0 and c1, and how many of them a pixel
+can have: c0 > c1 selects four, c0 <= c1 three and transparent black
+==================
+*/
+static int ColorPalette (int c0, int c1, int palette[4][3])
+{
+	int		j;
+
+	From565 (c0, palette[0]);
+	From565 (c1, palette[1]);
+	for (j = 0 ; j < 3 ; j++)
+	{
+		if (c0 > c1)
+		{
+			palette[2][j] = (2 * palette[0][j] + palette[1][j]) / 3;
+			palette[3][j] = (palette[0][j] + 2 * palette[1][j]) / 3;
+		}
+		else
+		{
+			palette[2][j] = (palette[0][j] + palette[1][j]) / 2;
+			palette[3][j] = 0;
+		}
+	}
+	return c0 > c1 ? 4 : 3;
+}
+
+/*
+==================
+AlphaPalette
+
+a0 > a1 selects eight values between them, a0 <= a1 six and 0 and 255
+==================
+*/
+static void AlphaPalette (int a0, int a1, int palette[8])
+{
+	int		j;
+
+	palette[0] = a0;
+	palette[1] = a1;
+	if (a0 > a1)
+	{
+		for (j = 1 ; j < 7 ; j++)
+			palette[j + 1] = ((7 - j) * a0 + j * a1) / 7;
+	}
+	else
+	{
+		for (j = 1 ; j < 5 ; j++)
+			palette[j + 1] = ((5 - j) * a0 + j * a1) / 5;
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+}
+
+static void WriteColorBlock (int c0, int c1, unsigned indices, byte *out)
+{
+	out[0] = c0 & 0xff;
+	out[1] = c0 >> 8;
+	out[2] = c1 & 0xff;
+	out[3] = c1 >> 8;
+	out[4] = indices & 0xff;
+	out[5] = (indices >> 8) & 0xff;
+	out[6] = (indices >> 16) & 0xff;
+	out[7] = indices >> 24;
+}
+
+static void WriteAlphaBlock (int a0, int a1, unsigned long long indices, byte *out)
+{
+	int		i;
+
+	out[0] = a0;
+	out[1] = a1;
+	for (i = 0 ; i < 6 ; i++)
+		out[2 + i] = (byte)(indices >> (i * 8));
+}
+
+
+/*
+============================================================================
+
+						INDICES
+
+Every pixel takes the nearest of the palette entries, the first of them on a
+tie, and the summed squared error says how well the end points did.  The
+SIMD versions give exactly the same indices and error.
+
+============================================================================
+*/
+
+/*
+==================
+ColorIndices
+
+Pixels with their bit set in transparent take index 3, which needs
+c0 <= c1, and aren't counted in the error
+==================
+*/
+static int ColorIndices (const byte block[64], int c0, int c1, int transparent, unsigned *indices)
+{
+	int			palette[4][3];
+	int			colours, i, j, d, best, bestdist, error;
+	unsigned	bits;
+
+	colours = ColorPalette (c0, c1, palette);
+	bits = 0;
+	error = 0;
+	for (i = 15 ; i >= 0 ; i--)
+	{
+		if (transparent & (1 << i))
+		{
+			best = 3;
+		}
+		else
+		{
+			best = 0;
+			bestdist = INT_MAX;
+			for (j = 0 ; j < colours ; j++)
+			{
+				d = (block[i * 4 + 0] - palette[j][0]) * (block[i * 4 + 0] - palette[j][0])
+					+ (block[i * 4 + 1] - palette[j][1]) * (block[i * 4 + 1] - palette[j][1])
+					+ (block[i * 4 + 2] - palette[j][2]) * (block[i * 4 + 2] - palette[j][2]);
+				if (d < bestdist)
+				{
+					bestdist = d;
+					best = j;
+				}
+			}
+			error += bestdist;
+		}
+		bits = (bits << 2) | best;
+	}
+
+	*indices = bits;
+	return error;
+}
+
+static int AlphaIndices (const byte block[64], const int palette[8], unsigned long long *indices)
+{
+	int					i, j, d, best, bestdist, error;
+	unsigned long long	bits;
+
+	bits = 0;
+	error = 0;
+	for (i = 15 ; i >= 0 ; i--)
+	{
+		best = 0;
+		bestdist = 256;
+		for (j = 0 ; j < 8 ; j++)
+		{
+			d = abs (block[i * 4 + 3] - palette[j]);
+			if (d < bestdist)
+			{
+				bestdist = d;
+				best = j;
+			}
+		}
+		error += bestdist * bestdist;
+		bits = (bits << 3) | best;
+	}
+
+	*indices = bits;
+	return error;
+}
+
+#ifdef DXTLIB_X86
+// sixteen indices of 0 to 3, a byte each, into 2 bits each
+DXTLIB_SSE41 static inline unsigned PackColorIndices (__m128i best)
+{
+	best = _mm_maddubs_epi16 (best, _mm_set1_epi16 (0x0401));
+	best = _mm_madd_epi16 (best, _mm_set1_epi32 (0x00100001));
+	best = _mm_packus_epi32 (best, best);
+	best = _mm_packus_epi16 (best, best);
+	return (unsigned)_mm_cvtsi128_si32 (best);
+}
+
+DXTLIB_SSE41 static inline int SumLanes (__m128i v)
+{
+	v = _mm_add_epi32 (v, _mm_shuffle_epi32 (v, _MM_SHUFFLE (1, 0, 3, 2)));
+	v = _mm_add_epi32 (v, _mm_shuffle_epi32 (v, _MM_SHUFFLE (2, 3, 0, 1)));
+	return _mm_cvtsi128_si32 (v);
+}
+
+/*
+==================
+ColorIndicesSSE41
+
+Four pixels at a time, widened to 16 bits so a multiply-add squares and
+sums two channels at once
+==================
+*/
+DXTLIB_SSE41 static int ColorIndicesSSE41 (const byte block[64], int c0, int c1, int transparent,
+										   unsigned *indices)
+{
+	int			palette[4][3];
+	int			colours, i, j;
+	__m128i		pixels[8], bestdist[4], best[4], tmask[4];
+	__m128i		row, p, d0, d1, dist, less, bits, zero, sum;
+
+	colours = ColorPalette (c0, c1, palette);
+	zero = _mm_setzero_si128 ();
+	for (i = 0 ; i < 4 ; i++)
+	{
+		row = _mm_and_si128 (_mm_loadu_si128 ((const __m128i *)(block + i * 16)), _mm_set1_epi32 (0x00ffffff));
+		pixels[i * 2] = _mm_cvtepu8_epi16 (row);
+		pixels[i * 2 + 1] = _mm_unpackhi_epi8 (row, zero);
+	}
+
+	for (j = 0 ; j < colours ; j++)
+	{
+		p = _mm_setr_epi16 (palette[j][0], palette[j][1], palette[j][2], 0,
+							palette[j][0], palette[j][1], palette[j][2], 0);
+		for (i = 0 ; i < 4 ; i++)
+		{
+			d0 = _mm_sub_epi16 (pixels[i * 2], p);
+			d1 = _mm_sub_epi16 (pixels[i * 2 + 1], p);
+			dist = _mm_hadd_epi32 (_mm_madd_epi16 (d0, d0), _mm_madd_epi16 (d1, d1));
+			if (!j)
+			{
+				bestdist[i] = dist;
+				best[i] = zero;
+				continue;
+			}
+			less = _mm_cmplt_epi32 (dist, bestdist[i]);
+			bestdist[i] = _mm_min_epi32 (dist, bestdist[i]);
+			best[i] = _mm_blendv_epi8 (best[i], _mm_set1_epi32 (j), less);
+		}
+	}
+
+	bits = _mm_setr_epi32 (1, 2, 4, 8);
+	sum = zero;
+	for (i = 0 ; i < 4 ; i++)
+	{
+		tmask[i] = _mm_cmpeq_epi32 (_mm_and_si128 (_mm_set1_epi32 (transparent >> (i * 4)), bits), bits);
+		best[i] = _mm_blendv_epi8 (best[i], _mm_set1_epi32 (3), tmask[i]);
+		sum = _mm_add_epi32 (sum, _mm_andnot_si128 (tmask[i], bestdist[i]));
+	}
+
+	*indices = PackColorIndices (_mm_packs_epi16 (_mm_packs_epi32 (best[0], best[1]),
+												  _mm_packs_epi32 (best[2], best[3])));
+	return SumLanes (sum);
+}
+
+/*
+==================
+ColorIndicesAVX2
+
+Eight pixels at a time.  The horizontal add works within each half, which
+leaves the pixels in the order 0 1 4 5 2 3 6 7 until they're packed.
+==================
+*/
+DXTLIB_AVX2 static int ColorIndicesAVX2 (const byte block[64], int c0, int c1, int transparent,
+										 unsigned *indices)
+{
+	int			palette[4][3];
+	int			colours, i, j;
+	__m256i		pixels[4], bestdist[2], best[2];
+	__m256i		p, d0, d1, dist, less, bits, tmask, sum, packed;
+
+	colours = ColorPalette (c0, c1, palette);
+	for (i = 0 ; i < 4 ; i++)
+		pixels[i] = _mm256_cvtepu8_epi16 (_mm_and_si128 (_mm_loadu_si128 ((const __m128i *)(block + i * 16)),
+														 _mm_set1_epi32 (0x00ffffff)));
+
+	for (j = 0 ; j < colours ; j++)
+	{
+		p = _mm256_setr_epi16 (palette[j][0], palette[j][1], palette[j][2], 0,
+							   palette[j][0], palette[j][1], palette[j][2], 0,
+							   palette[j][0], palette[j][1], palette[j][2], 0,
+							   palette[j][0], palette[j][1], palette[j][2], 0);
+		for (i = 0 ; i < 2 ; i++)
+		{
+			d0 = _mm256_sub_epi16 (pixels[i * 2], p);
+			d1 = _mm256_sub_epi16 (pixels[i * 2 + 1], p);
+			dist = _mm256_hadd_epi32 (_mm256_madd_epi16 (d0, d0), _mm256_madd_epi16 (d1, d1));
+			if (!j)
+			{
+				bestdist[i] = dist;
+				best[i] = _mm256_setzero_si256 ();
+				continue;
+			}
+			less = _mm256_cmpgt_epi32 (bestdist[i], dist);
+			bestdist[i] = _mm256_min_epi32 (dist, bestdist[i]);
+			best[i] = _mm256_blendv_epi8 (best[i], _mm256_set1_epi32 (j), less);
+		}
+	}
+
+	bits = _mm256_setr_epi32 (1, 2, 16, 32, 4, 8, 64, 128);
+	sum = _mm256_setzero_si256 ();
+	for (i = 0 ; i < 2 ; i++)
+	{
+		tmask = _mm256_cmpeq_epi32 (_mm256_and_si256 (_mm256_set1_epi32 (transparent >> (i * 8)), bits), bits);
+		best[i] = _mm256_blendv_epi8 (best[i], _mm256_set1_epi32 (3), tmask);
+		sum = _mm256_add_epi32 (sum, _mm256_andnot_si256 (tmask, bestdist[i]));
+		best[i] = _mm256_permute4x64_epi64 (best[i], _MM_SHUFFLE (3, 1, 2, 0));
+	}
+
+	packed = _mm256_permute4x64_epi64 (_mm256_packs_epi32 (best[0], best[1]), _MM_SHUFFLE (3, 1, 2, 0));
+	*indices = PackColorIndices (_mm_packs_epi16 (_mm256_castsi256_si128 (packed),
+												  _mm256_extracti128_si256 (packed, 1)));
+	return SumLanes (_mm_add_epi32 (_mm256_castsi256_si128 (sum), _mm256_extracti128_si256 (sum, 1)));
+}
+
+/*
+==================
+AlphaIndicesSSE41
+
+All sixteen alphas in one register, as bytes
+==================
+*/
+DXTLIB_SSE41 static int AlphaIndicesSSE41 (const byte block[64], const int palette[8], unsigned long long *indices)
+{
+	int			j;
+	__m128i		alpha, p, d, bestdist, best, less, zero, lo, hi;
+
+	zero = _mm_setzero_si128 ();
+	lo = _mm_packs_epi32 (_mm_srli_epi32 (_mm_loadu_si128 ((const __m128i *)block), 24),
+						  _mm_srli_epi32 (_mm_loadu_si128 ((const __m128i *)(block + 16)), 24));
+	hi = _mm_packs_epi32 (_mm_srli_epi32 (_mm_loadu_si128 ((const __m128i *)(block + 32)), 24),
+						  _mm_srli_epi32 (_mm_loadu_si128 ((const __m128i *)(block + 48)), 24));
+	alpha = _mm_packus_epi16 (lo, hi);
+
+	bestdist = best = zero;
+	for (j = 0 ; j < 8 ; j++)
+	{
+		p = _mm_set1_epi8 ((char)palette[j]);
+		d = _mm_or_si128 (_mm_subs_epu8 (alpha, p), _mm_subs_epu8 (p, alpha));
+		if (!j)
+		{
+			bestdist = d;
+			continue;
+		}
+		// d < bestdist, unsigned
+		less = _mm_xor_si128 (_mm_cmpeq_epi8 (_mm_max_epu8 (d, bestdist), d), _mm_set1_epi8 (-1));
+		bestdist = _mm_min_epu8 (d, bestdist);
+		best = _mm_blendv_epi8 (best, _mm_set1_epi8 ((char)j), less);
+	}
+
+	// 3 bits each, twelve to a 32 bit lane
+	best = _mm_maddubs_epi16 (best, _mm_set1_epi16 (0x0801));
+	best = _mm_madd_epi16 (best, _mm_set1_epi32 (0x00400001));
+	*indices = (unsigned long long)(unsigned)_mm_cvtsi128_si32 (best)
+		| (unsigned long long)(unsigned)_mm_extract_epi32 (best, 1) << 12
+		| (unsigned long long)(unsigned)_mm_extract_epi32 (best, 2) << 24
+		| (unsigned long long)(unsigned)_mm_extract_epi32 (best, 3) << 36;
+
+	lo = _mm_unpacklo_epi8 (bestdist, zero);
+	hi = _mm_unpackhi_epi8 (bestdist, zero);
+	return SumLanes (_mm_add_epi32 (_mm_madd_epi16 (lo, lo), _mm_madd_epi16 (hi, hi)));
+}
+#endif
+
+
+/*
+============================================================================
+
+						CLUSTER FIT
+
+The opaque pixels are put in order along the line through them that they
+spread out along most.  Every way of cutting that order into runs, one for
+each palette entry, is tried: the end points that fit a cut best are worked
+out by least squares, snapped to 565 and scored.
+
+Each pixel's index weights the two end points, so that with the weights
+scaled up to whole numbers, x is (wa a + wb b) / scale.  Over a cut, the
+sums A2 of wa squared, B2 of wb squared, AB of wa wb and AX and BX of wa
+and wb times x give the end points, and all but a constant part of the
+error.  With S(v) the sum of the first v pixels, they're all linear in
+the last boundary v for fixed earlier ones, so a run of cuts differing only
+in v is a line that the SIMD versions take four or eight at a time.
+
+Scores are worked out in the same order in every version, so they agree to
+the bit.  The best is the lowest score, the first on a tie.
+
+============================================================================
+*/
+
+typedef struct
+{
+	int		count;								// opaque pixels
+	float	sums[3][16 + FIT_LANES];			// S(v), staying at the total past count
+	float	v[16 + FIT_LANES];
+	float	total[3];
+} clusterfit_t;
+
+typedef struct
+{
+	float	base[3];		// AX is base + S(v)
+	float	a, av;			// A2 is a + av v
+	float	b, bv;
+	float	d, dv;			// AB
+	float	scale;
+	int		first;			// the smallest v
+	int		key;			// for ordering cuts across lines
+} fitline_t;
+
+typedef struct
+{
+	float		error;
+	int			key;
+	unsigned	ends;		// c0 | c1 << 16
+} fitbest_t;
+
+/*
+==================
+BuildClusterFit
+
+The principal axis is the covariance's biggest eigenvector, found by
+multiplying by it a few times.  Returns the number of opaque pixels.
+==================
+*/
+static int BuildClusterFit (const byte block[64], int transparent, clusterfit_t *fit)
+{
+	float	px[16][3], mean[3], cov[6], axis[3], w[3], dot[16], d[3];
+	float	biggest, t;
+	int		order[16];
+	int		n, i, j, c, v;
+
+	n = 0;
+	for (i = 0 ; i < 16 ; i++)
+	{
+		if (transparent & (1 << i))
+			continue;
+		for (c = 0 ; c < 3 ; c++)
+			px[n][c] = block[i * 4 + c];
+		n++;
+	}
+	fit->count = n;
+	if (!n)
+		return 0;
+
+	mean[0] = mean[1] = mean[2] = 0;
+	for (i = 0 ; i < n ; i++)
+		for (c = 0 ; c < 3 ; c++)
+			mean[c] += px[i][c];
+	for (c = 0 ; c < 3 ; c++)
+		mean[c] /= n;
+
+	memset (cov, 0, sizeof(cov));
+	for (i = 0 ; i < n ; i++)
+	{
+		for (c = 0 ; c < 3 ; c++)
+			d[c] = px[i][c] - mean[c];
+		cov[0] += d[0] * d[0];
+		cov[1] += d[0] * d[1];
+		cov[2] += d[0] * d[2];
+		cov[3] += d[1] * d[1];
+		cov[4] += d[1] * d[2];
+		cov[5] += d[2] * d[2];
+	}
+
+	axis[0] = axis[1] = axis[2] = 1;
+	for (i = 0 ; i < 8 ; i++)
+	{
+		w[0] = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+		w[1] = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+		w[2] = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+		biggest = 0;
+		for (c = 0 ; c < 3 ; c++)
+			if (w[c] > biggest || -w[c] > biggest)
+				biggest = w[c] > 0 ? w[c] : -w[c];
+		if (biggest == 0)
+			break;
+		for (c = 0 ; c < 3 ; c++)
+			axis[c] = w[c] / biggest;
+	}
+
+	// insertion sort, keeping pixels that tie in block order
+	for (i = 0 ; i < n ; i++)
+	{
+		t = px[i][0] * axis[0] + px[i][1] * axis[1] + px[i][2] * axis[2];
+		for (j = i ; j > 0 && dot[j - 1] > t ; j--)
+		{
+			dot[j] = dot[j - 1];
+			order[j] = order[j - 1];
+		}
+		dot[j] = t;
+		order[j] = i;
+	}
+
+	for (c = 0 ; c < 3 ; c++)
+	{
+		fit->sums[c][0] = 0;
+		for (v = 1 ; v < 16 + FIT_LANES ; v++)
+			fit->sums[c][v] = fit->sums[c][v - 1] + (v <= n ? px[order[v - 1]][c] : 0);
+		fit->total[c] = fit->sums[c][n];
+	}
+	for (v = 0 ; v < 16 + FIT_LANES ; v++)
+		fit->v[v] = (float)v;
+
+	return n;
+}
+
+/*
+==================
+FitLines
+
+Four colours have weights 3 2 1 0 for a and cuts i <= j <= v; three have
+2 1 0 and cuts i <= v.
+==================
+*/
+static int FitLines (const clusterfit_t *fit, int colours, fitline_t lines[FIT_MAX_LINES])
+{
+	fitline_t	*line;
+	int			n, i, j, c;
+
+	n = fit->count;
+	line = lines;
+	for (i = 0 ; i <= n ; i++)
+	{
+		if (colours == 3)
+		{
+			for (c = 0 ; c < 3 ; c++)
+				line->base[c] = fit->sums[c][i];
+			line->a = (float)(3 * i);
+			line->av = 1;
+			line->b = (float)(4 * n - i);
+			line->bv = -3;
+			line->d = (float)-i;
+			line->dv = 1;
+			line->scale = 2;
+			line->first = i;
+			line->key = (int)(line - lines) * 32;
+			line++;
+			continue;
+		}
+
+		for (j = i ; j <= n ; j++)
+		{
+			for (c = 0 ; c < 3 ; c++)
+				line->base[c] = fit->sums[c][i] + fit->sums[c][j];
+			line->a = (float)(5 * i + 3 * j);
+			line->av = 1;
+			line->b = (float)(9 * n - i - 3 * j);
+			line->bv = -5;
+			line->d = (float)(-2 * i);
+			line->dv = 2;
+			line->scale = 3;
+			line->first = j;
+			line->key = (int)(line - lines) * 32;
+			line++;
+		}
+	}
+
+	return (int)(line - lines);
+}
+
+/*
+==================
+ClusterSearch
+==================
+*/
+static void ClusterSearch (const clusterfit_t *fit, const fitline_t *lines, int numlines, fitbest_t *best)
+{
+	const fitline_t	*line;
+	float			a2, b2, ab, ab2, det, rdet, s2, ax, bx, ea, eb, qa, qb, e, error;
+	int				i, v, c, ia, ib;
+	unsigned		ends;
+
+	for (i = 0 ; i < numlines ; i++)
+	{
+		line = &lines[i];
+		s2 = line->scale + line->scale;
+		for (v = line->first ; v <= fit->count ; v++)
+		{
+			a2 = line->a + line->av * fit->v[v];
+			b2 = line->b + line->bv * fit->v[v];
+			ab = line->d + line->dv * fit->v[v];
+			ab2 = ab + ab;
+			det = a2 * b2 - ab * ab;
+			if (!(det > 0))
+				continue;
+			rdet = line->scale / det;
+
+			error = 0;
+			ends = 0;
+			for (c = 0 ; c < 3 ; c++)
+			{
+				ax = line->base[c] + fit->sums[c][v];
+				bx = line->scale * fit->total[c] - ax;
+				ea = (ax * b2 - bx * ab) * rdet;
+				eb = (bx * a2 - ax * ab) * rdet;
+				ea = ea > 0 ? ea : 0;
+				ea = ea < 255 ? ea : 255;
+				eb = eb > 0 ? eb : 0;
+				eb = eb < 255 ? eb : 255;
+				ia = (int)(ea * grid565[c] + 0.5f);
+				ib = (int)(eb * grid565[c] + 0.5f);
+				ends |= ((unsigned)ia << shift565[c]) | ((unsigned)ib << (shift565[c] + 16));
+				qa = (float)((ia << widenup[c]) | (ia >> widendown[c]));
+				qb = (float)((ib << widenup[c]) | (ib >> widendown[c]));
+				e = qa * ((a2 * qa + ab2 * qb) - s2 * ax) + qb * (b2 * qb - s2 * bx);
+				error = error + e;
+			}
+
+			if (error < best->error)
+			{
+				best->error = error;
+				best->key = line->key + v;
+				best->ends = ends;
+			}
+		}
+	}
+}
+
+#ifdef DXTLIB_X86
+// the lowest score, the first cut on a tie, of each lane's best
+static void BestOfLanes (const float *error, const int *key, const unsigned *ends, int lanes, fitbest_t *best)
+{
+	int		i;
+
+	for (i = 0 ; i < lanes ; i++)
+	{
+		if (error[i] < best->error || (error[i] == best->error && key[i] < best->key))
+		{
+			best->error = error[i];
+			best->key = key[i];
+			best->ends = ends[i];
+		}
+	}
+}
+
+DXTLIB_SSE41 static void ClusterSearchSSE41 (const clusterfit_t *fit, const fitline_t *lines, int numlines,
+											 fitbest_t *best)
+{
+	const fitline_t		*line;
+	__m128				besterror, zero, top, half, count;
+	__m128				vv, a2, b2, ab, ab2, det, rdet, s2, ax, bx, ea, eb, qa, qb, e, error, valid;
+	__m128i				bestkey, bestends, ia, ib, ends, better, up, down;
+	float				errors[4];
+	int					keys[4];
+	unsigned			endss[4];
+	int					i, v, c;
+
+	besterror = _mm_set1_ps (FLT_MAX);
+	bestkey = _mm_set1_epi32 (INT_MAX);
+	bestends = _mm_setzero_si128 ();
+	zero = _mm_setzero_ps ();
+	top = _mm_set1_ps (255.0f);
+	half = _mm_set1_ps (0.5f);
+	count = _mm_set1_ps ((float)fit->count);
+
+	for (i = 0 ; i < numlines ; i++)
+	{
+		line = &lines[i];
+		s2 = _mm_set1_ps (line->scale + line->scale);
+		for (v = line->first ; v <= fit->count ; v += 4)
+		{
+			vv = _mm_loadu_ps (&fit->v[v]);
+			a2 = _mm_add_ps (_mm_set1_ps (line->a), _mm_mul_ps (_mm_set1_ps (line->av), vv));
+			b2 = _mm_add_ps (_mm_set1_ps (line->b), _mm_mul_ps (_mm_set1_ps (line->bv), vv));
+			ab = _mm_add_ps (_mm_set1_ps (line->d), _mm_mul_ps (_mm_set1_ps (line->dv), vv));
+			ab2 = _mm_add_ps (ab, ab);
+			det = _mm_sub_ps (_mm_mul_ps (a2, b2), _mm_mul_ps (ab, ab));
+			valid = _mm_and_ps (_mm_cmpgt_ps (det, zero), _mm_cmple_ps (vv, count));
+			rdet = _mm_div_ps (_mm_set1_ps (line->scale), det);
+
+			error = zero;
+			ends = _mm_setzero_si128 ();
+			for (c = 0 ; c < 3 ; c++)
+			{
+				ax = _mm_add_ps (_mm_set1_ps (line->base[c]), _mm_loadu_ps (&fit->sums[c][v]));
+				bx = _mm_sub_ps (_mm_set1_ps (line->scale * fit->total[c]), ax);
+				ea = _mm_mul_ps (_mm_sub_ps (_mm_mul_ps (ax, b2), _mm_mul_ps (bx, ab)), rdet);
+				eb = _mm_mul_ps (_mm_sub_ps (_mm_mul_ps (bx, a2), _mm_mul_ps (ax, ab)), rdet);
+				ea = _mm_min_ps (_mm_max_ps (ea, zero), top);
+				eb = _mm_min_ps (_mm_max_ps (eb, zero), top);
+				ia = _mm_cvttps_epi32 (_mm_add_ps (_mm_mul_ps (ea, _mm_set1_ps (grid565[c])), half));
+				ib = _mm_cvttps_epi32 (_mm_add_ps (_mm_mul_ps (eb, _mm_set1_ps (grid565[c])), half));
+				ends = _mm_or_si128 (ends, _mm_sll_epi32 (ia, _mm_cvtsi32_si128 (shift565[c])));
+				ends = _mm_or_si128 (ends, _mm_sll_epi32 (ib, _mm_cvtsi32_si128 (shift565[c] + 16)));
+				up = _mm_cvtsi32_si128 (widenup[c]);
+				down = _mm_cvtsi32_si128 (widendown[c]);
+				qa = _mm_cvtepi32_ps (_mm_or_si128 (_mm_sll_epi32 (ia, up), _mm_srl_epi32 (ia, down)));
+				qb = _mm_cvtepi32_ps (_mm_or_si128 (_mm_sll_epi32 (ib, up), _mm_srl_epi32 (ib, down)));
+				e = _mm_add_ps (_mm_mul_ps (qa, _mm_sub_ps (_mm_add_ps (_mm_mul_ps (a2, qa), _mm_mul_ps (ab2, qb)),
+															_mm_mul_ps (s2, ax))),
+								_mm_mul_ps (qb, _mm_sub_ps (_mm_mul_ps (b2, qb), _mm_mul_ps (s2, bx))));
+				error = _mm_add_ps (error, e);
+			}
+
+			better = _mm_castps_si128 (_mm_and_ps (valid, _mm_cmplt_ps (error, besterror)));
+			besterror = _mm_blendv_ps (besterror, error, _mm_castsi128_ps (better));
+			bestkey = _mm_blendv_epi8 (bestkey, _mm_add_epi32 (_mm_set1_epi32 (line->key), _mm_cvttps_epi32 (vv)), better);
+			bestends = _mm_blendv_epi8 (bestends, ends, better);
+		}
+	}
+
+	_mm_storeu_ps (errors, besterror);
+	_mm_storeu_si128 ((__m128i *)keys, bestkey);
+	_mm_storeu_si128 ((__m128i *)endss, bestends);
+	BestOfLanes (errors, keys, endss, 4, best);
+}
+
+DXTLIB_AVX2 static void ClusterSearchAVX2 (const clusterfit_t *fit, const fitline_t *lines, int numlines,
+										   fitbest_t *best)
+{
+	const fitline_t		*line;
+	__m256				besterror, zero, top, half, count;
+	__m256				vv, a2, b2, ab, ab2, det, rdet, s2, ax, bx, ea, eb, qa, qb, e, error, valid;
+	__m256i				bestkey, bestends, ia, ib, ends, better;
+	__m128i				up, down;
+	float				errors[8];
+	int					keys[8];
+	unsigned			endss[8];
+	int					i, v, c;
+
+	besterror = _mm256_set1_ps (FLT_MAX);
+	bestkey = _mm256_set1_epi32 (INT_MAX);
+	bestends = _mm256_setzero_si256 ();
+	zero = _mm256_setzero_ps ();
+	top = _mm256_set1_ps (255.0f);
+	half = _mm256_set1_ps (0.5f);
+	count = _mm256_set1_ps ((float)fit->count);
+
+	for (i = 0 ; i < numlines ; i++)
+	{
+		line = &lines[i];
+		s2 = _mm256_set1_ps (line->scale + line->scale);
+		for (v = line->first ; v <= fit->count ; v += 8)
+		{
+			vv = _mm256_loadu_ps (&fit->v[v]);
+			a2 = _mm256_add_ps (_mm256_set1_ps (line->a), _mm256_mul_ps (_mm256_set1_ps (line->av), vv));
+			b2 = _mm256_add_ps (_mm256_set1_ps (line->b), _mm256_mul_ps (_mm256_set1_ps (line->bv), vv));
+			ab = _mm256_add_ps (_mm256_set1_ps (line->d), _mm256_mul_ps (_mm256_set1_ps (line->dv), vv));
+			ab2 = _mm256_add_ps (ab, ab);
+			det = _mm256_sub_ps (_mm256_mul_ps (a2, b2), _mm256_mul_ps (ab, ab));
+			valid = _mm256_and_ps (_mm256_cmp_ps (det, zero, _CMP_GT_OQ), _mm256_cmp_ps (vv, count, _CMP_LE_OQ));
+			rdet = _mm256_div_ps (_mm256_set1_ps (line->scale), det);
+
+			error = zero;
+			ends = _mm256_setzero_si256 ();
+			for (c = 0 ; c < 3 ; c++)
+			{
+				ax = _mm256_add_ps (_mm256_set1_ps (line->base[c]), _mm256_loadu_ps (&fit->sums[c][v]));
+				bx = _mm256_sub_ps (_mm256_set1_ps (line->scale * fit->total[c]), ax);
+				ea = _mm256_mul_ps (_mm256_sub_ps (_mm256_mul_ps (ax, b2), _mm256_mul_ps (bx, ab)), rdet);
+				eb = _mm256_mul_ps (_mm256_sub_ps (_mm256_mul_ps (bx, a2), _mm256_mul_ps (ax, ab)), rdet);
+				ea = _mm256_min_ps (_mm256_max_ps (ea, zero), top);
+				eb = _mm256_min_ps (_mm256_max_ps (eb, zero), top);
+				ia = _mm256_cvttps_epi32 (_mm256_add_ps (_mm256_mul_ps (ea, _mm256_set1_ps (grid565[c])), half));
+				ib = _mm256_cvttps_epi32 (_mm256_add_ps (_mm256_mul_ps (eb, _mm256_set1_ps (grid565[c])), half));
+				ends = _mm256_or_si256 (ends, _mm256_sll_epi32 (ia, _mm_cvtsi32_si128 (shift565[c])));
+				ends = _mm256_or_si256 (ends, _mm256_sll_epi32 (ib, _mm_cvtsi32_si128 (shift565[c] + 16)));
+				up = _mm_cvtsi32_si128 (widenup[c]);
+				down = _mm_cvtsi32_si128 (widendown[c]);
+				qa = _mm256_cvtepi32_ps (_mm256_or_si256 (_mm256_sll_epi32 (ia, up), _mm256_srl_epi32 (ia, down)));
+				qb = _mm256_cvtepi32_ps (_mm256_or_si256 (_mm256_sll_epi32 (ib, up), _mm256_srl_epi32 (ib, down)));
+				e = _mm256_add_ps (_mm256_mul_ps (qa, _mm256_sub_ps (_mm256_add_ps (_mm256_mul_ps (a2, qa),
+																					_mm256_mul_ps (ab2, qb)),
+																	 _mm256_mul_ps (s2, ax))),
+								   _mm256_mul_ps (qb, _mm256_sub_ps (_mm256_mul_ps (b2, qb), _mm256_mul_ps (s2, bx))));
+				error = _mm256_add_ps (error, e);
+			}
+
+			better = _mm256_castps_si256 (_mm256_and_ps (valid, _mm256_cmp_ps (error, besterror, _CMP_LT_OQ)));
+			besterror = _mm256_blendv_ps (besterror, error, _mm256_castsi256_ps (better));
+			bestkey = _mm256_blendv_epi8 (bestkey, _mm256_add_epi32 (_mm256_set1_epi32 (line->key),
+																	 _mm256_cvttps_epi32 (vv)), better);
+			bestends = _mm256_blendv_epi8 (bestends, ends, better);
+		}
+	}
+
+	_mm256_storeu_ps (errors, besterror);
+	_mm256_storeu_si256 ((__m256i *)keys, bestkey);
+	_mm256_storeu_si256 ((__m256i *)endss, bestends);
+	BestOfLanes (errors, keys, endss, 8, best);
+}
+#endif
+
+
+/*
+============================================================================
+
+						COMPRESSION
+
+============================================================================
+*/
+
+typedef struct
+{
+	int		(*colorindices) (const byte block[64], int c0, int c1, int transparent, unsigned *indices);
+	int		(*alphaindices) (const byte block[64], const int palette[8], unsigned long long *indices);
+	void	(*clustersearch) (const clusterfit_t *fit, const fitline_t *lines, int numlines, fitbest_t *best);
+} dxtkernels_t;
+
+static void PickKernels (dxtkernels_t *k)
+{
+	int		level;
+
+	level = Tex_SIMDLevel ();
+	k->colorindices = ColorIndices;
+	k->alphaindices = AlphaIndices;
+	k->clustersearch = ClusterSearch;
+#ifdef DXTLIB_X86
+	if (level >= TEX_SIMD_SSE41)
+	{
+		k->colorindices = ColorIndicesSSE41;
+		k->alphaindices = AlphaIndicesSSE41;
+		k->clustersearch = ClusterSearchSSE41;
+	}
+	if (level >= TEX_SIMD_AVX2)
+	{
+		k->colorindices = ColorIndicesAVX2;
+		k->clustersearch = ClusterSearchAVX2;
+	}
+#endif
+}
+
+/*
+==================
+TryClusterFit
+
+The best cut for the given number of colours, kept if its end points do
+better than the ones in *c0, *c1
+==================
+*/
+static void TryClusterFit (const byte block[64], const clusterfit_t *fit, int colours, int transparent,
+						   const dxtkernels_t *k, int *c0, int *c1, unsigned *indices, int *error)
+{
+	fitline_t	lines[FIT_MAX_LINES];
+	fitbest_t	best;
+	unsigned	bits;
+	int			e, a, b, t;
+
+	best.error = FLT_MAX;
+	best.key = INT_MAX;
+	best.ends = 0;
+	k->clustersearch (fit, lines, FitLines (fit, colours, lines), &best);
+	if (best.error == FLT_MAX)
+		return;
+
+	a = best.ends & 0xffff;
+	b = best.ends >> 16;
+	if (colours == 4 ? a < b : a > b)
+	{
+		t = a;
+		a = b;
+		b = t;
+	}
+
+	e = k->colorindices (block, a, b, transparent, &bits);
+	if (e < *error)
+	{
+		*c0 = a;
+		*c1 = b;
+		*indices = bits;
+		*error = e;
+	}
+}
+
+/*
+==================
+CompressColorBlock
+
+End points from the bounding box of the colours, pulled in by a sixteenth
+of its size at each end so they sit nearer the bulk of the pixels.  With
+DXT_QUALITY, a cluster fit in four colours, and in three where DXT1 allows
+it, replaces them if it does better.
+==================
+*/
+static void CompressColorBlock (const byte block[64], int transparent, int flags, qboolean threecolour,
+								const dxtkernels_t *k, byte *out)
+{
+	clusterfit_t	fit;
+	int				mins[3], maxs[3], inset, c0, c1, t;
+	int				i, j, error;
+	unsigned		indices;
+	qboolean		opaque;
+
+	mins[0] = mins[1] = mins[2] = 255;
+	maxs[0] = maxs[1] = maxs[2] = 0;
+	opaque = false;
+	for (i = 0 ; i < 16 ; i++)
+	{
+		if (transparent & (1 << i))
+			continue;
+		opaque = true;
+		for (j = 0 ; j < 3 ; j++)
+		{
+			if (block[i * 4 + j] < mins[j])
+				mins[j] = block[i * 4 + j];
+			if (block[i * 4 + j] > maxs[j])
+				maxs[j] = block[i * 4 + j];
+		}
+	}
+
+	if (!opaque)
+	{
+		// all transparent: three colour mode with every index on black
+		WriteColorBlock (0, 0, 0xffffffff, out);
+		return;
+	}
+
+	for (j = 0 ; j < 3 ; j++)
+	{
+		inset = (maxs[j] - mins[j]) >> 4;
+		mins[j] += inset;
+		maxs[j] -= inset;
+	}
+
+	c0 = To565 (maxs);
+	c1 = To565 (mins);
+	if (transparent ? c0 > c1 : c0 < c1)
+	{
+		t = c0;
+		c0 = c1;
+		c1 = t;
+	}
+	error = k->colorindices (block, c0, c1, transparent, &indices);
+
+	if ((flags & DXT_QUALITY) && error > 0 && BuildClusterFit (block, transparent, &fit) >= 2)
+	{
+		if (!transparent)
+			TryClusterFit (block, &fit, 4, transparent, k, &c0, &c1, &indices, &error);
+		if (threecolour)
+			TryClusterFit (block, &fit, 3, transparent, k, &c0, &c1, &indices, &error);
+	}
+
+	WriteColorBlock (c0, c1, indices, out);
+}
+
+/*
+==================
+CompressAlphaBlock
+
+The eight value mode, between the smallest and largest alpha.  With
+DXT_QUALITY, the six value mode between the alphas that aren't 0 or 255,
+which have indices of their own there, replaces it if it does better.
+==================
+*/
+static void CompressAlphaBlock (const byte block[64], int flags, const dxtkernels_t *k, byte *out)
+{
+	int					a0, a1, lo, hi, i, a, error, e;
+	int					palette[8];
+	unsigned long long	indices, bits;
+
+	a0 = 0;
+	a1 = 255;
+	for (i = 0 ; i < 16 ; i++)
+	{
+		if (block[i * 4 + 3] > a0)
+			a0 = block[i * 4 + 3];
+		if (block[i * 4 + 3] < a1)
+			a1 = block[i * 4 + 3];
+	}
+
+	if (a0 == a1)
+	{
+		WriteAlphaBlock (a0, a1, 0, out);
+		return;
+	}
+
+	AlphaPalette (a0, a1, palette);
+	error = k->alphaindices (block, palette, &indices);
+
+	if ((flags & DXT_QUALITY) && error > 0)
+	{
+		lo = 255;
+		hi = 0;
+		for (i = 0 ; i < 16 ; i++)
+		{
+			a = block[i * 4 + 3];
+			if (a == 0 || a == 255)
+				continue;
+			if (a < lo)
+				lo = a;
+			if (a > hi)
+				hi = a;
+		}
+		if (lo > hi)
+			lo = hi = 0;
+
+		AlphaPalette (lo, hi, palette);
+		e = k->alphaindices (block, palette, &bits);
+		if (e < error)
+		{
+			a0 = lo;
+			a1 = hi;
+			indices = bits;
+		}
+	}
+
+	WriteAlphaBlock (a0, a1, indices, out);
+}
+
+
+void CompressDXTRows (const byte *rgba, int width, int height, int blocksize, int flags,
+					  int firstrow, int numrows, byte *out)
+{
+	dxtkernels_t	k;
+	byte			block[64];
+	int				x, y, last;
+
+	PickKernels (&k);
+	out += firstrow * ((width + 3) / 4) * blocksize;
+	last = (firstrow + numrows) * 4;
+	if (last > height)
+		last = height;
+
+	for (y = firstrow * 4 ; y < last ; y += 4)
+	{
+		for (x = 0 ; x < width ; x += 4)
+		{
+			GetBlock (rgba, width, height, x, y, block);
+			if (blocksize == DXT5_BLOCK_SIZE)
+			{
+				CompressAlphaBlock (block, flags, &k, out);
+				CompressColorBlock (block, 0, flags, false, &k, out + 8);
+			}
+			else
+			{
+				CompressColorBlock (block, (flags & DXT_ONEBITALPHA) ? TransparentPixels (block) : 0,
+									flags, true, &k, out);
+			}
+			out += blocksize;
+		}
+	}
+}
+
+void CompressDXT1 (const byte *rgba, int width, int height, byte *out, int flags)
+{
+	CompressDXTRows (rgba, width, height, DXT1_BLOCK_SIZE, flags, 0, (height + 3) / 4, out);
+}
+
+void CompressDXT5 (const byte *rgba, int width, int height, byte *out, int flags)
+{
+	CompressDXTRows (rgba, width, height, DXT5_BLOCK_SIZE, flags, 0, (height + 3) / 4, out);
+}
+
+
+/*
+==================
+CompressDXTImages
+
+Each image is cut into strips of whole block rows, about DXT_STRIP_BLOCKS
+blocks each, and the strips of them all are shared out together
+==================
+*/
+typedef struct
+{
+	const dxtimage_t	*image;
+	int					firstrow;
+	int					numrows;
+} dxtstrip_t;
+
+typedef struct
+{
+	dxtstrip_t	*strips;
+	int			blocksize;
+	int			flags;
+} dxtjob_t;
+
+static void CompressStrip (void *param, int work)
+{
+	dxtjob_t	*job = (dxtjob_t *)param;
+	dxtstrip_t	*strip = &job->strips[work];
+
+	CompressDXTRows (strip->image->rgba, strip->image->width, strip->image->height, job->blocksize,
+					 job->flags, strip->firstrow, strip->numrows, strip->image->out);
+}
+
+void CompressDXTImages (const dxtimage_t *images, int count, int blocksize, int flags)
+{
+	dxtjob_t	job;
+	int			i, rows, striprows, numstrips, row;
+
+	numstrips = 0;
+	for (i = 0 ; i < count ; i++)
+	{
+		rows = (images[i].height + 3) / 4;
+		striprows = DXT_STRIP_BLOCKS / ((images[i].width + 3) / 4);
+		if (striprows < 1)
+			striprows = 1;
+		numstrips += (rows + striprows - 1) / striprows;
+	}
+
+	job.strips = (dxtstrip_t *)malloc (sizeof(dxtstrip_t) * numstrips);
+	job.blocksize = blocksize;
+	job.flags = flags;
+
+	numstrips = 0;
+	for (i = 0 ; i < count ; i++)
+	{
+		rows = (images[i].height + 3) / 4;
+		striprows = DXT_STRIP_BLOCKS / ((images[i].width + 3) / 4);
+		if (striprows < 1)
+			striprows = 1;
+		for (row = 0 ; row < rows ; row += striprows)
+		{
+			job.strips[numstrips].image = &images[i];
+			job.strips[numstrips].firstrow = row;
+			job.strips[numstrips].numrows = rows - row < striprows ? rows - row : striprows;
+			numstrips++;
+		}
+	}
+
+	ThreadShareWork (numstrips, CompressStrip, &job);
+	free (job.strips);
+}
@@ -0,0 +1,52 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: 
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+
+// dxtlib.h
+
+//
+// DXT1 and DXT5 (BC1 and BC3) compression.
+//
+// Images are RGBA8888, top row first, and are cut into 4x4 blocks left to
+// right, top to bottom.  Blocks hanging off the right or bottom edge repeat
+// the last column or row.  A DXT1 block is 8 bytes: two RGB565 end points
+// then sixteen 2 bit indices, low bits first.  DXT5 puts an 8 byte alpha
+// block in front of that: two alpha end points then sixteen 3 bit indices.
+//
+
+#define	DXT1_BLOCK_SIZE		8
+#define	DXT5_BLOCK_SIZE		16
+
+// bytes for a whole image
+#define	DXT_SIZE(width, height, blocksize)	((((width) + 3) / 4) * (((height) + 3) / 4) * (blocksize))
+
+// With DXT_ONEBITALPHA, pixels with alpha under 128 are written as DXT1's
+// transparent black, otherwise alpha is ignored.  DXT_QUALITY cluster fits
+// each block's end points rather than taking its bounding box, which is
+// several times slower but closer.
+#define	DXT_ONEBITALPHA		1
+#define	DXT_QUALITY			2
+
+void	CompressDXT1 (const byte *rgba, int width, int height, byte *out, int flags);
+void	CompressDXT5 (const byte *rgba, int width, int height, byte *out, int flags);
+
+// Just the block rows from firstrow to firstrow + numrows - 1, written where
+// they go in the whole image's out.  blocksize says DXT1 or DXT5.
+void	CompressDXTRows (const byte *rgba, int width, int height, int blocksize, int flags,
+						 int firstrow, int numrows, byte *out);
+
+// Several images in one format, a mip chain say, cut into strips of block
+// rows and shared out with ThreadShareWork to any threads free to help.
+typedef struct
+{
+	const byte	*rgba;
+	int			width;
+	int			height;
+	byte		*out;
+} dxtimage_t;
+
+void	CompressDXTImages (const dxtimage_t *images, int count, int blocksize, int flags);
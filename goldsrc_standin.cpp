@@ -73,21 +73,86 @@ static void RestoreConsoleTextColor( WORD color )
 }
 
 
+static THREADLOCAL spewbuffer_t *g_pSpewCapture = NULL;
+static void (*g_pfnSpewErrorWait)( spewbuffer_t *pBuffer ) = NULL;
+
+
+void SpewCapture( spewbuffer_t *pBuffer )
+{
+	g_pSpewCapture = pBuffer;
+}
+
+
+static void SpewBufferAppendV( spewbuffer_t *pBuffer, const char *pMsg, va_list marker )
+{
+	va_list copy;
+	va_copy( copy, marker );
+	int len = vsnprintf( NULL, 0, pMsg, copy );
+	va_end( copy );
+	if ( len <= 0 )
+		return;
+
+	if ( pBuffer->nLength + len + 1 > pBuffer->nMaxLength )
+	{
+		pBuffer->nMaxLength = pBuffer->nMaxLength ? pBuffer->nMaxLength * 2 : 256;
+		if ( pBuffer->nMaxLength < pBuffer->nLength + len + 1 )
+			pBuffer->nMaxLength = pBuffer->nLength + len + 1;
+		pBuffer->pData = (char *)realloc( pBuffer->pData, pBuffer->nMaxLength );
+	}
+	vsnprintf( pBuffer->pData + pBuffer->nLength, len + 1, pMsg, marker );
+	pBuffer->nLength += len;
+}
+
+
+void SpewBufferPrint( spewbuffer_t *pBuffer )
+{
+	if ( pBuffer->nLength )
+	{
+		fwrite( pBuffer->pData, 1, pBuffer->nLength, stdout );
+		fflush( stdout );
+	}
+	pBuffer->nLength = 0;
+}
+
+
+void SpewBufferFree( spewbuffer_t *pBuffer )
+{
+	free( pBuffer->pData );
+	pBuffer->pData = NULL;
+	pBuffer->nLength = pBuffer->nMaxLength = 0;
+}
+
+
+void SetSpewErrorWait( void (*pfnWait)( spewbuffer_t *pBuffer ) )
+{
+	g_pfnSpewErrorWait = pfnWait;
+}
+
+
 void Msg( const char *pMsg, ... )
 {
 	va_list marker;
 	va_start( marker, pMsg );
-	vprintf( pMsg, marker );
+	if ( g_pSpewCapture )
+		SpewBufferAppendV( g_pSpewCapture, pMsg, marker );
+	else
+		vprintf( pMsg, marker );
 	va_end( marker );
 }
 
 
 void Warning( const char *pMsg, ... )
 {
-	WORD old = SetConsoleTextColor( 1, 1, 0, 1 );
-	
 	va_list marker;
 	va_start( marker, pMsg );
+	if ( g_pSpewCapture )
+	{
+		SpewBufferAppendV( g_pSpewCapture, pMsg, marker );
+		va_end( marker );
+		return;
+	}
+
+	WORD old = SetConsoleTextColor( 1, 1, 0, 1 );
 	vprintf( pMsg, marker );
 	va_end( marker );
 
@@ -97,6 +162,16 @@ void Warning( const char *pMsg, ... )
 
 void Error (const char *error, ...)
 {
+	// Everything this thread held back goes out first, once it's its turn.
+	spewbuffer_t *pCapture = g_pSpewCapture;
+	if ( pCapture )
+	{
+		g_pSpewCapture = NULL;
+		if ( g_pfnSpewErrorWait )
+			g_pfnSpewErrorWait( pCapture );
+		SpewBufferPrint( pCapture );
+	}
+
 	WORD old = SetConsoleTextColor( 1, 0, 0, 1 );
 
 	va_list argptr;
@@ -107,6 +182,7 @@ void Error (const char *error, ...)
 	vprintf (error,argptr);
 	va_end (argptr);
 	printf ("\n");
+	fflush( stdout );
 
 	extern void PrintExitStuff();
 	PrintExitStuff();
@@ -117,6 +193,25 @@ void Error (const char *error, ...)
 }
 
 
+/*
+================
+I_FloatTime
+
+Seconds from an arbitrary start, off the monotonic high resolution counter
+================
+*/
+double I_FloatTime (void)
+{
+	static LARGE_INTEGER	freq;
+	LARGE_INTEGER			now;
+
+	if (!freq.QuadPart)
+		QueryPerformanceFrequency (&freq);
+	QueryPerformanceCounter (&now);
+	return (double)now.QuadPart / (double)freq.QuadPart;
+}
+
+
 /*
 ================
 filelength
@@ -17,11 +17,39 @@ typedef float vec3_t[3];
 typedef unsigned char byte;
 typedef int qboolean;
 
+// a variable each thread has its own copy of
+#ifdef _MSC_VER
+#define THREADLOCAL __declspec( thread )
+#else
+#define THREADLOCAL __thread
+#endif
+
 
 void Msg( const char *pMsg, ... );
 void Warning( const char *pMsg, ... );
 void Error( const char *pMsg, ... );
 
+// Worker threads can hold their Msg/Warning/Error text back in a buffer so
+// the caller can print it in a fixed order, whatever order the work finishes
+// in.  Capturing is per thread; NULL stops it.
+struct spewbuffer_t
+{
+	char	*pData;
+	int		nLength;
+	int		nMaxLength;
+};
+
+void SpewCapture( spewbuffer_t *pBuffer );
+void SpewBufferPrint( spewbuffer_t *pBuffer );	// prints and empties it
+void SpewBufferFree( spewbuffer_t *pBuffer );
+
+// Error on a thread that is capturing calls this first, with the thread's
+// buffer, so it can wait until it's that buffer's turn to be printed.  The
+// buffer and the error are then printed and the process exits as usual.
+void SetSpewErrorWait( void (*pfnWait)( spewbuffer_t *pBuffer ) );
+
+double	I_FloatTime (void);
+
 int		LoadFile (char *filename, void **bufferptr);
 void	SaveFile (char *filename, void *buffer, int count);
 
@@ -0,0 +1,870 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Microbenchmarks for the pixel kernels, each timed on its own.
+//
+//=============================================================================//
+
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+#include "goldsrc_standin.h"
+
+#include "wadlib.h"
+#include "lbmlib.h"
+#include "arena.h"
+#include "texlib.h"
+#include "dxtlib.h"
+#include "threads.h"
+
+// goldsrc_standin's Error() calls this on the way out.
+void PrintExitStuff() {}
+
+static double g_flTicksPerSecond = 0;
+
+static long long GetTicks() {
+  LARGE_INTEGER now;
+  QueryPerformanceCounter(&now);
+  return now.QuadPart;
+}
+
+static double SecondsSince(long long start) {
+  if (!g_flTicksPerSecond) {
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    g_flTicksPerSecond = (double)freq.QuadPart;
+  }
+  return (GetTicks() - start) / g_flTicksPerSecond;
+}
+
+// Results go here so the timed loops can't be optimized away.
+volatile int g_nSink;
+
+// Fixed seed so runs can be compared between commits.
+static unsigned int g_nRandom = 0x2545F491;
+
+static unsigned int RandomInt() {
+  g_nRandom ^= g_nRandom << 13;
+  g_nRandom ^= g_nRandom >> 17;
+  g_nRandom ^= g_nRandom << 5;
+  return g_nRandom;
+}
+
+//-----------------------------------------------------------------------------
+// Every kernel runs on what's in g_Case, set up before it's timed.  Each
+// measurement is the fastest of at least three calls and 50ms of them, so it
+// is the kernel with its data in whatever cache it fits in.  Cycles are read
+// from the time stamp counter, which on anything recent ticks at a fixed
+// rate rather than with the core clock, so they're only as exact as the two
+// agree.
+//-----------------------------------------------------------------------------
+
+struct Case_t {
+  int width;
+  int height;
+  byte *pIndices;      // 8 bit texels
+  byte palette[768];
+  RGBAColor *pSource;  // for kernels that change their input, copied each call
+  RGBAColor *pTexels;
+  RGBAColor *pResult;  // what the last call returned
+  bool bAlphatest;
+  byte *pOut;
+  byte *pPacked;       // LBM rows
+  char (*queries)[16];
+  int nQueries;
+  arena_t arena;
+};
+
+static Case_t g_Case;
+
+static void Measure(const char *pKernel, const char *pCase, const char *pSize, double units,
+                    void (*pfnSetup)(), void (*pfnRun)()) {
+  double flBest = 0, flTotal = 0;
+  unsigned long long bestCycles = 0;
+  for (int rep = 0; rep < 3 || flTotal < 0.05; rep++) {
+    Arena_Reset(&g_Case.arena);
+    if (pfnSetup) pfnSetup();
+
+    long long start = GetTicks();
+    unsigned long long startCycles = __rdtsc();
+    pfnRun();
+    unsigned long long cycles = __rdtsc() - startCycles;
+    double flSeconds = SecondsSince(start);
+
+    flTotal += flSeconds;
+    if (rep == 0 || flSeconds < flBest) {
+      flBest = flSeconds;
+      bestCycles = cycles;
+    }
+  }
+  printf("%-14s %-16s %12s %12.3f %12.2f\n", pKernel, pCase, pSize, flBest * 1e9 / units,
+         bestCycles / units);
+}
+
+static void PrintHeader(const char *pUnit) {
+  printf("%-14s %-16s %12s %9s/%-2s %9s/%-2s\n", "kernel", "case", "size", "ns", pUnit,
+         "cycles", pUnit);
+}
+
+// Indices 0-254 with alphaPercent of them 255.  Scattered, or else all in
+// one square hole in the middle, which is the flood fill's slowest case.
+static void MakeIndices(int width, int height, int alphaPercent, bool bHole) {
+  int count = width * height;
+  for (int i = 0; i < count; i++) g_Case.pIndices[i] = (byte)(RandomInt() % 255);
+  if (bHole) {
+    int side = (int)(sqrt(alphaPercent / 100.0) * (width < height ? width : height));
+    int x0 = (width - side) / 2, y0 = (height - side) / 2;
+    for (int y = y0; y < y0 + side; y++) memset(&g_Case.pIndices[y * width + x0], 255, side);
+  } else {
+    for (int i = 0; i < count; i++)
+      if ((int)(RandomInt() % 100) < alphaPercent) g_Case.pIndices[i] = 255;
+  }
+  for (int i = 0; i < 768; i++) g_Case.palette[i] = (byte)RandomInt();
+}
+
+// Allocates for the largest image any kernel is given.
+static void AllocCase(int maxSide) {
+  int count = maxSide * maxSide;
+  g_Case.pIndices = (byte *)malloc(count);
+  g_Case.pSource = (RGBAColor *)malloc(count * sizeof(RGBAColor));
+  g_Case.pTexels = (RGBAColor *)malloc(count * sizeof(RGBAColor));
+  g_Case.pOut = (byte *)malloc(count * sizeof(RGBAColor));
+  g_Case.pPacked = (byte *)malloc(count * 2);
+  Arena_Init(&g_Case.arena);
+}
+
+static void FreeCase() {
+  free(g_Case.pIndices);
+  free(g_Case.pSource);
+  free(g_Case.pTexels);
+  free(g_Case.pOut);
+  free(g_Case.pPacked);
+  Arena_Free(&g_Case.arena);
+}
+
+static void SizeName(int width, int height, char size[32]) {
+  sprintf(size, "%dx%d", width, height);
+}
+
+//-----------------------------------------------------------------------------
+// rgba: ConvertToRGBAUpsideDown
+//-----------------------------------------------------------------------------
+
+static void RunRGBA() {
+  g_Case.bAlphatest = false;
+  g_Case.pResult = ConvertToRGBAUpsideDown(&g_Case.arena, g_Case.pIndices, g_Case.width,
+                                           g_Case.height, g_Case.palette, false, &g_Case.bAlphatest);
+  g_nSink += g_Case.pResult[0].r;
+}
+
+static void RunRGBADecal() {
+  g_Case.bAlphatest = false;
+  g_Case.pResult = ConvertToRGBAUpsideDown(&g_Case.arena, g_Case.pIndices, g_Case.width,
+                                           g_Case.height, g_Case.palette, true, &g_Case.bAlphatest);
+  g_nSink += g_Case.pResult[0].a;
+}
+
+static const char *g_pSIMDNames[] = {"", "-sse2", "-sse4", "-avx2"};
+
+// Each case at every SIMD level the CPU has, each checked against the
+// scalar code's texels and alpha test.  texlib has nothing of its own for
+// SSE4.1, so that level would only time the SSE2 code again.
+static void MeasureSIMDLevels(const char *pKernel, const char *pCase, const char *pSize, int units,
+                              int count, void (*pfnRun)()) {
+  int best = Tex_SIMDLevel();
+  for (int level = TEX_SIMD_NONE; level <= best; level++) {
+    if (level == TEX_SIMD_SSE41) continue;
+    char kernel[32];
+    sprintf(kernel, "%s%s", pKernel, g_pSIMDNames[level]);
+    Tex_SetSIMDLevel(level);
+    Measure(kernel, pCase, pSize, units, NULL, pfnRun);
+    if (level == TEX_SIMD_NONE) {
+      memcpy(g_Case.pTexels, g_Case.pResult, count * sizeof(RGBAColor));
+      g_Case.pOut[0] = g_Case.bAlphatest;
+    } else if (memcmp(g_Case.pTexels, g_Case.pResult, count * sizeof(RGBAColor)) ||
+               g_Case.pOut[0] != g_Case.bAlphatest) {
+      Error("%s: %s %s doesn't match the scalar code\n", kernel, pCase, pSize);
+    }
+  }
+  Tex_SetSIMDLevel(best);
+}
+
+static void BenchRGBA() {
+  static const int sides[] = {64, 256, 1024, 2048};
+  static const int alphas[] = {0, 10, 50, 90};
+  printf("rgba: ConvertToRGBAUpsideDown, scattered transparent texels\n");
+  PrintHeader("px");
+  for (int s = 0; s < (int)(sizeof(sides) / sizeof(sides[0])); s++) {
+    g_Case.width = g_Case.height = sides[s];
+    char size[32], name[32];
+    SizeName(sides[s], sides[s], size);
+    for (int a = 0; a < (int)(sizeof(alphas) / sizeof(alphas[0])); a++) {
+      MakeIndices(sides[s], sides[s], alphas[a], false);
+      sprintf(name, "alpha %d%%", alphas[a]);
+      MeasureSIMDLevels("rgba", name, size, sides[s] * sides[s], sides[s] * sides[s], RunRGBA);
+    }
+    MeasureSIMDLevels("rgba", "decal", size, sides[s] * sides[s], sides[s] * sides[s],
+                      RunRGBADecal);
+  }
+}
+
+//-----------------------------------------------------------------------------
+// flood: FloodSolidPixels
+//-----------------------------------------------------------------------------
+
+// The flood fill as it was, a pass over the whole image per ring, to time
+// against and to check the current one's colours with.
+static void FloodSolidPixelsByPasses(RGBAColor *pTexels, int width, int height) {
+  int count = width * height;
+  byte *pAlpha = (byte *)malloc(count);
+  byte *pNewAlpha = (byte *)malloc(count);
+  for (int i = 0; i < count; i++) pAlpha[i] = pTexels[i].a;
+
+  bool bHappy = false;
+  while (!bHappy) {
+    bHappy = true;
+    memcpy(pNewAlpha, pAlpha, count);
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < width; x++) {
+        if (pAlpha[y * width + x] != 0) continue;
+        int neighbors = 0, total[3] = {0, 0, 0};
+        for (int testy = y - 1; testy <= y + 1; testy++) {
+          for (int testx = x - 1; testx <= x + 1; testx++) {
+            if (testx < 0 || testy < 0 || testx >= width || testy >= height) continue;
+            if (!pAlpha[testy * width + testx]) continue;
+            const RGBAColor &neighbor = pTexels[testy * width + testx];
+            neighbors++;
+            total[0] += neighbor.r;
+            total[1] += neighbor.g;
+            total[2] += neighbor.b;
+          }
+        }
+        if (neighbors) {
+          RGBAColor &texel = pTexels[y * width + x];
+          pNewAlpha[y * width + x] = 255;
+          bHappy = false;
+          texel.r = (byte)(total[0] / neighbors);
+          texel.g = (byte)(total[1] / neighbors);
+          texel.b = (byte)(total[2] / neighbors);
+        }
+      }
+    }
+    memcpy(pAlpha, pNewAlpha, count);
+  }
+  free(pAlpha);
+  free(pNewAlpha);
+}
+
+static void SetupFlood() {
+  memcpy(g_Case.pTexels, g_Case.pSource, g_Case.width * g_Case.height * sizeof(RGBAColor));
+}
+
+static void RunFlood() {
+  FloodSolidPixels(&g_Case.arena, g_Case.pTexels, g_Case.width, g_Case.height);
+  g_nSink += g_Case.pTexels[0].r;
+}
+
+static void RunFloodByPasses() {
+  FloodSolidPixelsByPasses(g_Case.pTexels, g_Case.width, g_Case.height);
+  g_nSink += g_Case.pTexels[0].r;
+}
+
+static void BenchFlood() {
+  static const int sides[] = {64, 256, 512, 2048};
+  static const int alphas[] = {10, 50, 90};
+  printf(
+      "flood: FloodSolidPixels, scattered texels or one hole in the middle, against\n"
+      "flood-old, a pass per ring, which is left out of holes bigger than 512x512\n");
+  PrintHeader("px");
+  for (int s = 0; s < (int)(sizeof(sides) / sizeof(sides[0])); s++) {
+    int side = sides[s];
+    g_Case.width = g_Case.height = side;
+    char size[32], name[32];
+    SizeName(side, side, size);
+    for (int hole = 0; hole < 2; hole++) {
+      for (int a = 0; a < (int)(sizeof(alphas) / sizeof(alphas[0])); a++) {
+        MakeIndices(side, side, alphas[a], hole != 0);
+        bool bAlphatest = false;
+        RGBAColor *pRGB = ConvertToRGBAUpsideDown(&g_Case.arena, g_Case.pIndices, side, side,
+                                                  g_Case.palette, false, &bAlphatest);
+        memcpy(g_Case.pSource, pRGB, side * side * sizeof(RGBAColor));
+        sprintf(name, "%s %d%%", hole ? "hole" : "alpha", alphas[a]);
+        Measure("flood", name, size, side * side, SetupFlood, RunFlood);
+        if (hole && side > 512) continue;
+        memcpy(g_Case.pOut, g_Case.pTexels, side * side * sizeof(RGBAColor));
+        Measure("flood-old", name, size, side * side, SetupFlood, RunFloodByPasses);
+        if (memcmp(g_Case.pOut, g_Case.pTexels, side * side * sizeof(RGBAColor)))
+          Error("flood: %s %s doesn't match a pass per ring\n", name, size);
+      }
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// resample: ResampleImage up to the next power of two
+//-----------------------------------------------------------------------------
+
+static int g_nFilter;
+static bool g_bWrap;
+
+static int NextPowerOf2(int n) {
+  int p = 1;
+  while (p < n) p <<= 1;
+  return p;
+}
+
+static void RunResample() {
+  g_Case.pResult = ResampleImage(&g_Case.arena, g_Case.pSource, g_Case.width, g_Case.height,
+                                 NextPowerOf2(g_Case.width), NextPowerOf2(g_Case.height),
+                                 g_nFilter, g_bWrap, g_Case.bAlphatest);
+  g_nSink += g_Case.pResult[0].r;
+}
+
+static void BenchResample() {
+  static const int sides[] = {48, 200, 600, 1500};
+  static const char *pFilters[] = {"box", "bilinear", "lanczos3"};
+  printf(
+      "resample: ResampleImage up to the next power of two, wrapping and alpha\n"
+      "tested or clamped, per new pixel\n");
+  PrintHeader("px");
+  for (int s = 0; s < (int)(sizeof(sides) / sizeof(sides[0])); s++) {
+    int side = sides[s], newSide = NextPowerOf2(side);
+    g_Case.width = g_Case.height = side;
+    char size[32], name[32];
+    sprintf(size, "%d>%d", side, newSide);
+    MakeIndices(side, side, 10, false);
+    bool bAlphatest = false;
+    RGBAColor *pRGB = ConvertToRGBAUpsideDown(&g_Case.arena, g_Case.pIndices, side, side,
+                                              g_Case.palette, false, &bAlphatest);
+    memcpy(g_Case.pSource, pRGB, side * side * sizeof(RGBAColor));
+    for (g_nFilter = RESAMPLE_BOX; g_nFilter <= RESAMPLE_LANCZOS3; g_nFilter++) {
+      for (int wrap = 0; wrap < 2; wrap++) {
+        g_bWrap = wrap != 0;
+        g_Case.bAlphatest = g_bWrap;  // a fence, or a sprite's soft edge
+        sprintf(name, "%s %s", pFilters[g_nFilter], wrap ? "wrap" : "clamp");
+        MeasureSIMDLevels("resample", name, size, newSide * newSide, newSide * newSide,
+                          RunResample);
+      }
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// mips: BuildMipChain
+//-----------------------------------------------------------------------------
+
+static int g_nMipFlags;
+
+static void RunMips() {
+  const RGBAColor *mips[MAX_MIP_LEVELS];
+  int mipwidth[MAX_MIP_LEVELS], mipheight[MAX_MIP_LEVELS];
+  BuildMipChain(&g_Case.arena, g_Case.pSource, g_Case.width, g_Case.height, g_nMipFlags, mips,
+                mipwidth, mipheight);
+  g_Case.pResult = (RGBAColor *)mips[1];
+  g_nSink += mips[1][0].r;
+}
+
+static void BenchMips() {
+  static const int sides[] = {256, 1024, 2048};
+  static const struct {
+    const char *pName;
+    int flags;
+  } modes[] = {
+      {"box", 0},
+      {"srgb", MIP_SRGB},
+      {"alphatest", MIP_SRGB | MIP_ALPHATEST},
+  };
+  printf(
+      "mips: BuildMipChain, every level below the image, a band of rows at a time\n"
+      "or a level at a time, per pixel of the image\n");
+  PrintHeader("px");
+  for (int s = 0; s < (int)(sizeof(sides) / sizeof(sides[0])); s++) {
+    int side = sides[s];
+    g_Case.width = g_Case.height = side;
+    char size[32], name[32];
+    SizeName(side, side, size);
+    MakeIndices(side, side, 10, false);
+    bool bAlphatest = false;
+    RGBAColor *pRGB = ConvertToRGBAUpsideDown(&g_Case.arena, g_Case.pIndices, side, side,
+                                              g_Case.palette, false, &bAlphatest);
+    memcpy(g_Case.pSource, pRGB, side * side * sizeof(RGBAColor));
+    g_Case.bAlphatest = false;
+    for (int m = 0; m < (int)(sizeof(modes) / sizeof(modes[0])); m++) {
+      for (int bands = 1; bands >= 0; bands--) {
+        g_nMipFlags = modes[m].flags | (bands ? 0 : MIP_NOBANDS);
+        sprintf(name, "%s %s", modes[m].pName, bands ? "bands" : "levels");
+        MeasureSIMDLevels("mips", name, size, side * side, side * side / 4, RunMips);
+      }
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// dxt: CompressDXT1 and CompressDXT5, fast and quality, with what each costs
+// in PSNR, and whole mip chains shared out between threads
+//-----------------------------------------------------------------------------
+
+static int g_nDXTBlockSize;
+static int g_nDXTFlags;
+static dxtimage_t g_DXTImages[MAX_MIP_LEVELS];
+static int g_nDXTImages;
+
+// Something like a texture for the encoders to work on: bricks in a few
+// colours, shaded across, with mortar between them and some grain.  Alpha
+// is solid, in round holes like a '{' texture's, or smoothly varying.
+#define DXT_ALPHA_SOLID 0
+#define DXT_ALPHA_HOLES 1
+#define DXT_ALPHA_SMOOTH 2
+
+static void MakeDXTImage(int side, int alphaMode) {
+  RGBAColor colours[6];
+  for (int i = 0; i < 6; i++) {
+    colours[i].r = (byte)(40 + RandomInt() % 176);
+    colours[i].g = (byte)(40 + RandomInt() % 176);
+    colours[i].b = (byte)(40 + RandomInt() % 176);
+  }
+  for (int y = 0; y < side; y++) {
+    int row = y / 16;
+    for (int x = 0; x < side; x++) {
+      int bx = x + (row & 1) * 16;
+      const RGBAColor &c = colours[(row * 7 + (bx / 32) * 3) % 6];
+      bool bMortar = (y % 16) < 2 || (bx % 32) < 2;
+      int shade = (bx % 32) + (y % 16) - 24;
+      int grain = (int)(RandomInt() % 9) - 4;
+      int rgb[3] = {c.r + shade + grain, c.g + shade + grain, c.b + shade + grain};
+      RGBAColor *pOut = &g_Case.pSource[y * side + x];
+      for (int k = 0; k < 3; k++) {
+        int v = bMortar ? 90 + grain : rgb[k];
+        (&pOut->r)[k] = (byte)(v < 0 ? 0 : v > 255 ? 255 : v);
+      }
+      pOut->a = 255;
+      if (alphaMode == DXT_ALPHA_HOLES) {
+        int dx = x % 64 - 32, dy = y % 64 - 32;
+        if (dx * dx + dy * dy < 20 * 20) pOut->a = 0;
+      } else if (alphaMode == DXT_ALPHA_SMOOTH) {
+        pOut->a = (byte)(128 + 127 * sin(x / 17.0) * cos(y / 23.0));
+      }
+    }
+  }
+}
+
+// What a decoder makes of the blocks, with the same rounding dxtlib assumes.
+// DXT5's colour block always has four colours.
+static void DecodeDXT(const byte *pIn, int width, int height, int blockSize, byte *pRGBA) {
+  for (int by = 0; by < height; by += 4) {
+    for (int bx = 0; bx < width; bx += 4, pIn += blockSize) {
+      const byte *pColor = pIn + (blockSize == DXT5_BLOCK_SIZE ? 8 : 0);
+      int c0 = pColor[0] | pColor[1] << 8, c1 = pColor[2] | pColor[3] << 8;
+      int palette[4][4];
+      for (int e = 0; e < 2; e++) {
+        int c = e ? c1 : c0;
+        int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+        palette[e][0] = (r << 3) | (r >> 2);
+        palette[e][1] = (g << 2) | (g >> 4);
+        palette[e][2] = (b << 3) | (b >> 2);
+        palette[e][3] = 255;
+      }
+      bool bFour = c0 > c1 || blockSize == DXT5_BLOCK_SIZE;
+      for (int k = 0; k < 3; k++) {
+        palette[2][k] = bFour ? (2 * palette[0][k] + palette[1][k]) / 3
+                              : (palette[0][k] + palette[1][k]) / 2;
+        palette[3][k] = bFour ? (palette[0][k] + 2 * palette[1][k]) / 3 : 0;
+      }
+      palette[2][3] = 255;
+      palette[3][3] = bFour ? 255 : 0;
+      unsigned indices = pColor[4] | pColor[5] << 8 | pColor[6] << 16 | (unsigned)pColor[7] << 24;
+
+      int alphas[8];
+      unsigned long long alphaIndices = 0;
+      if (blockSize == DXT5_BLOCK_SIZE) {
+        int a0 = pIn[0], a1 = pIn[1];
+        alphas[0] = a0;
+        alphas[1] = a1;
+        for (int j = 1; j < 7; j++) {
+          if (a0 > a1) alphas[j + 1] = ((7 - j) * a0 + j * a1) / 7;
+          else alphas[j + 1] = j < 5 ? ((5 - j) * a0 + j * a1) / 5 : j == 5 ? 0 : 255;
+        }
+        for (int i = 0; i < 6; i++) alphaIndices |= (unsigned long long)pIn[2 + i] << (i * 8);
+      }
+
+      for (int i = 0; i < 16; i++) {
+        int x = bx + (i & 3), y = by + (i >> 2);
+        if (x >= width || y >= height) continue;
+        byte *pOut = &pRGBA[(y * width + x) * 4];
+        const int *pEntry = palette[(indices >> (i * 2)) & 3];
+        for (int k = 0; k < 4; k++) pOut[k] = (byte)pEntry[k];
+        if (blockSize == DXT5_BLOCK_SIZE) pOut[3] = (byte)alphas[(alphaIndices >> (i * 3)) & 7];
+      }
+    }
+  }
+}
+
+// The colour over the pixels that are meant to show, and alpha as DXT1's one
+// bit or DXT5's eight, against the source.
+static void DXTPSNR(int side, int blockSize, int flags, double *pColor, double *pAlpha) {
+  byte *pDecoded = (byte *)malloc(side * side * 4);
+  DecodeDXT(g_Case.pOut, side, side, blockSize, pDecoded);
+  double colorError = 0, alphaError = 0, colorCount = 0;
+  for (int i = 0; i < side * side; i++) {
+    const byte *pSource = (const byte *)&g_Case.pSource[i];
+    const byte *pDecode = &pDecoded[i * 4];
+    int alpha = pSource[3];
+    if (flags & DXT_ONEBITALPHA) alpha = alpha < 128 ? 0 : 255;
+    if (blockSize == DXT5_BLOCK_SIZE || (flags & DXT_ONEBITALPHA))
+      alphaError += (double)(alpha - pDecode[3]) * (alpha - pDecode[3]);
+    if (!alpha && (flags & DXT_ONEBITALPHA)) continue;
+    for (int k = 0; k < 3; k++) colorError += (double)(pSource[k] - pDecode[k]) * (pSource[k] - pDecode[k]);
+    colorCount += 3;
+  }
+  free(pDecoded);
+  *pColor = colorError ? 10 * log10(255.0 * 255.0 * colorCount / colorError) : 99.99;
+  *pAlpha = alphaError ? 10 * log10(255.0 * 255.0 * side * side / alphaError) : 99.99;
+}
+
+static void RunDXT() {
+  if (g_nDXTBlockSize == DXT1_BLOCK_SIZE)
+    CompressDXT1((const byte *)g_Case.pSource, g_Case.width, g_Case.height, g_Case.pOut, g_nDXTFlags);
+  else
+    CompressDXT5((const byte *)g_Case.pSource, g_Case.width, g_Case.height, g_Case.pOut, g_nDXTFlags);
+  g_nSink += g_Case.pOut[0];
+}
+
+static void RunDXTChain() {
+  CompressDXTImages(g_DXTImages, g_nDXTImages, g_nDXTBlockSize, g_nDXTFlags);
+  g_nSink += g_DXTImages[0].out[0];
+}
+
+static void BenchDXT() {
+  static const int sides[] = {256, 1024};
+  static const struct {
+    const char *pName;
+    int blockSize;
+    int flags;
+    int alphaMode;
+  } formats[] = {
+      {"dxt1", DXT1_BLOCK_SIZE, 0, DXT_ALPHA_SOLID},
+      {"dxt1a", DXT1_BLOCK_SIZE, DXT_ONEBITALPHA, DXT_ALPHA_HOLES},
+      {"dxt5", DXT5_BLOCK_SIZE, 0, DXT_ALPHA_SMOOTH},
+  };
+  static const struct {
+    const char *pName;
+    int flags;
+  } modes[] = {
+      {"fast", 0},
+      {"quality", DXT_QUALITY},
+  };
+  const int nFormats = sizeof(formats) / sizeof(formats[0]);
+  const int nModes = sizeof(modes) / sizeof(modes[0]);
+  double colorPSNR[2][3][2], alphaPSNR[2][3][2];
+
+  printf(
+      "dxt: CompressDXT1 and CompressDXT5 on a brick texture, and its whole mip chain\n"
+      "on one thread and shared out between them all, per pixel of the image\n");
+  PrintHeader("px");
+  int best = Tex_SIMDLevel();
+  for (int s = 0; s < (int)(sizeof(sides) / sizeof(sides[0])); s++) {
+    int side = sides[s];
+    g_Case.width = g_Case.height = side;
+    char size[32], name[32];
+    SizeName(side, side, size);
+    int outSize = DXT_SIZE(side, side, DXT5_BLOCK_SIZE);
+    for (int f = 0; f < nFormats; f++) {
+      MakeDXTImage(side, formats[f].alphaMode);
+      g_nDXTBlockSize = formats[f].blockSize;
+      for (int m = 0; m < nModes; m++) {
+        g_nDXTFlags = formats[f].flags | modes[m].flags;
+        sprintf(name, "%s %s", formats[f].pName, modes[m].pName);
+        for (int level = TEX_SIMD_NONE; level <= best; level++) {
+          if (level == TEX_SIMD_SSE2) continue;  // nothing of dxtlib's
+          char kernel[32];
+          sprintf(kernel, "dxt%s", g_pSIMDNames[level]);
+          Tex_SetSIMDLevel(level);
+          Measure(kernel, name, size, side * side, NULL, RunDXT);
+          if (level == TEX_SIMD_NONE) {
+            memcpy(g_Case.pTexels, g_Case.pOut, outSize);
+            DXTPSNR(side, formats[f].blockSize, g_nDXTFlags, &colorPSNR[s][f][m], &alphaPSNR[s][f][m]);
+          } else if (memcmp(g_Case.pTexels, g_Case.pOut, outSize)) {
+            Error("%s: %s %s doesn't match the scalar code\n", kernel, name, size);
+          }
+        }
+        Tex_SetSIMDLevel(best);
+      }
+    }
+  }
+
+  // A 2048 mip chain, as VTF_Encode gives it, on one thread and then all.
+  const int side = 2048;
+  MakeDXTImage(side, DXT_ALPHA_SOLID);
+  const RGBAColor *mips[MAX_MIP_LEVELS];
+  int mipWidth[MAX_MIP_LEVELS], mipHeight[MAX_MIP_LEVELS];
+  g_nDXTImages = BuildMipChain(&g_Case.arena, g_Case.pSource, side, side, MIP_SRGB, mips, mipWidth,
+                               mipHeight);
+  byte *pChain = (byte *)malloc(side * side * 4 * 2);
+  byte *pIn = pChain, *pOut = g_Case.pOut;
+  for (int i = 0; i < g_nDXTImages; i++) {
+    memcpy(pIn, mips[i], mipWidth[i] * mipHeight[i] * 4);
+    g_DXTImages[i].rgba = pIn;
+    g_DXTImages[i].width = mipWidth[i];
+    g_DXTImages[i].height = mipHeight[i];
+    g_DXTImages[i].out = pOut;
+    pIn += mipWidth[i] * mipHeight[i] * 4;
+    pOut += DXT_SIZE(mipWidth[i], mipHeight[i], DXT1_BLOCK_SIZE);
+  }
+  ThreadSetDefault();
+  int nThreads = numthreads;
+  char size[32], name[32];
+  SizeName(side, side, size);
+  g_nDXTBlockSize = DXT1_BLOCK_SIZE;
+  const int threadCounts[] = {1, nThreads};
+  for (int m = 0; m < nModes; m++) {
+    g_nDXTFlags = modes[m].flags;
+    for (int t = 0; t < (nThreads > 1 ? 2 : 1); t++) {
+      numthreads = threadCounts[t];
+      sprintf(name, "chain %s %dt", modes[m].pName, numthreads);
+      Measure("dxt-threads", name, size, side * side, NULL, RunDXTChain);
+    }
+  }
+  numthreads = nThreads;
+  free(pChain);
+
+  printf("\n%-14s %-16s %12s %12s %12s\n", "dxt", "case", "size", "rgb dB", "alpha dB");
+  for (int s = 0; s < (int)(sizeof(sides) / sizeof(sides[0])); s++) {
+    SizeName(sides[s], sides[s], size);
+    for (int f = 0; f < nFormats; f++) {
+      for (int m = 0; m < nModes; m++) {
+        sprintf(name, "%s %s", formats[f].pName, modes[m].pName);
+        char alpha[32] = "-";
+        if (formats[f].flags || formats[f].blockSize == DXT5_BLOCK_SIZE)
+          sprintf(alpha, "%.2f", alphaPSNR[s][f][m]);
+        printf("%-14s %-16s %12s %12.2f %12s\n", "psnr", name, size, colorPSNR[s][f][m], alpha);
+      }
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// tga: WriteTGAPixels
+//-----------------------------------------------------------------------------
+
+static void RunTGA24() {
+  WriteTGAPixels(g_Case.pSource, g_Case.width * g_Case.height, false, g_Case.pOut);
+  g_nSink += g_Case.pOut[0];
+}
+
+static void RunTGA32() {
+  WriteTGAPixels(g_Case.pSource, g_Case.width * g_Case.height, true, g_Case.pOut);
+  g_nSink += g_Case.pOut[0];
+}
+
+static void BenchTGA() {
+  static const int sides[] = {64, 256, 1024, 2048};
+  printf("tga: WriteTGAPixels\n");
+  PrintHeader("px");
+  for (int s = 0; s < (int)(sizeof(sides) / sizeof(sides[0])); s++) {
+    int side = sides[s];
+    g_Case.width = g_Case.height = side;
+    for (int i = 0; i < side * side * (int)sizeof(RGBAColor); i++)
+      ((byte *)g_Case.pSource)[i] = (byte)RandomInt();
+    char size[32];
+    SizeName(side, side, size);
+    Measure("tga", "24 bit", size, side * side, NULL, RunTGA24);
+    Measure("tga", "32 bit", size, side * side, NULL, RunTGA32);
+  }
+}
+
+//-----------------------------------------------------------------------------
+// lbm: LBMRLEDecompress on rows packed the way ILBM and PBM bodies are
+//-----------------------------------------------------------------------------
+
+// PackBits: runs of 3 or more as a count and the byte, the rest as counted
+// literals, at most 128 of either.
+static int PackRow(const byte *pRow, int width, byte *pOut) {
+  int length = 0;
+  for (int x = 0; x < width;) {
+    int run = 1;
+    while (x + run < width && run < 128 && pRow[x + run] == pRow[x]) run++;
+    if (run >= 3) {
+      pOut[length++] = (byte)((run - 2) ^ 0xff);
+      pOut[length++] = pRow[x];
+      x += run;
+      continue;
+    }
+
+    int literal = 1;
+    while (x + literal < width && literal < 128 &&
+           !(x + literal + 2 < width && pRow[x + literal] == pRow[x + literal + 1] &&
+             pRow[x + literal] == pRow[x + literal + 2]))
+      literal++;
+    pOut[length++] = (byte)(literal - 1);
+    memcpy(pOut + length, pRow + x, literal);
+    length += literal;
+    x += literal;
+  }
+  return length;
+}
+
+static void RunLBM() {
+  byte *pSource = g_Case.pPacked;
+  for (int y = 0; y < g_Case.height; y++)
+    pSource = LBMRLEDecompress(pSource, g_Case.pOut + y * g_Case.width, g_Case.width);
+  g_nSink += g_Case.pOut[0];
+}
+
+static void BenchLBM() {
+  static const int sides[] = {64, 256, 1024, 2048};
+  printf("lbm: LBMRLEDecompress, rows of noise or of runs averaging 16\n");
+  PrintHeader("px");
+  for (int s = 0; s < (int)(sizeof(sides) / sizeof(sides[0])); s++) {
+    int side = sides[s];
+    g_Case.width = g_Case.height = side;
+    char size[32];
+    SizeName(side, side, size);
+    for (int runs = 0; runs < 2; runs++) {
+      for (int i = 0; i < side * side;) {
+        int run = runs ? 1 + RandomInt() % 31 : 1;
+        if (run > side * side - i) run = side * side - i;
+        memset(g_Case.pIndices + i, RandomInt() & 255, run);
+        i += run;
+      }
+      int packed = 0;
+      for (int y = 0; y < side; y++)
+        packed += PackRow(g_Case.pIndices + y * side, side, g_Case.pPacked + packed);
+      Measure("lbm", runs ? "runs" : "noise", size, side * side, NULL, RunLBM);
+      if (memcmp(g_Case.pOut, g_Case.pIndices, side * side))
+        Error("lbm: rows didn't unpack to what was packed\n");
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// flip: FlipRows on a bmp's bottom up rows
+//-----------------------------------------------------------------------------
+
+static void RunFlip() {
+  FlipRows(g_Case.pIndices, g_Case.width, g_Case.height);
+  g_nSink += g_Case.pIndices[0];
+}
+
+static void BenchFlip() {
+  static const int sides[] = {64, 256, 1024, 2048};
+  printf("flip: FlipRows on 8 bit rows\n");
+  PrintHeader("px");
+  for (int s = 0; s < (int)(sizeof(sides) / sizeof(sides[0])); s++) {
+    int side = sides[s];
+    g_Case.width = g_Case.height = side;
+    MakeIndices(side, side, 0, false);
+    char size[32];
+    SizeName(side, side, size);
+    Measure("flip", "", size, side * side, NULL, RunFlip);
+  }
+}
+
+//-----------------------------------------------------------------------------
+// names: CleanupName and W_CheckNumForName, per name
+//-----------------------------------------------------------------------------
+
+// Something that looks like a texture name, in either case.
+static void RandomLumpName(char name[16]) {
+  static const char chars[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_{+-~";
+  int len = 3 + RandomInt() % 13;
+  memset(name, 0, 16);
+  for (int i = 0; i < len; i++) name[i] = chars[RandomInt() % (sizeof(chars) - 1)];
+}
+
+static void RunCleanupName() {
+  char clean[16];
+  for (int i = 0; i < g_Case.nQueries; i++) {
+    CleanupName(g_Case.queries[i], clean);
+    g_nSink += clean[0];
+  }
+}
+
+static void RunCheckNumForName() {
+  for (int i = 0; i < g_Case.nQueries; i++) g_nSink += W_CheckNumForName(g_Case.queries[i]);
+}
+
+static void BenchNames() {
+  static const int lumpCounts[] = {1000, 50000};
+  const char *pTempWad = "kernelbench_names.wad";
+  printf("names: CleanupName and W_CheckNumForName, half hits and half misses\n");
+  PrintHeader("nm");
+
+  g_Case.nQueries = 4096;
+  g_Case.queries = (char (*)[16])malloc(g_Case.nQueries * 16);
+  for (int c = 0; c < (int)(sizeof(lumpCounts) / sizeof(lumpCounts[0])); c++) {
+    int count = lumpCounts[c];
+    char (*names)[16] = (char (*)[16])malloc(count * 16);
+    byte lump = 0;
+    WadWriter wad;
+    wad.Open(pTempWad, false);
+    for (int i = 0; i < count; i++) {
+      RandomLumpName(names[i]);
+      wad.AddLump(names[i], &lump, 1, TYP_LUMPY, CMP_NONE);
+    }
+    wad.Commit(1);
+    W_OpenWad(pTempWad);
+
+    for (int i = 0; i < g_Case.nQueries; i++) {
+      if (i & 1)
+        RandomLumpName(g_Case.queries[i]);
+      else
+        memcpy(g_Case.queries[i], names[RandomInt() % count], 16);
+    }
+
+    char size[32];
+    sprintf(size, "%d lumps", count);
+    Measure("names", "CleanupName", size, g_Case.nQueries, NULL, RunCleanupName);
+    Measure("names", "CheckNum", size, g_Case.nQueries, NULL, RunCheckNumForName);
+
+    W_CloseWad();
+    free(names);
+  }
+  free(g_Case.queries);
+  remove(pTempWad);
+}
+
+int main(int argc, char **argv) {
+  static const struct {
+    const char *pName;
+    void (*pfnBench)();
+  } benches[] = {
+      {"rgba", BenchRGBA}, {"flood", BenchFlood}, {"resample", BenchResample},
+      {"mips", BenchMips}, {"dxt", BenchDXT},     {"tga", BenchTGA},
+      {"lbm", BenchLBM},   {"flip", BenchFlip},   {"names", BenchNames},
+  };
+  const int nBenches = sizeof(benches) / sizeof(benches[0]);
+
+  if (argc > 1 && argv[1][0] == '-') {
+    printf(
+        "%s [kernel...]\n"
+        "\truns every kernel's benchmark, or just the ones named:\n"
+        "\trgba, flood, resample, mips, dxt, tga, lbm, flip and names.  Times\n"
+        "\tare the fastest call, per pixel, or per name for names.  dxt also\n"
+        "\tprints the PSNR of each format and mode.\n",
+        argv[0]);
+    return 1;
+  }
+
+  AllocCase(2048);
+  for (int b = 0; b < nBenches; b++) {
+    bool bRun = argc < 2;
+    for (int i = 1; i < argc; i++) bRun |= stricmp(argv[i], benches[b].pName) == 0;
+    if (!bRun) continue;
+    benches[b].pfnBench();
+    printf("\n");
+  }
+  for (int i = 1; i < argc; i++) {
+    bool bKnown = false;
+    for (int b = 0; b < nBenches; b++) bKnown |= stricmp(argv[i], benches[b].pName) == 0;
+    if (!bKnown) printf("Unknown kernel '%s'.\n", argv[i]);
+  }
+  FreeCase();
+  return 0;
+}
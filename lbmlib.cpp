@@ -10,8 +10,10 @@
 
 #include <WINDOWS.H>
 #include <STDIO.H>
-#include "lbmlib.h"
+#include <stdlib.h>
+#include <string.h>
 #include "goldsrc_standin.h"
+#include "lbmlib.h"
 
 
 
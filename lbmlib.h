@@ -12,10 +12,10 @@ typedef unsigned char	UBYTE;
 
 #ifndef _WINDOWS_
 typedef short			WORD;
+typedef long			LONG;
 #endif
 
 typedef unsigned short	UWORD;
-typedef long			LONG;
 
 typedef enum
 {
@@ -47,6 +47,9 @@ typedef struct
 extern	bmhd_t	bmhd;						// will be in native byte order
 
 
+// Unpacks one row of bpwidth bytes, returning where the next row starts.
+byte *LBMRLEDecompress (byte *source, byte *unpacked, int bpwidth);
+
 void LoadLBM (char *filename, byte **picture, byte **palette);
 int	LoadBMP (const char* szFile, byte** ppbBits, byte** ppbPalette);
 void WriteLBMfile (char *filename, byte *data, int width, int height
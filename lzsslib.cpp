@@ -0,0 +1,267 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: 
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+
+// lzsslib.c
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "goldsrc_standin.h"
+#include "lzsslib.h"
+
+#define	HASH_BITS		14
+#define	HASH_SIZE		(1<<HASH_BITS)
+#define	MAX_CHAIN		16				// candidates looked at per position
+#define	NIL				(-1)
+
+
+/*
+==================
+HashTriple
+
+Hashes the LZSS_MIN_MATCH bytes at p
+==================
+*/
+static inline int HashTriple (const byte *p)
+{
+	unsigned	v;
+
+	v = p[0] | (p[1] << 8) | (p[2] << 16);
+	return (int)((v * 2654435761u) >> (32 - HASH_BITS));
+}
+
+
+/*
+==================
+MatchLength
+
+How many of the first maxlen bytes at a and b agree.  Compares eight bytes
+at a time when there is room to read that far.
+==================
+*/
+static inline int MatchLength (const byte *a, const byte *b, int maxlen, const byte *end)
+{
+	unsigned long long	x, y, diff;
+	int					len;
+
+	len = 0;
+	if (b + LZSS_MAX_MATCH + 8 <= end)
+	{
+		for ( ; len < maxlen ; len += 8)
+		{
+			memcpy (&x, a + len, 8);
+			memcpy (&y, b + len, 8);
+			diff = x ^ y;
+			if (diff)
+			{
+				len += __builtin_ctzll (diff) >> 3;		// little endian
+				break;
+			}
+		}
+		return len < maxlen ? len : maxlen;
+	}
+
+	while (len < maxlen && a[len] == b[len])
+		len++;
+	return len;
+}
+
+
+/*
+==================
+LZSS_Compress
+
+Greedy parse with a hash chain match finder: head[] holds the newest
+position for each hash of three bytes and prev[] links each position in the
+window to the previous one with the same hash.
+
+Returns the compressed size, or 0 if it wouldn't fit in outsize, in which
+case the caller should just store the data.
+==================
+*/
+int LZSS_Compress (const byte *in, int length, byte *out, int outsize)
+{
+	int		head[HASH_SIZE];
+	int		prev[LZSS_WINDOW];
+	int		pos, cand, chain, len, maxlen, bestlen, bestdist;
+	int		h, i, outpos, flagpos, flagbit;
+
+	if (length <= 0 || outsize <= 0)
+		return 0;
+
+	memset (head, NIL, sizeof(head));
+
+	outpos = 0;
+	flagpos = 0;
+	flagbit = 8;			// start a new group on the first item
+	pos = 0;
+
+	while (pos < length)
+	{
+		if (flagbit == 8)
+		{
+			if (outpos >= outsize)
+				return 0;
+			flagpos = outpos++;
+			out[flagpos] = 0;
+			flagbit = 0;
+		}
+
+	// find the longest match in the window
+		bestlen = 0;
+		bestdist = 0;
+		maxlen = length - pos;
+		if (maxlen > LZSS_MAX_MATCH)
+			maxlen = LZSS_MAX_MATCH;
+
+		if (maxlen >= LZSS_MIN_MATCH)
+		{
+			h = HashTriple (in + pos);
+			cand = head[h];
+			for (chain = 0 ; chain < MAX_CHAIN && cand != NIL && pos - cand <= LZSS_WINDOW ; chain++)
+			{
+				if (in[cand + bestlen] == in[pos + bestlen])
+				{
+					len = MatchLength (in + cand, in + pos, maxlen, in + length);
+					if (len > bestlen)
+					{
+						bestlen = len;
+						bestdist = pos - cand;
+						if (len == maxlen)
+							break;
+					}
+				}
+				cand = prev[cand & (LZSS_WINDOW-1)];
+			}
+		}
+
+		if (bestlen >= LZSS_MIN_MATCH)
+		{
+			if (outpos + 2 > outsize)
+				return 0;
+			out[outpos++] = (bestdist - 1) & 255;
+			out[outpos++] = (((bestdist - 1) >> 4) & 0xf0) | (bestlen - LZSS_MIN_MATCH);
+		}
+		else
+		{
+			if (outpos >= outsize)
+				return 0;
+			out[flagpos] |= 1 << flagbit;
+			out[outpos++] = in[pos];
+			bestlen = 1;
+		}
+		flagbit++;
+
+	// link every position we just covered into the chains
+		for (i = 0 ; i < bestlen ; i++, pos++)
+		{
+			if (pos + LZSS_MIN_MATCH <= length)
+			{
+				h = HashTriple (in + pos);
+				prev[pos & (LZSS_WINDOW-1)] = head[h];
+				head[h] = pos;
+			}
+		}
+	}
+
+	return outpos;
+}
+
+
+/*
+==================
+DecodeLZSS
+
+With head set, decoding stops once outlength bytes are out, cutting short a
+reference that runs past them, and the rest of the input isn't looked at.
+==================
+*/
+static qboolean DecodeLZSS (const byte *in, int inlength, byte *out, int outlength, qboolean head)
+{
+	const byte	*inend;
+	byte		*outp, *outend;
+	const byte	*src;
+	int			flags, bit, dist, len;
+
+	inend = in + inlength;
+	outp = out;
+	outend = out + outlength;
+
+	while (outp < outend)
+	{
+		if (in >= inend)
+			return false;
+		flags = *in++;
+
+		for (bit = 0 ; bit < 8 && outp < outend ; bit++, flags >>= 1)
+		{
+			if (flags & 1)
+			{
+				if (in >= inend)
+					return false;
+				*outp++ = *in++;
+				continue;
+			}
+
+			if (inend - in < 2)
+				return false;
+			dist = (in[0] | ((in[1] & 0xf0) << 4)) + 1;
+			len = (in[1] & 0x0f) + LZSS_MIN_MATCH;
+			in += 2;
+
+			if (head && len > outend - outp)
+				len = outend - outp;
+			if (dist > outp - out || len > outend - outp)
+				return false;
+
+			src = outp - dist;
+			if (dist >= len)
+			{
+				memcpy (outp, src, len);
+				outp += len;
+			}
+			else
+			{
+				// overlapping, so it repeats the last dist bytes
+				while (len--)
+					*outp++ = *src++;
+			}
+		}
+	}
+
+	return head || in == inend;
+}
+
+
+/*
+==================
+LZSS_Decompress
+
+Decodes straight into out, which must be exactly outlength bytes.  Returns
+false if the data is corrupt: a reference before the start of the output,
+output that would overflow, or input that runs out early.
+==================
+*/
+qboolean LZSS_Decompress (const byte *in, int inlength, byte *out, int outlength)
+{
+	return DecodeLZSS (in, inlength, out, outlength, false);
+}
+
+
+/*
+==================
+LZSS_DecompressHead
+
+Decodes only the first outlength bytes, for a header, without the cost of the
+rest.  At most LZSS_BOUND(outlength) bytes of input are read.
+==================
+*/
+qboolean LZSS_DecompressHead (const byte *in, int inlength, byte *out, int outlength)
+{
+	return DecodeLZSS (in, inlength, out, outlength, true);
+}
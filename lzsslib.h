@@ -0,0 +1,30 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: 
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+
+// lzsslib.h
+
+//
+// LZSS as stored in CMP_LZSS wad lumps.
+//
+// The stream is a run of groups, each a flag byte followed by up to eight
+// items, low bit first.  A set bit is a literal byte.  A clear bit is a two
+// byte back reference: the low 8 bits of (distance - 1), then the high 4 bits
+// of (distance - 1) in the top nibble and (length - LZSS_MIN_MATCH) in the
+// bottom one.  So matches reach back up to 4096 bytes and are 3 to 18 long.
+//
+
+#define	LZSS_WINDOW			4096
+#define	LZSS_MIN_MATCH		3
+#define	LZSS_MAX_MATCH		(LZSS_MIN_MATCH + 15)
+
+// worst case output size, when nothing matches at all
+#define	LZSS_BOUND(length)	((length) + ((length) + 7) / 8)
+
+int		LZSS_Compress (const byte *in, int length, byte *out, int outsize);
+qboolean	LZSS_Decompress (const byte *in, int inlength, byte *out, int outlength);
+qboolean	LZSS_DecompressHead (const byte *in, int inlength, byte *out, int outlength);	// just the first outlength bytes
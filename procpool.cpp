@@ -0,0 +1,394 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: 
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+
+// procpool.c
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+extern char **environ;
+#endif
+#include "goldsrc_standin.h"
+#include "threads.h"
+#include "procpool.h"
+
+int		maxprocesses;
+
+static int		runningprocesses;
+
+#ifdef _WIN32
+static CRITICAL_SECTION	spawncrit;		// see RunChild
+static qboolean			spawncritinit;
+#endif
+
+
+/*
+==============
+AcquireProcessSlot
+
+Waits until fewer than maxprocesses children are running, asleep on the
+lock until ReleaseProcessSlot wakes it.
+==============
+*/
+static void AcquireProcessSlot (void)
+{
+	int		limit;
+
+	ThreadSetDefault ();
+	limit = maxprocesses > 0 ? maxprocesses : numthreads;
+
+	ThreadLock ();
+#ifdef _WIN32
+	if (!spawncritinit)
+	{
+		InitializeCriticalSection (&spawncrit);
+		spawncritinit = true;
+	}
+#endif
+	while (runningprocesses >= limit)
+		ThreadWait ();
+	runningprocesses++;
+	ThreadUnlock ();
+}
+
+static void ReleaseProcessSlot (void)
+{
+	ThreadLock ();
+	runningprocesses--;
+	ThreadWake ();
+	ThreadUnlock ();
+}
+
+
+/*
+==============
+AppendOutput
+==============
+*/
+static void AppendOutput (procresult_t *result, int *maxlength, const char *data, int length)
+{
+	if (result->outputlength + length + 1 > *maxlength)
+	{
+		*maxlength = (result->outputlength + length + 1) * 2;
+		result->output = (char *)realloc (result->output, *maxlength);
+	}
+	memcpy (result->output + result->outputlength, data, length);
+	result->outputlength += length;
+	result->output[result->outputlength] = 0;
+}
+
+
+/*
+==============
+FormatCommandLine
+
+Quotes each argument the way the Microsoft C runtime splits them again:
+backslashes only need doubling when they end up in front of a quote.
+==============
+*/
+void FormatCommandLine (int argc, const char **argv, char *out, int outsize)
+{
+	const char	*p;
+	int			len, i, slashes;
+
+#define	PUTC(c)	do { if (len < outsize - 1) out[len] = (c); len++; } while (0)
+
+	len = 0;
+	for (i = 0 ; i < argc ; i++)
+	{
+		if (i)
+			PUTC (' ');
+
+		if (argv[i][0] && !strpbrk (argv[i], " \t\""))
+		{
+			for (p = argv[i] ; *p ; p++)
+				PUTC (*p);
+			continue;
+		}
+
+		PUTC ('"');
+		for (p = argv[i] ; ; p++)
+		{
+			for (slashes = 0 ; *p == '\\' ; p++)
+				slashes++;
+
+			if (!*p)
+			{
+				while (slashes--)
+				{
+					PUTC ('\\');
+					PUTC ('\\');
+				}
+				break;
+			}
+			if (*p == '"')
+			{
+				while (slashes--)
+				{
+					PUTC ('\\');
+					PUTC ('\\');
+				}
+				PUTC ('\\');
+				PUTC ('"');
+				continue;
+			}
+			while (slashes--)
+				PUTC ('\\');
+			PUTC (*p);
+		}
+		PUTC ('"');
+	}
+	out[len < outsize ? len : outsize - 1] = 0;
+
+#undef PUTC
+}
+
+
+#ifdef _WIN32
+/*
+==============
+RunChild
+==============
+*/
+static void RunChild (int argc, const char **argv, int timeoutms, procresult_t *result)
+{
+	SECURITY_ATTRIBUTES	sa;
+	STARTUPINFO			si;
+	PROCESS_INFORMATION	pi;
+	HANDLE				readpipe, writepipe;
+	PROCESS_MEMORY_COUNTERS	memory;
+	DWORD				start, avail, got, code;
+	char				*cmdline;
+	char				buf[4096];
+	int					maxlength, cmdsize;
+	BOOL				started, exited;
+
+	cmdsize = 32768;
+	cmdline = (char *)malloc (cmdsize);
+	FormatCommandLine (argc, argv, cmdline, cmdsize);
+
+	memset (&sa, 0, sizeof(sa));
+	sa.nLength = sizeof(sa);
+	sa.bInheritHandle = TRUE;
+
+	// Children inherit every inheritable handle open when they're created,
+	// so the pipe and the CreateProcess go together or one child could end
+	// up holding another's pipe open.
+	EnterCriticalSection (&spawncrit);
+	if (!CreatePipe (&readpipe, &writepipe, &sa, 0))
+	{
+		LeaveCriticalSection (&spawncrit);
+		free (cmdline);
+		return;
+	}
+	SetHandleInformation (readpipe, HANDLE_FLAG_INHERIT, 0);
+
+	memset (&si, 0, sizeof(si));
+	si.cb = sizeof(si);
+	si.dwFlags = STARTF_USESTDHANDLES;
+	si.hStdInput = GetStdHandle (STD_INPUT_HANDLE);
+	si.hStdOutput = writepipe;
+	si.hStdError = writepipe;
+
+	started = CreateProcess (argv[0], cmdline, NULL, NULL, TRUE, CREATE_NO_WINDOW, NULL, NULL, &si, &pi);
+	CloseHandle (writepipe);
+	LeaveCriticalSection (&spawncrit);
+	free (cmdline);
+
+	if (!started)
+	{
+		CloseHandle (readpipe);
+		return;
+	}
+
+	// poll rather than block on the pipe, so the timeout can be checked
+	maxlength = 0;
+	start = GetTickCount ();
+	exited = FALSE;
+	for (;;)
+	{
+		// a child that never stops printing mustn't keep this from timing out
+		while (PeekNamedPipe (readpipe, NULL, 0, NULL, &avail, NULL) && avail
+			&& (timeoutms <= 0 || GetTickCount () - start <= (DWORD)timeoutms))
+		{
+			if (!ReadFile (readpipe, buf, avail < sizeof(buf) ? avail : sizeof(buf), &got, NULL) || !got)
+				break;
+			AppendOutput (result, &maxlength, buf, got);
+		}
+		if (exited)
+			break;
+
+		exited = WaitForSingleObject (pi.hProcess, 10) == WAIT_OBJECT_0;
+		if (!exited && timeoutms > 0 && GetTickCount () - start > (DWORD)timeoutms)
+		{
+			TerminateProcess (pi.hProcess, 1);
+			WaitForSingleObject (pi.hProcess, INFINITE);
+			result->timedout = true;
+			break;
+		}
+	}
+
+	if (!result->timedout && GetExitCodeProcess (pi.hProcess, &code))
+		result->exitcode = (int)code;
+	if (GetProcessMemoryInfo (pi.hProcess, &memory, sizeof(memory)))
+		result->peakmemorykb = (int)(memory.PeakWorkingSetSize / 1024);
+
+	CloseHandle (readpipe);
+	CloseHandle (pi.hThread);
+	CloseHandle (pi.hProcess);
+}
+#else
+static int ElapsedMs (const struct timespec *start)
+{
+	struct timespec	now;
+
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return (int)((now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000);
+}
+
+/*
+==============
+RunChild
+==============
+*/
+static void RunChild (int argc, const char **argv, int timeoutms, procresult_t *result)
+{
+	posix_spawn_file_actions_t	actions;
+	struct pollfd				pfd;
+	struct timespec				start;
+	struct rusage				usage;
+	char						**args;
+	char						buf[4096];
+	int							fds[2];
+	int							maxlength, status, i;
+	ssize_t						got;
+	pid_t						pid;
+
+	if (pipe (fds))
+		return;
+	// close on exec, so only the child it's meant for holds the write end
+	fcntl (fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl (fds[1], F_SETFD, FD_CLOEXEC);
+
+	posix_spawn_file_actions_init (&actions);
+	posix_spawn_file_actions_adddup2 (&actions, fds[1], 1);
+	posix_spawn_file_actions_adddup2 (&actions, fds[1], 2);
+
+	args = (char **)malloc ((argc + 1) * sizeof(char *));
+	for (i = 0 ; i < argc ; i++)
+		args[i] = (char *)argv[i];
+	args[argc] = NULL;
+
+	i = posix_spawn (&pid, argv[0], &actions, NULL, args, environ);
+	posix_spawn_file_actions_destroy (&actions);
+	free (args);
+	close (fds[1]);
+	if (i)
+	{
+		close (fds[0]);
+		return;
+	}
+
+	maxlength = 0;
+	clock_gettime (CLOCK_MONOTONIC, &start);
+	pfd.fd = fds[0];
+	pfd.events = POLLIN;
+	for (;;)
+	{
+		i = poll (&pfd, 1, 10);
+		if (i > 0)
+		{
+			got = read (fds[0], buf, sizeof(buf));
+			if (got > 0)
+				AppendOutput (result, &maxlength, buf, (int)got);
+			else if (got == 0)
+				break;		// every writer has gone
+		}
+		else if (i < 0 && errno != EINTR)
+			break;
+
+		// checked after output as well, so a child that never stops
+		// printing still runs out of time
+		if (timeoutms > 0 && ElapsedMs (&start) > timeoutms)
+		{
+			kill (pid, SIGKILL);
+			result->timedout = true;
+			break;
+		}
+	}
+	close (fds[0]);
+
+	// A child can close its output and still keep running, so the deadline
+	// holds while it's waited for too.
+	memset (&usage, 0, sizeof(usage));
+	status = 0;
+	for (;;)
+	{
+		i = wait4 (pid, &status, result->timedout ? 0 : WNOHANG, &usage);
+		if (i == pid || (i == -1 && errno != EINTR))
+			break;
+		if (i != 0 || result->timedout)
+			continue;
+
+		if (timeoutms > 0 && ElapsedMs (&start) > timeoutms)
+		{
+			kill (pid, SIGKILL);
+			result->timedout = true;
+		}
+		else
+			usleep (10000);
+	}
+	if (i == pid && !result->timedout && WIFEXITED (status))
+		result->exitcode = WEXITSTATUS (status);
+	result->peakmemorykb = (int)usage.ru_maxrss;	// already KB
+}
+#endif
+
+
+/*
+==============
+RunProcess
+==============
+*/
+qboolean RunProcess (int argc, const char **argv, int timeoutms, procresult_t *result)
+{
+	memset (result, 0, sizeof(*result));
+	result->exitcode = -1;
+
+	AcquireProcessSlot ();
+	RunChild (argc, argv, timeoutms, result);
+	ReleaseProcessSlot ();
+
+	if (!result->output)
+	{
+		result->output = (char *)malloc (1);
+		result->output[0] = 0;
+	}
+	return result->exitcode == 0 && !result->timedout;
+}
+
+
+void FreeProcResult (procresult_t *result)
+{
+	free (result->output);
+	result->output = NULL;
+	result->outputlength = 0;
+}
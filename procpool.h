@@ -0,0 +1,43 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: 
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+
+// procpool.h
+
+#ifndef PROCPOOL_H
+#define PROCPOOL_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+
+typedef struct
+{
+	int			exitcode;		// -1 if it couldn't be started or had to be killed
+	qboolean	timedout;
+	char		*output;		// stdout and stderr together, malloc'd and terminated
+	int			outputlength;
+	int			peakmemorykb;	// the child's peak working set, 0 if unknown
+} procresult_t;
+
+// How many children RunProcess lets run at once, across every thread that
+// calls it.  0 (the default) means numthreads.
+extern	int		maxprocesses;
+
+// Starts argv[0] with the given arguments, straight away rather than through
+// a shell, and blocks the calling thread until it exits.  Its stdout and
+// stderr are captured into result.  A child still running after timeoutms
+// (0 for no limit) is killed.  Returns false if the child couldn't be
+// started, timed out or exited with a non zero code.
+qboolean	RunProcess (int argc, const char **argv, int timeoutms, procresult_t *result);
+void		FreeProcResult (procresult_t *result);
+
+// The command line RunProcess would use, for messages
+void		FormatCommandLine (int argc, const char **argv, char *out, int outsize);
+
+
+#endif // PROCPOOL_H
@@ -0,0 +1,197 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Checks that RepackWad gives back every lump as it went in.
+//
+//=============================================================================//
+
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#include "goldsrc_standin.h"
+
+#include "wadlib.h"
+#include "goldsrc_bspfile.h"
+#include "wadrepack.h"
+
+static const char *g_pTempWad = "repacktest.wad";
+
+// RepackWad writes the new wad next to the old one before renaming it over.
+static void RemoveTempFiles() {
+  char tempPath[MAX_PATH];
+  _snprintf(tempPath, sizeof(tempPath), "%s.tmp", g_pTempWad);
+  tempPath[sizeof(tempPath) - 1] = 0;
+  remove(tempPath);
+  remove(g_pTempWad);
+}
+
+// goldsrc_standin's Error() calls this on the way out, so nothing is left
+// behind when the wad library gives up part way through.  The writer may
+// still have the .tmp open, and an open file can't be removed.
+void PrintExitStuff() {
+  _fcloseall();
+  RemoveTempFiles();
+}
+
+// Fixed seed so a failure can be reproduced.
+static unsigned int g_nRandom = 0x2545F491;
+
+static unsigned int RandomInt() {
+  g_nRandom ^= g_nRandom << 13;
+  g_nRandom ^= g_nRandom >> 17;
+  g_nRandom ^= g_nRandom << 5;
+  return g_nRandom;
+}
+
+static char (*g_pKeys)[16];
+
+static int CompareKeys(const void *a, const void *b) {
+  int la = *(const int *)a, lb = *(const int *)b;
+  int c = memcmp(g_pKeys[la], g_pKeys[lb], 16);
+  return c ? c : la - lb;
+}
+
+// Names that have to come through untouched: mixed case, all 16 bytes used
+// with no terminator, and old bytes left after the terminator.
+static void MakeName(int i, char name[16]) {
+  static const char *pFixed[] = {"MixedCase_Tex", "abcdefghijklmnop", "{FenceSixteen_16", "lowercase"};
+  static const char chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_{+-~";
+  const int nFixed = sizeof(pFixed) / sizeof(pFixed[0]);
+  memset(name, 0, 16);
+  if (i < nFixed) {
+    memcpy(name, pFixed[i], strlen(pFixed[i]));
+  } else if (i == nFixed) {
+    memcpy(name, "tex\0stale_bytes", 16);
+  } else {
+    int len = 3 + RandomInt() % 13;
+    for (int k = 0; k < len; k++) {
+      name[k] = chars[RandomInt() % (sizeof(chars) - 1)];
+      if (RandomInt() & 1) name[k] = (char)tolower(name[k]);
+    }
+    if (i % 3 == 0) {
+      for (int k = 0; k < 16; k++)
+        if (!name[k]) name[k] = 'a' + k;
+    }
+  }
+}
+
+// The lumps go in back to front with stale bytes between them, the way a wad
+// looks after being edited a few times, and every eighth one repeats an
+// earlier lump's data.
+static void WriteFragmentedWad(const char *pFilename, int count, char (*names)[16], const byte *pData,
+                               int lumpSize) {
+  FILE *fp = SafeOpenWrite((char *)pFilename);
+  byte stale[7] = {0xde, 0xad, 0xbe, 0xef, 0xde, 0xad, 0xbe};
+  lumpinfo_t *pInfo = (lumpinfo_t *)calloc(count, sizeof(lumpinfo_t));
+  int offset = sizeof(wadinfo_t);
+
+  wadinfo_t hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  SafeWrite(fp, &hdr, sizeof(hdr));
+  for (int i = count - 1; i >= 0; i--) {
+    SafeWrite(fp, stale, sizeof(stale));
+    offset += sizeof(stale);
+    pInfo[i].filepos = LittleLong(offset);
+    pInfo[i].size = pInfo[i].disksize = LittleLong(lumpSize);
+    pInfo[i].type = TYP_MIPTEX;
+    pInfo[i].compression = CMP_NONE;
+    memcpy(pInfo[i].name, names[i], sizeof(pInfo[i].name));
+    SafeWrite(fp, (void *)(pData + i * lumpSize), lumpSize);
+    offset += lumpSize;
+  }
+  SafeWrite(fp, pInfo, count * sizeof(lumpinfo_t));
+
+  memcpy(hdr.identification, "WAD3", 4);
+  hdr.numlumps = LittleLong(count);
+  hdr.infotableofs = LittleLong(offset);
+  fseek(fp, 0, SEEK_SET);
+  SafeWrite(fp, &hdr, sizeof(hdr));
+  fclose(fp);
+  free(pInfo);
+}
+
+// Repacks a fresh copy of the wad and compares it lump for lump against what
+// went in.  pOrder is where each original lump should end up.
+static bool CheckRepack(int count, char (*names)[16], const byte *pData, int lumpSize,
+                        bool bSort, const int *pOrder) {
+  const char *pMode = bSort ? "sorted by name" : "directory order";
+  WriteFragmentedWad(g_pTempWad, count, names, pData, lumpSize);
+  if (!RepackWad(g_pTempWad, bSort)) {
+    printf("FAILED %s: %s couldn't be repacked\n", pMode, g_pTempWad);
+    return false;
+  }
+
+  WadReader wad;
+  if (!wad.Open(g_pTempWad)) {
+    printf("FAILED %s: %s\n", pMode, wad.GetError());
+    return false;
+  }
+  if (wad.NumLumps() != count) {
+    printf("FAILED %s: %d lumps came back as %d\n", pMode, count, wad.NumLumps());
+    return false;
+  }
+
+  int nFailed = 0;
+  for (int i = 0; i < count && nFailed < 10; i++) {
+    int original = pOrder[i];
+    const lumpinfo_t *pInfo = wad.LumpInfo(i);
+    const char *pProblem = NULL;
+    if (memcmp(pInfo->name, names[original], 16)) {
+      pProblem = "was renamed";
+    } else if (wad.LumpLength(i) != lumpSize || pInfo->type != TYP_MIPTEX) {
+      pProblem = "changed size or type";
+    } else {
+      byte *pLump = (byte *)wad.LoadLumpNum(i);
+      if (memcmp(pLump, pData + original * lumpSize, lumpSize)) pProblem = "has different data";
+      free(pLump);
+    }
+    if (!pProblem && wad.CheckNumForName(names[original]) == -1) pProblem = "can't be found by name";
+    if (pProblem) {
+      printf("FAILED %s: lump %d (%.16s) %s\n", pMode, original, names[original], pProblem);
+      nFailed++;
+    }
+  }
+  wad.Close();
+  if (!nFailed) printf("ok     %s\n", pMode);
+  return !nFailed;
+}
+
+int main(int argc, char **argv) {
+  const int count = 4000;
+  const int lumpSize = 256;
+
+  char (*names)[16] = (char (*)[16])malloc(count * 16);
+  byte *pData = (byte *)malloc(count * lumpSize);
+  for (int i = 0; i < count; i++) {
+    MakeName(i, names[i]);
+    if (i >= 8 && i % 8 == 0) {
+      memcpy(pData + i * lumpSize, pData + (i / 2) * lumpSize, lumpSize);
+    } else {
+      for (int k = 0; k < lumpSize; k++) pData[i * lumpSize + k] = (byte)RandomInt();
+    }
+  }
+
+  // Sorted, they go by cleaned up name, repeated names in their old order.
+  int *pInOrder = (int *)malloc(count * sizeof(int));
+  int *pSorted = (int *)malloc(count * sizeof(int));
+  g_pKeys = (char (*)[16])malloc(count * 16);
+  for (int i = 0; i < count; i++) {
+    pInOrder[i] = pSorted[i] = i;
+    CleanupName(names[i], g_pKeys[i]);
+  }
+  qsort(pSorted, count, sizeof(int), CompareKeys);
+
+  int nFailed = 0;
+  nFailed += !CheckRepack(count, names, pData, lumpSize, false, pInOrder);
+  nFailed += !CheckRepack(count, names, pData, lumpSize, true, pSorted);
+  RemoveTempFiles();
+
+  free(g_pKeys);
+  free(pSorted);
+  free(pInOrder);
+  free(pData);
+  free(names);
+  return nFailed ? 1 : 0;
+}
@@ -0,0 +1,4 @@
+set CC=g++
+set OUTPUT=repacktest.exe
+%CC% repacktest.cpp wadlib.cpp wadrepack.cpp lzsslib.cpp threads.cpp goldsrc_standin.cpp -lpsapi -o %OUTPUT%
+%OUTPUT%
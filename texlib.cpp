@@ -0,0 +1,991 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: 
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+
+// texlib.c
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include "goldsrc_standin.h"
+#include "arena.h"
+#include "texlib.h"
+
+// x86 builds can always try AVX2, on its own functions, once the CPU has
+// been checked.  SSE2 is only used when the whole build may assume it.
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define TEXLIB_X86
+#define TEXLIB_AVX2		__attribute__ ((target ("avx2")))
+#include <immintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#define TEXLIB_X86
+#define TEXLIB_AVX2
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+#if defined(TEXLIB_X86) && (defined(__SSE2__) || defined(_M_X64) || _M_IX86_FP >= 2)
+#define TEXLIB_SSE2
+#endif
+
+
+/*
+============================================================================
+
+						SIMD SUPPORT
+
+============================================================================
+*/
+
+static int	simdlevel = -1;		// not worked out yet
+
+/*
+==================
+CPUSIMDLevel
+
+AVX2 needs the OS to save the YMM registers as well as the CPU to have it,
+which GCC's check covers and MSVC's has to ask XGETBV about.
+==================
+*/
+static int CPUSIMDLevel (void)
+{
+#if defined(TEXLIB_X86) && defined(__GNUC__)
+	__builtin_cpu_init ();
+	if (__builtin_cpu_supports ("avx2"))
+		return TEX_SIMD_AVX2;
+	if (__builtin_cpu_supports ("sse4.1"))
+		return TEX_SIMD_SSE41;
+	if (__builtin_cpu_supports ("sse2"))
+		return TEX_SIMD_SSE2;
+#elif defined(TEXLIB_X86) && defined(_MSC_VER)
+	int		info[4];
+
+	__cpuid (info, 0);
+	if (info[0] >= 7)
+	{
+		__cpuid (info, 1);
+		if ((info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv (0) & 6) == 6)
+		{
+			__cpuidex (info, 7, 0);
+			if (info[1] & (1 << 5))
+				return TEX_SIMD_AVX2;
+		}
+	}
+	__cpuid (info, 1);
+	if (info[2] & (1 << 19))
+		return TEX_SIMD_SSE41;
+	if (info[3] & (1 << 26))
+		return TEX_SIMD_SSE2;
+#endif
+	return TEX_SIMD_NONE;
+}
+
+int Tex_SIMDLevel (void)
+{
+	if (simdlevel == -1)
+		simdlevel = CPUSIMDLevel ();
+	return simdlevel;
+}
+
+void Tex_SetSIMDLevel (int level)
+{
+	int		best;
+
+	best = CPUSIMDLevel ();
+	simdlevel = level < best ? level : best;
+}
+
+
+/*
+============================================================================
+
+						PALETTE EXPANSION
+
+============================================================================
+*/
+
+/*
+==================
+BuildPaletteTable
+
+Every index's finished texel, so expanding a row is one load per texel: the
+palette back to front with alpha 255, and index 255 see-through.  A decal's
+texels are all entry 255's colour with the index as alpha.
+==================
+*/
+static void BuildPaletteTable (const byte *palette, qboolean decal, RGBAColor table[256])
+{
+	int		i;
+	const byte	*color;
+
+	for (i = 0 ; i < 256 ; i++)
+	{
+		color = decal ? &palette[255 * 3] : &palette[i * 3];
+		table[i].r = color[2];
+		table[i].g = color[1];
+		table[i].b = color[0];
+		table[i].a = decal ? i : 255;
+	}
+	if (!decal)
+		table[255].a = 0;
+}
+
+static void ExpandRow (const RGBAColor *table, const byte *in, int count, RGBAColor *out)
+{
+	int		i;
+
+	for (i = 0 ; i < count ; i++)
+		out[i] = table[in[i]];
+}
+
+#ifdef TEXLIB_SSE2
+// SSE2 has no gather, so four loads go out as one store
+static void ExpandRowSSE2 (const RGBAColor *table, const byte *in, int count, RGBAColor *out)
+{
+	const int	*lut;
+	int			i;
+
+	lut = (const int *)table;
+	for (i = 0 ; i + 4 <= count ; i += 4)
+	{
+		_mm_storeu_si128 ((__m128i *)(out + i),
+			_mm_setr_epi32 (lut[in[i]], lut[in[i + 1]], lut[in[i + 2]], lut[in[i + 3]]));
+	}
+	ExpandRow (table, in + i, count - i, out + i);
+}
+#endif
+
+#ifdef TEXLIB_X86
+TEXLIB_AVX2 static void ExpandRowAVX2 (const RGBAColor *table, const byte *in, int count, RGBAColor *out)
+{
+	const int	*lut;
+	__m256i		indices;
+	int			i;
+
+	lut = (const int *)table;
+	for (i = 0 ; i + 8 <= count ; i += 8)
+	{
+		indices = _mm256_cvtepu8_epi32 (_mm_loadl_epi64 ((const __m128i *)(in + i)));
+		_mm256_storeu_si256 ((__m256i *)(out + i), _mm256_i32gather_epi32 (lut, indices, 4));
+	}
+	ExpandRow (table, in + i, count - i, out + i);
+}
+#endif
+
+
+/*
+==================
+ConvertToRGBAUpsideDown
+==================
+*/
+RGBAColor *ConvertToRGBAUpsideDown (arena_t *arena, const byte *bits, int width, int height,
+									const byte *palette, qboolean decal, bool *alphatest)
+{
+	RGBAColor	table[256];
+	RGBAColor	*out;
+	const byte	*line;
+	int			y;
+	void		(*expand) (const RGBAColor *table, const byte *in, int count, RGBAColor *out);
+
+	out = (RGBAColor *)Arena_Alloc (arena, sizeof(RGBAColor) * width * height);
+	BuildPaletteTable (palette, decal, table);
+
+	expand = ExpandRow;
+#ifdef TEXLIB_SSE2
+	if (Tex_SIMDLevel () >= TEX_SIMD_SSE2)
+		expand = ExpandRowSSE2;
+#endif
+#ifdef TEXLIB_X86
+	if (Tex_SIMDLevel () >= TEX_SIMD_AVX2)
+		expand = ExpandRowAVX2;
+#endif
+
+	// write the lines upside down
+	for (y = 0 ; y < height ; y++)
+	{
+		line = &bits[(height - y - 1) * width];
+		expand (table, line, width, &out[y * width]);
+		if (!decal && !*alphatest && memchr (line, 255, width))
+			*alphatest = true;
+	}
+
+	return out;
+}
+
+
+/*
+==================
+FloodSolidPixels
+
+Fills outwards from the solid texels one ring at a time, as a breadth first
+search, so each texel is visited once however far it is from a solid one.
+A ring's texels only average texels filled before it, which is what a whole
+image pass at a time used to do, so the colours come out the same.  The
+state map has a border of edge cells so the neighbours need no bounds
+checks, and the next ring is queued while the current one is averaged.
+==================
+*/
+#define	FLOOD_EMPTY		0
+#define	FLOOD_QUEUED	1
+#define	FLOOD_FILLED	2
+#define	FLOOD_EDGE		3
+
+// (total * floodreciprocal[n]) >> 16 is total / n for totals up to 8 * 255
+static const int	floodreciprocal[9] = {0, 65537, 32769, 21846, 16385, 13108, 10923, 9363, 8193};
+
+void FloodSolidPixels (arena_t *arena, RGBAColor *texels, int width, int height)
+{
+	byte		*state;
+	int			*queue;		// pairs of state cell and texel
+	int			celloffset[8], texeloffset[8];
+	int			pitch, start, end, count, i, k, x, y, cell, texel, scale;
+	int			neighbors, total[3];
+	RGBAColor	*neighbor;
+
+	pitch = width + 2;
+	state = (byte *)Arena_Alloc (arena, pitch * (height + 2));
+	queue = (int *)Arena_Alloc (arena, sizeof(int) * 2 * width * height);
+	memset (state, FLOOD_EDGE, pitch * (height + 2));
+
+	for (k = 0, y = -1 ; y <= 1 ; y++)
+	{
+		for (x = -1 ; x <= 1 ; x++)
+		{
+			if (!x && !y)
+				continue;
+			celloffset[k] = y * pitch + x;
+			texeloffset[k] = y * width + x;
+			k++;
+		}
+	}
+
+	for (y = 0 ; y < height ; y++)
+		for (x = 0 ; x < width ; x++)
+			state[(y + 1) * pitch + x + 1] = texels[y * width + x].a ? FLOOD_FILLED : FLOOD_EMPTY;
+
+	// the first ring is the transparent texels touching a solid one
+	end = 0;
+	for (y = 0 ; y < height ; y++)
+	{
+		for (x = 0 ; x < width ; x++)
+		{
+			cell = (y + 1) * pitch + x + 1;
+			if (state[cell] != FLOOD_EMPTY)
+				continue;
+			for (k = 0 ; k < 8 ; k++)
+				if (state[cell + celloffset[k]] == FLOOD_FILLED)
+					break;
+			if (k == 8)
+				continue;
+			state[cell] = FLOOD_QUEUED;
+			queue[end * 2] = cell;
+			queue[end * 2 + 1] = y * width + x;
+			end++;
+		}
+	}
+
+	for (start = 0 ; start < end ; start = end, end = count)
+	{
+		// blend each texel's filled neighbours, and queue its empty ones
+		count = end;
+		for (i = start ; i < end ; i++)
+		{
+			cell = queue[i * 2];
+			texel = queue[i * 2 + 1];
+			neighbors = 0;
+			total[0] = total[1] = total[2] = 0;
+			for (k = 0 ; k < 8 ; k++)
+			{
+				switch (state[cell + celloffset[k]])
+				{
+				case FLOOD_FILLED:
+					neighbor = &texels[texel + texeloffset[k]];
+					neighbors++;
+					total[0] += neighbor->r;
+					total[1] += neighbor->g;
+					total[2] += neighbor->b;
+					break;
+				case FLOOD_EMPTY:
+					state[cell + celloffset[k]] = FLOOD_QUEUED;
+					queue[count * 2] = cell + celloffset[k];
+					queue[count * 2 + 1] = texel + texeloffset[k];
+					count++;
+					break;
+				}
+			}
+			scale = floodreciprocal[neighbors];
+			texels[texel].r = (byte)((total[0] * scale) >> 16);
+			texels[texel].g = (byte)((total[1] * scale) >> 16);
+			texels[texel].b = (byte)((total[2] * scale) >> 16);
+		}
+
+		// only now can this ring be averaged into the next
+		for (i = start ; i < end ; i++)
+			state[queue[i * 2]] = FLOOD_FILLED;
+	}
+}
+
+
+/*
+============================================================================
+
+						RESAMPLING
+
+============================================================================
+*/
+
+#define	PI		3.14159265358979323846
+
+// the distance from a texel's centre at which each filter falls to nothing
+static const float	filtersupport[] = {0.5f, 1.0f, 3.0f};
+
+static float FilterWeight (int filter, float x)
+{
+	double	px;
+
+	if (x < 0)
+		x = -x;
+	switch (filter)
+	{
+	case RESAMPLE_BOX:
+		return x < 0.5f ? 1.0f : 0.0f;
+	case RESAMPLE_BILINEAR:
+		return x < 1.0f ? 1.0f - x : 0.0f;
+	default:
+		if (x == 0)
+			return 1.0f;
+		if (x >= 3.0f)
+			return 0.0f;
+		px = PI * x;
+		return (float)(3.0 * sin (px) * sin (px / 3.0) / (px * px));
+	}
+}
+
+/*
+==================
+BuildTaps
+
+The source texels, and their weights, that make up each texel along one
+axis.  Every destination texel gets the same number of taps, the unused
+ones weighted zero, so the loops over them don't vary.  Shrinking widens
+the filter to cover every source texel.  Texels off the edge of the image
+come from the far side if it wraps, and from the edge if not.
+==================
+*/
+static int BuildTaps (arena_t *arena, int size, int newsize, int filter, qboolean wrap,
+					  int **indices, float **weights)
+{
+	float	scale, filterscale, support, center, total;
+	int		taps, i, j, first, index;
+	float	*w;
+	int		*in;
+
+	scale = (float)newsize / size;
+	filterscale = scale < 1 ? scale : 1;
+	support = filtersupport[filter] / filterscale;
+	taps = (int)ceil (support * 2) + 1;
+
+	*indices = in = (int *)Arena_Alloc (arena, sizeof(int) * newsize * taps);
+	*weights = w = (float *)Arena_Alloc (arena, sizeof(float) * newsize * taps);
+
+	for (i = 0 ; i < newsize ; i++, in += taps, w += taps)
+	{
+		center = (i + 0.5f) / scale - 0.5f;
+		first = (int)ceil (center - support);
+		total = 0;
+		for (j = 0 ; j < taps ; j++)
+		{
+			w[j] = FilterWeight (filter, (first + j - center) * filterscale);
+			total += w[j];
+
+			index = first + j;
+			if (wrap)
+				index = ((index % size) + size) % size;
+			else if (index < 0)
+				index = 0;
+			else if (index >= size)
+				index = size - 1;
+			in[j] = index;
+		}
+
+		if (total == 0)
+		{
+			// a box can fall between texels; take the nearest
+			index = (int)floor (center + 0.5f) - first;
+			w[index < 0 ? 0 : index >= taps ? taps - 1 : index] = total = 1;
+		}
+		for (j = 0 ; j < taps ; j++)
+			w[j] /= total;
+	}
+
+	return taps;
+}
+
+// each texel along a row from its taps, as floats
+static void FilterRow (const RGBAColor *in, int newwidth, int taps, const int *indices,
+					   const float *weights, float *out)
+{
+	int			x, k;
+	float		acc[4];
+	const byte	*texel;
+
+	for (x = 0 ; x < newwidth ; x++, indices += taps, weights += taps, out += 4)
+	{
+		acc[0] = acc[1] = acc[2] = acc[3] = 0;
+		for (k = 0 ; k < taps ; k++)
+		{
+			texel = (const byte *)&in[indices[k]];
+			acc[0] = acc[0] + weights[k] * texel[0];
+			acc[1] = acc[1] + weights[k] * texel[1];
+			acc[2] = acc[2] + weights[k] * texel[2];
+			acc[3] = acc[3] + weights[k] * texel[3];
+		}
+		out[0] = acc[0];
+		out[1] = acc[1];
+		out[2] = acc[2];
+		out[3] = acc[3];
+	}
+}
+
+// one row from the filtered rows its taps pick
+static void FilterColumns (float **rows, const float *weights, int taps, int count, float *out)
+{
+	int		i, k;
+
+	for (i = 0 ; i < count ; i++)
+		out[i] = 0;
+	for (k = 0 ; k < taps ; k++)
+		for (i = 0 ; i < count ; i++)
+			out[i] = out[i] + weights[k] * rows[k][i];
+}
+
+static void StoreRow (const float *in, int count, byte *out)
+{
+	int		i;
+	float	f;
+
+	for (i = 0 ; i < count ; i++)
+	{
+		f = in[i] < 0 ? 0 : in[i] > 255 ? 255 : in[i];
+		out[i] = (byte)(int)(f + 0.5f);
+	}
+}
+
+#ifdef TEXLIB_SSE2
+// a texel's four channels to a register each tap, so a texel is one multiply
+// and add per tap
+static void FilterRowSSE2 (const RGBAColor *in, int newwidth, int taps, const int *indices,
+						   const float *weights, float *out)
+{
+	int			x, k;
+	__m128		acc;
+	__m128i		zero, texel;
+
+	zero = _mm_setzero_si128 ();
+	for (x = 0 ; x < newwidth ; x++, indices += taps, weights += taps, out += 4)
+	{
+		acc = _mm_setzero_ps ();
+		for (k = 0 ; k < taps ; k++)
+		{
+			texel = _mm_cvtsi32_si128 (*(const int *)&in[indices[k]]);
+			texel = _mm_unpacklo_epi16 (_mm_unpacklo_epi8 (texel, zero), zero);
+			acc = _mm_add_ps (acc, _mm_mul_ps (_mm_set1_ps (weights[k]), _mm_cvtepi32_ps (texel)));
+		}
+		_mm_storeu_ps (out, acc);
+	}
+}
+
+static void FilterColumnsSSE2 (float **rows, const float *weights, int taps, int count, float *out)
+{
+	int		i, k;
+	__m128	w;
+
+	// count is a multiple of four, a texel's channels
+	for (i = 0 ; i < count ; i += 4)
+		_mm_storeu_ps (out + i, _mm_setzero_ps ());
+	for (k = 0 ; k < taps ; k++)
+	{
+		w = _mm_set1_ps (weights[k]);
+		for (i = 0 ; i < count ; i += 4)
+			_mm_storeu_ps (out + i, _mm_add_ps (_mm_loadu_ps (out + i),
+				_mm_mul_ps (w, _mm_loadu_ps (rows[k] + i))));
+	}
+}
+
+static void StoreRowSSE2 (const float *in, int count, byte *out)
+{
+	int		i;
+	__m128	lo, hi, half, limit;
+	__m128i	pixels;
+
+	half = _mm_set1_ps (0.5f);
+	limit = _mm_set1_ps (255.0f);
+	for (i = 0 ; i + 8 <= count ; i += 8)
+	{
+		lo = _mm_min_ps (_mm_max_ps (_mm_loadu_ps (in + i), _mm_setzero_ps ()), limit);
+		hi = _mm_min_ps (_mm_max_ps (_mm_loadu_ps (in + i + 4), _mm_setzero_ps ()), limit);
+		pixels = _mm_packs_epi32 (_mm_cvttps_epi32 (_mm_add_ps (lo, half)),
+								  _mm_cvttps_epi32 (_mm_add_ps (hi, half)));
+		_mm_storel_epi64 ((__m128i *)(out + i), _mm_packus_epi16 (pixels, pixels));
+	}
+	StoreRow (in + i, count - i, out + i);
+}
+#endif
+
+#ifdef TEXLIB_X86
+TEXLIB_AVX2 static void FilterColumnsAVX2 (float **rows, const float *weights, int taps, int count, float *out)
+{
+	int		i, k;
+	__m256	w;
+
+	for (i = 0 ; i + 8 <= count ; i += 8)
+		_mm256_storeu_ps (out + i, _mm256_setzero_ps ());
+	for ( ; i < count ; i++)
+		out[i] = 0;
+	for (k = 0 ; k < taps ; k++)
+	{
+		w = _mm256_set1_ps (weights[k]);
+		for (i = 0 ; i + 8 <= count ; i += 8)
+			_mm256_storeu_ps (out + i, _mm256_add_ps (_mm256_loadu_ps (out + i),
+				_mm256_mul_ps (w, _mm256_loadu_ps (rows[k] + i))));
+		for ( ; i < count ; i++)
+			out[i] = out[i] + weights[k] * rows[k][i];
+	}
+}
+#endif
+
+static int CountSolid (const RGBAColor *rgb, int count)
+{
+	int		i, solid;
+
+	solid = 0;
+	for (i = 0 ; i < count ; i++)
+		if (rgb[i].a >= 128)
+			solid++;
+	return solid;
+}
+
+/*
+==================
+CutAlpha
+
+Cuts a filtered alpha back to 0 or 255 at the level that leaves share of
+the texels solid, so alpha testing neither eats into nor grows the shapes
+it cuts.
+==================
+*/
+static void CutAlpha (RGBAColor *rgb, int count, double share)
+{
+	int		histogram[256];
+	int		i, solid, target, threshold;
+
+	target = (int)(share * count + 0.5);
+
+	memset (histogram, 0, sizeof(histogram));
+	for (i = 0 ; i < count ; i++)
+		histogram[rgb[i].a]++;
+
+	// the lowest threshold that doesn't go over, or the one just past it
+	// if that's closer
+	solid = 0;
+	for (threshold = 256 ; threshold > 0 ; threshold--)
+	{
+		if (solid + histogram[threshold - 1] > target)
+		{
+			if (solid + histogram[threshold - 1] - target < target - solid)
+				threshold--;
+			break;
+		}
+		solid += histogram[threshold - 1];
+	}
+
+	for (i = 0 ; i < count ; i++)
+		rgb[i].a = rgb[i].a >= threshold ? 255 : 0;
+}
+
+/*
+==================
+ResampleImage
+
+Separable: each source row is filtered across to the new width, as floats,
+then each new row is filtered down from those.
+==================
+*/
+RGBAColor *ResampleImage (arena_t *arena, const RGBAColor *rgb, int width, int height,
+						  int newwidth, int newheight, int filter, qboolean wrap, qboolean alphatest)
+{
+	RGBAColor	*out;
+	float		*across, *row, *xweights, *yweights;
+	float		**rows;
+	int			*xindices, *yindices;
+	int			xtaps, ytaps, y, k, level;
+	void		(*filterrow) (const RGBAColor *in, int newwidth, int taps, const int *indices,
+							  const float *weights, float *out);
+	void		(*filtercolumns) (float **rows, const float *weights, int taps, int count, float *out);
+	void		(*storerow) (const float *in, int count, byte *out);
+
+	xtaps = BuildTaps (arena, width, newwidth, filter, wrap, &xindices, &xweights);
+	ytaps = BuildTaps (arena, height, newheight, filter, wrap, &yindices, &yweights);
+
+	out = (RGBAColor *)Arena_Alloc (arena, sizeof(RGBAColor) * newwidth * newheight);
+	across = (float *)Arena_Alloc (arena, sizeof(float) * 4 * newwidth * height);
+	row = (float *)Arena_Alloc (arena, sizeof(float) * 4 * newwidth);
+	rows = (float **)Arena_Alloc (arena, sizeof(float *) * ytaps);
+
+	level = Tex_SIMDLevel ();
+	filterrow = FilterRow;
+	filtercolumns = FilterColumns;
+	storerow = StoreRow;
+#ifdef TEXLIB_SSE2
+	if (level >= TEX_SIMD_SSE2)
+	{
+		filterrow = FilterRowSSE2;
+		filtercolumns = FilterColumnsSSE2;
+		storerow = StoreRowSSE2;
+	}
+#endif
+#ifdef TEXLIB_X86
+	if (level >= TEX_SIMD_AVX2)
+		filtercolumns = FilterColumnsAVX2;
+#endif
+
+	for (y = 0 ; y < height ; y++)
+		filterrow (&rgb[y * width], newwidth, xtaps, xindices, xweights, &across[y * 4 * newwidth]);
+
+	for (y = 0 ; y < newheight ; y++)
+	{
+		for (k = 0 ; k < ytaps ; k++)
+			rows[k] = &across[yindices[y * ytaps + k] * 4 * newwidth];
+		filtercolumns (rows, &yweights[y * ytaps], ytaps, 4 * newwidth, row);
+		storerow (row, 4 * newwidth, (byte *)&out[y * newwidth]);
+	}
+
+	if (alphatest)
+		CutAlpha (out, newwidth * newheight, (double)CountSolid (rgb, width * height) / (width * height));
+	return out;
+}
+
+
+/*
+============================================================================
+
+						MIP LEVELS
+
+============================================================================
+*/
+
+#define	MIP_BAND	32		// rows of the image made into every level at once
+
+static unsigned short	srgbtolinear[256];		// 14 bits, so four still add up in 16
+static byte				lineartosrgb[1 << 14];
+static qboolean			srgbinit;
+
+static void InitSRGBTables (void)
+{
+	int		i;
+	double	f;
+
+	// the race to fill them in writes the same values
+	if (srgbinit)
+		return;
+	for (i = 0 ; i < 256 ; i++)
+	{
+		f = i / 255.0;
+		f = f <= 0.04045 ? f / 12.92 : pow ((f + 0.055) / 1.055, 2.4);
+		srgbtolinear[i] = (unsigned short)(f * 16383 + 0.5);
+	}
+	for (i = 0 ; i < 1 << 14 ; i++)
+	{
+		f = i / 16383.0;
+		f = f <= 0.0031308 ? f * 12.92 : 1.055 * pow (f, 1 / 2.4) - 0.055;
+		lineartosrgb[i] = (byte)(f * 255 + 0.5);
+	}
+	srgbinit = true;
+}
+
+/*
+==================
+HalveRow
+
+Each texel of a new row is the rounded average of a 2x2 square from the two
+rows above it.  With pair 0 the old row is a single texel wide, so both
+sides of the square are that texel.  The sRGB versions work on the colour
+in 14 bit linear light, with alpha left as it is.
+==================
+*/
+static void HalveRow (const byte *row0, const byte *row1, int count, int pair, byte *out)
+{
+	int		x, c;
+
+	for (x = 0 ; x < count ; x++, row0 += 8, row1 += 8, out += 4)
+		for (c = 0 ; c < 4 ; c++)
+			out[c] = (row0[c] + row0[c + pair * 4] + row1[c] + row1[c + pair * 4] + 2) >> 2;
+}
+
+static void HalveLinearRow (const unsigned short *row0, const unsigned short *row1, int count,
+							int pair, unsigned short *out)
+{
+	int		x, c;
+
+	for (x = 0 ; x < count ; x++, row0 += 8, row1 += 8, out += 4)
+		for (c = 0 ; c < 4 ; c++)
+			out[c] = (row0[c] + row0[c + pair * 4] + row1[c] + row1[c + pair * 4] + 2) >> 2;
+}
+
+#ifdef TEXLIB_SSE2
+static void HalveRowSSE2 (const byte *row0, const byte *row1, int count, int pair, byte *out)
+{
+	int		x;
+	__m128i	zero, two, a, b, c, d, s0, s1, s2, s3;
+
+	zero = _mm_setzero_si128 ();
+	two = _mm_set1_epi16 (2);
+	for (x = 0 ; pair && x + 4 <= count ; x += 4)
+	{
+		a = _mm_loadu_si128 ((const __m128i *)(row0 + x * 8));
+		b = _mm_loadu_si128 ((const __m128i *)(row0 + x * 8 + 16));
+		c = _mm_loadu_si128 ((const __m128i *)(row1 + x * 8));
+		d = _mm_loadu_si128 ((const __m128i *)(row1 + x * 8 + 16));
+
+		// the rows added, two old texels to a register
+		s0 = _mm_add_epi16 (_mm_unpacklo_epi8 (a, zero), _mm_unpacklo_epi8 (c, zero));
+		s1 = _mm_add_epi16 (_mm_unpackhi_epi8 (a, zero), _mm_unpackhi_epi8 (c, zero));
+		s2 = _mm_add_epi16 (_mm_unpacklo_epi8 (b, zero), _mm_unpacklo_epi8 (d, zero));
+		s3 = _mm_add_epi16 (_mm_unpackhi_epi8 (b, zero), _mm_unpackhi_epi8 (d, zero));
+
+		// and each register's two texels added into one
+		s0 = _mm_add_epi16 (s0, _mm_srli_si128 (s0, 8));
+		s1 = _mm_add_epi16 (s1, _mm_srli_si128 (s1, 8));
+		s2 = _mm_add_epi16 (s2, _mm_srli_si128 (s2, 8));
+		s3 = _mm_add_epi16 (s3, _mm_srli_si128 (s3, 8));
+
+		s0 = _mm_srli_epi16 (_mm_add_epi16 (_mm_unpacklo_epi64 (s0, s1), two), 2);
+		s2 = _mm_srli_epi16 (_mm_add_epi16 (_mm_unpacklo_epi64 (s2, s3), two), 2);
+		_mm_storeu_si128 ((__m128i *)(out + x * 4), _mm_packus_epi16 (s0, s2));
+	}
+	HalveRow (row0 + x * 8, row1 + x * 8, count - x, pair, out + x * 4);
+}
+
+static void HalveLinearRowSSE2 (const unsigned short *row0, const unsigned short *row1, int count,
+								int pair, unsigned short *out)
+{
+	int		x;
+	__m128i	two, s0, s1;
+
+	two = _mm_set1_epi16 (2);
+	for (x = 0 ; pair && x + 2 <= count ; x += 2)
+	{
+		// 14 bit values, so four of them don't overflow
+		s0 = _mm_add_epi16 (_mm_loadu_si128 ((const __m128i *)(row0 + x * 8)),
+							_mm_loadu_si128 ((const __m128i *)(row1 + x * 8)));
+		s1 = _mm_add_epi16 (_mm_loadu_si128 ((const __m128i *)(row0 + x * 8 + 8)),
+							_mm_loadu_si128 ((const __m128i *)(row1 + x * 8 + 8)));
+		s0 = _mm_add_epi16 (s0, _mm_srli_si128 (s0, 8));
+		s1 = _mm_add_epi16 (s1, _mm_srli_si128 (s1, 8));
+		s0 = _mm_srli_epi16 (_mm_add_epi16 (_mm_unpacklo_epi64 (s0, s1), two), 2);
+		_mm_storeu_si128 ((__m128i *)(out + x * 4), s0);
+	}
+	HalveLinearRow (row0 + x * 8, row1 + x * 8, count - x, pair, out + x * 4);
+}
+#endif
+
+static void DecodeSRGBRow (const byte *in, int count, unsigned short *out)
+{
+	int		i;
+
+	for (i = 0 ; i < count ; i++, in += 4, out += 4)
+	{
+		out[0] = srgbtolinear[in[0]];
+		out[1] = srgbtolinear[in[1]];
+		out[2] = srgbtolinear[in[2]];
+		out[3] = in[3];
+	}
+}
+
+static void EncodeSRGBRow (const unsigned short *in, int count, byte *out)
+{
+	int		i;
+
+	for (i = 0 ; i < count ; i++, in += 4, out += 4)
+	{
+		out[0] = lineartosrgb[in[0]];
+		out[1] = lineartosrgb[in[1]];
+		out[2] = lineartosrgb[in[2]];
+		out[3] = (byte)in[3];
+	}
+}
+
+typedef struct
+{
+	qboolean		srgb;
+	void			(*halve) (const byte *row0, const byte *row1, int count, int pair, byte *out);
+	void			(*halvelinear) (const unsigned short *row0, const unsigned short *row1, int count,
+									int pair, unsigned short *out);
+	unsigned short	*linear[3];		// the two old rows and the new one, for sRGB
+} mipwork_t;
+
+// count new texels from two old rows
+static void MakeMipRow (mipwork_t *work, const RGBAColor *row0, const RGBAColor *row1, int count,
+						int pair, RGBAColor *out)
+{
+	if (!work->srgb)
+	{
+		work->halve ((const byte *)row0, (const byte *)row1, count, pair, (byte *)out);
+		return;
+	}
+	DecodeSRGBRow ((const byte *)row0, count * (1 + pair), work->linear[0]);
+	if (row1 != row0)
+		DecodeSRGBRow ((const byte *)row1, count * (1 + pair), work->linear[1]);
+	work->halvelinear (work->linear[0], row1 != row0 ? work->linear[1] : work->linear[0], count,
+					   pair, work->linear[2]);
+	EncodeSRGBRow (work->linear[2], count, (byte *)out);
+}
+
+/*
+==================
+BuildMipChain
+
+Tall images are done a band of rows at a time, each band taken down to a
+single row while it's still in the cache, then the levels smaller than a
+band are made whole.  Full width bands keep the reads in order for the
+prefetcher, where square tiles would hop between rows.  Every texel comes
+from the same four either way.  Alpha tested levels are made with the
+averaged alpha, then cut, so the bands don't need to know about the rest
+of their level.
+==================
+*/
+int BuildMipChain (arena_t *arena, const RGBAColor *rgb, int width, int height, int flags,
+				   const RGBAColor *mips[MAX_MIP_LEVELS], int mipwidth[MAX_MIP_LEVELS],
+				   int mipheight[MAX_MIP_LEVELS])
+{
+	mipwork_t	work;
+	RGBAColor	*level;
+	const RGBAColor	*in;
+	int			nummips, i, k, y, band, rows, level1, inwidth, outwidth;
+	double		share;
+
+	if ((width & (width - 1)) || (height & (height - 1)) || width < 1 || height < 1)
+		Error ("BuildMipChain: image is %dx%d, not a power of two", width, height);
+
+	mips[0] = rgb;
+	mipwidth[0] = width;
+	mipheight[0] = height;
+	for (nummips = 1 ; mipwidth[nummips - 1] > 1 || mipheight[nummips - 1] > 1 ; nummips++)
+	{
+		if (nummips == MAX_MIP_LEVELS)
+			Error ("BuildMipChain: image is %dx%d, too big", width, height);
+		mipwidth[nummips] = mipwidth[nummips - 1] > 1 ? mipwidth[nummips - 1] / 2 : 1;
+		mipheight[nummips] = mipheight[nummips - 1] > 1 ? mipheight[nummips - 1] / 2 : 1;
+		mips[nummips] = (RGBAColor *)Arena_Alloc (arena, sizeof(RGBAColor) * mipwidth[nummips] * mipheight[nummips]);
+	}
+
+	work.srgb = (flags & MIP_SRGB) != 0;
+	work.halve = HalveRow;
+	work.halvelinear = HalveLinearRow;
+#ifdef TEXLIB_SSE2
+	if (Tex_SIMDLevel () >= TEX_SIMD_SSE2)
+	{
+		work.halve = HalveRowSSE2;
+		work.halvelinear = HalveLinearRowSSE2;
+	}
+#endif
+	if (work.srgb)
+	{
+		InitSRGBTables ();
+		for (i = 0 ; i < 3 ; i++)
+			work.linear[i] = (unsigned short *)Arena_Alloc (arena, sizeof(unsigned short) * 4 * width);
+	}
+
+	level1 = 1;
+	if (!(flags & MIP_NOBANDS) && height >= MIP_BAND)
+	{
+		for (band = 0 ; band < height ; band += MIP_BAND)
+		{
+			for (k = 0, rows = MIP_BAND ; rows > 1 ; k++, rows >>= 1)
+			{
+				inwidth = mipwidth[k];
+				outwidth = mipwidth[k + 1];
+				in = mips[k] + (band >> k) * inwidth;
+				level = (RGBAColor *)mips[k + 1] + (band >> (k + 1)) * outwidth;
+				for (y = 0 ; y < rows / 2 ; y++)
+					MakeMipRow (&work, in + y * 2 * inwidth, in + (y * 2 + 1) * inwidth, outwidth,
+								inwidth > 1, level + y * outwidth);
+			}
+		}
+		level1 = k + 1;
+	}
+
+	for (i = level1 ; i < nummips ; i++)
+	{
+		in = mips[i - 1];
+		inwidth = mipwidth[i - 1];
+		level = (RGBAColor *)mips[i];
+		for (y = 0 ; y < mipheight[i] ; y++)
+		{
+			MakeMipRow (&work, in + (mipheight[i - 1] > 1 ? y * 2 : 0) * inwidth,
+						in + (mipheight[i - 1] > 1 ? y * 2 + 1 : 0) * inwidth, mipwidth[i],
+						inwidth > 1, level + y * mipwidth[i]);
+		}
+	}
+
+	if (flags & MIP_ALPHATEST)
+	{
+		share = (double)CountSolid (rgb, width * height) / (width * height);
+		for (i = 1 ; i < nummips ; i++)
+			CutAlpha ((RGBAColor *)mips[i], mipwidth[i] * mipheight[i], share);
+	}
+
+	return nummips;
+}
+
+
+/*
+==================
+WriteTGAPixels
+==================
+*/
+void WriteTGAPixels (const RGBAColor *rgb, int count, qboolean alpha, byte *out)
+{
+	int		i;
+
+	if (alpha)
+	{
+		memcpy (out, rgb, sizeof(RGBAColor) * count);
+		return;
+	}
+	for (i = 0 ; i < count ; i++)
+		memcpy (out + i * 3, rgb + i, 3);
+}
+
+
+/*
+==================
+FlipRows
+
+Swaps rows from the ends inwards, through a small buffer so no row has to
+fit in it.
+==================
+*/
+void FlipRows (byte *pixels, int rowbytes, int height)
+{
+	byte	temp[1024];
+	byte	*top, *bottom;
+	int		y, x, chunk;
+
+	for (y = 0 ; y < height / 2 ; y++)
+	{
+		top = pixels + y * rowbytes;
+		bottom = pixels + (height - y - 1) * rowbytes;
+		for (x = 0 ; x < rowbytes ; x += chunk)
+		{
+			chunk = rowbytes - x < (int)sizeof(temp) ? rowbytes - x : (int)sizeof(temp);
+			memcpy (temp, top + x, chunk);
+			memcpy (top + x, bottom + x, chunk);
+			memcpy (bottom + x, temp, chunk);
+		}
+	}
+}
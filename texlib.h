@@ -0,0 +1,90 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: 
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+
+// texlib.h
+
+#ifndef TEXLIB_H
+#define TEXLIB_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+
+//
+// The pixel work of turning a paletted texture into a true colour one.
+// Images are bottom row first, the way a TGA holds them, and BGRA in memory
+// despite RGBAColor's names, because the palette is read back to front.
+// Scratch and results come from the arena, so arena.h goes first.
+//
+
+typedef struct
+{
+	unsigned char	r, g, b, a;
+} RGBAColor;
+
+// The widest instructions the kernels use, here and in dxtlib.  It starts at
+// the best the CPU has, and can be lowered to compare the paths, but never
+// raised past that.  Only dxtlib has anything of its own for SSE4.1.
+#define	TEX_SIMD_NONE	0
+#define	TEX_SIMD_SSE2	1
+#define	TEX_SIMD_SSE41	2
+#define	TEX_SIMD_AVX2	3
+
+int			Tex_SIMDLevel (void);
+void		Tex_SetSIMDLevel (int level);
+
+// Looks each texel up in the palette and flips the rows.  Index 255 is
+// transparent and sets *alphatest, which is otherwise left alone.  A decal
+// is entirely palette entry 255, with the index as its alpha.
+RGBAColor	*ConvertToRGBAUpsideDown (arena_t *arena, const byte *bits, int width, int height,
+									  const byte *palette, qboolean decal, bool *alphatest);
+
+// Spreads the colour of the solid texels into the transparent ones next to
+// them, a ring at a time, until every transparent texel that can be reached
+// has the average of its filled neighbours.  Each texel is visited once,
+// however deep the transparent area is.  Alpha is left as it was, so
+// alpha testing still cuts the same holes, but filtering and resizing don't
+// pull the transparent colour in around their edges.
+void		FloodSolidPixels (arena_t *arena, RGBAColor *texels, int width, int height);
+
+// Resizes with a box, bilinear or Lanczos filter, texel centres lined up.
+// Tiling textures wrap, so their edges are filtered with the opposite ones;
+// otherwise the edge texels carry on outwards.  With alphatest the new alpha
+// is cut to 0 or 255 so the same share of the image stays solid.
+#define	RESAMPLE_BOX		0
+#define	RESAMPLE_BILINEAR	1
+#define	RESAMPLE_LANCZOS3	2
+
+RGBAColor	*ResampleImage (arena_t *arena, const RGBAColor *rgb, int width, int height,
+							int newwidth, int newheight, int filter, qboolean wrap,
+							qboolean alphatest);
+
+// The levels below a power of two image, each half the size of the one
+// above, down to 1x1, a side already at 1 staying at 1.  mips[0] is the
+// image itself and the rest are in the arena.  A 2x2 square becomes a texel
+// as the rounded average of its four, in linear light with MIP_SRGB.  With
+// MIP_ALPHATEST every level keeps the image's share of solid texels, alpha
+// cut to 0 or 255.  MIP_NOBANDS makes the levels one at a time instead of a
+// band of rows at a time, to compare with.
+#define	MIP_SRGB		1
+#define	MIP_ALPHATEST	2
+#define	MIP_NOBANDS		4
+#define	MAX_MIP_LEVELS	16
+
+int			BuildMipChain (arena_t *arena, const RGBAColor *rgb, int width, int height, int flags,
+						   const RGBAColor *mips[MAX_MIP_LEVELS], int mipwidth[MAX_MIP_LEVELS],
+						   int mipheight[MAX_MIP_LEVELS]);
+
+// The pixels of a 24 or 32 bit TGA, which are stored just as they are here.
+void		WriteTGAPixels (const RGBAColor *rgb, int count, qboolean alpha, byte *out);
+
+// Turns an image of rows upside down in place, like a BMP's bottom up rows.
+void		FlipRows (byte *pixels, int rowbytes, int height);
+
+
+#endif // TEXLIB_H
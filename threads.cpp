@@ -0,0 +1,650 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: 
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+
+// threads.c
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#ifndef _WIN32_WINNT
+#define	_WIN32_WINNT	0x0600		// condition variables
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+#include "goldsrc_standin.h"
+#include "threads.h"
+
+#define	MAX_THREADS	256
+
+int		numthreads = -1;
+
+static int		dispatch;
+static int		workcount;
+static int		oldf;
+static qboolean	pacifier;
+static qboolean	threaded;
+static int		extrathreads;		// started by ThreadBegin and not yet ended
+
+static void (*workfunction) (int threadnum);
+static void (*individualfunction) (int threadnum, int work);
+
+#ifdef _WIN32
+static CRITICAL_SECTION		crit;
+static CONDITION_VARIABLE	sharedcond;
+static CONDITION_VARIABLE	lockcond;
+static qboolean				critinit;
+#else
+static pthread_mutex_t	crit = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	sharedcond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t	lockcond = PTHREAD_COND_INITIALIZER;
+#endif
+
+static void InitLock (void)
+{
+#ifdef _WIN32
+	if (!critinit)
+	{
+		InitializeCriticalSection (&crit);
+		InitializeConditionVariable (&sharedcond);
+		InitializeConditionVariable (&lockcond);
+		critinit = true;
+	}
+#endif
+}
+
+
+/*
+=============
+ThreadSetDefault
+
+Uses one thread per logical processor unless -threads set numthreads
+=============
+*/
+void ThreadSetDefault (void)
+{
+	if (numthreads == -1)
+	{
+#ifdef _WIN32
+		SYSTEM_INFO	info;
+
+		GetSystemInfo (&info);
+		numthreads = info.dwNumberOfProcessors;
+#else
+		numthreads = (int)sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+	}
+
+	if (numthreads < 1)
+		numthreads = 1;
+	if (numthreads > MAX_THREADS)
+		numthreads = MAX_THREADS;
+}
+
+
+void ThreadLock (void)
+{
+	if (!threaded && !extrathreads)
+		return;
+#ifdef _WIN32
+	EnterCriticalSection (&crit);
+#else
+	pthread_mutex_lock (&crit);
+#endif
+}
+
+void ThreadUnlock (void)
+{
+	if (!threaded && !extrathreads)
+		return;
+#ifdef _WIN32
+	LeaveCriticalSection (&crit);
+#else
+	pthread_mutex_unlock (&crit);
+#endif
+}
+
+/*
+=============
+ThreadWait
+
+Under ThreadLock.  With no other thread running nothing could ever wake it.
+=============
+*/
+void ThreadWait (void)
+{
+	if (!threaded && !extrathreads)
+		Error ("ThreadWait: no other threads to wait on");
+#ifdef _WIN32
+	SleepConditionVariableCS (&lockcond, &crit, INFINITE);
+#else
+	pthread_cond_wait (&lockcond, &crit);
+#endif
+}
+
+void ThreadWake (void)
+{
+	if (!threaded && !extrathreads)
+		return;
+#ifdef _WIN32
+	WakeAllConditionVariable (&lockcond);
+#else
+	pthread_cond_broadcast (&lockcond);
+#endif
+}
+
+
+/*
+=============
+GetThreadWork
+
+Returns the next work item, or -1 once they have all been handed out
+=============
+*/
+int GetThreadWork (void)
+{
+	int	r;
+	int	f;
+
+	ThreadLock ();
+
+	if (dispatch == workcount)
+	{
+		ThreadUnlock ();
+		return -1;
+	}
+
+	if (pacifier)
+	{
+		f = 10*dispatch / workcount;
+		if (f != oldf)
+		{
+			oldf = f;
+			printf ("%i...", f);
+			fflush (stdout);
+		}
+	}
+
+	r = dispatch;
+	dispatch++;
+	ThreadUnlock ();
+
+	return r;
+}
+
+
+static void ThreadWorkerFunction (int threadnum)
+{
+	int		work;
+
+	while ((work = GetThreadWork ()) != -1)
+		individualfunction (threadnum, work);
+}
+
+
+void RunThreadsOnIndividual (int workcnt, qboolean showpacifier, void (*func)(int threadnum, int work))
+{
+	individualfunction = func;
+	RunThreadsOn (workcnt, showpacifier, ThreadWorkerFunction);
+}
+
+
+/*
+=============
+Work stealing
+
+Each thread owns a run of work items, [next, end).  It takes from the front
+of its own run and steals from the back of someone else's, both under the
+lock, so a steal never hands out an item the owner is about to take.
+=============
+*/
+typedef struct
+{
+	int		next;
+	int		end;
+	double	busytime;
+} workrun_t;
+
+static workrun_t	workruns[MAX_THREADS];
+static int			steals;
+static threadstats_t	laststats;
+static qboolean		stealing;			// inside RunThreadsOnStealing
+static int			workingthreads;		// of its threads, those with items left
+
+static int GetStolenWork (int threadnum)
+{
+	workrun_t	*run, *victim;
+	int			i, left, mostleft, half;
+
+	ThreadLock ();
+	run = &workruns[threadnum];
+	if (run->next == run->end)
+	{
+		victim = NULL;
+		mostleft = 0;
+		for (i = 0 ; i < numthreads ; i++)
+		{
+			left = workruns[i].end - workruns[i].next;
+			if (left > mostleft)
+			{
+				mostleft = left;
+				victim = &workruns[i];
+			}
+		}
+		if (!victim)
+		{
+			ThreadUnlock ();
+			return -1;
+		}
+
+		// the owner is working on the item before next, so a run of one
+		// can be taken whole
+		half = (mostleft + 1) / 2;
+		run->next = victim->end - half;
+		run->end = victim->end;
+		victim->end -= half;
+		steals++;
+	}
+	i = run->next++;
+	ThreadUnlock ();
+
+	return i;
+}
+
+
+/*
+=============
+Shared work
+
+A thread in the middle of one of its items can share out work of its own.
+It's published in a slot, and the owner and any thread that has run out of
+items take its work one at a time under the lock, until the owner sees it
+all done and takes it down again.  Threads with nothing to do sleep on
+sharedcond, which is woken when work is shared, when the last item of some
+is done, and when the last thread runs out of items of its own.
+=============
+*/
+typedef struct
+{
+	void	(*func) (void *param, int work);
+	void	*param;
+	int		next;
+	int		count;
+	int		done;
+} sharedwork_t;
+
+static sharedwork_t	*sharedwork[MAX_THREADS];
+
+static void (*sharedfunction) (void *param, int work);
+static void *sharedparam;
+
+// both under the lock, which the wait gives up while it sleeps
+static void WaitSharedWork (void)
+{
+#ifdef _WIN32
+	SleepConditionVariableCS (&sharedcond, &crit, INFINITE);
+#else
+	pthread_cond_wait (&sharedcond, &crit);
+#endif
+}
+
+static void WakeSharedWork (void)
+{
+#ifdef _WIN32
+	WakeAllConditionVariable (&sharedcond);
+#else
+	pthread_cond_broadcast (&sharedcond);
+#endif
+}
+
+/*
+=============
+HelpSharedWork
+
+Takes shared work until every thread has run out of items of its own, since
+only those can share any more
+=============
+*/
+static void HelpSharedWork (int threadnum)
+{
+	sharedwork_t	*share;
+	int				i, work;
+	double			start;
+
+	ThreadLock ();
+	for (;;)
+	{
+		share = NULL;
+		for (i = 0 ; i < MAX_THREADS ; i++)
+		{
+			if (sharedwork[i] && sharedwork[i]->next < sharedwork[i]->count)
+			{
+				share = sharedwork[i];
+				break;
+			}
+		}
+
+		if (!share)
+		{
+			if (!workingthreads)
+				break;
+			WaitSharedWork ();
+			continue;
+		}
+
+		work = share->next++;
+		ThreadUnlock ();
+
+		start = I_FloatTime ();
+		share->func (share->param, work);
+		workruns[threadnum].busytime += I_FloatTime () - start;
+
+		ThreadLock ();
+		if (++share->done == share->count)
+			WakeSharedWork ();
+	}
+	ThreadUnlock ();
+}
+
+static void SharedWorkerFunction (int, int work)
+{
+	sharedfunction (sharedparam, work);
+}
+
+void ThreadShareWork (int workcnt, void (*func)(void *param, int work), void *param)
+{
+	sharedwork_t	share;
+	int				i, slot;
+
+	if (!stealing)
+	{
+		if (threaded)
+		{
+			for (i = 0 ; i < workcnt ; i++)
+				func (param, i);
+			return;
+		}
+		sharedfunction = func;
+		sharedparam = param;
+		RunThreadsOnIndividual (workcnt, false, SharedWorkerFunction);
+		return;
+	}
+
+	share.func = func;
+	share.param = param;
+	share.next = 0;
+	share.count = workcnt;
+	share.done = 0;
+
+	ThreadLock ();
+	for (slot = 0 ; slot < MAX_THREADS && sharedwork[slot] ; slot++)
+		;
+	if (slot < MAX_THREADS)
+	{
+		sharedwork[slot] = &share;
+		WakeSharedWork ();
+	}
+	ThreadUnlock ();
+
+	if (slot == MAX_THREADS)
+	{
+		for (i = 0 ; i < workcnt ; i++)
+			func (param, i);
+		return;
+	}
+
+	for (;;)
+	{
+		ThreadLock ();
+		if (share.next == share.count)
+		{
+			ThreadUnlock ();
+			break;
+		}
+		i = share.next++;
+		ThreadUnlock ();
+
+		func (param, i);
+
+		ThreadLock ();
+		share.done++;
+		ThreadUnlock ();
+	}
+
+	// helpers may still be on the last few
+	ThreadLock ();
+	while (share.done < share.count)
+		WaitSharedWork ();
+	sharedwork[slot] = NULL;
+	ThreadUnlock ();
+}
+
+
+static void StealingWorkerFunction (int threadnum)
+{
+	int		work;
+	double	start;
+
+	while ((work = GetStolenWork (threadnum)) != -1)
+	{
+		start = I_FloatTime ();
+		individualfunction (threadnum, work);
+		workruns[threadnum].busytime += I_FloatTime () - start;
+	}
+
+	// nothing left of its own, so help those still sharing theirs
+	ThreadLock ();
+	if (!--workingthreads)
+		WakeSharedWork ();
+	ThreadUnlock ();
+	HelpSharedWork (threadnum);
+}
+
+void RunThreadsOnStealing (int workcnt, void (*func)(int threadnum, int work))
+{
+	int		i;
+	double	start;
+
+	ThreadSetDefault ();
+
+	for (i = 0 ; i < numthreads ; i++)
+	{
+		workruns[i].next = (int)((long long)workcnt * i / numthreads);
+		workruns[i].end = (int)((long long)workcnt * (i + 1) / numthreads);
+		workruns[i].busytime = 0;
+	}
+	steals = 0;
+
+	start = I_FloatTime ();
+	individualfunction = func;
+	if (numthreads == 1 || workcnt <= 1)
+	{
+		// RunThreadsOn would only call it for thread 0
+		for (i = 1 ; i < numthreads ; i++)
+			workruns[i].next = workruns[i].end = 0;
+		workruns[0].next = 0;
+		workruns[0].end = workcnt;
+	}
+	workingthreads = (numthreads == 1 || workcnt <= 1) ? 1 : numthreads;
+	stealing = true;
+	RunThreadsOn (workcnt, false, StealingWorkerFunction);
+	stealing = false;
+
+	laststats.threads = (numthreads == 1 || workcnt <= 1) ? 1 : numthreads;
+	laststats.work = workcnt;
+	laststats.steals = steals;
+	laststats.walltime = I_FloatTime () - start;
+	laststats.busytime = 0;
+	for (i = 0 ; i < numthreads ; i++)
+		laststats.busytime += workruns[i].busytime;
+}
+
+void GetThreadStats (threadstats_t *stats)
+{
+	*stats = laststats;
+}
+
+
+#ifdef _WIN32
+static DWORD WINAPI ThreadEntry (LPVOID param)
+{
+	workfunction ((int)(size_t)param);
+	return 0;
+}
+#else
+static void *ThreadEntry (void *param)
+{
+	workfunction ((int)(size_t)param);
+	return NULL;
+}
+#endif
+
+
+/*
+=============
+RunThreadsOn
+=============
+*/
+void RunThreadsOn (int workcnt, qboolean showpacifier, void (*func)(int threadnum))
+{
+	int		i;
+#ifdef _WIN32
+	HANDLE	threadhandle[MAX_THREADS];
+	DWORD	threadid;
+#else
+	pthread_t	threadhandle[MAX_THREADS];
+#endif
+
+	ThreadSetDefault ();
+
+	dispatch = 0;
+	workcount = workcnt;
+	oldf = -1;
+	pacifier = showpacifier;
+	workfunction = func;
+
+	// not worth starting threads for
+	if (numthreads == 1 || workcnt <= 1)
+	{
+		func (0);
+		if (pacifier)
+			printf (" (done)\n");
+		return;
+	}
+
+	InitLock ();
+	threaded = true;
+
+	for (i=0 ; i<numthreads ; i++)
+	{
+#ifdef _WIN32
+		threadhandle[i] = CreateThread (NULL, 0, ThreadEntry, (LPVOID)(size_t)i, 0, &threadid);
+		if (!threadhandle[i])
+			Error ("RunThreadsOn: CreateThread failed");
+#else
+		if (pthread_create (&threadhandle[i], NULL, ThreadEntry, (void *)(size_t)i))
+			Error ("RunThreadsOn: pthread_create failed");
+#endif
+	}
+
+	for (i=0 ; i<numthreads ; i++)
+	{
+#ifdef _WIN32
+		WaitForSingleObject (threadhandle[i], INFINITE);
+		CloseHandle (threadhandle[i]);
+#else
+		pthread_join (threadhandle[i], NULL);
+#endif
+	}
+
+	threaded = false;
+
+	if (pacifier)
+		printf (" (done)\n");
+}
+
+
+/*
+=============
+ThreadBegin
+
+A thread of its own, running alongside the main thread and whatever it goes
+on to run.  The lock is live from here until the last one has been ended,
+even if nothing else is threaded.
+=============
+*/
+typedef struct
+{
+	void	(*func) (void *param);
+	void	*param;
+#ifdef _WIN32
+	HANDLE		handle;
+#else
+	pthread_t	handle;
+#endif
+} extrathread_t;
+
+#ifdef _WIN32
+static DWORD WINAPI ExtraThreadEntry (LPVOID param)
+{
+	extrathread_t	*t = (extrathread_t *)param;
+
+	t->func (t->param);
+	return 0;
+}
+#else
+static void *ExtraThreadEntry (void *param)
+{
+	extrathread_t	*t = (extrathread_t *)param;
+
+	t->func (t->param);
+	return NULL;
+}
+#endif
+
+void *ThreadBegin (void (*func)(void *param), void *param)
+{
+	extrathread_t	*t;
+#ifdef _WIN32
+	DWORD			threadid;
+#endif
+
+	t = (extrathread_t *)malloc (sizeof(*t));
+	t->func = func;
+	t->param = param;
+
+	InitLock ();
+	extrathreads++;
+
+#ifdef _WIN32
+	t->handle = CreateThread (NULL, 0, ExtraThreadEntry, t, 0, &threadid);
+	if (!t->handle)
+		Error ("ThreadBegin: CreateThread failed");
+#else
+	if (pthread_create (&t->handle, NULL, ExtraThreadEntry, t))
+		Error ("ThreadBegin: pthread_create failed");
+#endif
+	return t;
+}
+
+void ThreadEnd (void *thread)
+{
+	extrathread_t	*t = (extrathread_t *)thread;
+
+#ifdef _WIN32
+	WaitForSingleObject (t->handle, INFINITE);
+	CloseHandle (t->handle);
+#else
+	pthread_join (t->handle, NULL);
+#endif
+	free (t);
+	extrathreads--;
+}
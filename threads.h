@@ -0,0 +1,74 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: 
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+
+// threads.h
+
+#ifndef THREADS_H
+#define THREADS_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+
+extern	int		numthreads;
+
+void	ThreadSetDefault (void);
+int		GetThreadWork (void);
+
+// Calls func once for each work item from 0 to workcnt-1, spread over
+// numthreads threads.  Work items are handed out in order, each to the
+// first thread that asks for one.
+void	RunThreadsOnIndividual (int workcnt, qboolean showpacifier, void (*func)(int threadnum, int work));
+
+// Calls func once on each of numthreads threads, which are expected to get
+// their own work with GetThreadWork.
+void	RunThreadsOn (int workcnt, qboolean showpacifier, void (*func)(int threadnum));
+
+// Like RunThreadsOnIndividual, but each thread starts with its own run of
+// consecutive work items and takes them in order.  A thread that runs out
+// steals the back half of the run with the most left, so neighbouring items
+// mostly stay on one thread and every thread stays busy to the end.
+void	RunThreadsOnStealing (int workcnt, void (*func)(int threadnum, int work));
+
+// From inside a RunThreadsOnStealing func, calls func once for each work
+// item from 0 to workcnt-1, on this thread and on any others that have run
+// out of items of their own, and returns once they're all done.  Outside of any
+// RunThreadsOn they're spread over numthreads threads like
+// RunThreadsOnIndividual; inside another kind this thread does them all.
+void	ThreadShareWork (int workcnt, void (*func)(void *param, int work), void *param);
+
+typedef struct
+{
+	int		threads;
+	int		work;
+	int		steals;
+	double	walltime;
+	double	busytime;		// in func, summed over the threads
+} threadstats_t;
+
+// For the last RunThreadsOnStealing.  busytime / (walltime * threads) is how
+// well the threads were kept busy.
+void	GetThreadStats (threadstats_t *stats);
+
+// Starts func on a thread of its own, to run alongside the main thread and
+// the RunThreadsOn calls it makes.  ThreadEnd waits for it to return.  Only
+// the main thread may begin or end them.
+void	*ThreadBegin (void (*func)(void *param), void *param);
+void	ThreadEnd (void *thread);
+
+void	ThreadLock (void);
+void	ThreadUnlock (void);
+
+// Under ThreadLock, ThreadWait gives up the lock and sleeps until some other
+// thread calls ThreadWake, then has the lock again.  Every waiter wakes, so
+// each rechecks whatever it's waiting for in a loop.
+void	ThreadWait (void);
+void	ThreadWake (void);
+
+
+#endif // THREADS_H
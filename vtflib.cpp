@@ -0,0 +1,311 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: 
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+
+// vtflib.c
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include "goldsrc_standin.h"
+#include "arena.h"
+#include "texlib.h"
+#include "dxtlib.h"
+#include "vtflib.h"
+
+#define	MAX_MIPS	MAX_MIP_LEVELS
+
+
+int VTF_ImageSize (int format, int width, int height)
+{
+	switch (format)
+	{
+	case IMAGE_FORMAT_RGBA8888:
+		return width * height * 4;
+	case IMAGE_FORMAT_RGB888:
+		return width * height * 3;
+	case IMAGE_FORMAT_DXT1:
+		return DXT_SIZE (width, height, DXT1_BLOCK_SIZE);
+	case IMAGE_FORMAT_DXT5:
+		return DXT_SIZE (width, height, DXT5_BLOCK_SIZE);
+	}
+	return -1;
+}
+
+
+static const struct
+{
+	int			format;
+	const char	*name;
+} formatnames[] =
+{
+	{ IMAGE_FORMAT_RGBA8888,	"RGBA8888" },
+	{ IMAGE_FORMAT_RGB888,		"RGB888" },
+	{ IMAGE_FORMAT_DXT1,		"DXT1" },
+	{ IMAGE_FORMAT_DXT5,		"DXT5" },
+};
+
+const char *VTF_FormatName (int format)
+{
+	int		i;
+
+	for (i = 0 ; i < (int)(sizeof(formatnames) / sizeof(formatnames[0])) ; i++)
+		if (formatnames[i].format == format)
+			return formatnames[i].name;
+	return "unknown";
+}
+
+int VTF_FormatForName (const char *name)
+{
+	int		i;
+
+	for (i = 0 ; i < (int)(sizeof(formatnames) / sizeof(formatnames[0])) ; i++)
+		if (!stricmp (formatnames[i].name, name))
+			return formatnames[i].format;
+	return IMAGE_FORMAT_NONE;
+}
+
+
+/*
+==================
+EncodeImage
+
+The uncompressed formats; the DXT ones are done a mip chain at a time
+==================
+*/
+static void EncodeImage (const byte *rgba, int width, int height, int format, byte *out)
+{
+	int		i;
+
+	switch (format)
+	{
+	case IMAGE_FORMAT_RGBA8888:
+		memcpy (out, rgba, width * height * 4);
+		break;
+	case IMAGE_FORMAT_RGB888:
+		for (i = 0 ; i < width * height ; i++)
+		{
+			out[i * 3 + 0] = rgba[i * 4 + 0];
+			out[i * 3 + 1] = rgba[i * 4 + 1];
+			out[i * 3 + 2] = rgba[i * 4 + 2];
+		}
+		break;
+	}
+}
+
+
+/*
+==================
+ComputeReflectivity
+
+The average colour of the image in linear space
+==================
+*/
+static void ComputeReflectivity (const byte *rgba, int width, int height, float reflectivity[3])
+{
+	static float	togamma[256];
+	static qboolean	tableinit;
+	double			total[3];
+	int				i, c;
+
+	// the race to fill it in writes the same values
+	if (!tableinit)
+	{
+		for (i = 0 ; i < 256 ; i++)
+			togamma[i] = (float)pow (i / 255.0, 2.2);
+		tableinit = true;
+	}
+
+	total[0] = total[1] = total[2] = 0;
+	for (i = 0 ; i < width * height ; i++)
+		for (c = 0 ; c < 3 ; c++)
+			total[c] += togamma[rgba[i * 4 + c]];
+
+	for (c = 0 ; c < 3 ; c++)
+		reflectivity[c] = (float)(total[c] / (width * height));
+}
+
+
+/*
+==================
+MipSizes
+
+The size of every mip level down to 1x1, and which becomes the thumbnail
+==================
+*/
+static int MipSizes (int width, int height, int mipwidth[MAX_MIPS], int mipheight[MAX_MIPS], int *thumbmip)
+{
+	int		nummips;
+
+	if ((width & (width - 1)) || (height & (height - 1)) || width < 1 || height < 1)
+		Error ("VTF_Encode: image is %dx%d, not a power of two", width, height);
+
+	mipwidth[0] = width;
+	mipheight[0] = height;
+	for (nummips = 1 ; mipwidth[nummips - 1] > 1 || mipheight[nummips - 1] > 1 ; nummips++)
+	{
+		if (nummips == MAX_MIPS)
+			Error ("VTF_Encode: image is %dx%d, too big", width, height);
+		mipwidth[nummips] = mipwidth[nummips - 1] > 1 ? mipwidth[nummips - 1] / 2 : 1;
+		mipheight[nummips] = mipheight[nummips - 1] > 1 ? mipheight[nummips - 1] / 2 : 1;
+	}
+
+	// the first level that fits
+	for (*thumbmip = 0 ; mipwidth[*thumbmip] > VTF_THUMBNAIL_SIZE || mipheight[*thumbmip] > VTF_THUMBNAIL_SIZE ; (*thumbmip)++)
+		;
+	return nummips;
+}
+
+
+/*
+==================
+VTF_FileSize
+==================
+*/
+int VTF_FileSize (int format, int width, int height, int flags)
+{
+	int		mipwidth[MAX_MIPS], mipheight[MAX_MIPS];
+	int		nummips, thumbmip, i, size;
+
+	nummips = MipSizes (width, height, mipwidth, mipheight, &thumbmip);
+	if (flags & TEXTUREFLAGS_NOMIP)
+		nummips = 1;
+
+	size = VTF_HEADER_SIZE + VTF_ImageSize (IMAGE_FORMAT_DXT1, mipwidth[thumbmip], mipheight[thumbmip]);
+	for (i = 0 ; i < nummips ; i++)
+		size += VTF_ImageSize (format, mipwidth[i], mipheight[i]);
+	return size;
+}
+
+
+/*
+==================
+VTF_Encode
+==================
+*/
+byte *VTF_Encode (const byte *rgba, int width, int height, int format, int flags,
+	qboolean alpha, qboolean quality, arena_t *scratch, int *length)
+{
+	vtfheader_t	header;
+	const RGBAColor	*mips[MAX_MIPS];
+	dxtimage_t	images[MAX_MIPS];
+	int			mipwidth[MAX_MIPS], mipheight[MAX_MIPS];
+	int			nummips, thumbmip, i, size, mipflags, dxtflags;
+	qboolean	dxt;
+	byte		*buffer, *out;
+
+	if (VTF_ImageSize (format, 1, 1) < 0)
+		Error ("VTF_Encode: can't write format %d", format);
+
+	// Every mip level is needed for the thumbnail, whether or not it's kept.
+	nummips = MipSizes (width, height, mipwidth, mipheight, &thumbmip);
+	mipflags = MIP_SRGB;
+	if (alpha && (flags & TEXTUREFLAGS_ONEBITALPHA))
+		mipflags |= MIP_ALPHATEST;
+	BuildMipChain (scratch, (const RGBAColor *)rgba, width, height, mipflags, mips, mipwidth, mipheight);
+
+	if (alpha)
+	{
+		if (format == IMAGE_FORMAT_DXT1)
+			flags |= TEXTUREFLAGS_ONEBITALPHA;
+		else if (format != IMAGE_FORMAT_RGB888 && !(flags & TEXTUREFLAGS_ONEBITALPHA))
+			flags |= TEXTUREFLAGS_EIGHTBITALPHA;
+	}
+
+	memset (&header, 0, sizeof(header));
+	memcpy (header.signature, "VTF", 4);
+	header.version[0] = LittleLong (VTF_VERSION_MAJOR);
+	header.version[1] = LittleLong (VTF_VERSION_MINOR);
+	header.headerSize = LittleLong (VTF_HEADER_SIZE);
+	header.width = LittleShort (width);
+	header.height = LittleShort (height);
+	header.flags = LittleLong (flags);
+	header.frames = LittleShort (1);
+	header.firstFrame = 0;
+	ComputeReflectivity (rgba, width, height, header.reflectivity);
+	for (i = 0 ; i < 3 ; i++)
+		header.reflectivity[i] = LittleFloat (header.reflectivity[i]);
+	header.bumpmapScale = LittleFloat (1.0f);
+	header.highResImageFormat = LittleLong (format);
+	header.mipmapCount = (flags & TEXTUREFLAGS_NOMIP) ? 1 : nummips;
+	header.lowResImageFormat = LittleLong (IMAGE_FORMAT_DXT1);
+	header.lowResImageWidth = mipwidth[thumbmip];
+	header.lowResImageHeight = mipheight[thumbmip];
+	header.depth = LittleShort (1);
+
+	size = VTF_FileSize (format, width, height, flags);
+	buffer = (byte *)malloc (size);
+	*length = size;
+
+	memset (buffer, 0, VTF_HEADER_SIZE);
+	memcpy (buffer, &header, sizeof(header));
+	out = buffer + VTF_HEADER_SIZE;
+
+	CompressDXT1 ((const byte *)mips[thumbmip], mipwidth[thumbmip], mipheight[thumbmip], out, 0);
+	out += VTF_ImageSize (IMAGE_FORMAT_DXT1, mipwidth[thumbmip], mipheight[thumbmip]);
+
+	// Smallest first.  The DXT levels are compressed all together, so a big
+	// texture's can be shared out between threads.
+	dxt = format == IMAGE_FORMAT_DXT1 || format == IMAGE_FORMAT_DXT5;
+	for (i = header.mipmapCount - 1 ; i >= 0 ; i--)
+	{
+		if (dxt)
+		{
+			images[i].rgba = (const byte *)mips[i];
+			images[i].width = mipwidth[i];
+			images[i].height = mipheight[i];
+			images[i].out = out;
+		}
+		else
+		{
+			EncodeImage ((const byte *)mips[i], mipwidth[i], mipheight[i], format, out);
+		}
+		out += VTF_ImageSize (format, mipwidth[i], mipheight[i]);
+	}
+
+	if (dxt)
+	{
+		dxtflags = quality ? DXT_QUALITY : 0;
+		if (alpha && format == IMAGE_FORMAT_DXT1)
+			dxtflags |= DXT_ONEBITALPHA;
+		CompressDXTImages (images, header.mipmapCount,
+						   format == IMAGE_FORMAT_DXT1 ? DXT1_BLOCK_SIZE : DXT5_BLOCK_SIZE, dxtflags);
+	}
+
+	return buffer;
+}
+
+
+/*
+==================
+VTF_Write
+==================
+*/
+qboolean VTF_Write (const char *filename, const byte *rgba, int width, int height,
+	int format, int flags, qboolean alpha, qboolean quality)
+{
+	arena_t	scratch;
+	byte	*buffer;
+	int		length;
+	FILE	*f;
+
+	Arena_Init (&scratch);
+	buffer = VTF_Encode (rgba, width, height, format, flags, alpha, quality, &scratch, &length);
+	Arena_Free (&scratch);
+
+	f = fopen (filename, "wb");
+	if (!f)
+	{
+		free (buffer);
+		return false;
+	}
+	SafeWrite (f, buffer, length);
+	fclose (f);
+	free (buffer);
+	return true;
+}
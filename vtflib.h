@@ -0,0 +1,88 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: 
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+
+// vtflib.h
+
+//
+// VTF 7.2 writing.
+//
+// The file is the header, the low res thumbnail in DXT1, then the mip levels
+// from the smallest up to the full size image.  Only the single frame, single
+// face, single slice textures xwad makes are handled.
+//
+
+#define	VTF_VERSION_MAJOR	7
+#define	VTF_VERSION_MINOR	2
+#define	VTF_HEADER_SIZE		80		// sizeof(vtfheader_t) rounded up to 16
+
+#define	VTF_THUMBNAIL_SIZE	16		// largest the thumbnail gets either way
+
+// image formats, as numbered in the file
+#define	IMAGE_FORMAT_NONE		-1
+#define	IMAGE_FORMAT_RGBA8888	0
+#define	IMAGE_FORMAT_RGB888		2
+#define	IMAGE_FORMAT_DXT1		13
+#define	IMAGE_FORMAT_DXT5		15
+
+#define	TEXTUREFLAGS_POINTSAMPLE	0x00000001
+#define	TEXTUREFLAGS_TRILINEAR		0x00000002
+#define	TEXTUREFLAGS_CLAMPS			0x00000004
+#define	TEXTUREFLAGS_CLAMPT			0x00000008
+#define	TEXTUREFLAGS_NOMIP			0x00000100
+#define	TEXTUREFLAGS_NOLOD			0x00000200
+#define	TEXTUREFLAGS_ONEBITALPHA	0x00001000
+#define	TEXTUREFLAGS_EIGHTBITALPHA	0x00002000
+
+#pragma pack(1)
+typedef struct
+{
+	char			signature[4];		// "VTF\0"
+	unsigned int	version[2];
+	unsigned int	headerSize;
+	unsigned short	width;
+	unsigned short	height;
+	unsigned int	flags;
+	unsigned short	frames;
+	unsigned short	firstFrame;
+	byte			padding0[4];
+	float			reflectivity[3];
+	byte			padding1[4];
+	float			bumpmapScale;
+	int				highResImageFormat;
+	byte			mipmapCount;
+	int				lowResImageFormat;
+	byte			lowResImageWidth;
+	byte			lowResImageHeight;
+	unsigned short	depth;
+} vtfheader_t;
+#pragma pack()
+
+// -1 for anything VTF_Write doesn't know how to write
+int			VTF_ImageSize (int format, int width, int height);
+const char	*VTF_FormatName (int format);
+int			VTF_FormatForName (const char *name);
+
+// Writes the top row first RGBA8888 pixels out as a VTF in format (RGB888,
+// RGBA8888, DXT1 or DXT5), with a full mip chain unless flags has
+// TEXTUREFLAGS_NOMIP.  The mips are averaged in linear light, and alpha
+// tested ones, with alpha and TEXTUREFLAGS_ONEBITALPHA, keep the share of
+// solid texels.  The width and height must be powers of two.  The alpha
+// flags are added to suit the format when alpha is set.  With quality the
+// DXT formats are cluster fit, otherwise they're the faster bounding box
+// fit.  False if the file couldn't be opened.
+qboolean	VTF_Write (const char *filename, const byte *rgba, int width, int height,
+				int format, int flags, qboolean alpha, qboolean quality);
+
+// How big VTF_Write would make the file.
+int			VTF_FileSize (int format, int width, int height, int flags);
+
+// The same file in a malloced buffer, *length bytes long, for writing later.
+// The mip levels are made in scratch, which the caller resets.
+// The DXT levels are shared out between threads with ThreadShareWork.
+byte		*VTF_Encode (const byte *rgba, int width, int height, int format, int flags,
+				qboolean alpha, qboolean quality, arena_t *scratch, int *length);
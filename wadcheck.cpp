@@ -0,0 +1,436 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: 
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+
+// wadcheck.c
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "goldsrc_standin.h"
+#include "wadlib.h"
+#include "goldsrc_bspfile.h"
+#include "lzsslib.h"
+#include "checksum.h"
+#include "threads.h"
+#include "wadcheck.h"
+
+#define	MAX_CHECK_WADS		64		// wads open at once
+#define	LUMPS_PER_WORK		64
+#define	MAX_MIPTEX_SIDE		5000	// the largest the converter will load
+
+// per lump problems, turned into text when the wad is reported
+#define	LC_BOUNDS			1
+#define	LC_HEADER			2
+#define	LC_DIRECTORY		4
+#define	LC_COMPRESSION		8
+#define	LC_DECOMPRESS		16
+#define	LC_MIPTEX			32
+#define	LC_MIPLEVEL			64
+#define	LC_PALETTE			128
+
+typedef struct
+{
+	unsigned	crc;			// of the stored bytes
+	int			flags;			// LC_*
+} lumpcheck_t;
+
+typedef struct
+{
+	const char	*name;
+	WadReader	reader;
+	qboolean	opened;
+	lumpcheck_t	*lumps;
+} checkwad_t;
+
+typedef struct
+{
+	int			wad;
+	int			firstlump;
+	int			numlumps;
+} checkwork_t;
+
+static checkwad_t	*checkwads;
+static checkwork_t	*checkwork;
+
+
+/*
+==================
+CheckOpenWad
+==================
+*/
+static void CheckOpenWad (int, int w)
+{
+	checkwad_t	*cw;
+
+	cw = &checkwads[w];
+	cw->opened = cw->reader.Open (cw->name);
+	if (cw->opened)
+		cw->lumps = (lumpcheck_t *)calloc (cw->reader.NumLumps () + 1, sizeof(lumpcheck_t));
+}
+
+
+/*
+==================
+CheckMiptex
+
+Returns the LC_ flags for a miptex that doesn't fit in its own lump
+==================
+*/
+static int CheckMiptex (const byte *data, int length, qboolean wad3)
+{
+	lumpview_t		view;
+	const miptex_t	*mt;
+	long long		width, height, ofs, size;
+	int				i;
+
+	view.data = data;
+	view.length = length;
+
+	mt = (const miptex_t *)W_ViewRange (&view, 0, sizeof(miptex_t));
+	if (!mt)
+		return LC_MIPTEX;
+
+	width = (unsigned)LittleLong (mt->width);
+	height = (unsigned)LittleLong (mt->height);
+	if (!width || !height || width > MAX_MIPTEX_SIDE || height > MAX_MIPTEX_SIDE)
+		return LC_MIPTEX;
+
+	for (i = 0 ; i < MIPLEVELS ; i++)
+	{
+		ofs = (unsigned)LittleLong (mt->offsets[i]);
+		size = (width >> i) * (height >> i);
+		if (ofs < (long long)sizeof(miptex_t) || ofs + size > length)
+			return LC_MIPLEVEL;
+	}
+
+	// the palette is a short count and 256 colors after the last mip
+	if (wad3)
+	{
+		ofs = (long long)(unsigned)LittleLong (mt->offsets[3]) + width * height / 64 + 2;
+		if (ofs + 768 > length)
+			return LC_PALETTE;
+	}
+
+	return 0;
+}
+
+
+/*
+==================
+CheckLumps
+==================
+*/
+static void CheckLumps (int, int work)
+{
+	checkwork_t			*cw;
+	const WadReader		*wad;
+	const lumpinfo_t	*l;
+	lumpcheck_t			*lc;
+	lumpview_t			stored;
+	byte				*scratch, *unpacked;
+	int					scratchsize, unpackedsize, size;
+	int					dirstart, dirend;
+	int					i;
+
+	cw = &checkwork[work];
+	wad = &checkwads[cw->wad].reader;
+	dirstart = wad->Header ().infotableofs;
+	dirend = dirstart + wad->NumLumps () * (int)sizeof(lumpinfo_t);
+
+	scratch = unpacked = NULL;
+	scratchsize = unpackedsize = 0;
+
+	for (i = cw->firstlump ; i < cw->firstlump + cw->numlumps ; i++)
+	{
+		l = wad->LumpInfo (i);
+		lc = &checkwads[cw->wad].lumps[i];
+
+		if (l->filepos < 0 || l->disksize < 0 || l->size < 0
+		|| l->filepos > wad->FileSize () - l->disksize
+		|| (l->compression == CMP_NONE && l->filepos > wad->FileSize () - l->size))
+		{
+			lc->flags |= LC_BOUNDS;
+			continue;
+		}
+		if (l->disksize && l->filepos < (int)sizeof(wadinfo_t))
+			lc->flags |= LC_HEADER;
+		if (l->disksize && l->filepos < dirend && l->filepos + l->disksize > dirstart)
+			lc->flags |= LC_DIRECTORY;
+
+		// an uncompressed lump is looked at for size bytes below, which can
+		// be more than disksize, so the copy has to hold both
+		if (!wad->MapStoredLump (i, &stored))
+		{
+			size = l->disksize;
+			if (l->compression == CMP_NONE && l->size > size)
+				size = l->size;
+			if (size > scratchsize)
+			{
+				scratchsize = size;
+				scratch = (byte *)realloc (scratch, scratchsize);
+			}
+			if (size > l->disksize)
+				wad->ReadLumpNum (i, scratch);
+			else if (!wad->ReadStoredLump (i, scratch))
+			{
+				lc->flags |= LC_BOUNDS;
+				continue;
+			}
+			stored.data = scratch;
+			stored.length = l->disksize;
+		}
+
+		lc->crc = CRC32C (0, stored.data, stored.length);
+
+		switch (l->compression)
+		{
+		case CMP_NONE:
+			// disksize only matters for compressed lumps
+			stored.length = l->size;
+			break;
+
+		case CMP_LZSS:
+			if (l->size > unpackedsize)
+			{
+				unpackedsize = l->size;
+				unpacked = (byte *)realloc (unpacked, unpackedsize);
+			}
+			if (!LZSS_Decompress (stored.data, l->disksize, unpacked, l->size))
+			{
+				lc->flags |= LC_DECOMPRESS;
+				continue;
+			}
+			stored.data = unpacked;
+			stored.length = l->size;
+			break;
+
+		default:
+			lc->flags |= LC_COMPRESSION;
+			continue;
+		}
+
+		if (l->type == TYP_MIPTEX || l->type == TYP_MIPTEX3)
+			lc->flags |= CheckMiptex (stored.data, stored.length, l->type == TYP_MIPTEX3);
+	}
+
+	free (unpacked);
+	free (scratch);
+}
+
+
+/*
+==================
+CompareFilepos
+==================
+*/
+static const lumpinfo_t	*sortlumps;
+
+static int CompareFilepos (const void *a, const void *b)
+{
+	const lumpinfo_t	*la, *lb;
+
+	la = &sortlumps[*(const int *)a];
+	lb = &sortlumps[*(const int *)b];
+	if (la->filepos != lb->filepos)
+		return la->filepos < lb->filepos ? -1 : 1;
+	if (la->disksize != lb->disksize)
+		return la->disksize < lb->disksize ? -1 : 1;
+	return *(const int *)a - *(const int *)b;
+}
+
+
+/*
+==================
+ReportOverlaps
+
+Lumps that share exactly the same data are fine, WadWriter's dedup makes
+them.  Anything else that overlaps is reported once per pair.  Lumps that
+are already past the end of the file are left out.
+==================
+*/
+static int ReportOverlaps (const checkwad_t *cw)
+{
+	const WadReader		*wad = &cw->reader;
+	const lumpinfo_t	*dir, *a, *b;
+	int					*order;
+	int					i, j, count, problems;
+
+	dir = wad->Directory ();
+	count = wad->NumLumps ();
+	order = (int *)malloc ((count + 1) * sizeof(int));
+	for (i = 0 ; i < count ; i++)
+		order[i] = i;
+
+	sortlumps = dir;
+	qsort (order, count, sizeof(int), CompareFilepos);
+
+	problems = 0;
+	for (i = 0 ; i < count ; i++)
+	{
+		a = &dir[order[i]];
+		if (a->disksize <= 0 || (cw->lumps[order[i]].flags & LC_BOUNDS))
+			continue;
+
+		for (j = i + 1 ; j < count ; j++)
+		{
+			b = &dir[order[j]];
+			if (b->filepos >= a->filepos + a->disksize)
+				break;
+			if (b->disksize <= 0 || (cw->lumps[order[j]].flags & LC_BOUNDS))
+				continue;
+			if (b->filepos == a->filepos && b->disksize == a->disksize)
+				continue;
+
+			printf ("  %-16.16s overlaps %.16s\n", a->name, b->name);
+			problems++;
+		}
+	}
+
+	free (order);
+	return problems;
+}
+
+
+/*
+==================
+ReportWad
+==================
+*/
+static int ReportWad (checkwad_t *cw, qboolean listcrcs)
+{
+	const WadReader		*wad;
+	const lumpinfo_t	*l;
+	lumpcheck_t			*lc;
+	unsigned			crc;
+	int					i, problems;
+
+	if (!cw->opened)
+	{
+		printf ("%s\n", cw->reader.GetError ());
+		return 1;
+	}
+
+	wad = &cw->reader;
+	problems = 0;
+	crc = 0;
+
+	if (wad->Header ().infotableofs < (int)sizeof(wadinfo_t))
+	{
+		printf ("  directory overlaps the header\n");
+		problems++;
+	}
+
+	for (i = 0 ; i < wad->NumLumps () ; i++)
+	{
+		l = wad->LumpInfo (i);
+		lc = &cw->lumps[i];
+		crc = CRC32C (crc, &lc->crc, sizeof(lc->crc));
+
+		if (listcrcs)
+			printf ("  %-16.16s %08x\n", l->name, lc->crc);
+
+		if (!lc->flags)
+			continue;
+		problems++;
+
+		printf ("  %-16.16s", l->name);
+		if (lc->flags & LC_BOUNDS)
+			printf (" extends past the end of the file (filepos %i, size %i)", l->filepos, l->compression == CMP_NONE ? l->size : l->disksize);
+		if (lc->flags & LC_HEADER)
+			printf (" overlaps the header");
+		if (lc->flags & LC_DIRECTORY)
+			printf (" overlaps the directory");
+		if (lc->flags & LC_COMPRESSION)
+			printf (" has unknown compression %i", l->compression);
+		if (lc->flags & LC_DECOMPRESS)
+			printf (" doesn't decompress to %i bytes", l->size);
+		if (lc->flags & LC_MIPTEX)
+			printf (" has a bad miptex header");
+		if (lc->flags & LC_MIPLEVEL)
+			printf (" has mips past the end of the lump");
+		if (lc->flags & LC_PALETTE)
+			printf (" has a palette past the end of the lump");
+		printf ("\n");
+	}
+
+	problems += ReportOverlaps (cw);
+
+	printf ("%s: %i lumps, crc %08x, %s\n", cw->name, wad->NumLumps (), crc,
+		problems ? "PROBLEMS" : "ok");
+	return problems;
+}
+
+
+/*
+==================
+CheckWads
+==================
+*/
+int CheckWads (int numwads, char **wadnames, qboolean listcrcs)
+{
+	int		first, count, numwork, maxwork;
+	int		i, j, problems;
+
+	ThreadSetDefault ();
+
+	checkwads = new checkwad_t[MAX_CHECK_WADS];
+	checkwork = NULL;
+	maxwork = 0;
+	problems = 0;
+
+	for (first = 0 ; first < numwads ; first += count)
+	{
+		count = numwads - first;
+		if (count > MAX_CHECK_WADS)
+			count = MAX_CHECK_WADS;
+
+		for (i = 0 ; i < count ; i++)
+		{
+			checkwads[i].name = wadnames[first + i];
+			checkwads[i].opened = false;
+			checkwads[i].lumps = NULL;
+		}
+		RunThreadsOnIndividual (count, false, CheckOpenWad);
+
+		// split every wad into runs of lumps so one big wad still uses every thread
+		numwork = 0;
+		for (i = 0 ; i < count ; i++)
+		{
+			if (!checkwads[i].opened)
+				continue;
+			for (j = 0 ; j < checkwads[i].reader.NumLumps () ; j += LUMPS_PER_WORK)
+			{
+				if (numwork == maxwork)
+				{
+					maxwork = maxwork ? maxwork * 2 : 1024;
+					checkwork = (checkwork_t *)realloc (checkwork, maxwork * sizeof(checkwork_t));
+				}
+				checkwork[numwork].wad = i;
+				checkwork[numwork].firstlump = j;
+				checkwork[numwork].numlumps = checkwads[i].reader.NumLumps () - j;
+				if (checkwork[numwork].numlumps > LUMPS_PER_WORK)
+					checkwork[numwork].numlumps = LUMPS_PER_WORK;
+				numwork++;
+			}
+		}
+		RunThreadsOnIndividual (numwork, false, CheckLumps);
+
+		for (i = 0 ; i < count ; i++)
+		{
+			problems += ReportWad (&checkwads[i], listcrcs);
+			free (checkwads[i].lumps);
+			checkwads[i].reader.Close ();
+		}
+	}
+
+	printf ("%i wads checked, %i problems\n", numwads, problems);
+
+	free (checkwork);
+	delete [] checkwads;
+	return problems;
+}
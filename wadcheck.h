@@ -0,0 +1,27 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: 
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+
+// wadcheck.h
+
+#ifndef WADCHECK_H
+#define WADCHECK_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+
+// Checks every lump of every wad without converting anything: the stored
+// data has to be inside the file and clear of the header, the directory and
+// other lumps, compressed lumps have to decompress, and miptex mips and
+// palettes have to fit in their lumps.  Lumps are checksummed with CRC32C.
+// The work is spread over numthreads threads, but the report comes out one
+// wad at a time in the order given.  Returns the number of problems found.
+int		CheckWads (int numwads, char **wadnames, qboolean listcrcs);
+
+
+#endif // WADCHECK_H
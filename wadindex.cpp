@@ -0,0 +1,644 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: 
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+
+// wadindex.c
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdarg.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+#include "goldsrc_standin.h"
+#include "wadlib.h"
+#include "threads.h"
+#include "wadindex.h"
+
+/*
+============================================================================
+
+							INDEX READING
+
+============================================================================
+*/
+
+WadIndex::WadIndex ()
+{
+	m_pData = NULL;
+	m_nDataSize = 0;
+	m_bMapped = false;
+#ifdef _WIN32
+	m_hFile = INVALID_HANDLE_VALUE;
+	m_hMapping = NULL;
+#endif
+	m_pHeader = NULL;
+	m_pWads = NULL;
+	m_pEntries = NULL;
+	m_pHash = NULL;
+	m_pStrings = NULL;
+	m_szError[0] = 0;
+}
+
+
+WadIndex::~WadIndex ()
+{
+	Close ();
+}
+
+
+/*
+====================
+WadIndex::SetError
+
+Records why Open failed, always returns false
+====================
+*/
+bool WadIndex::SetError (const char *fmt, ...)
+{
+	va_list		argptr;
+
+	va_start (argptr, fmt);
+	vsnprintf (m_szError, sizeof(m_szError), fmt, argptr);
+	va_end (argptr);
+	Close ();
+	return false;
+}
+
+
+/*
+====================
+IndexBlockOK
+
+True if count items of itemsize at ofs are all inside the file
+====================
+*/
+static bool IndexBlockOK (int filesize, int ofs, int count, int itemsize)
+{
+	if (ofs < 0 || count < 0 || ofs > filesize)
+		return false;
+	return count <= (filesize - ofs) / itemsize;
+}
+
+
+/*
+====================
+WadIndex::Open
+
+Maps the index and checks that every table in it is inside the file and
+every number in them points somewhere sensible, so lookups don't have to.
+====================
+*/
+bool WadIndex::Open (const char *filename)
+{
+	const wadindexheader_t	*h;
+	int						i;
+
+	Close ();
+	m_szError[0] = 0;
+
+#ifdef _WIN32
+	LARGE_INTEGER	size;
+
+	m_hFile = CreateFile (filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (m_hFile == INVALID_HANDLE_VALUE)
+		return SetError ("Error opening %s", filename);
+	if (!GetFileSizeEx ((HANDLE)m_hFile, &size) || size.QuadPart > 0x7fffffff)
+		return SetError ("Index %s is too large", filename);
+	m_nDataSize = (int)size.QuadPart;
+
+	if (m_nDataSize >= (int)sizeof(wadindexheader_t))
+	{
+		m_hMapping = CreateFileMapping ((HANDLE)m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (m_hMapping)
+			m_pData = (const byte *)MapViewOfFile ((HANDLE)m_hMapping, FILE_MAP_READ, 0, 0, 0);
+	}
+	if (m_pData)
+	{
+		m_bMapped = true;
+	}
+	else if (m_nDataSize >= (int)sizeof(wadindexheader_t))
+	{
+		DWORD	got;
+
+		m_pData = (const byte *)malloc (m_nDataSize);
+		if (!ReadFile ((HANDLE)m_hFile, (void *)m_pData, m_nDataSize, &got, NULL) || (int)got != m_nDataSize)
+			return SetError ("Error reading %s", filename);
+	}
+#else
+	struct stat	st;
+	int			fd;
+	void		*p;
+
+	fd = open (filename, O_RDONLY);
+	if (fd == -1)
+		return SetError ("Error opening %s: %s", filename, strerror(errno));
+	if (fstat (fd, &st) == -1 || st.st_size > 0x7fffffff)
+	{
+		close (fd);
+		return SetError ("Index %s is too large", filename);
+	}
+	m_nDataSize = (int)st.st_size;
+
+	if (m_nDataSize >= (int)sizeof(wadindexheader_t))
+	{
+		p = mmap (NULL, m_nDataSize, PROT_READ, MAP_SHARED, fd, 0);
+		if (p != MAP_FAILED)
+		{
+			m_pData = (const byte *)p;
+			m_bMapped = true;
+		}
+		else
+		{
+			m_pData = (const byte *)malloc (m_nDataSize);
+			if (pread (fd, (void *)m_pData, m_nDataSize, 0) != m_nDataSize)
+			{
+				close (fd);
+				return SetError ("Error reading %s", filename);
+			}
+		}
+	}
+	close (fd);		// a mapping outlives its descriptor
+#endif
+
+	if (!m_pData)
+		return SetError ("Index %s is truncated", filename);
+
+	h = (const wadindexheader_t *)m_pData;
+	if (h->ident != WADINDEX_IDENT)
+		return SetError ("%s is not a wad index", filename);
+	if (h->version != WADINDEX_VERSION)
+		return SetError ("Index %s is version %i, not %i", filename, h->version, WADINDEX_VERSION);
+
+	if (!IndexBlockOK (m_nDataSize, h->wadofs, h->numwads, sizeof(wadindexwad_t))
+	|| !IndexBlockOK (m_nDataSize, h->entryofs, h->numentries, sizeof(wadindexentry_t))
+	|| !IndexBlockOK (m_nDataSize, h->hashofs, h->hashsize, sizeof(int))
+	|| !IndexBlockOK (m_nDataSize, h->stringofs, h->stringsize, 1)
+	|| (h->wadofs & 7) || (h->entryofs & 3) || (h->hashofs & 3)
+	|| h->hashsize < 1 || (h->hashsize & (h->hashsize - 1))
+	|| h->stringsize < 1 || m_pData[h->stringofs + h->stringsize - 1])
+		return SetError ("Index %s is corrupt", filename);
+
+	m_pHeader = h;
+	m_pWads = (const wadindexwad_t *)(m_pData + h->wadofs);
+	m_pEntries = (const wadindexentry_t *)(m_pData + h->entryofs);
+	m_pHash = (const int *)(m_pData + h->hashofs);
+	m_pStrings = (const char *)(m_pData + h->stringofs);
+
+	for (i = 0 ; i < h->numwads ; i++)
+	{
+		if (m_pWads[i].nameofs < 0 || m_pWads[i].nameofs >= h->stringsize)
+			return SetError ("Index %s is corrupt", filename);
+	}
+	for (i = 0 ; i < h->numentries ; i++)
+	{
+		if ((unsigned)m_pEntries[i].wad >= (unsigned)h->numwads)
+			return SetError ("Index %s is corrupt", filename);
+	}
+	for (i = 0 ; i < h->hashsize ; i++)
+	{
+		if (m_pHash[i] < -1 || m_pHash[i] >= h->numentries)
+			return SetError ("Index %s is corrupt", filename);
+	}
+
+	return true;
+}
+
+
+/*
+====================
+WadIndex::Close
+====================
+*/
+void WadIndex::Close ()
+{
+	if (m_pData)
+	{
+		if (!m_bMapped)
+			free ((void *)m_pData);
+#ifdef _WIN32
+		else
+			UnmapViewOfFile (m_pData);
+#else
+		else
+			munmap ((void *)m_pData, m_nDataSize);
+#endif
+	}
+#ifdef _WIN32
+	if (m_hMapping)
+		CloseHandle ((HANDLE)m_hMapping);
+	if (m_hFile != INVALID_HANDLE_VALUE)
+		CloseHandle ((HANDLE)m_hFile);
+	m_hMapping = NULL;
+	m_hFile = INVALID_HANDLE_VALUE;
+#endif
+	m_pData = NULL;
+	m_nDataSize = 0;
+	m_bMapped = false;
+
+	m_pHeader = NULL;
+	m_pWads = NULL;
+	m_pEntries = NULL;
+	m_pHash = NULL;
+	m_pStrings = NULL;
+}
+
+
+const wadindexwad_t *WadIndex::WadInfo (int wad) const
+{
+	if ((unsigned)wad >= (unsigned)NumWads ())
+		Error ("WadIndex::WadInfo: %i >= numwads", wad);
+	return m_pWads + wad;
+}
+
+
+const char *WadIndex::WadName (int wad) const
+{
+	return m_pStrings + WadInfo (wad)->nameofs;
+}
+
+
+const wadindexentry_t *WadIndex::Entry (int entry) const
+{
+	if ((unsigned)entry >= (unsigned)NumEntries ())
+		Error ("WadIndex::Entry: %i >= numentries", entry);
+	return m_pEntries + entry;
+}
+
+
+/*
+====================
+WadIndex::Find
+====================
+*/
+int WadIndex::Find (const char *name, int *count) const
+{
+	char	cleanname[16];
+	int		mask, slot, first, i, n;
+
+	*count = 0;
+	if (!m_pHeader)
+		return -1;
+
+	CleanupName ((char *)name, cleanname);
+	mask = m_pHeader->hashsize - 1;
+
+	// the table is never full, so there is always an empty slot to stop on
+	for (slot = W_HashName (cleanname) & mask, n = 0 ; n <= mask ; slot = (slot+1) & mask, n++)
+	{
+		first = m_pHash[slot];
+		if (first == -1)
+			return -1;
+		if (memcmp (m_pEntries[first].name, cleanname, sizeof(cleanname)))
+			continue;
+
+		for (i = first + 1 ; i < m_pHeader->numentries ; i++)
+		{
+			if (memcmp (m_pEntries[i].name, cleanname, sizeof(cleanname)))
+				break;
+		}
+		*count = i - first;
+		return first;
+	}
+
+	return -1;
+}
+
+
+/*
+====================
+WadIndex_StatFile
+====================
+*/
+bool WadIndex_StatFile (const char *filename, long long *filesize, long long *mtime)
+{
+	struct stat	st;
+
+	if (stat (filename, &st) == -1)
+		return false;
+	*filesize = st.st_size;
+	*mtime = st.st_mtime;
+	return true;
+}
+
+
+/*
+====================
+WadIndex::IsWadCurrent
+====================
+*/
+bool WadIndex::IsWadCurrent (int wad) const
+{
+	const wadindexwad_t	*w;
+	long long			filesize, mtime;
+
+	w = WadInfo (wad);
+	if (!WadIndex_StatFile (WadName (wad), &filesize, &mtime))
+		return false;
+	return filesize == w->filesize && mtime == w->mtime;
+}
+
+
+/*
+============================================================================
+
+							INDEX BUILDING
+
+============================================================================
+*/
+
+typedef struct
+{
+	const char			*name;
+	long long			filesize;
+	long long			mtime;
+	qboolean			ok;
+	qboolean			reused;			// entries came from the old index
+	int					numlumps;
+	wadindexentry_t		*entries;
+	char				error[256];
+} indexwad_t;
+
+static indexwad_t	*indexwads;
+
+
+/*
+====================
+IndexReadWad
+
+Reads one wad's directory into index entries
+====================
+*/
+static void IndexReadWad (int, int w)
+{
+	indexwad_t			*iw;
+	WadReader			wad;
+	const lumpinfo_t	*l;
+	wadindexentry_t		*e;
+	int					i;
+
+	iw = &indexwads[w];
+	if (iw->reused)
+		return;
+
+	// stat first, so a wad that changes while it's read looks stale next time
+	if (!WadIndex_StatFile (iw->name, &iw->filesize, &iw->mtime))
+	{
+		snprintf (iw->error, sizeof(iw->error), "Error opening %s", iw->name);
+		return;
+	}
+	if (!wad.Open (iw->name))
+	{
+		snprintf (iw->error, sizeof(iw->error), "%s", wad.GetError ());
+		return;
+	}
+
+	iw->numlumps = wad.NumLumps ();
+	iw->entries = (wadindexentry_t *)malloc ((iw->numlumps + 1) * sizeof(wadindexentry_t));
+	for (i = 0 ; i < iw->numlumps ; i++)
+	{
+		l = wad.LumpInfo (i);
+		e = &iw->entries[i];
+		memset (e, 0, sizeof(*e));
+		CleanupName ((char *)l->name, e->name);
+		e->wad = w;
+		e->lump = i;
+		e->filepos = l->filepos;
+		e->disksize = l->disksize;
+		e->size = l->size;
+		e->type = l->type;
+		e->compression = l->compression;
+	}
+	iw->ok = true;
+}
+
+
+/*
+====================
+ReuseOldIndex
+
+Takes the entries of every wad the old index has that is still the same
+size and age
+====================
+*/
+static void ReuseOldIndex (WadIndex *old, int numwads)
+{
+	const wadindexentry_t	*e;
+	int						*remap, *filled;
+	int						i, j, w;
+	long long				filesize, mtime;
+
+	remap = (int *)malloc ((old->NumWads () + 1) * sizeof(int));
+	for (i = 0 ; i < old->NumWads () ; i++)
+	{
+		remap[i] = -1;
+		if (!WadIndex_StatFile (old->WadName (i), &filesize, &mtime)
+		|| filesize != old->WadInfo (i)->filesize || mtime != old->WadInfo (i)->mtime)
+			continue;
+
+		for (j = 0 ; j < numwads ; j++)
+		{
+			if (!indexwads[j].reused && !strcmp (indexwads[j].name, old->WadName (i)))
+				break;
+		}
+		if (j == numwads)
+			continue;
+
+		remap[i] = j;
+		indexwads[j].reused = indexwads[j].ok = true;
+		indexwads[j].filesize = filesize;
+		indexwads[j].mtime = mtime;
+		indexwads[j].numlumps = old->WadInfo (i)->numlumps;
+		indexwads[j].entries = (wadindexentry_t *)malloc ((indexwads[j].numlumps + 1) * sizeof(wadindexentry_t));
+	}
+
+	// the entries are in name order, put them back in lump order
+	filled = (int *)calloc (numwads + 1, sizeof(int));
+	for (i = 0 ; i < old->NumEntries () ; i++)
+	{
+		e = old->Entry (i);
+		w = remap[e->wad];
+		if (w == -1 || (unsigned)e->lump >= (unsigned)indexwads[w].numlumps)
+			continue;
+		indexwads[w].entries[e->lump] = *e;
+		indexwads[w].entries[e->lump].wad = w;
+		filled[w]++;
+	}
+
+	// an index that doesn't account for every lump gets the wad read again
+	for (i = 0 ; i < old->NumWads () ; i++)
+	{
+		w = remap[i];
+		if (w != -1 && filled[w] != indexwads[w].numlumps)
+		{
+			free (indexwads[w].entries);
+			indexwads[w].entries = NULL;
+			indexwads[w].reused = indexwads[w].ok = false;
+		}
+	}
+
+	free (filled);
+	free (remap);
+}
+
+
+static int CompareIndexEntries (const void *a, const void *b)
+{
+	const wadindexentry_t	*ea = (const wadindexentry_t *)a;
+	const wadindexentry_t	*eb = (const wadindexentry_t *)b;
+	int						c;
+
+	c = memcmp (ea->name, eb->name, sizeof(ea->name));
+	if (c)
+		return c;
+	if (ea->wad != eb->wad)
+		return ea->wad - eb->wad;
+	return ea->lump - eb->lump;
+}
+
+
+/*
+====================
+WadIndex_Build
+====================
+*/
+int WadIndex_Build (const char *filename, int numwads, char **wadnames)
+{
+	WadIndex			old;
+	wadindexheader_t	h;
+	wadindexwad_t		*wads;
+	wadindexentry_t		*entries;
+	int					*hash;
+	char				*strings;
+	char				tempname[1024+8];
+	int					i, j, slot, numentries, numreused, numbad, mask;
+	FILE				*f;
+
+	indexwads = (indexwad_t *)calloc (numwads + 1, sizeof(indexwad_t));
+	for (i = 0 ; i < numwads ; i++)
+		indexwads[i].name = wadnames[i];
+
+	numreused = 0;
+	if (old.Open (filename))
+	{
+		ReuseOldIndex (&old, numwads);
+		old.Close ();		// so it can be replaced
+		for (i = 0 ; i < numwads ; i++)
+			numreused += indexwads[i].reused;
+	}
+
+	ThreadSetDefault ();
+	RunThreadsOnIndividual (numwads, false, IndexReadWad);
+
+	// gather every lump of every wad that could be read
+	memset (&h, 0, sizeof(h));
+	numentries = numbad = 0;
+	h.stringsize = 1;
+	for (i = 0 ; i < numwads ; i++)
+	{
+		if (!indexwads[i].ok)
+		{
+			printf ("%s\n", indexwads[i].error);
+			numbad++;
+			continue;
+		}
+		numentries += indexwads[i].numlumps;
+		h.stringsize += strlen (indexwads[i].name) + 1;
+	}
+
+	wads = (wadindexwad_t *)calloc (numwads + 1, sizeof(wadindexwad_t));
+	entries = (wadindexentry_t *)malloc ((numentries + 1) * sizeof(wadindexentry_t));
+	strings = (char *)calloc (h.stringsize + 3, 1);
+	h.stringsize = 1;		// offset 0 is the empty string
+	numentries = 0;
+
+	for (i = j = 0 ; i < numwads ; i++)
+	{
+		if (!indexwads[i].ok)
+			continue;
+
+		wads[j].filesize = indexwads[i].filesize;
+		wads[j].mtime = indexwads[i].mtime;
+		wads[j].numlumps = indexwads[i].numlumps;
+		wads[j].nameofs = h.stringsize;
+		strcpy (strings + h.stringsize, indexwads[i].name);
+		h.stringsize += strlen (indexwads[i].name) + 1;
+
+		memcpy (entries + numentries, indexwads[i].entries, indexwads[i].numlumps * sizeof(wadindexentry_t));
+		for (slot = 0 ; slot < indexwads[i].numlumps ; slot++)
+			entries[numentries + slot].wad = j;
+		numentries += indexwads[i].numlumps;
+		j++;
+	}
+
+	qsort (entries, numentries, sizeof(wadindexentry_t), CompareIndexEntries);
+
+	// hash the first entry of every run of names, at most half full
+	for (h.hashsize = 16 ; h.hashsize < numentries*2 ; h.hashsize <<= 1)
+		;
+	mask = h.hashsize - 1;
+	hash = (int *)malloc (h.hashsize * sizeof(int));
+	memset (hash, -1, h.hashsize * sizeof(int));
+	for (i = 0 ; i < numentries ; i++)
+	{
+		if (i && !memcmp (entries[i].name, entries[i-1].name, sizeof(entries[i].name)))
+			continue;
+		for (slot = W_HashName (entries[i].name) & mask ; hash[slot] != -1 ; slot = (slot+1) & mask)
+			;
+		hash[slot] = i;
+	}
+
+	h.ident = WADINDEX_IDENT;
+	h.version = WADINDEX_VERSION;
+	h.numwads = j;
+	h.wadofs = sizeof(h);
+	h.numentries = numentries;
+	h.entryofs = h.wadofs + h.numwads * sizeof(wadindexwad_t);
+	h.hashofs = h.entryofs + h.numentries * sizeof(wadindexentry_t);
+	h.stringofs = h.hashofs + h.hashsize * sizeof(int);
+
+	// written under a temporary name so a reader never sees half an index
+	snprintf (tempname, sizeof(tempname), "%s.tmp", filename);
+	f = SafeOpenWrite (tempname);
+	SafeWrite (f, &h, sizeof(h));
+	SafeWrite (f, wads, h.numwads * sizeof(wadindexwad_t));
+	SafeWrite (f, entries, h.numentries * sizeof(wadindexentry_t));
+	SafeWrite (f, hash, h.hashsize * sizeof(int));
+	SafeWrite (f, strings, h.stringsize);
+	if (fclose (f))
+		Error ("File write failure: %s", tempname);
+
+#ifdef _WIN32
+	if (!MoveFileEx (tempname, filename, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+		Error ("Error renaming %s to %s", tempname, filename);
+#else
+	if (rename (tempname, filename))
+		Error ("Error renaming %s to %s: %s", tempname, filename, strerror(errno));
+#endif
+
+	printf ("%s: %i wads (%i unchanged), %i lumps\n", filename, h.numwads, numreused, numentries);
+
+	for (i = 0 ; i < numwads ; i++)
+		free (indexwads[i].entries);
+	free (indexwads);
+	indexwads = NULL;
+	free (hash);
+	free (strings);
+	free (entries);
+	free (wads);
+
+	return numbad;
+}
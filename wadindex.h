@@ -0,0 +1,125 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: 
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+
+// wadindex.h
+
+#ifndef WADINDEX_H
+#define WADINDEX_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+
+//
+// A sidecar file holding the directories of a whole set of wads, so a
+// texture can be found without opening any of them.  Every lump is one
+// entry; the entries are sorted by cleaned up name (then by the order the
+// wads were given in) and a hash table points at the first entry for each
+// name.  The file is used in place through a read only mapping.
+//
+// Each wad's size and modification time are recorded when its directory is
+// read, so a wad that has changed since can be spotted with a stat.
+//
+
+#define	WADINDEX_IDENT		(('X'<<24)+('D'<<16)+('I'<<8)+'W')	// "WIDX"
+#define	WADINDEX_VERSION	1
+
+typedef struct
+{
+	int			ident;
+	int			version;
+	int			numwads;
+	int			wadofs;
+	int			numentries;
+	int			entryofs;
+	int			hashsize;				// power of two, slots hold entry numbers, -1 is empty
+	int			hashofs;
+	int			stringsize;				// wad file names
+	int			stringofs;
+} wadindexheader_t;
+
+typedef struct
+{
+	long long	filesize;
+	long long	mtime;
+	int			nameofs;				// into the string block
+	int			numlumps;
+} wadindexwad_t;
+
+typedef struct
+{
+	char		name[16];				// CleanupName'd
+	int			wad;
+	int			lump;
+	int			filepos;
+	int			disksize;
+	int			size;
+	char		type;
+	char		compression;
+	char		pad1, pad2;
+} wadindexentry_t;
+
+
+class WadIndex
+{
+public:
+	WadIndex ();
+	~WadIndex ();
+
+	bool					Open (const char *filename);	// false with GetError() set on failure
+	void					Close ();
+	const char				*GetError () const { return m_szError; }
+
+	int						NumWads () const { return m_pHeader ? m_pHeader->numwads : 0; }
+	const char				*WadName (int wad) const;
+	const wadindexwad_t		*WadInfo (int wad) const;
+	int						NumEntries () const { return m_pHeader ? m_pHeader->numentries : 0; }
+	const wadindexentry_t	*Entry (int entry) const;
+
+	// Returns the first entry with the name and sets count to the number of
+	// wads that have it, in the order the index was built with.  -1 if no wad
+	// has it.
+	int						Find (const char *name, int *count) const;
+
+	// Stats the wad and compares it against what the index recorded
+	bool					IsWadCurrent (int wad) const;
+
+private:
+	WadIndex (const WadIndex &);
+	WadIndex &operator= (const WadIndex &);
+
+	bool					SetError (const char *fmt, ...);
+
+	const byte				*m_pData;
+	int						m_nDataSize;
+	bool					m_bMapped;				// else m_pData was malloc'd
+#ifdef _WIN32
+	void					*m_hFile;
+	void					*m_hMapping;
+#endif
+
+	const wadindexheader_t	*m_pHeader;
+	const wadindexwad_t		*m_pWads;
+	const wadindexentry_t	*m_pEntries;
+	const int				*m_pHash;
+	const char				*m_pStrings;
+
+	char					m_szError[256];
+};
+
+// Stats a file the same way the index does.  False if it can't be found.
+bool	WadIndex_StatFile (const char *filename, long long *filesize, long long *mtime);
+
+// Writes an index of the wads' directories.  If filename already holds an
+// index, wads it lists that haven't changed are copied across instead of
+// being opened again.  Wads that can't be read are reported and left out.
+// Returns the number left out.
+int		WadIndex_Build (const char *filename, int numwads, char **wadnames);
+
+
+#endif // WADINDEX_H
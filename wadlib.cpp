@@ -21,8 +21,16 @@
 #ifdef NeXT
 #include <libc.h>
 #endif
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
 #include "goldsrc_standin.h"
 #include "wadlib.h"
+#include "lzsslib.h"
 
 /*
 ============================================================================
@@ -33,107 +41,400 @@
 */
 
 
+// The W_ functions below are a thin layer over this reader, and these globals
+// mirror its directory for the code that still looks at them directly.
+static WadReader	defaultwad;
+
 lumpinfo_t		*lumpinfo;		// location of each lump on disk
 int				numlumps;
 
 wadinfo_t		header;
-FILE			*wadhandle;
 
 
 /*
 ====================
-W_OpenWad
+W_HashName
+
+Hashes a name that has been through CleanupName
 ====================
 */
-void W_OpenWad (const char *filename)
+unsigned W_HashName (const char *cleanname)
+{
+	unsigned long long	a, b;
+
+	memcpy (&a, cleanname, 8);
+	memcpy (&b, cleanname + 8, 8);
+	a = (a ^ (b * 0x9E3779B97F4A7C15ull)) * 0xBF58476D1CE4E5B9ull;
+	return (unsigned)(a >> 32);
+}
+
+
+/*
+====================
+W_HashData
+
+64 bit hash of a block of memory, for spotting lumps with the same contents
+====================
+*/
+unsigned long long W_HashData (const void *data, int length)
+{
+	const byte			*p = (const byte *)data;
+	unsigned long long	h, v;
+
+	h = 0x9E3779B97F4A7C15ull ^ (unsigned long long)length;
+	for ( ; length >= 8 ; p += 8, length -= 8)
+	{
+		memcpy (&v, p, 8);
+		h ^= v * 0x87C37B91114253D5ull;
+		h = ((h << 31) | (h >> 33)) * 0x4CF5AD432745937Full;
+	}
+	for ( ; length > 0 ; p++, length--)
+		h = (h ^ *p) * 0x100000001B3ull;
+
+	// final avalanche so every input bit reaches the low bits of the table index
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDull;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+
+WadReader::WadReader ()
+{
+	m_pLumpInfo = NULL;
+	m_nLumps = 0;
+	memset (&m_Header, 0, sizeof(m_Header));
+	m_pMapping = NULL;
+	m_nFileSize = 0;
+#ifdef _WIN32
+	m_hFile = INVALID_HANDLE_VALUE;
+	m_hMapping = NULL;
+#else
+	m_nFile = -1;
+#endif
+	m_pKeys = NULL;
+	m_pHash = NULL;
+	m_pNextSame = NULL;
+	m_nHashMask = 0;
+	m_szError[0] = 0;
+}
+
+
+WadReader::~WadReader ()
+{
+	Close ();
+}
+
+
+/*
+====================
+WadReader::SetError
+
+Records why Open failed, always returns false
+====================
+*/
+bool WadReader::SetError (const char *fmt, ...)
+{
+	va_list		argptr;
+
+	va_start (argptr, fmt);
+	vsnprintf (m_szError, sizeof(m_szError), fmt, argptr);
+	va_end (argptr);
+	return false;
+}
+
+
+/*
+====================
+WadReader::ReadAt
+
+Positional read that leaves no shared file pointer behind, so any number of
+threads can read through the same reader.  Returns false on a short read.
+====================
+*/
+bool WadReader::ReadAt (void *dest, int length, int offset) const
+{
+	byte	*out = (byte *)dest;
+
+	if (m_pMapping)
+	{
+		if (offset < 0 || length < 0 || offset > m_nFileSize - length)
+			return false;
+		memcpy (dest, m_pMapping + offset, length);
+		return true;
+	}
+
+	while (length > 0)
+	{
+#ifdef _WIN32
+		OVERLAPPED	ov;
+		DWORD		got;
+
+		memset (&ov, 0, sizeof(ov));
+		ov.Offset = (DWORD)offset;
+		if (!ReadFile ((HANDLE)m_hFile, out, (DWORD)length, &got, &ov) || !got)
+			return false;
+#else
+		ssize_t		got;
+
+		got = pread (m_nFile, out, length, offset);
+		if (got <= 0)
+		{
+			if (got == -1 && errno == EINTR)
+				continue;
+			return false;
+		}
+#endif
+		out += got;
+		offset += (int)got;
+		length -= (int)got;
+	}
+	return true;
+}
+
+
+/*
+====================
+WadReader::MapFile
+
+Opens the file and maps the whole thing read only.  If the mapping can't be
+made the file stays open and lumps are read with ReadAt instead.
+====================
+*/
+bool WadReader::MapFile (const char *filename)
+{
+#ifdef _WIN32
+	LARGE_INTEGER	size;
+
+	m_hFile = CreateFile (filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (m_hFile == INVALID_HANDLE_VALUE)
+		return SetError ("Error opening %s", filename);
+
+	if (!GetFileSizeEx ((HANDLE)m_hFile, &size) || size.QuadPart > 0x7fffffff)
+		return SetError ("Wad file %s is too large", filename);
+	m_nFileSize = (int)size.QuadPart;
+
+	if (m_nFileSize > 0)
+	{
+		m_hMapping = CreateFileMapping ((HANDLE)m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (m_hMapping)
+		{
+			m_pMapping = (byte *)MapViewOfFile ((HANDLE)m_hMapping, FILE_MAP_READ, 0, 0, 0);
+			if (!m_pMapping)
+			{
+				CloseHandle ((HANDLE)m_hMapping);
+				m_hMapping = NULL;
+			}
+		}
+	}
+#else
+	struct stat	st;
+	void		*p;
+
+	m_nFile = open (filename, O_RDONLY);
+	if (m_nFile == -1)
+		return SetError ("Error opening %s: %s", filename, strerror(errno));
+
+	if (fstat (m_nFile, &st) == -1 || st.st_size > 0x7fffffff)
+		return SetError ("Wad file %s is too large", filename);
+	m_nFileSize = (int)st.st_size;
+
+	if (m_nFileSize > 0)
+	{
+		p = mmap (NULL, m_nFileSize, PROT_READ, MAP_SHARED, m_nFile, 0);
+		if (p != MAP_FAILED)
+			m_pMapping = (byte *)p;
+	}
+#endif
+	return true;
+}
+
+
+/*
+====================
+WadReader::BuildNameHash
+
+Builds the name index used by CheckNumForName.  The table is kept at most
+half full, and when names repeat the first lump wins like the old linear
+search did, with the later ones chained after it for NextNumForName.
+====================
+*/
+void WadReader::BuildNameHash ()
+{
+	int			i, size, slot, j;
+
+	for (size = 16 ; size < m_nLumps*2 ; size <<= 1)
+		;
+	m_nHashMask = size - 1;
+	m_pHash = (int *)malloc (size * sizeof(*m_pHash));
+	memset (m_pHash, -1, size * sizeof(*m_pHash));
+
+	m_pKeys = (char (*)[16])malloc (m_nLumps * sizeof(*m_pKeys));
+	m_pNextSame = (int *)malloc (m_nLumps * sizeof(*m_pNextSame));
+	for (i=0 ; i<m_nLumps ; i++)
+	{
+		CleanupName (m_pLumpInfo[i].name, m_pKeys[i]);
+		m_pNextSame[i] = -1;
+
+		for (slot = W_HashName (m_pKeys[i]) & m_nHashMask ; (j = m_pHash[slot]) != -1 ; slot = (slot+1) & m_nHashMask)
+		{
+			if (!memcmp (m_pKeys[j], m_pKeys[i], sizeof(m_pKeys[i])))
+				break;
+		}
+		if (j == -1)
+		{
+			m_pHash[slot] = i;
+			continue;
+		}
+		while (m_pNextSame[j] != -1)
+			j = m_pNextSame[j];
+		m_pNextSame[j] = i;
+	}
+}
+
+
+/*
+====================
+WadReader::Open
+
+Maps the whole file if it can, reads the header and directory, and indexes
+the names.  Returns false with GetError() set if the file is not a usable
+wad.
+====================
+*/
+bool WadReader::Open (const char *filename)
 {
 	lumpinfo_t		*lump_p;
 	int	i;
 	int				length;
 
+	Close ();
+	m_szError[0] = 0;
+
 //
 // open the file and add to directory
 //	
-	wadhandle = SafeOpenRead ((char*)filename);
-	SafeRead (wadhandle, &header, sizeof(header));
+	if (!MapFile (filename))
+		return false;
+
+	if (!ReadAt (&m_Header, sizeof(m_Header), 0))
+		return SetError ("Wad file %s is truncated", filename);
 
-	if (strncmp(header.identification,"WAD2",4) &&
-		strncmp(header.identification, "WAD3", 4))
-		Error ("Wad file %s doesn't have WAD2/WAD3 id\n",filename);
+	if (strncmp(m_Header.identification,"WAD2",4) &&
+		strncmp(m_Header.identification, "WAD3", 4))
+		return SetError ("Wad file %s doesn't have WAD2/WAD3 id",filename);
 		
-	header.numlumps = LittleLong(header.numlumps);
-	header.infotableofs = LittleLong(header.infotableofs);
+	m_Header.numlumps = LittleLong(m_Header.numlumps);
+	m_Header.infotableofs = LittleLong(m_Header.infotableofs);
 
-	numlumps = header.numlumps;
+	m_nLumps = m_Header.numlumps;
+	if (m_nLumps < 0 || m_nLumps > m_nFileSize / (int)sizeof(lumpinfo_t))
+		return SetError ("Wad file %s has a bad lump count", filename);
 
-	length = numlumps*sizeof(lumpinfo_t);
-	lumpinfo = (lumpinfo_t*)malloc (length);
-	lump_p = lumpinfo;
+	length = m_nLumps*sizeof(lumpinfo_t);
+	m_pLumpInfo = (lumpinfo_t*)malloc (length);
+	lump_p = m_pLumpInfo;
 	
-	fseek (wadhandle, header.infotableofs, SEEK_SET);
-	SafeRead (wadhandle, lumpinfo, length);
+	if (!ReadAt (m_pLumpInfo, length, m_Header.infotableofs))
+		return SetError ("Wad file %s has a truncated directory", filename);
 
 //
 // Fill in lumpinfo
 //
 	
-	for (i=0 ; i<numlumps ; i++,lump_p++)
+	for (i=0 ; i<m_nLumps ; i++,lump_p++)
 	{
 		lump_p->filepos = LittleLong(lump_p->filepos);
+		lump_p->disksize = LittleLong(lump_p->disksize);
 		lump_p->size = LittleLong(lump_p->size);
 	}
+
+	BuildNameHash ();
+	return true;
 }
 
 
-void CleanupName (char *in, char *out)
+/*
+====================
+WadReader::Close
+
+Releases the mapping, the file and the directory.  Safe to call on a closed
+reader.
+====================
+*/
+void WadReader::Close ()
 {
-	int		i;
-	
-	for (i=0 ; i<sizeof( ((lumpinfo_t *)0)->name ) ; i++ )
-	{
-		if (!in[i])
-			break;
-			
-		out[i] = toupper(in[i]);
-	}
-	
-	for ( ; i<sizeof( ((lumpinfo_t *)0)->name ); i++ )
-		out[i] = 0;
+#ifdef _WIN32
+	if (m_pMapping)
+		UnmapViewOfFile (m_pMapping);
+	if (m_hMapping)
+		CloseHandle ((HANDLE)m_hMapping);
+	if (m_hFile != INVALID_HANDLE_VALUE)
+		CloseHandle ((HANDLE)m_hFile);
+	m_hMapping = NULL;
+	m_hFile = INVALID_HANDLE_VALUE;
+#else
+	if (m_pMapping)
+		munmap (m_pMapping, m_nFileSize);
+	if (m_nFile != -1)
+		close (m_nFile);
+	m_nFile = -1;
+#endif
+	m_pMapping = NULL;
+	m_nFileSize = 0;
+
+	free (m_pLumpInfo);
+	m_pLumpInfo = NULL;
+	m_nLumps = 0;
+	memset (&m_Header, 0, sizeof(m_Header));
+
+	free (m_pKeys);
+	m_pKeys = NULL;
+	free (m_pHash);
+	m_pHash = NULL;
+	free (m_pNextSame);
+	m_pNextSame = NULL;
+	m_nHashMask = 0;
+}
+
+
+/*
+====================
+WadReader::LumpInfo
+====================
+*/
+const lumpinfo_t *WadReader::LumpInfo (int lump) const
+{
+	if ((unsigned)lump >= (unsigned)m_nLumps)
+		Error ("WadReader::LumpInfo: %i >= numlumps",lump);
+	return m_pLumpInfo + lump;
 }
 
 
 /*
 ====================
-W_CheckNumForName
+WadReader::CheckNumForName
 
-Returns -1 if name not found
+Returns -1 if name not found.  Names are compared after CleanupName on both
+sides, so the lookup is case insensitive.
 ====================
 */
-int	W_CheckNumForName (char *name)
+int WadReader::CheckNumForName (const char *name) const
 {
 	char	cleanname[16];
-	int		v1,v2, v3, v4;
-	int		i;
-	lumpinfo_t	*lump_p;
+	int		slot, i;
 	
-	CleanupName (name, cleanname);
-	
-// make the name into four integers for easy compares
-
-	v1 = *(int *)cleanname;
-	v2 = *(int *)&cleanname[4];
-	v3 = *(int *)&cleanname[8];
-	v4 = *(int *)&cleanname[12];
+	if (!m_pHash)
+		return -1;
 
-// find it
-
-	lump_p = lumpinfo;
-	for (i=0 ; i<numlumps ; i++, lump_p++)
+	CleanupName ((char *)name, cleanname);
+	
+	for (slot = W_HashName (cleanname) & m_nHashMask ; (i = m_pHash[slot]) != -1 ; slot = (slot+1) & m_nHashMask)
 	{
-		if ( *(int *)lump_p->name == v1
-		&& *(int *)&lump_p->name[4] == v2
-		&& *(int *)&lump_p->name[8] == v3
-		&& *(int *)&lump_p->name[12] == v4)
+		if (!memcmp (m_pKeys[i], cleanname, sizeof(cleanname)))
 			return i;
 	}
 
@@ -143,16 +444,31 @@ int	W_CheckNumForName (char *name)
 
 /*
 ====================
-W_GetNumForName
+WadReader::NextNumForName
 
-Calls W_CheckNumForName, but bombs out if not found
+The next lump after one CheckNumForName found with the same name, or -1
 ====================
 */
-int	W_GetNumForName (char *name)
+int WadReader::NextNumForName (int lump) const
+{
+	if (!m_pNextSame || lump < 0 || lump >= m_nLumps)
+		return -1;
+	return m_pNextSame[lump];
+}
+
+
+/*
+====================
+WadReader::GetNumForName
+
+Calls CheckNumForName, but bombs out if not found
+====================
+*/
+int WadReader::GetNumForName (const char *name) const
 {
 	int	i;
 
-	i = W_CheckNumForName (name);
+	i = CheckNumForName (name);
 	if (i != -1)
 		return i;
 
@@ -163,54 +479,79 @@ int	W_GetNumForName (char *name)
 
 /*
 ====================
-W_LumpLength
+WadReader::LumpLength
 
 Returns the buffer size needed to load the given lump
 ====================
 */
-int W_LumpLength (int lump)
+int WadReader::LumpLength (int lump) const
 {
-	if (lump >= numlumps)
-		Error ("W_LumpLength: %i >= numlumps",lump);
-	return lumpinfo[lump].size;
+	return LumpInfo (lump)->size;
 }
 
 
 /*
 ====================
-W_ReadLumpNum
+WadReader::ReadLumpNum
 
-Loads the lump into the given buffer, which must be >= W_LumpLength()
+Loads the lump into the given buffer, which must be >= LumpLength().
+CMP_LZSS lumps are decompressed straight into it.
 ====================
 */
-void W_ReadLumpNum (int lump, void *dest)
+void WadReader::ReadLumpNum (int lump, void *dest) const
 {
-	lumpinfo_t	*l;
+	const lumpinfo_t	*l;
+	byte				*packed;
+	qboolean			ok;
 	
-	if (lump >= numlumps)
-		Error ("W_ReadLump: %i >= numlumps",lump);
-	l = lumpinfo+lump;
-	
-	fseek (wadhandle, l->filepos, SEEK_SET);
-	SafeRead (wadhandle, dest, l->size);
-}
+	l = LumpInfo (lump);
 
+	switch (l->compression)
+	{
+	case CMP_NONE:
+		if (!ReadAt (dest, l->size, l->filepos))
+			Error ("File read failure: lump %i extends past the end of the file",lump);
+		break;
+
+	case CMP_LZSS:
+		if (l->filepos < 0 || l->disksize < 0 || l->filepos > m_nFileSize - l->disksize)
+			Error ("File read failure: lump %i extends past the end of the file",lump);
+
+		if (m_pMapping)
+		{
+			ok = LZSS_Decompress (m_pMapping + l->filepos, l->disksize, (byte *)dest, l->size);
+		}
+		else
+		{
+			packed = (byte *)malloc (l->disksize);
+			if (!ReadAt (packed, l->disksize, l->filepos))
+				Error ("File read failure: lump %i",lump);
+			ok = LZSS_Decompress (packed, l->disksize, (byte *)dest, l->size);
+			free (packed);
+		}
+		if (!ok)
+			Error ("Lump %i (%.16s) has corrupt LZSS data",lump,l->name);
+		break;
+
+	default:
+		Error ("Lump %i (%.16s) has unknown compression %i",lump,l->name,l->compression);
+	}
+}
 
 
 /*
 ====================
-W_LoadLumpNum
+WadReader::LoadLumpNum
+
+Returns a malloc'd copy of the lump
 ====================
 */
-void	*W_LoadLumpNum (int lump)
+void *WadReader::LoadLumpNum (int lump) const
 {
 	void	*buf;
 	
-	if ((unsigned)lump >= (unsigned)numlumps)
-		Error ("W_CacheLumpNum: %i >= numlumps",lump);
-		
-	buf = malloc (W_LumpLength (lump));
-	W_ReadLumpNum (lump, buf);
+	buf = malloc (LumpLength (lump));
+	ReadLumpNum (lump, buf);
 	
 	return buf;
 }
@@ -218,12 +559,261 @@ void	*W_LoadLumpNum (int lump)
 
 /*
 ====================
-W_LoadLumpName
+WadReader::MapLumpNum
+
+Points the view straight into the mapped file, no copy is made.  Returns
+false if the wad isn't mapped or the lump is compressed, so the caller has
+to ReadLumpNum it instead.  The view is valid until Close.
+====================
+*/
+bool WadReader::MapLumpNum (int lump, lumpview_t *view) const
+{
+	const lumpinfo_t	*l;
+
+	l = LumpInfo (lump);
+	if (!m_pMapping || l->compression != CMP_NONE)
+		return false;
+
+	if (l->filepos < 0 || l->size < 0 || l->filepos > m_nFileSize - l->size)
+		Error ("W_MapLumpNum: %i extends past the end of the file",lump);
+
+	view->data = m_pMapping + l->filepos;
+	view->length = l->size;
+	return true;
+}
+
+
+/*
+====================
+WadReader::ReadLumpHead
+
+Reads just the first length bytes of the lump, decompressing only as much of
+a CMP_LZSS lump as they need.  Unlike ReadLumpNum, a bad lump returns false
+rather than being an error.
 ====================
 */
+bool WadReader::ReadLumpHead (int lump, void *dest, int length) const
+{
+	const lumpinfo_t	*l;
+	byte				*packed;
+	int					packedlength;
+	bool				ok;
+
+	l = LumpInfo (lump);
+	if (l->size < length || l->filepos < 0 || l->disksize < 0)
+		return false;
+
+	switch (l->compression)
+	{
+	case CMP_NONE:
+		return ReadAt (dest, length, l->filepos);
+
+	case CMP_LZSS:
+		if (l->filepos > m_nFileSize - l->disksize)
+			return false;
+		if (m_pMapping)
+			return LZSS_DecompressHead (m_pMapping + l->filepos, l->disksize, (byte *)dest, length) != 0;
+
+		packedlength = l->disksize < LZSS_BOUND(length) ? l->disksize : LZSS_BOUND(length);
+		packed = (byte *)malloc (packedlength);
+		ok = ReadAt (packed, packedlength, l->filepos)
+			&& LZSS_DecompressHead (packed, packedlength, (byte *)dest, length);
+		free (packed);
+		return ok;
+
+	default:
+		return false;
+	}
+}
+
+
+/*
+====================
+WadReader::ReadStoredLump
+====================
+*/
+bool WadReader::ReadStoredLump (int lump, void *dest) const
+{
+	const lumpinfo_t	*l;
+
+	l = LumpInfo (lump);
+	if (l->filepos < 0 || l->disksize < 0 || l->filepos > m_nFileSize - l->disksize)
+		return false;
+	return ReadAt (dest, l->disksize, l->filepos);
+}
+
+
+/*
+====================
+WadReader::MapStoredLump
+====================
+*/
+bool WadReader::MapStoredLump (int lump, lumpview_t *view) const
+{
+	const lumpinfo_t	*l;
+
+	l = LumpInfo (lump);
+	if (!m_pMapping)
+		return false;
+	if (l->filepos < 0 || l->disksize < 0 || l->filepos > m_nFileSize - l->disksize)
+		return false;
+
+	view->data = m_pMapping + l->filepos;
+	view->length = l->disksize;
+	return true;
+}
+
+
+/*
+====================
+WadReader::PrefetchLumpNum
+
+Has the system start reading the lump's pages of the mapping in the
+background, so they're already in memory when it's mapped.  Returns at
+once, and does nothing if the file isn't mapped or the system can't.
+====================
+*/
+#ifdef _WIN32
+typedef struct
+{
+	PVOID	VirtualAddress;
+	SIZE_T	NumberOfBytes;
+} prefetchrange_t;
+
+typedef BOOL (WINAPI *prefetchfunc_t) (HANDLE process, ULONG_PTR count, prefetchrange_t *ranges, ULONG flags);
+
+static prefetchfunc_t	prefetchfunc;
+static qboolean			prefetchinit;
+#endif
+
+void WadReader::PrefetchLumpNum (int lump) const
+{
+	const lumpinfo_t	*l;
+
+	l = LumpInfo (lump);
+	if (!m_pMapping || l->filepos < 0 || l->disksize <= 0 || l->filepos > m_nFileSize - l->disksize)
+		return;
+
+#ifdef _WIN32
+	prefetchrange_t	range;
+
+	// Windows 8 and later; the race to look it up finds the same thing
+	if (!prefetchinit)
+	{
+		prefetchfunc = (prefetchfunc_t)GetProcAddress (GetModuleHandle ("kernel32.dll"), "PrefetchVirtualMemory");
+		prefetchinit = true;
+	}
+	if (!prefetchfunc)
+		return;
+	range.VirtualAddress = m_pMapping + l->filepos;
+	range.NumberOfBytes = l->disksize;
+	prefetchfunc (GetCurrentProcess (), 1, &range, 0);
+#else
+	size_t	page, start;
+
+	page = (size_t)sysconf (_SC_PAGESIZE);
+	start = (size_t)l->filepos & ~(page - 1);
+	madvise (m_pMapping + start, l->filepos + l->disksize - start, MADV_WILLNEED);
+#endif
+}
+
+
+/*
+====================
+W_OpenWad
+====================
+*/
+void W_OpenWad (const char *filename)
+{
+	if (!defaultwad.Open (filename))
+		Error ("%s\n", defaultwad.GetError ());
+
+	lumpinfo = (lumpinfo_t *)defaultwad.Directory ();
+	numlumps = defaultwad.NumLumps ();
+	header = defaultwad.Header ();
+}
+
+
+/*
+====================
+W_CloseWad
+====================
+*/
+void W_CloseWad (void)
+{
+	defaultwad.Close ();
+	lumpinfo = NULL;
+	numlumps = 0;
+	memset (&header, 0, sizeof(header));
+}
+
+
+void CleanupName (char *in, char *out)
+{
+	int		i;
+	
+	for (i=0 ; i<sizeof( ((lumpinfo_t *)0)->name ) ; i++ )
+	{
+		if (!in[i])
+			break;
+			
+		out[i] = toupper(in[i]);
+	}
+	
+	for ( ; i<sizeof( ((lumpinfo_t *)0)->name ); i++ )
+		out[i] = 0;
+}
+
+
+int	W_CheckNumForName (char *name)
+{
+	return defaultwad.CheckNumForName (name);
+}
+
+int	W_GetNumForName (char *name)
+{
+	return defaultwad.GetNumForName (name);
+}
+
+int W_LumpLength (int lump)
+{
+	return defaultwad.LumpLength (lump);
+}
+
+void W_ReadLumpNum (int lump, void *dest)
+{
+	defaultwad.ReadLumpNum (lump, dest);
+}
+
+void	*W_LoadLumpNum (int lump)
+{
+	return defaultwad.LoadLumpNum (lump);
+}
+
 void	*W_LoadLumpName (char *name)
 {
-	return W_LoadLumpNum (W_GetNumForName(name));
+	return defaultwad.LoadLumpNum (defaultwad.GetNumForName (name));
+}
+
+qboolean W_MapLumpNum (int lump, lumpview_t *view)
+{
+	return defaultwad.MapLumpNum (lump, view);
+}
+
+
+/*
+====================
+W_ViewRange
+
+Returns a pointer to length bytes at offset in the view, or NULL if any of
+them fall outside of it
+====================
+*/
+const void *W_ViewRange (const lumpview_t *view, int offset, int length)
+{
+	if (offset < 0 || length < 0 || offset > view->length - length)
+		return NULL;
+	return view->data + offset;
 }
 
 
@@ -235,87 +825,434 @@ void	*W_LoadLumpName (char *name)
 ===============================================================================
 */
 
-FILE		*outwad;
+#define	WAD_WRITE_BUFFER	(1<<20)		// bytes gathered per write
+#define	WAD_BUFFER_ALIGN	4096
 
-lumpinfo_t	outinfo[4096];
-int			outlumps;
+// NewWad/AddLump/WriteWad go through this one
+static WadWriter	defaultwriter;
+
+
+WadWriter::WadWriter ()
+{
+	m_pFile = NULL;
+	m_szPath[0] = 0;
+	m_szTempPath[0] = 0;
+	m_pBufferBase = NULL;
+	m_pBuffer = NULL;
+	m_nBuffered = 0;
+	m_nOffset = 0;
+	m_pInfo = NULL;
+	m_nLumps = 0;
+	m_nMaxLumps = 0;
+	m_bBigEndian = false;
+	m_nAlignment = 1;
+	m_pPacked = NULL;
+	m_nPackedSize = 0;
+	m_bDedup = true;
+	m_pContentHash = NULL;
+	m_pDedupTable = NULL;
+	m_nDedupMask = 0;
+	m_nDedupEntries = 0;
+	m_pVerify = NULL;
+	m_nVerifySize = 0;
+	m_nDedupLumps = 0;
+	m_nDedupBytes = 0;
+}
+
+
+WadWriter::~WadWriter ()
+{
+	Abort ();
+	free (m_pBufferBase);
+	free (m_pInfo);
+	free (m_pPacked);
+	free (m_pContentHash);
+	free (m_pDedupTable);
+	free (m_pVerify);
+}
 
-short	(*wadshort) (short l);
-int		(*wadlong) (int l);
 
 /*
 ===============
-NewWad
+WadWriter::WadLong
 ===============
 */
+int WadWriter::WadLong (int l) const
+{
+	return m_bBigEndian ? BigLong (l) : LittleLong (l);
+}
 
-void NewWad (char *pathname, qboolean bigendien)
+
+/*
+===============
+WadWriter::Open
+
+Starts a new wad.  Everything goes to pathname.tmp until Commit renames it
+over pathname, so a failed or interrupted run never leaves a half written
+wad in place.  Lumps are padded to start on a multiple of alignment bytes.
+===============
+*/
+void WadWriter::Open (const char *pathname, qboolean bigendien, int alignment)
 {
-	outwad = SafeOpenWrite (pathname);
-	fseek (outwad, sizeof(wadinfo_t), SEEK_SET);
-	memset (outinfo, 0, sizeof(outinfo));
-	
-	if (bigendien)
+	wadinfo_t	placeholder;
+
+	Abort ();
+
+	if (alignment < 1 || (alignment & (alignment - 1)))
+		Error ("WadWriter: alignment %i is not a power of two", alignment);
+
+	snprintf (m_szPath, sizeof(m_szPath), "%s", pathname);
+	snprintf (m_szTempPath, sizeof(m_szTempPath), "%s.tmp", pathname);
+
+	// opened for update so duplicates can be checked against what was written
+	m_pFile = fopen (m_szTempPath, "w+b");
+	if (!m_pFile)
+		Error ("Error opening %s: %s", m_szTempPath, strerror(errno));
+
+	// we do our own buffering
+	setvbuf (m_pFile, NULL, _IONBF, 0);
+	if (!m_pBufferBase)
 	{
-		wadshort = BigShort;
-		wadlong = BigLong;
+		m_pBufferBase = (byte *)malloc (WAD_WRITE_BUFFER + WAD_BUFFER_ALIGN);
+		m_pBuffer = (byte *)(((size_t)m_pBufferBase + WAD_BUFFER_ALIGN - 1) & ~(size_t)(WAD_BUFFER_ALIGN - 1));
 	}
-	else
+	m_nBuffered = 0;
+	m_nOffset = 0;
+	m_nLumps = 0;
+	m_bBigEndian = bigendien ? true : false;
+	m_nAlignment = alignment;
+
+	if (m_pDedupTable)
+		memset (m_pDedupTable, -1, (m_nDedupMask + 1) * sizeof(*m_pDedupTable));
+	m_nDedupEntries = 0;
+	m_nDedupLumps = 0;
+	m_nDedupBytes = 0;
+
+	// the real header goes in at Commit, once the directory offset is known
+	memset (&placeholder, 0, sizeof(placeholder));
+	Write (&placeholder, sizeof(placeholder));
+}
+
+
+/*
+===============
+WadWriter::Flush
+===============
+*/
+void WadWriter::Flush ()
+{
+	if (m_nBuffered)
 	{
-		wadshort = LittleShort;
-		wadlong = LittleLong;
+		if (fwrite (m_pBuffer, 1, m_nBuffered, m_pFile) != (size_t)m_nBuffered)
+			Error ("File write failure: %s", m_szTempPath);
+		m_nBuffered = 0;
 	}
-	
-	outlumps = 0;
 }
 
 
 /*
 ===============
-AddLump
+WadWriter::Write
+
+Appends to the file through the write buffer.  Whole buffers go out at a
+time, so writes stay large and land on buffer sized boundaries.
 ===============
 */
+void WadWriter::Write (const void *data, int length)
+{
+	const byte	*in = (const byte *)data;
+	int			count;
 
-void	AddLump (char *name, void *buffer, int length, int type, int compress)
+	if (length > 0x7fffffff - m_nOffset)
+		Error ("WadWriter: %s would be larger than 2GB", m_szPath);
+	m_nOffset += length;
+
+	while (length > 0)
+	{
+		count = WAD_WRITE_BUFFER - m_nBuffered;
+		if (count > length)
+			count = length;
+		memcpy (m_pBuffer + m_nBuffered, in, count);
+		m_nBuffered += count;
+		in += count;
+		length -= count;
+
+		if (m_nBuffered == WAD_WRITE_BUFFER)
+			Flush ();
+	}
+}
+
+
+/*
+===============
+WadWriter::Pad
+
+Zero fills up to the next multiple of alignment
+===============
+*/
+void WadWriter::Pad (int alignment)
+{
+	static const byte	zeros[64] = { 0 };
+	int					count;
+
+	while (m_nOffset & (alignment - 1))
+	{
+		count = alignment - (m_nOffset & (alignment - 1));
+		if (count > (int)sizeof(zeros))
+			count = sizeof(zeros);
+		Write (zeros, count);
+	}
+}
+
+
+/*
+===============
+WadWriter::ReadBack
+
+Copies length bytes that were already written at offset, some of which may
+still be sitting in the write buffer
+===============
+*/
+void WadWriter::ReadBack (void *dest, int length, int offset)
+{
+	byte	*out = (byte *)dest;
+	int		flushed, count;
+
+	flushed = m_nOffset - m_nBuffered;		// everything before this is on disk
+	if (offset < flushed)
+	{
+		count = flushed - offset;
+		if (count > length)
+			count = length;
+		fseek (m_pFile, offset, SEEK_SET);
+		if (fread (out, 1, count, m_pFile) != (size_t)count)
+			Error ("File read failure: %s", m_szTempPath);
+		fseek (m_pFile, 0, SEEK_END);
+		out += count;
+		offset += count;
+		length -= count;
+	}
+	if (length > 0)
+		memcpy (out, m_pBuffer + (offset - flushed), length);
+}
+
+
+/*
+===============
+WadWriter::FindDuplicate
+
+Returns an earlier lump whose stored contents decode to exactly these bytes,
+or -1.  Hash matches are always confirmed against the data on disk.
+===============
+*/
+int WadWriter::FindDuplicate (unsigned long long hash, const void *buffer, int length)
+{
+	const lumpinfo_t	*info;
+	int					slot, lump, filepos, disksize;
+	byte				*raw;
+	qboolean			same;
+
+	if (!m_pDedupTable)
+		return -1;
+
+	for (slot = (int)hash & m_nDedupMask ; (lump = m_pDedupTable[slot]) != -1 ; slot = (slot+1) & m_nDedupMask)
+	{
+		info = &m_pInfo[lump];
+		if (m_pContentHash[lump] != hash || WadLong(info->size) != length)
+			continue;
+
+		filepos = WadLong(info->filepos);
+		disksize = WadLong(info->disksize);
+		if (m_nVerifySize < disksize + length)
+		{
+			m_nVerifySize = disksize + length;
+			m_pVerify = (byte *)realloc (m_pVerify, m_nVerifySize);
+		}
+		ReadBack (m_pVerify, disksize, filepos);
+
+		if (info->compression == CMP_LZSS)
+		{
+			raw = m_pVerify + disksize;
+			same = LZSS_Decompress (m_pVerify, disksize, raw, length) && !memcmp (raw, buffer, length);
+		}
+		else
+		{
+			same = !memcmp (m_pVerify, buffer, length);
+		}
+
+		if (same)
+			return lump;
+	}
+
+	return -1;
+}
+
+
+/*
+===============
+WadWriter::AddToDedup
+
+Makes a lump that was just written available to FindDuplicate
+===============
+*/
+void WadWriter::AddToDedup (int lump)
+{
+	int		*old, oldsize, size, slot, i;
+
+	if (m_nDedupEntries * 2 >= m_nDedupMask)
+	{
+		old = m_pDedupTable;
+		oldsize = old ? m_nDedupMask + 1 : 0;
+		size = oldsize ? oldsize * 2 : 1024;
+
+		m_pDedupTable = (int *)malloc (size * sizeof(*m_pDedupTable));
+		memset (m_pDedupTable, -1, size * sizeof(*m_pDedupTable));
+		m_nDedupMask = size - 1;
+		m_nDedupEntries = 0;
+
+		for (i = 0 ; i < oldsize ; i++)
+		{
+			if (old[i] != -1)
+				AddToDedup (old[i]);
+		}
+		free (old);
+	}
+
+	for (slot = (int)m_pContentHash[lump] & m_nDedupMask ; m_pDedupTable[slot] != -1 ; slot = (slot+1) & m_nDedupMask)
+		;
+	m_pDedupTable[slot] = lump;
+	m_nDedupEntries++;
+}
+
+
+/*
+===============
+WadWriter::AddLump
+
+The name is cut to 15 characters and upper cased, the way the old tools
+stored it
+===============
+*/
+void WadWriter::AddLump (const char *name, const void *buffer, int length, int type, int compress)
+{
+	char	storedname[16];
+
+	memset (storedname, 0, sizeof(storedname));
+	strncpy (storedname, name, sizeof(storedname) - 1);
+	strupr (storedname);
+	AddRawLump (storedname, buffer, length, type, compress);
+}
+
+
+/*
+===============
+WadWriter::AddRawLump
+
+Stores the 16 name bytes exactly as given.  When dedup is on, a lump whose
+bytes were already written just gets a directory entry pointing at the
+existing copy.
+===============
+*/
+void WadWriter::AddRawLump (const char name[16], const void *buffer, int length, int type, int compress)
 {
 	lumpinfo_t	*info;
-	int			ofs;
-	
-	info = &outinfo[outlumps];
-	outlumps++;
+	int			packed, dup;
 
-	memset (info,0,sizeof(info));
-	
-	strcpy (info->name, name);
-	strupr (info->name);
+	if (!m_pFile)
+		Error ("WadWriter::AddLump: no wad open");
+
+	if (m_nLumps == m_nMaxLumps)
+	{
+		m_nMaxLumps = m_nMaxLumps ? m_nMaxLumps * 2 : 1024;
+		m_pInfo = (lumpinfo_t *)realloc (m_pInfo, m_nMaxLumps * sizeof(lumpinfo_t));
+		m_pContentHash = (unsigned long long *)realloc (m_pContentHash, m_nMaxLumps * sizeof(*m_pContentHash));
+		if (!m_pInfo || !m_pContentHash)
+			Error ("WadWriter::AddLump: out of memory for %i lumps", m_nMaxLumps);
+	}
+
+	info = &m_pInfo[m_nLumps];
+	m_nLumps++;
+
+	memset (info,0,sizeof(*info));
 	
-	ofs = ftell(outwad);
-	info->filepos = wadlong(ofs);
-	info->size = info->disksize = wadlong(length);
+	memcpy (info->name, name, sizeof(info->name));
 	info->type = type;
-	info->compression = compress;
-	
-// FIXME: do compression
 
-	SafeWrite (outwad, buffer, length);
+	if (compress != CMP_NONE && compress != CMP_LZSS)
+		Error ("WadWriter::AddLump: unknown compression %i for %.16s", compress, name);
+
+	if (m_bDedup && length > 0)
+	{
+		m_pContentHash[m_nLumps-1] = W_HashData (buffer, length);
+
+		dup = FindDuplicate (m_pContentHash[m_nLumps-1], buffer, length);
+		if (dup != -1)
+		{
+			info->filepos = m_pInfo[dup].filepos;
+			info->disksize = m_pInfo[dup].disksize;
+			info->size = m_pInfo[dup].size;
+			info->compression = m_pInfo[dup].compression;
+			m_nDedupLumps++;
+			m_nDedupBytes += WadLong(info->disksize);
+			return;
+		}
+	}
+
+	Pad (m_nAlignment);
+	info->filepos = WadLong(m_nOffset);
+	info->size = info->disksize = WadLong(length);
+	info->compression = CMP_NONE;
+
+	packed = 0;
+	if (compress == CMP_LZSS && length > 0)
+	{
+		if (m_nPackedSize < length)
+		{
+			m_nPackedSize = length;
+			m_pPacked = (byte *)realloc (m_pPacked, m_nPackedSize);
+		}
+
+		// only keep it compressed if it actually got smaller
+		packed = LZSS_Compress ((const byte *)buffer, length, m_pPacked, length - 1);
+	}
+
+	if (packed)
+	{
+		info->disksize = WadLong(packed);
+		info->compression = CMP_LZSS;
+		Write (m_pPacked, packed);
+	}
+	else
+	{
+		Write (buffer, length);
+	}
+
+	if (m_bDedup && length > 0)
+		AddToDedup (m_nLumps-1);
 }
 
 
 /*
 ===============
-WriteWad
+WadWriter::Commit
+
+Writes the directory and header and moves the finished wad into place
 ===============
 */
-
-void WriteWad (int wad3)
+void WadWriter::Commit (int wad3)
 {
 	wadinfo_t	header;
 	int			ofs;
 	
+	if (!m_pFile)
+		Error ("WadWriter::Commit: no wad open");
+
 // write the lumpingo
-	ofs = ftell(outwad);
+	Pad (m_nAlignment);
+	ofs = m_nOffset;
 
-	SafeWrite (outwad, outinfo, outlumps*sizeof(lumpinfo_t) );
+	Write (m_pInfo, m_nLumps*sizeof(lumpinfo_t));
+	Flush ();
 		
 // write the header
 
@@ -325,12 +1262,75 @@ void WriteWad (int wad3)
 	header.identification[2] = 'D';
 	header.identification[3] = wad3 ? '3' : '2';
 	
-	header.numlumps = wadlong(outlumps);
-	header.infotableofs = wadlong(ofs);
+	header.numlumps = WadLong(m_nLumps);
+	header.infotableofs = WadLong(ofs);
 		
-	fseek (outwad, 0, SEEK_SET);
-	SafeWrite (outwad, &header, sizeof(header));
-	fclose (outwad);
+	fseek (m_pFile, 0, SEEK_SET);
+	SafeWrite (m_pFile, &header, sizeof(header));
+	if (fclose (m_pFile))
+		Error ("File write failure: %s", m_szTempPath);
+	m_pFile = NULL;
+
+#ifdef _WIN32
+	if (!MoveFileEx (m_szTempPath, m_szPath, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+		Error ("Error renaming %s to %s", m_szTempPath, m_szPath);
+#else
+	if (rename (m_szTempPath, m_szPath))
+		Error ("Error renaming %s to %s: %s", m_szTempPath, m_szPath, strerror(errno));
+#endif
+}
+
+
+/*
+===============
+WadWriter::Abort
+
+Throws away a wad that was never committed
+===============
+*/
+void WadWriter::Abort ()
+{
+	if (m_pFile)
+	{
+		fclose (m_pFile);
+		m_pFile = NULL;
+		remove (m_szTempPath);
+	}
+	m_nBuffered = 0;
+}
+
+
+/*
+===============
+NewWad
+===============
+*/
+void NewWad (char *pathname, qboolean bigendien)
+{
+	defaultwriter.Open (pathname, bigendien);
+}
+
+
+/*
+===============
+AddLump
+===============
+*/
+void	AddLump (char *name, void *buffer, int length, int type, int compress)
+{
+	defaultwriter.AddLump (name, buffer, length, type, compress);
 }
 
 
+/*
+===============
+WriteWad
+===============
+*/
+void WriteWad (int wad3)
+{
+	if (defaultwriter.DedupedLumps ())
+		Msg ("%i duplicate lumps shared, %lld bytes saved\n", defaultwriter.DedupedLumps (), defaultwriter.DedupedBytes ());
+	defaultwriter.Commit (wad3);
+}
+
@@ -18,6 +18,8 @@
 #define	TYP_NONE		0
 #define	TYP_LABEL		1
 #define	TYP_LUMPY		64				// 64 + grab command number
+#define	TYP_MIPTEX3		67				// half-life miptex, palette after the mips
+#define	TYP_MIPTEX		68
 
 typedef struct
 {
@@ -38,11 +40,91 @@ typedef struct
 	char		name[16];				// must be null terminated
 } lumpinfo_t;
 
+// a bounds checked window onto a lump inside a mapped wad
+typedef struct
+{
+	const byte	*data;
+	int			length;
+} lumpview_t;
+
+//
+// A self contained wad reader.  Once Open has returned, every const method
+// is safe to call from any number of threads at once: lumps are read straight
+// out of a mapping of the whole file, or with positional reads when the file
+// can't be mapped.
+//
+class WadReader
+{
+public:
+	WadReader ();
+	~WadReader ();
+
+	bool				Open (const char *filename);	// false with GetError() set on failure
+	void				Close ();
+	const char			*GetError () const { return m_szError; }
+
+	const wadinfo_t		&Header () const { return m_Header; }
+	int					NumLumps () const { return m_nLumps; }
+	const lumpinfo_t	*Directory () const { return m_pLumpInfo; }
+	const lumpinfo_t	*LumpInfo (int lump) const;
+	int					FileSize () const { return m_nFileSize; }
+
+	int					CheckNumForName (const char *name) const;
+	int					NextNumForName (int lump) const;	// -1 after the last
+	int					GetNumForName (const char *name) const;
+	int					LumpLength (int lump) const;
+	void				ReadLumpNum (int lump, void *dest) const;
+	void				*LoadLumpNum (int lump) const;
+	bool				MapLumpNum (int lump, lumpview_t *view) const;
+	bool				ReadLumpHead (int lump, void *dest, int length) const;	// false if shorter or unreadable
+
+	// The disksize bytes at filepos exactly as stored, still compressed.  False
+	// if they aren't all inside the file (or for Map, if it isn't mapped).
+	bool				ReadStoredLump (int lump, void *dest) const;
+	bool				MapStoredLump (int lump, lumpview_t *view) const;
+
+	// Starts the lump being read in ahead of being mapped, without waiting.
+	void				PrefetchLumpNum (int lump) const;
+
+private:
+	WadReader (const WadReader &);
+	WadReader &operator= (const WadReader &);
+
+	bool				SetError (const char *fmt, ...);
+	bool				MapFile (const char *filename);
+	bool				ReadAt (void *dest, int length, int offset) const;
+	void				BuildNameHash ();
+
+	wadinfo_t			m_Header;
+	lumpinfo_t			*m_pLumpInfo;		// location of each lump on disk
+	int					m_nLumps;
+
+	byte				*m_pMapping;		// the whole file, when it could be mapped
+	int					m_nFileSize;
+#ifdef _WIN32
+	void				*m_hFile;
+	void				*m_hMapping;
+#else
+	int					m_nFile;
+#endif
+
+	char				(*m_pKeys)[16];		// cleaned up names, for hashing
+	int					*m_pHash;			// open addressed, -1 is an empty slot
+	int					*m_pNextSame;		// per lump, the next with its name, or -1
+	int					m_nHashMask;
+
+	char				m_szError[256];
+};
+
+//
+// the original interface, over a single shared reader
+//
 extern	lumpinfo_t		*lumpinfo;		// location of each lump on disk
 extern	int				numlumps;
 extern	wadinfo_t		header;
 
 void	W_OpenWad (const char *filename);
+void	W_CloseWad (void);
 int		W_CheckNumForName (char *name);
 int		W_GetNumForName (char *name);
 int		W_LumpLength (int lump);
@@ -50,11 +132,85 @@ void	W_ReadLumpNum (int lump, void *dest);
 void	*W_LoadLumpNum (int lump);
 void	*W_LoadLumpName (char *name);
 
+qboolean	W_MapLumpNum (int lump, lumpview_t *view);
+const void	*W_ViewRange (const lumpview_t *view, int offset, int length);
+
 void CleanupName (char *in, char *out);
+unsigned W_HashName (const char *cleanname);	// of a CleanupName'd name
+unsigned long long W_HashData (const void *data, int length);
 
 //
 // wad creation
 //
+
+//
+// Streams lumps out through a large buffer and keeps a growable directory,
+// so there is no limit on the number of lumps.  The wad is written under a
+// temporary name and only renamed into place by Commit.
+//
+class WadWriter
+{
+public:
+	WadWriter ();
+	~WadWriter ();
+
+	void				Open (const char *pathname, qboolean bigendien, int alignment = 1);
+	void				AddLump (const char *name, const void *buffer, int length, int type, int compress);
+	// The 16 name bytes as they are, case and all, for copying a lump over.
+	void				AddRawLump (const char name[16], const void *buffer, int length, int type, int compress);
+	void				Commit (int wad3);
+	void				Abort ();
+
+	int					NumLumps () const { return m_nLumps; }
+
+	// Lumps with the same bytes as one already written share its data.  On by
+	// default; these count the lumps and bytes that didn't have to be written.
+	void				SetDedup (bool bDedup) { m_bDedup = bDedup; }
+	int					DedupedLumps () const { return m_nDedupLumps; }
+	long long			DedupedBytes () const { return m_nDedupBytes; }
+
+private:
+	WadWriter (const WadWriter &);
+	WadWriter &operator= (const WadWriter &);
+
+	int					WadLong (int l) const;
+	void				Write (const void *data, int length);
+	void				Pad (int alignment);
+	void				Flush ();
+	void				ReadBack (void *dest, int length, int offset);
+	int					FindDuplicate (unsigned long long hash, const void *buffer, int length);
+	void				AddToDedup (int lump);
+
+	char				m_szPath[1024];
+	char				m_szTempPath[1024+8];
+	FILE				*m_pFile;
+
+	byte				*m_pBufferBase;
+	byte				*m_pBuffer;			// m_pBufferBase rounded up to a page
+	int					m_nBuffered;
+	int					m_nOffset;			// file offset the next byte will land at
+
+	lumpinfo_t			*m_pInfo;
+	int					m_nLumps;
+	int					m_nMaxLumps;
+
+	bool				m_bBigEndian;
+	int					m_nAlignment;
+
+	byte				*m_pPacked;			// CMP_LZSS scratch
+	int					m_nPackedSize;
+
+	bool				m_bDedup;
+	unsigned long long	*m_pContentHash;	// per lump, of the uncompressed bytes
+	int					*m_pDedupTable;		// open addressed lump numbers, -1 is empty
+	int					m_nDedupMask;
+	int					m_nDedupEntries;
+	byte				*m_pVerify;			// scratch for confirming a match
+	int					m_nVerifySize;
+	int					m_nDedupLumps;
+	long long			m_nDedupBytes;
+};
+
 void	NewWad (char *pathname, qboolean bigendien);
 void	AddLump (char *name, void *buffer, int length, int type, int compress);
 void	WriteWad (int wad3);
@@ -0,0 +1,178 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: 
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+
+// wadrepack.c
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "goldsrc_standin.h"
+#include "wadlib.h"
+#include "wadrepack.h"
+
+static char				(*sortnames)[16];
+
+static int CompareLumpNames (const void *a, const void *b)
+{
+	int		la = *(const int *)a;
+	int		lb = *(const int *)b;
+	int		c;
+
+	c = memcmp (sortnames[la], sortnames[lb], sizeof(sortnames[la]));
+	if (c)
+		return c;
+	return la - lb;		// repeated names keep their order
+}
+
+
+static const lumpinfo_t	*seeklumps;
+
+static int CompareExtents (const void *a, const void *b)
+{
+	const lumpinfo_t	*la = &seeklumps[*(const int *)a];
+	const lumpinfo_t	*lb = &seeklumps[*(const int *)b];
+
+	if (la->filepos != lb->filepos)
+		return la->filepos < lb->filepos ? -1 : 1;
+	if (la->disksize != lb->disksize)
+		return la->disksize < lb->disksize ? -1 : 1;
+	return *(const int *)a - *(const int *)b;
+}
+
+
+/*
+==================
+CountSeeks
+
+How many lumps a front to back read of the directory can't get to without
+seeking.  A lump sharing data with one before it doesn't count, the data has
+already been read.
+==================
+*/
+static int CountSeeks (const WadReader *wad)
+{
+	const lumpinfo_t	*dir;
+	int					*order;
+	qboolean			*shared;
+	int					i, count, next, seeks;
+
+	dir = wad->Directory ();
+	count = wad->NumLumps ();
+
+	// lumps with the same extent sort next to each other, lowest number first
+	order = (int *)malloc ((count + 1) * sizeof(int));
+	shared = (qboolean *)calloc (count + 1, sizeof(qboolean));
+	for (i = 0 ; i < count ; i++)
+		order[i] = i;
+	seeklumps = dir;
+	qsort (order, count, sizeof(int), CompareExtents);
+	for (i = 1 ; i < count ; i++)
+	{
+		if (dir[order[i]].filepos == dir[order[i-1]].filepos
+		&& dir[order[i]].disksize == dir[order[i-1]].disksize)
+			shared[order[i]] = true;
+	}
+
+	seeks = 0;
+	next = sizeof(wadinfo_t);
+	for (i = 0 ; i < count ; i++)
+	{
+		if (shared[i])
+			continue;
+		if (dir[i].filepos != next)
+			seeks++;
+		next = dir[i].filepos + dir[i].disksize;
+	}
+
+	free (shared);
+	free (order);
+	return seeks;
+}
+
+
+/*
+==================
+RepackWad
+==================
+*/
+qboolean RepackWad (const char *filename, qboolean sortbyname)
+{
+	WadReader			wad;
+	WadWriter			writer;
+	const lumpinfo_t	*l;
+	int					*order;
+	int					i, count, oldsize, seeks;
+	qboolean			wad3;
+	void				*data;
+
+	if (!wad.Open (filename))
+	{
+		printf ("%s\n", wad.GetError ());
+		return false;
+	}
+
+	count = wad.NumLumps ();
+	for (i = 0 ; i < count ; i++)
+	{
+		l = wad.LumpInfo (i);
+		if (l->compression != CMP_NONE && l->compression != CMP_LZSS)
+		{
+			printf ("%s: lump %i (%.16s) has unknown compression %i\n", filename, i, l->name, l->compression);
+			return false;
+		}
+		if (l->filepos < 0 || l->disksize < 0 || l->filepos > wad.FileSize () - l->disksize)
+		{
+			printf ("%s: lump %i (%.16s) extends past the end of the file\n", filename, i, l->name);
+			return false;
+		}
+	}
+
+	order = (int *)malloc ((count + 1) * sizeof(int));
+	for (i = 0 ; i < count ; i++)
+		order[i] = i;
+
+	if (sortbyname)
+	{
+		sortnames = (char (*)[16])malloc ((count + 1) * sizeof(*sortnames));
+		for (i = 0 ; i < count ; i++)
+			CleanupName ((char *)wad.LumpInfo (i)->name, sortnames[i]);
+		qsort (order, count, sizeof(int), CompareLumpNames);
+		free (sortnames);
+		sortnames = NULL;
+	}
+
+	wad3 = wad.Header ().identification[3] == '3';
+	oldsize = wad.FileSize ();
+	seeks = CountSeeks (&wad);
+
+	// lumps go through uncompressed, so anything that was LZSS'd is packed
+	// again the same way and duplicates are found on their real contents
+	writer.Open (filename, false);
+	for (i = 0 ; i < count ; i++)
+	{
+		l = wad.LumpInfo (order[i]);
+		data = wad.LoadLumpNum (order[i]);
+		writer.AddRawLump (l->name, data, l->size, l->type, l->compression);
+		free (data);
+	}
+	free (order);
+
+	// the reader has to let go before the new file can replace it
+	wad.Close ();
+	writer.Commit (wad3);
+
+	if (!wad.Open (filename))
+		Error ("%s\n", wad.GetError ());
+	printf ("%s: %i lumps, %i -> %i bytes, %i -> %i seeks", filename, count,
+		oldsize, wad.FileSize (), seeks, CountSeeks (&wad));
+	if (writer.DedupedLumps ())
+		printf (", %i duplicate lumps shared", writer.DedupedLumps ());
+	printf ("\n");
+
+	return true;
+}
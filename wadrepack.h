@@ -0,0 +1,27 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: 
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+
+// wadrepack.h
+
+#ifndef WADREPACK_H
+#define WADREPACK_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+
+// Rewrites a wad in place with every lump stored back to back, in directory
+// order or sorted by name, so reading it front to back never seeks.  Space
+// left behind by deleted or replaced lumps is dropped, lumps with the same
+// contents share their data, and the directory goes in one piece at the end.
+// Names are copied byte for byte, case and all.
+// Returns false, having changed nothing, if the wad can't be read.
+qboolean	RepackWad (const char *filename, qboolean sortbyname);
+
+
+#endif // WADREPACK_H
@@ -0,0 +1,302 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: 
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+
+
+// workqueue.c
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
+#ifdef _WIN32
+#ifndef _WIN32_WINNT
+#define	_WIN32_WINNT	0x0600		// condition variables
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include "goldsrc_standin.h"
+#include "workqueue.h"
+
+
+typedef struct
+{
+#ifdef _WIN32
+	CRITICAL_SECTION	lock;
+	CONDITION_VARIABLE	notfull;
+	CONDITION_VARIABLE	notempty;
+#else
+	pthread_mutex_t		lock;
+	pthread_cond_t		notfull;
+	pthread_cond_t		notempty;
+#endif
+} wqsleep_t;
+
+
+void WQ_Init (workqueue_t *q, int size)
+{
+	wqsleep_t	*s;
+	size_t	i, count;
+
+	for (count = 2 ; (int)count < size ; count <<= 1)
+		;
+
+	memset (q, 0, sizeof(*q));
+	q->slots = (workslot_t *)malloc (count * sizeof(workslot_t));
+	q->mask = count - 1;
+	for (i = 0 ; i < count ; i++)
+	{
+		q->slots[i].sequence = i;
+		q->slots[i].item = NULL;
+	}
+
+	s = (wqsleep_t *)malloc (sizeof(*s));
+#ifdef _WIN32
+	InitializeCriticalSection (&s->lock);
+	InitializeConditionVariable (&s->notfull);
+	InitializeConditionVariable (&s->notempty);
+#else
+	pthread_mutex_init (&s->lock, NULL);
+	pthread_cond_init (&s->notfull, NULL);
+	pthread_cond_init (&s->notempty, NULL);
+#endif
+	q->sleep = s;
+}
+
+void WQ_Free (workqueue_t *q)
+{
+	wqsleep_t	*s = (wqsleep_t *)q->sleep;
+
+#ifdef _WIN32
+	DeleteCriticalSection (&s->lock);
+#else
+	pthread_cond_destroy (&s->notempty);
+	pthread_cond_destroy (&s->notfull);
+	pthread_mutex_destroy (&s->lock);
+#endif
+	free (s);
+	q->sleep = NULL;
+	free (q->slots);
+	q->slots = NULL;
+}
+
+
+/*
+=============
+PushSlot
+
+A slot is free to push into when its sequence equals the position, and
+holds an item to pop when it's one past.  Popping moves it a whole lap on,
+ready for the push after next round.
+=============
+*/
+static qboolean PushSlot (workqueue_t *q, void *item)
+{
+	workslot_t	*slot;
+	size_t		pos, seq;
+
+	pos = __atomic_load_n (&q->pushpos, __ATOMIC_RELAXED);
+	for (;;)
+	{
+		slot = &q->slots[pos & q->mask];
+		seq = __atomic_load_n (&slot->sequence, __ATOMIC_ACQUIRE);
+		if (seq == pos)
+		{
+			if (__atomic_compare_exchange_n (&q->pushpos, &pos, pos + 1, true,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else if ((ptrdiff_t)(seq - pos) < 0)
+			return false;		// still holding last lap's item
+		else
+			pos = __atomic_load_n (&q->pushpos, __ATOMIC_RELAXED);
+	}
+
+	slot->item = item;
+	__atomic_store_n (&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+static qboolean PopSlot (workqueue_t *q, void **item)
+{
+	workslot_t	*slot;
+	size_t		pos, seq;
+
+	pos = __atomic_load_n (&q->poppos, __ATOMIC_RELAXED);
+	for (;;)
+	{
+		slot = &q->slots[pos & q->mask];
+		seq = __atomic_load_n (&slot->sequence, __ATOMIC_ACQUIRE);
+		if (seq == pos + 1)
+		{
+			if (__atomic_compare_exchange_n (&q->poppos, &pos, pos + 1, true,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else if ((ptrdiff_t)(seq - (pos + 1)) < 0)
+			return false;		// nothing pushed there yet
+		else
+			pos = __atomic_load_n (&q->poppos, __ATOMIC_RELAXED);
+	}
+
+	*item = slot->item;
+	__atomic_store_n (&slot->sequence, pos + q->mask + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+
+/*
+=============
+Sleepers
+
+A thread that means to sleep counts itself in and tries once more under the
+lock before waiting.  The other side checks the count after its own push or
+pop, with a full fence between them, so either the last try sees the change
+or the count is seen and the waker takes the lock, which it can't get until
+the sleeper is waiting.
+=============
+*/
+static void SleepLock (wqsleep_t *s)
+{
+#ifdef _WIN32
+	EnterCriticalSection (&s->lock);
+#else
+	pthread_mutex_lock (&s->lock);
+#endif
+}
+
+static void SleepUnlock (wqsleep_t *s)
+{
+#ifdef _WIN32
+	LeaveCriticalSection (&s->lock);
+#else
+	pthread_mutex_unlock (&s->lock);
+#endif
+}
+
+#ifdef _WIN32
+static void SleepOn (wqsleep_t *s, CONDITION_VARIABLE *cond)
+{
+	SleepConditionVariableCS (cond, &s->lock, INFINITE);
+}
+
+static void WakeSleepers (workqueue_t *q, volatile int *sleepers, CONDITION_VARIABLE *cond)
+#else
+static void SleepOn (wqsleep_t *s, pthread_cond_t *cond)
+{
+	pthread_cond_wait (cond, &s->lock);
+}
+
+static void WakeSleepers (workqueue_t *q, volatile int *sleepers, pthread_cond_t *cond)
+#endif
+{
+	wqsleep_t	*s = (wqsleep_t *)q->sleep;
+
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+	if (!__atomic_load_n (sleepers, __ATOMIC_RELAXED))
+		return;
+	SleepLock (s);
+#ifdef _WIN32
+	WakeAllConditionVariable (cond);
+#else
+	pthread_cond_broadcast (cond);
+#endif
+	SleepUnlock (s);
+}
+
+
+qboolean WQ_TryPush (workqueue_t *q, void *item)
+{
+	wqsleep_t	*s = (wqsleep_t *)q->sleep;
+
+	if (!PushSlot (q, item))
+		return false;
+	WakeSleepers (q, &q->popsleepers, &s->notempty);
+	return true;
+}
+
+qboolean WQ_TryPop (workqueue_t *q, void **item)
+{
+	wqsleep_t	*s = (wqsleep_t *)q->sleep;
+
+	if (!PopSlot (q, item))
+		return false;
+	WakeSleepers (q, &q->pushsleepers, &s->notfull);
+	return true;
+}
+
+
+/*
+=============
+Backoff
+
+Spins briefly, then gives up the rest of the time slice.  False once it's
+been long enough that the thread should sleep instead.
+=============
+*/
+static qboolean Backoff (int *tries)
+{
+	if (*tries >= 128)
+		return false;
+	if (*tries >= 64)
+	{
+#ifdef _WIN32
+		Sleep (0);
+#else
+		sched_yield ();
+#endif
+	}
+	(*tries)++;
+	return true;
+}
+
+void WQ_Push (workqueue_t *q, void *item)
+{
+	wqsleep_t	*s = (wqsleep_t *)q->sleep;
+	int			tries;
+
+	if (WQ_TryPush (q, item))
+		return;
+
+	__atomic_add_fetch (&q->stalls, 1, __ATOMIC_RELAXED);
+	for (tries = 0 ; Backoff (&tries) ; )
+		if (WQ_TryPush (q, item))
+			return;
+
+	SleepLock (s);
+	__atomic_add_fetch (&q->pushsleepers, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+	while (!PushSlot (q, item))
+		SleepOn (s, &s->notfull);
+	__atomic_sub_fetch (&q->pushsleepers, 1, __ATOMIC_RELAXED);
+	SleepUnlock (s);
+	WakeSleepers (q, &q->popsleepers, &s->notempty);
+}
+
+void *WQ_Pop (workqueue_t *q)
+{
+	wqsleep_t	*s = (wqsleep_t *)q->sleep;
+	void		*item;
+	int			tries;
+
+	for (tries = 0 ; Backoff (&tries) ; )
+		if (WQ_TryPop (q, &item))
+			return item;
+
+	SleepLock (s);
+	__atomic_add_fetch (&q->popsleepers, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+	while (!PopSlot (q, &item))
+		SleepOn (s, &s->notempty);
+	__atomic_sub_fetch (&q->popsleepers, 1, __ATOMIC_RELAXED);
+	SleepUnlock (s);
+	WakeSleepers (q, &q->pushsleepers, &s->notfull);
+	return item;
+}
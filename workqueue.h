@@ -0,0 +1,66 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: 
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+
+
+// workqueue.h
+
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+
+//
+// A bounded queue of pointers that any number of threads can push to and pop
+// from at once without taking a lock.  Each slot carries a sequence number
+// saying whose turn it is, so a push or pop is one compare and swap on the
+// queue's position plus a store into the slot.
+//
+// Push blocks while the queue is full, which is what holds the threads
+// filling it back to the pace of the ones emptying it.  A thread that has to
+// wait spins a little, then sleeps on a condition variable.  The other side
+// only takes the lock to wake it when a count says someone's asleep, so while
+// nothing waits the queue stays lock free.
+//
+
+typedef struct
+{
+	volatile size_t	sequence;
+	void			*item;
+} workslot_t;
+
+typedef struct
+{
+	workslot_t		*slots;
+	size_t			mask;				// number of slots - 1
+	char			pad0[64];
+	volatile size_t	pushpos;			// on a line of its own
+	char			pad1[64];
+	volatile size_t	poppos;
+	char			pad2[64];
+	volatile int	stalls;				// pushes that found it full
+	volatile int	pushsleepers;		// asleep in WQ_Push, waiting for room
+	volatile int	popsleepers;		// asleep in WQ_Pop, waiting for an item
+	void			*sleep;				// the lock and conditions they sleep on
+} workqueue_t;
+
+// The size is rounded up to a power of two.
+void		WQ_Init (workqueue_t *q, int size);
+void		WQ_Free (workqueue_t *q);
+
+// False if it's full or empty, without waiting.
+qboolean	WQ_TryPush (workqueue_t *q, void *item);
+qboolean	WQ_TryPop (workqueue_t *q, void **item);
+
+// Wait until there's room or something to take.
+void		WQ_Push (workqueue_t *q, void *item);
+void		*WQ_Pop (workqueue_t *q);
+
+
+#endif // WORKQUEUE_H
@@ -8,13 +8,18 @@
 //=============================================================================//
 
 #include <windows.h>
+#include <algorithm>
 #include <map>
+#include <set>
+#include <string>
+#include <vector>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <conio.h>
 #include <ctype.h>
+#include <limits.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <io.h>
@@ -25,10 +30,17 @@
 
 #include "wadlib.h"
 #include "goldsrc_bspfile.h"
+#include "threads.h"
+#include "wadcheck.h"
+#include "wadindex.h"
+#include "wadrepack.h"
+#include "procpool.h"
+#include "arena.h"
+#include "texlib.h"
+#include "vtflib.h"
+#include "workqueue.h"
 
 
-extern FILE *wadhandle;
-
 #define max(a, b) a > b ? a : b
 #pragma pack(1)
 struct TGAHeader_t {
@@ -69,16 +81,22 @@ typedef struct {
   int height;
 } dspriteframe_t;
 
-class RGBAColor {
- public:
-  unsigned char r, g, b, a;
-};
-
 const char *g_pDefaultShader = "lightmappedgeneric";
 const char *g_pShader = g_pDefaultShader;
 bool g_bBMPAllowTranslucent = false;
 bool g_bDecal = false;
 bool g_bQuiet = false;
+bool g_bForce = false;
+bool g_bVTFBatch = false;
+int g_nVTFTimeout = 120;  // seconds, for each texture VTFCmd is given
+bool g_bWriteTGA = true;
+bool g_bWriteVTF = false;  // written here rather than by vtfcmd
+int g_nVTFFormat = IMAGE_FORMAT_DXT1;
+int g_nVTFAlphaFormat = IMAGE_FORMAT_DXT5;
+int g_nVTFAlphatestFormat = IMAGE_FORMAT_DXT1;  // for { textures, whose alpha is all or nothing
+bool g_bDXTQuality = false;  // cluster fit rather than bounding box
+#define RESAMPLE_VTFCMD -1  // the tga keeps its size for vtfcmd to resize
+int g_nResample = RESAMPLE_BILINEAR;
 
 //vmtcmd additions
 const char *g_pMaterialtxt = NULL;
@@ -124,134 +142,90 @@ void PrintExitStuff() {
   }
 }
 
-RGBAColor *ConvertToRGBAUpsideDown(byte *pBits, int width, int height, byte *pPalette, bool *bAlphatest) {
-  RGBAColor *pRet = new RGBAColor[width * height];
-
-  // Write the lines upside-down.
-  for (int y = 0; y < height; y++) {
-    byte *pLine = &pBits[(height - y - 1) * width];
-    for (int x = 0; x < width; x++) {
-      if (g_bDecal) {
-        pRet[y * width + x].r = pPalette[255 * 3 + 2];
-        pRet[y * width + x].g = pPalette[255 * 3 + 1];
-        pRet[y * width + x].b = pPalette[255 * 3 + 0];
-        pRet[y * width + x].a = pLine[x];
-      } else {
-        pRet[y * width + x].r = pPalette[pLine[x] * 3 + 2];
-        pRet[y * width + x].g = pPalette[pLine[x] * 3 + 1];
-        pRet[y * width + x].b = pPalette[pLine[x] * 3 + 0];
-        if (pLine[x] == 255) {
-          *bAlphatest = true;
-          pRet[y * width + x].a = 0;
-        } else {
-          pRet[y * width + x].a = 255;
-        }     
-      }
-    }
-  }
-
-  return pRet;
-}
-
-// adds texture bleeding so that $laphatest does not break
-void FloodSolidPixels(RGBAColor *pTexels, int width, int height) {
-  byte *pAlphaMap = new byte[width * height];
-  byte *pNewAlphaMap = new byte[width * height];
-
-  for (int y = 0; y < height; y++)
-    for (int x = 0; x < width; x++)
-      pAlphaMap[y * width + x] = pTexels[y * width + x].a;
-
-  bool bHappy = false;
-  while (!bHappy) {
-    bHappy = true;
-
-    memcpy(pNewAlphaMap, pAlphaMap, width * height);
-
-    for (int y = 0; y < height; y++) {
-      RGBAColor *pLine = &pTexels[y * width];
-
-      for (int x = 0; x < width; x++) {
-        if (pAlphaMap[y * width + x] == 0) {
-          int nNeighbors = 0;
-          int neighborTotal[3] = {0, 0, 0};
-
-          // Blend all the neighboring solid pixels.
-          for (int offsetX = -1; offsetX <= 1; offsetX++) {
-            for (int offsetY = -1; offsetY <= 1; offsetY++) {
-              int testX = x + offsetX;
-              int testY = y + offsetY;
-              if (testX >= 0 && testY >= 0 && testX < width && testY < height) {
-                if (pAlphaMap[testY * width + testX]) {
-                  RGBAColor *pNeighbor = &pTexels[testY * width + testX];
-                  ++nNeighbors;
-                  neighborTotal[0] += pNeighbor->r;
-                  neighborTotal[1] += pNeighbor->g;
-                  neighborTotal[2] += pNeighbor->b;
-                }
-              }
-            }
-          }
-
-          if (nNeighbors) {
-            pNewAlphaMap[y * width + x] = 255;
-            bHappy = false;
-            pLine[x].r = (byte)(neighborTotal[0] / nNeighbors);
-            pLine[x].g = (byte)(neighborTotal[1] / nNeighbors);
-            pLine[x].b = (byte)(neighborTotal[2] / nNeighbors);
-          }
-        }
-      }
-    }
+//-----------------------------------------------------------------------------
+// -stats times each stage of a texture's conversion.  Every task keeps its
+// own record, and the thread working on a task points g_pStageTimes at it,
+// so the timers are just a clock read either side of the stage and nothing
+// is shared between threads.  Work that isn't for any one texture goes in a
+// record of the run's own.
+//-----------------------------------------------------------------------------
+
+enum {
+  STAGE_DIRECTORY,   // making the output directories
+  STAGE_READ,        // reading and hashing the lump, bmp or sprite
+  STAGE_RGBA,        // ConvertToRGBAUpsideDown
+  STAGE_FLOOD,       // FloodSolidPixels
+  STAGE_RESAMPLE,    // resizing up to powers of two
+  STAGE_TGA_ENCODE,
+  STAGE_VTF_ENCODE,  // including resizing, with -resample vtfcmd
+  STAGE_TGA_WRITE,
+  STAGE_VTF_WRITE,
+  STAGE_VMT_WRITE,   // and the .resizeinfo
+  STAGE_TOOL,        // vtfcmd
+  STAGE_QUEUE_WAIT,  // for room in the writers' queue
+  NUM_STAGES
+};
 
-    memcpy(pAlphaMap, pNewAlphaMap, width * height);
-  }
+static const char *g_pStageNames[NUM_STAGES] = {
+    "directory creation", "read", "rgba", "flood", "resample", "tga encode", "vtf encode",
+    "tga write", "vtf write", "vmt write", "external tool", "queue wait"};
 
-  delete[] pAlphaMap;
-  delete[] pNewAlphaMap;
-}
+struct StageTimes_t {
+  double seconds[NUM_STAGES];
+  int calls[NUM_STAGES];
+  long long bytes[NUM_STAGES];   // read, made or written
+  long long pixels[NUM_STAGES];  // handled
+};
 
-// RGBAColor *ResampleImage(RGBAColor *pRGB, int width, int height, int newWidth,
-//                          int newHeight) {
-//   RGBAColor *pResampled = new RGBAColor[newWidth * newHeight];
-//   for (int y = 0; y < newHeight; y++) {
-//     float yPercent = (float)y / (newHeight - 1);
-//     float flSrcY = yPercent * (height - 1.00001f);
-//     int iSrcY = (int)flSrcY;
-//     float flYFrac = flSrcY - iSrcY;
+static THREADLOCAL StageTimes_t *g_pStageTimes;
 
-//     for (int x = 0; x < newWidth; x++) {
-//       float xPercent = (float)x / (newWidth - 1);
-//       float flSrcX = xPercent * (width - 1.00001f);
-//       int iSrcX = (int)flSrcX;
-//       float flXFrac = flSrcX - iSrcX;
+// 0 when nothing is being timed, so not timing costs a test.
+inline double BeginStage() { return g_pStageTimes ? I_FloatTime() : 0; }
 
-//       byte *pSrc0 = ((byte *)&pRGB[iSrcY * width + iSrcX]);
-//       byte *pSrc1 = ((byte *)&pRGB[iSrcY * width + iSrcX + 1]);
-//       byte *pSrc2 = ((byte *)&pRGB[(iSrcY + 1) * width + iSrcX]);
-//       byte *pSrc3 = ((byte *)&pRGB[(iSrcY + 1) * width + iSrcX + 1]);
-//       byte *pDest = (byte *)&pResampled[y * newWidth + x];
+inline void AddStage(int stage, double seconds, long long bytes, long long pixels) {
+  StageTimes_t *pTimes = g_pStageTimes;
+  if (!pTimes) return;
+  pTimes->seconds[stage] += seconds;
+  pTimes->calls[stage]++;
+  pTimes->bytes[stage] += bytes;
+  pTimes->pixels[stage] += pixels;
+}
 
-//       // Now blend the nearest 4 source pixels.
-//       for (int i = 0; i < 4; i++) {
-//         // pDest[i] = pSrc0[i];
-//         float topColor = (pSrc0[i] * (1 - flXFrac) + pSrc1[i] * flXFrac);
-//         float bottomColor = (pSrc2[i] * (1 - flXFrac) + pSrc3[i] * flXFrac);
-//         pDest[i] = (byte)(topColor * (1 - flYFrac) + bottomColor * flYFrac);
-//       }
-//     }
-//   }
-//   return pResampled;
-// }
+inline void EndStage(int stage, double start, long long bytes, long long pixels) {
+  if (g_pStageTimes) AddStage(stage, I_FloatTime() - start, bytes, pixels);
+}
 
+void AddStageTimes(StageTimes_t *pTotal, const StageTimes_t &times) {
+  for (int i = 0; i < NUM_STAGES; i++) {
+    pTotal->seconds[i] += times.seconds[i];
+    pTotal->calls[i] += times.calls[i];
+    pTotal->bytes[i] += times.bytes[i];
+    pTotal->pixels[i] += times.pixels[i];
+  }
+}
 
+int ResampleFilterForName(const char *pName) {
+  if (!stricmp(pName, "box")) return RESAMPLE_BOX;
+  if (!stricmp(pName, "bilinear")) return RESAMPLE_BILINEAR;
+  if (!stricmp(pName, "lanczos3")) return RESAMPLE_LANCZOS3;
+  if (!stricmp(pName, "vtfcmd")) return RESAMPLE_VTFCMD;
+  return -2;
+}
 
-bool WriteTGAFile(const char *pFilename, bool bAllowTranslucent, byte *pBits,
-                  int width, int height, byte *pPalette, bool bPowerOf2,
-                  bool *bAlphatest, bool *bResized) {
+// The texture as the TGA holds it: bottom row first, in BGRA order despite
+// RGBAColor's names.  It and everything used to make it are in the arena.
+// Tiling textures wrap around their edges when they're resized.
+RGBAColor *ConvertTexture(arena_t *pArena, bool bAllowTranslucent, const byte *pBits, int width, int height,
+                          const byte *pPalette, bool bPowerOf2, bool bTiling, bool *bAlphatest,
+                          bool *bResized, int *pNewWidth, int *pNewHeight) {
   *bResized = *bAlphatest = false;
+  *pNewWidth = width;
+  *pNewHeight = height;
 
-  RGBAColor *pRGB = ConvertToRGBAUpsideDown(pBits, width, height, pPalette, bAlphatest);
+  double start = BeginStage();
+  RGBAColor *pRGB =
+      ConvertToRGBAUpsideDown(pArena, pBits, width, height, pPalette, g_bDecal, bAlphatest);
+  EndStage(STAGE_RGBA, start, sizeof(RGBAColor) * width * height, width * height);
 
   // Unless the filename starts with '{', we don't allow translucency.
   if (!bAllowTranslucent) *bAlphatest = false;
@@ -260,7 +234,9 @@ bool WriteTGAFile(const char *pFilename, bool bAllowTranslucent, byte *pBits,
       // Flood the solid texel colors into the transparent texels.
       // Since we turn on point sampling for these textures, this only matters if
       // we're resizing the texture.
-      FloodSolidPixels(pRGB, width, height);
+      start = BeginStage();
+      FloodSolidPixels(pArena, pRGB, width, height);
+      EndStage(STAGE_FLOOD, start, 0, width * height);
   }
 
   if (bPowerOf2) {
@@ -273,21 +249,45 @@ bool WriteTGAFile(const char *pFilename, bool bAllowTranslucent, byte *pBits,
       int newHeight = height;
       while ((newHeight & (newHeight - 1))) ++newHeight;
 
-      if (!g_bQuiet) printf("\t (%dx%d) -> (%dx%d)\n", width, height, newWidth, newHeight);
-
-      //RGBAColor *pResampled =
-          //ResampleImage(pRGB, width, height, newWidth, newHeight);
-      //delete[] pRGB;
-      //pRGB = pResampled;
-
-      //width = newWidth;
-      //height = newHeight;
+      if (!g_bQuiet) Msg("\t (%dx%d) -> (%dx%d)\n", width, height, newWidth, newHeight);
 
       *bResized = true;
+
+      // With -resample vtfcmd the TGA keeps the original size and vtfcmd
+      // resizes it, so only the VTF written here needs resizing.
+      if (g_nResample != RESAMPLE_VTFCMD) {
+        start = BeginStage();
+        pRGB = ResampleImage(pArena, pRGB, width, height, newWidth, newHeight, g_nResample,
+                             bTiling, *bAlphatest);
+        EndStage(STAGE_RESAMPLE, start, sizeof(RGBAColor) * newWidth * newHeight,
+                 newWidth * newHeight);
+        *pNewWidth = newWidth;
+        *pNewHeight = newHeight;
+      }
     }
   }
 
-  // Write it..
+  return pRGB;
+}
+
+// A file's worth of bytes, encoded on a conversion thread and written out
+// later by a writer thread.
+struct OutputFile_t {
+  char filename[1024];
+  byte *pData;  // NULL when it isn't wanted
+  int length;
+};
+
+void WriteOutputFile(const OutputFile_t &file) {
+  FILE *fp = fopen(file.filename, "wb");
+  if (!fp) Error("\tError writing %s.\n", file.filename);
+  SafeWrite(fp, file.pData, file.length);
+  fclose(fp);
+}
+
+void EncodeTGAFile(OutputFile_t *pFile, const RGBAColor *pRGB, int width, int height,
+                   bool bAlpha) {
+  double start = BeginStage();
   TGAHeader_t hdr;
   memset(&hdr, 0, sizeof(hdr));
 
@@ -295,27 +295,61 @@ bool WriteTGAFile(const char *pFilename, bool bAllowTranslucent, byte *pBits,
   hdr.height = height;
   hdr.colormap_type = 0;  // no, no colormap please
   hdr.image_type = 2;     // uncompressed, true-color
-  if (*bAlphatest || g_bDecal) {
+  if (bAlpha) {
     hdr.pixel_size = 32;    // 32 bits per pixel
   } else {
     hdr.pixel_size = 24;    // 32 bits per pixel
   }
 
-  FILE *fp = fopen(pFilename, "wb");
-  if (!fp) return false;
+  pFile->length = sizeof(hdr) + width * height * (bAlpha ? 4 : 3);
+  pFile->pData = (byte *)malloc(pFile->length);
+  memcpy(pFile->pData, &hdr, sizeof(hdr));
 
-  SafeWrite(fp, &hdr, sizeof(hdr));
-  if (*bAlphatest || g_bDecal) {
-    SafeWrite(fp, pRGB, sizeof(RGBAColor) * width * height);
-  } else {
-    for (int i = 0; i < height * width; i++) {
-      SafeWrite(fp, pRGB + i, sizeof(unsigned char) * 3);
+  WriteTGAPixels(pRGB, width * height, bAlpha, pFile->pData + sizeof(hdr));
+  EndStage(STAGE_TGA_ENCODE, start, pFile->length, width * height);
+}
+
+// The -vtf format for a texture.  Alpha tested ones only need DXT1's one bit.
+int VTFFormatFor(bool bAlpha, bool bAlphatest) {
+  if (!bAlpha) return g_nVTFFormat;
+  return bAlphatest ? g_nVTFAlphatestFormat : g_nVTFAlphaFormat;
+}
+
+// Encodes the VTF vtfcmd would have made from the TGA: resized up to powers
+// of two, with the alpha format if the TGA is 32 bit.
+void EncodeVTFFile(arena_t *pArena, OutputFile_t *pFile, const RGBAColor *pRGB, int width,
+                   int height, bool bAlpha, bool bTiling, bool bAlphatest) {
+  double start = BeginStage();
+  if ((width & (width - 1)) || (height & (height - 1))) {
+    int newWidth = width;
+    while ((newWidth & (newWidth - 1))) ++newWidth;
+    int newHeight = height;
+    while ((newHeight & (newHeight - 1))) ++newHeight;
+
+    pRGB = ResampleImage(pArena, pRGB, width, height, newWidth, newHeight, RESAMPLE_BILINEAR,
+                         bTiling, bAlphatest);
+    width = newWidth;
+    height = newHeight;
+  }
+
+  // VTFs are top row first and RGBA.
+  byte *pPixels = (byte *)Arena_Alloc(pArena, width * height * 4);
+  for (int y = 0; y < height; y++) {
+    const RGBAColor *pIn = &pRGB[(height - 1 - y) * width];
+    byte *pOut = &pPixels[y * width * 4];
+    for (int x = 0; x < width; x++) {
+      pOut[x * 4 + 0] = pIn[x].b;
+      pOut[x * 4 + 1] = pIn[x].g;
+      pOut[x * 4 + 2] = pIn[x].r;
+      pOut[x * 4 + 3] = bAlpha ? pIn[x].a : 255;
     }
   }
-  fclose(fp);
 
-  delete[] pRGB;
-  return true;
+  // Alpha tested mips keep their share of solid texels.
+  pFile->pData = VTF_Encode(pPixels, width, height, VTFFormatFor(bAlpha, bAlphatest),
+                            bAlphatest ? TEXTUREFLAGS_ONEBITALPHA : 0, bAlpha, g_bDXTQuality,
+                            pArena, &pFile->length);
+  EndStage(STAGE_VTF_ENCODE, start, pFile->length, width * height);
 }
 
 int PrintUsage(const char *pExtra) {
@@ -336,6 +370,32 @@ int PrintUsage(const char *pExtra) {
       "\t[-vtfcmd <vtfcmd.exe path>]\n"
       "\t\tif vtfcmd is specified, then it calls vtfcmd on each\n"
       "\t\tnewly-created .tga file.\n"
+      "\t[-vtf]\n"
+      "\t\twrites the .vtf files itself, rather than with vtfcmd.\n"
+      "\t[-vtfformat <format>] [-vtfalphaformat <format>]\n"
+      "\t\twith -vtf, the formats for textures without and with alpha:\n"
+      "\t\tDXT1, DXT5, RGB888 or RGBA8888 (default DXT1 and DXT5).\n"
+      "\t[-vtfalphatestformat <format>]\n"
+      "\t\twith -vtf, the format for textures whose alpha is all or\n"
+      "\t\tnothing, like {textures (default DXT1, with one bit alpha).\n"
+      "\t[-dxt <fast|quality>]\n"
+      "\t\twith -vtf, how DXT blocks are fit: fast takes each block's\n"
+      "\t\tbounding box, quality tries every way of splitting it along\n"
+      "\t\tits colours, several times slower (default fast).\n"
+      "\t[-resample <filter>]\n"
+      "\t\thow textures that aren't powers of two are resized up to them:\n"
+      "\t\tbox, bilinear or lanczos3 (default bilinear), or vtfcmd to\n"
+      "\t\twrite the .tga at its own size for vtfcmd to resize.\n"
+      "\t[-notga]\n"
+      "\t\tdoesn't write the .tga files to materialsrc.\n"
+      "\t[-vtfbatch]\n"
+      "\t\twith -vtfcmd, gives vtfcmd the .tga files a list at a time once\n"
+      "\t\teach wad or all the bmps are done, instead of one at a time.\n"
+      "\t[-vtfjobs <count>]\n"
+      "\t\thow many copies of vtfcmd can run at once (default -threads).\n"
+      "\t[-vtftimeout <seconds>]\n"
+      "\t\tvtfcmd is stopped if it takes longer than this per texture\n"
+      "\t\t(default 120, 0 for no limit).\n"
       "\t[-materials <materials.txt path>]\n"
       "\t\tif materials is specified it will add appropriate surfaceproperties\n"
       "\t[-vmtparam <paramname> <paramvalue>]\n"
@@ -365,6 +425,45 @@ int PrintUsage(const char *pExtra) {
       "\t\tuse the wad filename if no -subdir is specified.\n"
       "\t-quiet\n"
       "\t\tdon't print out anything or wait for a keypress on exit.\n"
+      "\t-force\n"
+      "\t\tconverts every texture in a wad. otherwise textures whose lump\n"
+      "\t\tand options match the xwad.manifest left in materialsrc by the\n"
+      "\t\tlast run, and whose files are still there, are skipped.\n"
+      "\t-check\n"
+      "\t\tdoesn't convert anything, just checks every wad matched by\n"
+      "\t\t-wadfile for lumps outside the file or overlapping each other,\n"
+      "\t\tbad compressed data and miptexes that don't fit their lumps.\n"
+      "\t\t-basedir isn't needed.\n"
+      "\t-checkcrcs\n"
+      "\t\tlike -check, and lists the CRC32C of every lump.\n"
+      "\t-makeindex <index file>\n"
+      "\t\twrites an index of every wad matched by -wadfile, so -find can\n"
+      "\t\tlook textures up without opening the wads. wads that haven't\n"
+      "\t\tchanged since the last -makeindex aren't read again.\n"
+      "\t-find <tex name> -index <index file>\n"
+      "\t\tlists the wads in the index that have the texture.\n"
+      "\t-repack\n"
+      "\t\trewrites every wad matched by -wadfile with its lumps back to\n"
+      "\t\tback in directory order and any dead space dropped.\n"
+      "\t-sortnames\n"
+      "\t\twith -repack, orders the lumps by name instead.\n"
+      "\t-threads <count>\n"
+      "\t\tnumber of threads to use (default is one per processor). the\n"
+      "\t\tlumps of every wad, the bmps and the frames of every sprite\n"
+      "\t\tare converted in parallel, but print in order.\n"
+      "\t-stats\n"
+      "\t\tprints how long the conversion took, how busy the threads\n"
+      "\t\twere kept, the time and throughput of each stage of it and\n"
+      "\t\tthe slowest textures.\n"
+      "\t-statsjson <file>\n"
+      "\t\tlike -stats, and writes the stages and slowest textures to the\n"
+      "\t\tfile as JSON.\n"
+      "\t-plan\n"
+      "\t\tdoesn't convert or write anything, just lists what would be\n"
+      "\t\twritten, the pixels and bytes involved, textures that would\n"
+      "\t\toverwrite each other and roughly how long it would take.\n"
+      "\t-planjson\n"
+      "\t\tlike -plan, but prints it as JSON.\n"
       "\n",
       pExtra);
   printf("ex: %s -vtex -basedir c:\\hl2\\dod -wadfile c:\\hl1\\dod\\*.wad\n",
@@ -445,7 +544,31 @@ char *FilenameParams(const char *pName, int *vmtparams) {
   return (char *)pName;
 }
 
-void WriteVMTFile(const char *pBaseDir, const char *pSubDir, const char *pName,
+// The materials.txt type for a texture, or 0.  The last rule that matches
+// wins.
+char FindSurfaceMaterial(const char *pName, char **matkeys, char *matvals, int pairs) {
+  int vmtparams = 0;
+  char *pCleanName = FilenameParams(pName, &vmtparams);
+
+  char lastmat = 0;
+  for (int i = 0; i < pairs; i++) {
+    if (strlen(matkeys[i]) < 12) {
+      if (!stricmp(matkeys[i], pName)) {
+        lastmat = matvals[i];
+      } else if (!stricmp(matkeys[i], pCleanName)) {
+        lastmat = matvals[i];
+      }
+    } else {
+      if (!strnicmp(matkeys[i], pName, strlen(matkeys[i]))) {
+        lastmat = matvals[i];
+      }
+    }
+  }
+  return lastmat;
+}
+
+// Returns the size of the file.
+int WriteVMTFile(const char *pBaseDir, const char *pSubDir, const char *pName,
                   bool bAlphatest, char fogintensity, int fogcolor, char **matkeys, char *matvals, int pairs) {
   char vmtFilename[512];
   sprintf(vmtFilename, "%s\\materials\\%s\\%s.vmt", pBaseDir, pSubDir, pName);
@@ -453,7 +576,7 @@ void WriteVMTFile(const char *pBaseDir, const char *pSubDir, const char *pName,
   FILE *fp = fopen(vmtFilename, "wt");
   if (!fp) {
     Error("\tWriteVMTFile failed to open %s for writing.\n", vmtFilename);
-    return;
+    return 0;
   }
   int vmtparams = 0;
   char *pCleanName = FilenameParams(pName, &vmtparams);
@@ -476,22 +599,9 @@ void WriteVMTFile(const char *pBaseDir, const char *pSubDir, const char *pName,
     fprintf(fp, "\t\"$fogcolor\"\t\"{%d %d %d}\"\n", (fogcolor) & 255, (fogcolor >> 8) & 255, (fogcolor >> 16) & 255);
   }
   int i;
-  char lastmat = 0;
-  for (i = 0; i < pairs; i++) {
-    if (strlen(matkeys[i]) < 12) {
-      if (!stricmp(matkeys[i], pName)) {
-        lastmat = matvals[i];
-      } else if (!stricmp(matkeys[i], pCleanName)) {
-        lastmat = matvals[i];
-      }
-    } else {
-      if (!strnicmp(matkeys[i], pName, strlen(matkeys[i]))) {
-        lastmat = matvals[i];
-      }
-    }
-  }
+  char lastmat = FindSurfaceMaterial(pName, matkeys, matvals, pairs);
   if (!g_bQuiet && lastmat) {
-    printf("\t LastMaterial [%c]\n", lastmat);
+    Msg("\t LastMaterial [%c]\n", lastmat);
   }
   if (lastmat == 'M') {
     fprintf(fp, "\t\"$surfaceprop\"\t\"metal\"\n");
@@ -519,7 +629,9 @@ void WriteVMTFile(const char *pBaseDir, const char *pSubDir, const char *pName,
 
   fprintf(fp, "}");
 
+  int length = ftell(fp);
   fclose(fp);
+  return length;
 }
 
 void WriteTXTFile(const char *pBaseDir, const char *pSubDir,
@@ -534,7 +646,8 @@ void WriteTXTFile(const char *pBaseDir, const char *pSubDir,
   fclose(fp);
 }
 
-void WriteResizeInfoFile(const char *pBaseDir, const char *pSubDir,
+// Returns the size of the file.
+int WriteResizeInfoFile(const char *pBaseDir, const char *pSubDir,
                          const char *pName, int width, int height) {
   char filename[512];
   sprintf(filename, "%s\\materials\\%s\\%s.resizeinfo", pBaseDir, pSubDir,
@@ -543,11 +656,12 @@ void WriteResizeInfoFile(const char *pBaseDir, const char *pSubDir,
   FILE *fp = fopen(filename, "wt");
   if (!fp) {
     Error("\tWriteResizeInfoFile failed to open %s for writing.\n", filename);
-    return;
+    return 0;
   }
 
-  fprintf(fp, "%d %d", width, height);
+  int length = fprintf(fp, "%d %d", width, height);
   fclose(fp);
+  return length;
 }
 
 void RunVTexOnFile(const char *pBaseDir, const char *pFilename) {
@@ -574,24 +688,214 @@ void RunVTexOnFile(const char *pBaseDir, const char *pFilename) {
   }
 }
 
+// Windows won't take a command line over 32767 characters.
+#define MAX_VTFCMD_COMMAND_LINE 30000
+
+void GetVTFCmdArgs(const char *pVTFcmdexe, const char *pOutputDir, int nFiles,
+                   const char *const *ppFiles, std::vector<const char *> *pArgs) {
+  pArgs->push_back(pVTFcmdexe);
+  pArgs->push_back("-silent");
+  pArgs->push_back("-resize");
+  pArgs->push_back("-rmethod");
+  pArgs->push_back("BIGGEST");
+  for (int i = 0; i < nFiles; i++) {
+    pArgs->push_back("-file");
+    pArgs->push_back(ppFiles[i]);
+  }
+  pArgs->push_back("-output");
+  pArgs->push_back(pOutputDir);
+}
+
+// What -vtftimeout allows for that many files, in milliseconds.  A big
+// enough batch would overflow an int, so it's held at the most there is.
+int VTFCmdTimeout(int nFiles) {
+  long long ms = (long long)g_nVTFTimeout * 1000 * nFiles;
+  return ms > INT_MAX ? INT_MAX : (int)ms;
+}
+
+// Runs VTFCmd on the files, starting it directly rather than through the
+// shell, and stopping it if it runs for longer than -vtftimeout allows for
+// that many files.
+void RunVTFCmd(const char *pVTFcmdexe, const char *pOutputDir, int nFiles,
+               const char *const *ppFiles, procresult_t *pResult) {
+  std::vector<const char *> args;
+  GetVTFCmdArgs(pVTFcmdexe, pOutputDir, nFiles, ppFiles, &args);
+  RunProcess((int)args.size(), &args[0], VTFCmdTimeout(nFiles), pResult);
+}
+
+void VTFCmdFailed(const char *pVTFcmdexe, const char *pOutputDir, int nFiles,
+                  const char *const *ppFiles, const procresult_t &result) {
+  std::vector<const char *> args;
+  GetVTFCmdArgs(pVTFcmdexe, pOutputDir, nFiles, ppFiles, &args);
+  char command[4096];
+  FormatCommandLine((int)args.size(), &args[0], command, sizeof(command));
+
+  if (result.timedout)
+    Error("\tCommand '%s' took longer than %d seconds!\n%s", command,
+          VTFCmdTimeout(nFiles) / 1000, result.output);
+  Error("\tCommand '%s' failed!\n%s", command, result.output);
+}
+
 void RunVTFCMDOnFile(const char *pBaseDir, const char *pSubDir, const char *pName, const char *pFilename,
 					 const char *pVTFcmdexe) {
   // Call vtfcmd on this texture now.
-  char vtfcmdcommand[1024];
-  sprintf(vtfcmdcommand, "\"\"%s\" -silent -resize -rmethod BIGGEST -file \"%s\" -output \"%s\\materials\\%s\"\"", pVTFcmdexe, pFilename, pBaseDir, pSubDir);
-  if (system(vtfcmdcommand) != 0) {
-    Error("\tCommand '%s' failed!\n", vtfcmdcommand);
+  char outputDir[1024];
+  sprintf(outputDir, "%s\\materials\\%s", pBaseDir, pSubDir);
+  procresult_t result;
+  RunVTFCmd(pVTFcmdexe, outputDir, 1, &pFilename, &result);
+  if (result.exitcode != 0 || result.timedout) {
+    VTFCmdFailed(pVTFcmdexe, outputDir, 1, &pFilename, result);
   } else if (!g_bQuiet) {
-  	printf("\t (%s) -> (%s.vtf)\n", pName, pName);
+    Msg("%s", result.output);
+  	Msg("\t (%s) -> (%s.vtf)\n", pName, pName);
+  }
+  FreeProcResult(&result);
+}
+
+//-----------------------------------------------------------------------------
+// With -vtfbatch, the TGAs are queued up instead and VTFCmd is given them a
+// list at a time, so it's started a handful of times per wad rather than once
+// per texture.  The lists are split so each process in the pool gets one.
+//-----------------------------------------------------------------------------
+
+// The TGAs waiting for VTFCmd, by the materials directory they go to.
+typedef std::map<std::string, std::set<std::string> > VTFCmdQueue_t;
+static VTFCmdQueue_t g_VTFCmdQueue;
+
+struct VTFCmdBatch_t {
+  const char *pOutputDir;
+  std::vector<const char *> files;
+  procresult_t result;
+  double seconds;
+};
+
+static std::vector<VTFCmdBatch_t> g_VTFCmdBatches;
+static const char *g_pVTFCmdBatchExe;
+
+void QueueVTFCmdFile(const char *pBaseDir, const char *pSubDir, const char *pFilename) {
+  char outputDir[1024];
+  sprintf(outputDir, "%s\\materials\\%s", pBaseDir, pSubDir);
+  ThreadLock();
+  g_VTFCmdQueue[outputDir].insert(pFilename);
+  ThreadUnlock();
+}
+
+void RunVTFCmdBatchThread(int, int batch) {
+  VTFCmdBatch_t &b = g_VTFCmdBatches[batch];
+  double start = I_FloatTime();
+  RunVTFCmd(g_pVTFCmdBatchExe, b.pOutputDir, (int)b.files.size(), &b.files[0], &b.result);
+  b.seconds = I_FloatTime() - start;
+}
+
+void FlushVTFCmdQueue(const char *pVTFcmdexe) {
+  if (g_VTFCmdQueue.empty()) return;
+
+  ThreadSetDefault();
+  int nProcesses = maxprocesses > 0 ? maxprocesses : numthreads;
+
+  for (VTFCmdQueue_t::iterator it = g_VTFCmdQueue.begin(); it != g_VTFCmdQueue.end(); ++it) {
+    int nFiles = (int)it->second.size();
+    int nPerBatch = (nFiles + nProcesses - 1) / nProcesses;
+    int length = 0;
+    for (std::set<std::string>::iterator f = it->second.begin(); f != it->second.end(); ++f) {
+      int fileLength = (int)f->size() + 10;  // quotes, spaces and -file
+      if (g_VTFCmdBatches.empty() || g_VTFCmdBatches.back().pOutputDir != it->first.c_str() ||
+          (int)g_VTFCmdBatches.back().files.size() == nPerBatch ||
+          length + fileLength > MAX_VTFCMD_COMMAND_LINE) {
+        g_VTFCmdBatches.push_back(VTFCmdBatch_t());
+        g_VTFCmdBatches.back().pOutputDir = it->first.c_str();
+        length = 0;
+      }
+      g_VTFCmdBatches.back().files.push_back(f->c_str());
+      length += fileLength;
+    }
+  }
+
+  g_pVTFCmdBatchExe = pVTFcmdexe;
+  RunThreadsOnIndividual((int)g_VTFCmdBatches.size(), false, RunVTFCmdBatchThread);
+
+  for (size_t i = 0; i < g_VTFCmdBatches.size(); i++) {
+    VTFCmdBatch_t &b = g_VTFCmdBatches[i];
+    AddStage(STAGE_TOOL, b.seconds, 0, 0);
+    if (b.result.exitcode != 0 || b.result.timedout)
+      VTFCmdFailed(pVTFcmdexe, b.pOutputDir, (int)b.files.size(), &b.files[0], b.result);
+    if (!g_bQuiet) {
+      Msg("%s", b.result.output);
+      Msg("\t %d textures -> (%s)\n", (int)b.files.size(), b.pOutputDir);
+    }
+    FreeProcResult(&b.result);
   }
+  g_VTFCmdBatches.clear();
+  g_VTFCmdQueue.clear();
+}
+
+//-----------------------------------------------------------------------------
+// Writing is the last stage of a texture's conversion.  The conversion
+// threads read, decode and encode everything into memory, then hand it to the
+// writer threads through a bounded queue, so the disk and vtfcmd are kept
+// busy while the next textures are being converted.  If the writers fall
+// behind, the queue fills and holds the conversion threads back, so only a
+// queue's worth of encoded textures is ever waiting however big the input.
+//-----------------------------------------------------------------------------
+
+struct OutputJob_t {
+  int task;
+  const char *pBaseDir;
+  const char *pSubDir;
+  char name[512];
+  const char *pVTFcmdexe;
+  char **matkeys;
+  char *matvals;
+  int pairs;
+
+  OutputFile_t tga;
+  OutputFile_t vtf;
+
+  bool bVMT;
+  bool bAlphatest;
+  char fogintensity;
+  int fogcolor;
+  bool bResized;  // so it needs a .resizeinfo
+  int width;
+  int height;
+  bool bNewline;  // ends the texture's output
+};
+
+OutputJob_t *NewOutputJob(const char *pBaseDir, const char *pSubDir, const char *pName) {
+  OutputJob_t *pJob = new OutputJob_t;
+  memset(pJob, 0, sizeof(*pJob));
+  pJob->task = -1;
+  pJob->pBaseDir = pBaseDir;
+  pJob->pSubDir = pSubDir;
+  strncpy(pJob->name, pName, sizeof(pJob->name) - 1);
+  return pJob;
 }
 
-void WriteOutputFiles(const char *pBaseDir, const char *pSubDir,
-                      const char *pName, bool bAllowTranslucent, byte *buffer,
-                      int width, int height, byte *pPalette, bool bVTex,
-                      const char *pVTFcmdexe, char **matkeys, char *matvals, int pairs) {
+void FreeOutputJob(OutputJob_t *pJob) {
+  free(pJob->tga.pData);
+  free(pJob->vtf.pData);
+  delete pJob;
+}
+
+// Everything but the writing, which WriteOutputFiles does with what this
+// returns.  The scratch buffers come from the arena; the files it returns
+// are on the heap, to outlive the arena's next reset.
+OutputJob_t *EncodeOutputFiles(arena_t *pArena, const char *pBaseDir, const char *pSubDir,
+                               const char *pName, bool bAllowTranslucent, const byte *buffer,
+                               int width, int height, const byte *pPalette, bool bVTex,
+                               const char *pVTFcmdexe, char **matkeys, char *matvals, int pairs) {
+  OutputJob_t *pJob = NewOutputJob(pBaseDir, pSubDir, pName);
+  pJob->pVTFcmdexe = pVTFcmdexe;
+  pJob->matkeys = matkeys;
+  pJob->matvals = matvals;
+  pJob->pairs = pairs;
+  pJob->width = width;
+  pJob->height = height;
+
   bool bAlphatest, bResized;
   bool bPowerOf2 = true;
+  bool bTiling = !g_bDecal;  // decals are placed once, everything else repeats
+  int newWidth, newHeight;
   int  vmtparams = 0;
   char fogintensity = 0;
   int  fogcolor;
@@ -599,15 +903,49 @@ void WriteOutputFiles(const char *pBaseDir, const char *pSubDir,
   if (pPalette[13] == 0 && pPalette[14] == 0) {
     fogintensity = pPalette[12];
   }
-  char tgaFilename[1024];
-  sprintf(tgaFilename, "%s\\materialsrc\\%s\\%s.tga", pBaseDir, pSubDir, pName);
-  if (!WriteTGAFile(tgaFilename, bAllowTranslucent, buffer, width, height,
-                    pPalette, bPowerOf2, &bAlphatest, &bResized)) {
-    Error("\tError writing %s.\n", tgaFilename);
+  RGBAColor *pRGB = ConvertTexture(pArena, bAllowTranslucent, buffer, width, height, pPalette,
+                                   bPowerOf2, bTiling, &bAlphatest, &bResized, &newWidth,
+                                   &newHeight);
+
+  sprintf(pJob->tga.filename, "%s\\materialsrc\\%s\\%s.tga", pBaseDir, pSubDir, pName);
+  if (g_bWriteTGA)
+    EncodeTGAFile(&pJob->tga, pRGB, newWidth, newHeight, bAlphatest || g_bDecal);
+
+  pJob->bVMT = true;
+  pJob->bAlphatest = bAlphatest;
+  pJob->fogintensity = fogintensity;
+  pJob->fogcolor = fogcolor;
+
+  if (g_bWriteVTF) {
+    sprintf(pJob->vtf.filename, "%s\\materials\\%s\\%s.vtf", pBaseDir, pSubDir, pName);
+    EncodeVTFFile(pArena, &pJob->vtf, pRGB, newWidth, newHeight, bAlphatest || g_bDecal, bTiling,
+                  bAlphatest);
+  }
+  pJob->bResized = bResized;
+
+  return pJob;
+}
+
+void WriteOutputFiles(const OutputJob_t *pJob) {
+  const char *pBaseDir = pJob->pBaseDir;
+  const char *pSubDir = pJob->pSubDir;
+  const char *pName = pJob->name;
+  int pixels = pJob->width * pJob->height;
+  double start;
+
+  if (pJob->tga.pData) {
+    start = BeginStage();
+    WriteOutputFile(pJob->tga);
+    EndStage(STAGE_TGA_WRITE, start, pJob->tga.length, pixels);
   }
 
   // Write its .VMT file.
-  WriteVMTFile(pBaseDir, pSubDir, pName, bAlphatest, fogintensity, fogcolor, matkeys, matvals, pairs);
+  if (pJob->bVMT) {
+    start = BeginStage();
+    int length = WriteVMTFile(pBaseDir, pSubDir, pName, pJob->bAlphatest, pJob->fogintensity,
+                              pJob->fogcolor, pJob->matkeys, pJob->matvals, pJob->pairs);
+    EndStage(STAGE_VMT_WRITE, start, length, 0);
+  }
 
   // Write a text file for it if it's translucent so we can enable pointsample
   // for vtex.
@@ -619,182 +957,380 @@ void WriteOutputFiles(const char *pBaseDir, const char *pSubDir,
   // if (bVTex) {
   //   RunVTexOnFile(pBaseDir, tgaFilename);
   // }
-  if (pVTFcmdexe) {
-  	RunVTFCMDOnFile(pBaseDir, pSubDir, pName, tgaFilename, pVTFcmdexe);
+  if (pJob->vtf.pData) {
+    start = BeginStage();
+    WriteOutputFile(pJob->vtf);
+    EndStage(STAGE_VTF_WRITE, start, pJob->vtf.length, pixels);
+    if (!g_bQuiet) Msg("\t (%s) -> (%s.vtf)\n", pName, pName);
+  } else if (pJob->pVTFcmdexe && g_bVTFBatch) {
+    QueueVTFCmdFile(pBaseDir, pSubDir, pJob->tga.filename);
+  } else if (pJob->pVTFcmdexe) {
+    start = BeginStage();
+  	RunVTFCMDOnFile(pBaseDir, pSubDir, pName, pJob->tga.filename, pJob->pVTFcmdexe);
+    EndStage(STAGE_TOOL, start, pJob->tga.length, pixels);
   }
-  if (bResized) {
-    WriteResizeInfoFile(pBaseDir, pSubDir, pName, width, height);
+  if (pJob->bResized) {
+    start = BeginStage();
+    int length = WriteResizeInfoFile(pBaseDir, pSubDir, pName, pJob->width, pJob->height);
+    EndStage(STAGE_VMT_WRITE, start, length, 0);
   }
+
+  if (pJob->bNewline && !g_bQuiet) Msg("\n");
 }
 
 void EnsureDirectoriesExist(const char *pBaseDir, const char *pSubDir) {
   char materialsrcDir[512], materialsDir[512];
   sprintf(materialsrcDir, "%s\\materialsrc\\%s", pBaseDir, pSubDir);
   sprintf(materialsDir, "%s\\materials\\%s", pBaseDir, pSubDir);
+  double start = BeginStage();
   EnsureDirExists(materialsrcDir);
   EnsureDirExists(materialsDir);
+  EndStage(STAGE_DIRECTORY, start, 0, 0);
 }
 
-void ProcessWadFile(const char *pWadFilename, const char *pBaseDir,
-                    const char *pSubDir, const char *pOnlyTex, bool bVTex,
-                    const char *pVTFcmdexe, char **matkeys, char *matvals, int pairs) {
-  if (!g_bQuiet) printf("\n\n[WADFILE %s]\n\n", pWadFilename);
-
-  // If no -subdir was specified, then figure it out from the wad filename.
-  char wadBaseName[512];
-  if (!pSubDir) {
-    // Get the base wad filename.
-    GetBaseFilename(pWadFilename, wadBaseName);
-    pSubDir = wadBaseName;
-  }
-
-  EnsureDirectoriesExist(pBaseDir, pSubDir);
-
-  // Now process all the images in the wad.
-  W_OpenWad(pWadFilename);
-
-  #define MAXLUMP (640 * 480 * 85 / 64)
-  byte inbuffer[MAXLUMP];
+//-----------------------------------------------------------------------------
+// The manifest records, for every texture written to an output directory, a
+// hash of the lump it came from and of every option that changes what gets
+// written for it.  A texture whose hash still matches, and whose files are
+// still there, doesn't need converting again.
+//-----------------------------------------------------------------------------
 
-  for (int i = 0; i < numlumps; i++) {
-    if (pOnlyTex && stricmp(pOnlyTex, lumpinfo[i].name) != 0) continue;
+#define MANIFEST_VERSION 1
 
-    fseek(wadhandle, lumpinfo[i].filepos, SEEK_SET);
-    SafeRead(wadhandle, inbuffer, lumpinfo[i].size);
+typedef std::map<std::string, unsigned long long> Manifest_t;
 
-    miptex_t *qtex = (miptex_t *)inbuffer;
-    int width = LittleLong(qtex->width);
-    int height = LittleLong(qtex->height);
+void GetManifestFilename(const char *pBaseDir, const char *pSubDir, char filename[512]) {
+  _snprintf(filename, 512, "%s\\materialsrc\\%s\\xwad.manifest", pBaseDir, pSubDir);
+  filename[511] = 0;
+}
 
-    if (width <= 0 || height <= 0 || width > 5000 || height > 5000) {
-      if (!g_bQuiet)
-        printf("\tskipping %s @ %d  size %d (not an image?)\n",
-               lumpinfo[i].name, lumpinfo[i].filepos, lumpinfo[i].size);
-      continue;
-    } else {
-      if (!g_bQuiet) printf("\t%s\n", lumpinfo[i].name);
+void LoadManifest(const char *pFilename, Manifest_t *pManifest) {
+  pManifest->clear();
+
+  FILE *fp = fopen(pFilename, "rt");
+  if (!fp) return;
+
+  // A manifest from another version of xwad might not hash the same things.
+  int version = 0;
+  char line[512];
+  if (fgets(line, sizeof(line), fp) && sscanf(line, "xwad manifest %d", &version) == 1 &&
+      version == MANIFEST_VERSION) {
+    while (fgets(line, sizeof(line), fp)) {
+      unsigned long long hash;
+      char name[256];
+      if (sscanf(line, "%llx %255s", &hash, name) == 2) (*pManifest)[name] = hash;
     }
+  }
+  fclose(fp);
+}
 
-    byte *pPalette =
-        inbuffer + LittleLong(qtex->offsets[3]) + width * height / 64 + 2;
-    byte *psrc, *pdest;
+void SaveManifest(const char *pFilename, const Manifest_t &manifest) {
+  char tempFilename[512 + 8];
+  sprintf(tempFilename, "%s.tmp", pFilename);
 
-    byte outbuffer[(640 + 320) * 480];
+  FILE *fp = fopen(tempFilename, "wt");
+  if (!fp) Error("\tSaveManifest: can't open %s for writing.\n", tempFilename);
 
-    // The old xwad	put the mipmaps in there too, but we don't want that now
-    // (usually).
-    // copy in 0 image
-    psrc = inbuffer + LittleLong(qtex->offsets[0]);
-    pdest = outbuffer;
-    for (int t = 0; t < height; t++) {
-      memcpy(pdest + t * width, psrc + t * width, width);
-    }
+  fprintf(fp, "xwad manifest %d\n", MANIFEST_VERSION);
+  for (Manifest_t::const_iterator it = manifest.begin(); it != manifest.end(); ++it)
+    fprintf(fp, "%016llx %s\n", it->second, it->first.c_str());
+  if (fclose(fp)) Error("\tSaveManifest: error writing %s.\n", tempFilename);
 
-    WriteOutputFiles(pBaseDir,              // base directory
-                     pSubDir,               // subdir under materials
-                     qtex->name,            // filename (w/o extension)
-                     qtex->name[0] == '{',  // allow transparency?
-                     outbuffer, width, height, pPalette, bVTex, pVTFcmdexe, matkeys, matvals, pairs);
-    if (!g_bQuiet) printf("\n");
+  if (!MoveFileEx(tempFilename, pFilename, MOVEFILE_REPLACE_EXISTING))
+    Error("\tSaveManifest: can't rename %s to %s.\n", tempFilename, pFilename);
+}
+
+// Everything that goes into a texture's files: the lump itself and the
+// options that end up in the .tga, .vmt or .vtf.
+unsigned long long HashTextureInputs(const void *pLump, int lumpLength, const char *pSubDir,
+                                     const char *pName, const char *pVTFcmdexe,
+                                     char **matkeys, char *matvals, int pairs) {
+  char options[4096];
+  int len = _snprintf(options, sizeof(options), "%s|%s|%d|%d|%d|%c|%d|%d|%d|%d|%d|%d|%d",
+                      pSubDir, g_pShader, g_bDecal, g_bBMPAllowTranslucent, pVTFcmdexe != NULL,
+                      FindSurfaceMaterial(pName, matkeys, matvals, pairs), g_bWriteTGA,
+                      g_bWriteVTF, g_nVTFFormat, g_nVTFAlphaFormat, g_nResample,
+                      g_nVTFAlphatestFormat, g_bDXTQuality);
+  for (int i = 0; i < g_NumVMTParams && len >= 0 && len < (int)sizeof(options); i++) {
+    len += _snprintf(options + len, sizeof(options) - len, "|%s=%s",
+                     g_VMTParams[i].m_szParam, g_VMTParams[i].m_szValue);
   }
+  if (len < 0 || len > (int)sizeof(options)) len = sizeof(options);
 
+  unsigned long long hashes[2];
+  hashes[0] = W_HashData(pLump, lumpLength);
+  hashes[1] = W_HashData(options, len);
+  return W_HashData(hashes, sizeof(hashes));
 }
 
-void ProcessBMPFile(const char *pBaseDir, const char *pSubDir,  const char *pFilename, bool bVTex, const char *pVTFcmdexe, char **matkeys, char *matvals, int pairs) {
-  if (!g_bQuiet) printf("[%s]\n", pFilename);
+// True if every file WriteOutputFiles makes for the texture is still there.
+bool OutputFilesExist(const char *pBaseDir, const char *pSubDir, const char *pName,
+                      const char *pVTFcmdexe) {
+  char filename[1024];
+  sprintf(filename, "%s\\materialsrc\\%s\\%s.tga", pBaseDir, pSubDir, pName);
+  if (g_bWriteTGA && _access(filename, 0) != 0) return false;
+  sprintf(filename, "%s\\materials\\%s\\%s.vmt", pBaseDir, pSubDir, pName);
+  if (_access(filename, 0) != 0) return false;
+  if (pVTFcmdexe || g_bWriteVTF) {
+    sprintf(filename, "%s\\materials\\%s\\%s.vtf", pBaseDir, pSubDir, pName);
+    if (_access(filename, 0) != 0) return false;
+  }
+  return true;
+}
 
-  if (!pSubDir) pSubDir = ".";
+//-----------------------------------------------------------------------------
+// Every input is broken into tasks up front, a lump of a wad, a bmp or a
+// frame of a sprite, and all of them go to one work stealing scheduler, so a
+// big wad at the end of the list doesn't leave the other threads idle.
+// Each task's console output is held back and printed in task order, along
+// with each file's own header and trailer, so a run prints the same thing
+// whatever the thread count, and an Error in one task comes out after
+// everything the tasks before it printed.
+//-----------------------------------------------------------------------------
 
-  // First make directories under materialsrc and materials if they don't exist.
-  EnsureDirectoriesExist(pBaseDir, pSubDir);
+enum { INPUT_WAD, INPUT_BMP, INPUT_SPR };
 
-  // Read in the 8-bit BMP file.
-  FILE *fp = fopen(pFilename, "rb");
-  if (!fp)
-    Error("ProcessBMPFile( %s ) can't open the file for reading.\n", pFilename);
+// A manifest shared by every wad that writes to its subdir.
+struct ManifestFile_t {
+  char filename[512];
+  Manifest_t entries;
+  int nFilesLeft;  // wads still to be finished
+  bool bChanged;
+};
 
-  BITMAPFILEHEADER bfh;
-  BITMAPINFOHEADER bih;
-  unsigned char pixelData[512 * 512];
+struct InputFile_t {
+  int type;
+  char filename[512];
+  char subDir[512];
+  spewbuffer_t header;   // printed before its first task
+  spewbuffer_t trailer;  // and after its last
+  int firstTask;
+  int nTasks;
+  bool bStarted;
+
+  // wads
+  WadReader *pWad;
+  int firstLump;
+  ManifestFile_t *pManifest;
+
+  // sprites
+  byte *pSprite;
+  int spriteLength;
+  const byte *pPalette;
+  std::vector<int> frameOfs;  // of each frame's dspriteframe_t
+  bool bComplete;             // every frame was good, so it gets a .txt and .vmt
+  int numFrames;
+};
 
-  SafeRead(fp, &bfh, sizeof(bfh));
-  SafeRead(fp, &bih, sizeof(bih));
+struct Task_t {
+  spewbuffer_t spew;  // first, so the buffer Error hands back leads to the task
+  int file;
+  int item;           // lump or frame, unused for bmps
+  int prevSameName;   // an earlier task that writes the same files, or -1
+  bool bDone;
+  bool bConverted;
+  bool bQueued;       // its files have gone to the writers
+  unsigned long long inputHash;
+  char texName[17];
+  int width;   // of the converted image
+  int height;
+  StageTimes_t times;
+};
 
-  // Make sure it's an 8-bit one like we want.
-  if (bih.biSize != sizeof(bih) || bih.biPlanes != 1 || bih.biBitCount != 8 ||
-      bih.biCompression != BI_RGB || bih.biHeight < 0 ||
-      bih.biWidth * bih.biHeight > sizeof(pixelData)) {
-    Error("ProcessBMPFile( %s ) - invalid format.\n", pFilename);
-  }
+struct Run_t {
+  bool bPlan;  // only working out what would be done
+  const char *pBaseDir;
+  const char *pOnlyTex;
+  bool bVTex;
+  const char *pVTFcmdexe;
+  char **matkeys;
+  char *matvals;
+  int pairs;
+
+  std::vector<InputFile_t *> files;
+  std::map<std::string, ManifestFile_t *> manifests;
+  std::vector<Task_t> tasks;
+  std::map<std::string, int> lastWithName;  // for prevSameName
+
+  int printFile;  // the first file that hasn't been finished
+  int nextPrint;  // the first task whose output hasn't been printed
+
+  workqueue_t writeQueue;  // OutputJob_t's, NULL to stop a writer
+  int nWriters;
+  int nWritersInError;  // stopped in Error, waiting to report it
+  int nWritten;
+
+  std::vector<arena_t> arenas;  // each conversion thread's scratch
+
+  bool bStageTimes;                        // for -stats
+  StageTimes_t runTimes;                   // what isn't any one texture's
+  std::vector<StageTimes_t> threadTimes;   // each conversion thread's queue waits
+};
 
-  int nColorsUsed = 256;
-  if (bih.biClrUsed != 0) {
-    nColorsUsed = bih.biClrUsed;
-    if (nColorsUsed > 256)
-      Error("ProcessBMPFile( %s ) - bih.biClrUsed = %d.\n", pFilename,
-            bih.biClrUsed);
-  }
+static Run_t g_Run;
+
+// The name a lump's files are written under: the miptex's own, as
+// ConvertWadLump uses.  Only the header is read, decompressed if need be.  A
+// lump too short to have one isn't written, so its directory name will do.
+void GetLumpTexName(const WadReader &wad, int lump, char texName[17]) {
+  lumpview_t view;
+  miptex_t head;
+  const miptex_t *qtex = NULL;
+  if (wad.MapLumpNum(lump, &view))
+    qtex = (const miptex_t *)W_ViewRange(&view, 0, sizeof(miptex_t));
+  else if (wad.ReadLumpHead(lump, &head, sizeof(head)))
+    qtex = &head;
+  memcpy(texName, qtex ? qtex->name : wad.LumpInfo(lump)->name, 16);
+  texName[16] = 0;
+}
 
-  RGBQUAD quadPalette[256];
-  SafeRead(fp, quadPalette, sizeof(quadPalette[0]) * nColorsUsed);
+// Adds a task for the file being set up.  Filenames aren't case sensitive, so
+// neither is spotting two tasks that write the same ones: they're matched on
+// the whole of the path their files go under, lower cased.
+void AddTask(int file, int item, const char *pSubDir, const char *pName) {
+  Task_t task;
+  memset(&task, 0, sizeof(task));
+  task.file = file;
+  task.item = item;
+
+  char path[1024];
+  _snprintf(path, sizeof(path), "%s\\%s", pSubDir, pName);
+  path[sizeof(path) - 1] = 0;
+  for (char *p = path; *p; p++) *p = *p == '/' ? '\\' : tolower(*p);
+  std::map<std::string, int>::iterator it = g_Run.lastWithName.find(path);
+  task.prevSameName = it != g_Run.lastWithName.end() ? it->second : -1;
+  g_Run.lastWithName[path] = (int)g_Run.tasks.size();
+
+  g_Run.tasks.push_back(task);
+  g_Run.files[file]->nTasks++;
+}
 
-  // Usually, bfOffBits is the same place we are at now, but sometimes it's a
-  // little different.
-  fseek(fp, bfh.bfOffBits, SEEK_SET);
+InputFile_t *NewInputFile(int type, const char *pFilename, const char *pSubDir) {
+  InputFile_t *pFile = new InputFile_t;
+  pFile->type = type;
+  strncpy(pFile->filename, pFilename, sizeof(pFile->filename) - 1);
+  pFile->filename[sizeof(pFile->filename) - 1] = 0;
+  strncpy(pFile->subDir, pSubDir, sizeof(pFile->subDir) - 1);
+  pFile->subDir[sizeof(pFile->subDir) - 1] = 0;
+  memset(&pFile->header, 0, sizeof(pFile->header));
+  memset(&pFile->trailer, 0, sizeof(pFile->trailer));
+  pFile->firstTask = (int)g_Run.tasks.size();
+  pFile->nTasks = 0;
+  pFile->bStarted = false;
+  pFile->pWad = NULL;
+  pFile->firstLump = 0;
+  pFile->pManifest = NULL;
+  pFile->pSprite = NULL;
+  pFile->spriteLength = 0;
+  pFile->pPalette = NULL;
+  pFile->bComplete = false;
+  pFile->numFrames = 0;
+  g_Run.files.push_back(pFile);
+  return pFile;
+}
 
-  // Now read the bitmap data.
-  SafeRead(fp, pixelData, bih.biWidth * bih.biHeight);
+void AddWadFile(const char *pWadFilename, const char *pSubDir) {
+  // If no -subdir was specified, then figure it out from the wad filename.
+  char wadBaseName[512];
+  if (!pSubDir) {
+    // Get the base wad filename.
+    GetBaseFilename(pWadFilename, wadBaseName);
+    pSubDir = wadBaseName;
+  }
 
-  fclose(fp);
+  int file = (int)g_Run.files.size();
+  InputFile_t *pFile = NewInputFile(INPUT_WAD, pWadFilename, pSubDir);
+  SpewCapture(&pFile->header);
+  if (!g_bQuiet) Msg("\n\n[WADFILE %s]\n\n", pWadFilename);
+
+  if (!g_Run.bPlan) EnsureDirectoriesExist(g_Run.pBaseDir, pSubDir);
+
+  // Wads sharing a subdir share its manifest.
+  char manifestFilename[512];
+  GetManifestFilename(g_Run.pBaseDir, pSubDir, manifestFilename);
+  ManifestFile_t *&pManifest = g_Run.manifests[manifestFilename];
+  if (!pManifest) {
+    pManifest = new ManifestFile_t;
+    strcpy(pManifest->filename, manifestFilename);
+    pManifest->nFilesLeft = 0;
+    pManifest->bChanged = false;
+    LoadManifest(manifestFilename, &pManifest->entries);
+  }
+  pManifest->nFilesLeft++;
+  pFile->pManifest = pManifest;
 
-  // Convert the palette.
-  byte palette[256][3];
-  for (int i = 0; i < 256; i++) {
-    palette[i][0] = quadPalette[i].rgbRed;
-    palette[i][1] = quadPalette[i].rgbGreen;
-    palette[i][2] = quadPalette[i].rgbBlue;
+  // Now process all the images in the wad.
+  pFile->pWad = new WadReader;
+  if (!pFile->pWad->Open(pWadFilename)) Error("%s\n", pFile->pWad->GetError());
+
+  // -onlytex is looked up in the name hash rather than tested on every lump,
+  // and every lump with the name is converted, as when it was tested.
+  int firstLump = 0;
+  if (g_Run.pOnlyTex) {
+    firstLump = pFile->pWad->CheckNumForName(g_Run.pOnlyTex);
+    if (firstLump == -1 && !g_bQuiet) Msg("\t%s not found in %s\n", g_Run.pOnlyTex, pWadFilename);
   }
+  pFile->firstLump = firstLump;
 
-  // Unflip the pixel data.
-  for (int y = 0; y < bih.biHeight / 2; y++) {
-    byte tempLine[1024];
-    memcpy(tempLine, &pixelData[y * bih.biWidth], bih.biWidth);
-    memcpy(&pixelData[y * bih.biWidth],
-           &pixelData[(bih.biHeight - y - 1) * bih.biWidth], bih.biWidth);
-    memcpy(&pixelData[(bih.biHeight - y - 1) * bih.biWidth], tempLine,
-           bih.biWidth);
+  char texName[17];
+  if (g_Run.pOnlyTex) {
+    for (int lump = firstLump; lump != -1; lump = pFile->pWad->NextNumForName(lump)) {
+      GetLumpTexName(*pFile->pWad, lump, texName);
+      AddTask(file, lump, pSubDir, texName);
+    }
+  } else {
+    for (int lump = 0; lump < pFile->pWad->NumLumps(); lump++) {
+      GetLumpTexName(*pFile->pWad, lump, texName);
+      AddTask(file, lump, pSubDir, texName);
+    }
   }
+  SpewCapture(NULL);
+}
+
+void AddBMPFile(const char *pFilename, const char *pSubDir) {
+  if (!pSubDir) pSubDir = ".";
+
+  int file = (int)g_Run.files.size();
+  NewInputFile(INPUT_BMP, pFilename, pSubDir);
 
   char baseFilename[512];
   GetBaseFilename(pFilename, baseFilename);
-
-  // Save it out.
-  WriteOutputFiles(pBaseDir,                // base directory
-                   pSubDir,                 // subdir under materials
-                   baseFilename,            // filename (w/o extension)
-                   g_bBMPAllowTranslucent,  // allow transparency
-                   pixelData, bih.biWidth, bih.biHeight, (byte *)palette,
-                   bVTex, pVTFcmdexe, matkeys, matvals, pairs);
+  AddTask(file, 0, pSubDir, baseFilename);
 }
 
-void ProcessSPRFile(const char *pBaseDir, const char *pSubDir,  const char *pFilename, bool bVTex) {
-  if (!g_bQuiet) printf("[%s]\n", pFilename);
-
+// The sprite file is loaded and its frames found here, so each can be its
+// own task.  The file is walked the way the frames used to be read one after
+// another, so anything wrong with a frame stops it at the same place.
+void AddSPRFile(const char *pFilename, const char *pSubDir) {
   if (!pSubDir) pSubDir = ".";
 
+  int file = (int)g_Run.files.size();
+  InputFile_t *pFile = NewInputFile(INPUT_SPR, pFilename, pSubDir);
+  SpewCapture(&pFile->header);
+  if (!g_bQuiet) Msg("[%s]\n", pFilename);
+
   char baseFilename[512];
   GetBaseFilename(pFilename, baseFilename);
 
   // First make directories under materialsrc and materials if they don't exist.
-  EnsureDirectoriesExist(pBaseDir, pSubDir);
+  if (!g_Run.bPlan) EnsureDirectoriesExist(g_Run.pBaseDir, pSubDir);
 
   // Read in the SPR file.
   FILE *fp = fopen(pFilename, "rb");
   if (!fp)
     Error("ProcessSPRFile( %s ) can't open the file for reading.\n", pFilename);
-
+  fclose(fp);
+  void *pData;
+  double start = BeginStage();
+  pFile->spriteLength = LoadFile((char *)pFilename, &pData);
+  EndStage(STAGE_READ, start, pFile->spriteLength, 0);
+  pFile->pSprite = (byte *)pData;
+
+  const byte *pSprite = pFile->pSprite;
+  int pos = sizeof(dsprite_t);
+  if (pFile->spriteLength < pos) Error("File read failure");
   dsprite_t header;
-  SafeRead(fp, &header, sizeof(header));
+  memcpy(&header, pSprite, sizeof(header));
 
   // Make sure it's a sprite file.
   if (((header.ident >> 0) & 0xFF) != 'I' ||
@@ -802,62 +1338,53 @@ void ProcessSPRFile(const char *pBaseDir, const char *pSubDir,  const char *pFil
       ((header.ident >> 16) & 0xFF) != 'S' ||
       ((header.ident >> 24) & 0xFF) != 'P') {
     Warning("WARNING: sprite %s is not a sprite file. Skipping.\n", pFilename);
-    fclose(fp);
+    SpewCapture(NULL);
     return;
   }
 
   if (header.version != 2) {
     Warning("WARNING: sprite %s is not a version 2 sprite file. Skipping.\n",
             pFilename);
-    fclose(fp);
+    SpewCapture(NULL);
     return;
   }
 
-  // Read the palette.
-  short cnt;
-  byte palette[768];
-  SafeRead(fp, &cnt, sizeof(cnt));
-  SafeRead(fp, palette, sizeof(palette));
+  // The palette, after its count.
+  if (pFile->spriteLength < pos + (int)sizeof(short) + 768) Error("File read failure");
+  pFile->pPalette = pSprite + pos + sizeof(short);
+  pos += sizeof(short) + 768;
 
-  // Read the frames.
-  int i;
-  for (i = 0; i < header.numframes; i++) {
+  // A bad frame is reported after the frames before it have printed.
+  SpewCapture(&pFile->trailer);
+  pFile->numFrames = header.numframes;
+  pFile->bComplete = true;
+  for (int i = 0; i < header.numframes; i++) {
     spriteframetype_t type;
-    SafeRead(fp, &type, sizeof(type));
+    if (pFile->spriteLength < pos + (int)sizeof(type)) Error("File read failure");
+    memcpy(&type, pSprite + pos, sizeof(type));
+    pos += sizeof(type);
     if (type == SPR_SINGLE) {
       dspriteframe_t frame;
-      SafeRead(fp, &frame, sizeof(frame));
+      if (pFile->spriteLength < pos + (int)sizeof(frame)) Error("File read failure");
+      memcpy(&frame, pSprite + pos, sizeof(frame));
       if (frame.width > 5000 || frame.height > 5000 || frame.width < 1 ||
           frame.height < 1) {
         Warning(
             "WARNING: sprite %s has an invalid frame size (%d x %d) for frame "
             "%d.\n",
             pFilename, frame.width, frame.height, i);
-        fclose(fp);
-        return;
-      }
-
-      byte *frameData = new byte[frame.width * frame.height];
-      SafeRead(fp, frameData, frame.width * frame.height);
-
-      Msg("\tFrame %d   ", i);
-
-      // Write the TGA file for this frame.
-      bool bAlphatest, bResized;
-      char frameFilename[512];
-      _snprintf(frameFilename, sizeof(frameFilename),
-                "%s\\materialsrc\\%s\\%s%03d.tga", pBaseDir, pSubDir,
-                baseFilename, i);
-      if (!WriteTGAFile(frameFilename, g_bBMPAllowTranslucent, frameData,
-                        frame.width, frame.height, palette,
-                        true,  // allow power-of-2
-                        &bAlphatest, &bResized)) {
-        Error("\tError writing %s.\n", frameFilename);
+        pFile->bComplete = false;
+        break;
       }
+      if (pFile->spriteLength - pos - (int)sizeof(frame) < frame.width * frame.height)
+        Error("File read failure");
 
-      if (!g_bQuiet) printf("\n");
+      pFile->frameOfs.push_back(pos);
+      pos += sizeof(frame) + frame.width * frame.height;
 
-      delete[] frameData;
+      char frameName[512];
+      _snprintf(frameName, sizeof(frameName), "%s%03d", baseFilename, i);
+      AddTask(file, i, pSubDir, frameName);
     } else if (type == SPR_GROUP) {
       Error(
           "Sprite %s uses type SPR_GROUP. Get a programmer to add support for "
@@ -867,56 +1394,316 @@ void ProcessSPRFile(const char *pBaseDir, const char *pSubDir,  const char *pFil
       Warning(
           "WARNING: sprite %s has an invalid frame type (%d) for frame %d.\n",
           pFilename, type, i);
-      fclose(fp);
-      return;
+      pFile->bComplete = false;
+      break;
     }
   }
+  SpewCapture(NULL);
+}
 
-  fclose(fp);
+// Sleeps until the task has finished, for the rare one that has to wait on
+// another.  FinishTask wakes it.
+void WaitForTask(int task) {
+  ThreadLock();
+  while (!g_Run.tasks[task].bDone) ThreadWait();
+  ThreadUnlock();
+}
 
-  //
-  // Generate a .txt file for the sprite.
-  //
-  char txtFilename[512];
-  sprintf(txtFilename, "%s\\materialsrc\\%s\\%s.txt", pBaseDir, pSubDir,
-          baseFilename);
+// Error on a conversion or writer thread waits here until every task before
+// its own has been printed.  Those tasks may still be in the write queue, so
+// once every writer is waiting here there's nothing left to take them, and
+// the error goes out straight away instead.
+void WaitToReportTaskError(spewbuffer_t *pSpew) {
+  int task = (int)((Task_t *)pSpew - &g_Run.tasks[0]);
+  ThreadLock();
+  if (g_Run.tasks[task].bQueued) {
+    g_Run.nWritersInError++;
+    ThreadWake();
+  }
+  while (g_Run.nextPrint != task && g_Run.nWritersInError != g_Run.nWriters) ThreadWait();
+  ThreadUnlock();
+}
 
-  fp = fopen(txtFilename, "wt");
-  if (!fp) Error("\tProcessSPRFile: can't open %s for writing.\n", txtFilename);
+enum { LUMP_IMAGE, LUMP_NOT_IMAGE, LUMP_TRUNCATED, LUMP_UNCHANGED };
 
-  fprintf(fp, "\"startframe\" \"0\"\n");
-  fprintf(fp, "\"endframe\" \"%d\"\n", header.numframes - 1);
-  fprintf(fp, "\"nomip\" \"1\"\n");
-  fprintf(fp, "\"nolod\" \"1\"\n");
-  fclose(fp);
+struct LumpImage_t {
+  const byte *pPixels;
+  const byte *pPalette;
+  int width;
+  int height;
+};
 
-  //
-  // Run VTEX on the .txt file?
-  //
-  // if (bVTex) {
-  //   RunVTexOnFile(pBaseDir, txtFilename);
-  // }
+// Finds the lump's miptex and decides whether it needs converting, the same
+// way for a real run as for -plan.  The task's name and hash are filled in
+// for a LUMP_IMAGE or LUMP_UNCHANGED.  lastWriter is the task this run that
+// last wrote the files this one would, or -1 if that was the last run, as
+// recorded in the manifest.
+int ReadWadLump(arena_t *pArena, InputFile_t *pFile, int i, Task_t *pTask, int lastWriter,
+                LumpImage_t *pImage) {
+  const WadReader &wad = *pFile->pWad;
+  const char *pSubDir = pFile->subDir;
+
+  // Read the miptex in place from the mapped wad if we can, otherwise read
+  // a copy of the lump into the arena.
+  const lumpinfo_t *pInfo = wad.LumpInfo(i);
+  lumpview_t lump;
+  if (!wad.MapLumpNum(i, &lump)) {
+    byte *pLoaded = (byte *)Arena_Alloc(pArena, wad.LumpLength(i));
+    wad.ReadLumpNum(i, pLoaded);
+    lump.data = pLoaded;
+    lump.length = pInfo->size;
+  }
 
-  //
-  // Generate a .vmt file.
-  //
-  char vmtFilename[512];
-  _snprintf(vmtFilename, sizeof(vmtFilename), "%s\\materials\\%s\\%s.vmt",
-            pBaseDir, pSubDir, baseFilename);
-  fp = fopen(vmtFilename, "wt");
-  if (!fp) Error("\tProcessSPRFile: can't open %s for writing.\n", vmtFilename);
+  const miptex_t *qtex =
+      (const miptex_t *)W_ViewRange(&lump, 0, sizeof(miptex_t));
+  int width = qtex ? LittleLong(qtex->width) : 0;
+  int height = qtex ? LittleLong(qtex->height) : 0;
+
+  if (width <= 0 || height <= 0 || width > 5000 || height > 5000)
+    return LUMP_NOT_IMAGE;
+
+  // The old xwad	put the mipmaps in there too, but we don't want that now
+  // (usually), so only the 0 image and the palette after the last mip.
+  pImage->pPixels = (const byte *)W_ViewRange(
+      &lump, LittleLong(qtex->offsets[0]), width * height);
+  pImage->pPalette = (const byte *)W_ViewRange(
+      &lump, LittleLong(qtex->offsets[3]) + width * height / 64 + 2, 768);
+  pImage->width = width;
+  pImage->height = height;
+
+  if (!pImage->pPixels || !pImage->pPalette)
+    return LUMP_TRUNCATED;
+
+  // The name in the mapping isn't guaranteed to be terminated.
+  char *texName = pTask->texName;
+  memcpy(texName, qtex->name, sizeof(qtex->name));
+  texName[sizeof(qtex->name)] = 0;
+
+  pTask->inputHash = HashTextureInputs(lump.data, lump.length, pSubDir, texName,
+                                       g_Run.pVTFcmdexe, g_Run.matkeys,
+                                       g_Run.matvals, g_Run.pairs);
+  bool bUnchanged = false;
+  if (lastWriter != -1) {
+    const Task_t *pWriter = &g_Run.tasks[lastWriter];
+    bUnchanged = pWriter->texName[0] && pWriter->inputHash == pTask->inputHash;
+  } else if (!g_bForce) {
+    // -force still loads the manifest so entries not converted this run are kept.
+    const Manifest_t &manifest = pFile->pManifest->entries;
+    Manifest_t::const_iterator it = manifest.find(texName);
+    bUnchanged = it != manifest.end() && it->second == pTask->inputHash;
+  }
+  if (bUnchanged && OutputFilesExist(g_Run.pBaseDir, pSubDir, texName, g_Run.pVTFcmdexe))
+    return LUMP_UNCHANGED;
 
-  if (g_pShader == g_pDefaultShader)
-    fprintf(fp, "\"UnlitGeneric\"\n");
-  else
-    fprintf(fp, "\"%s\"\n", g_pShader);
+  return LUMP_IMAGE;
+}
+
+// NULL if there's nothing to write.
+OutputJob_t *ConvertWadLump(arena_t *pArena, InputFile_t *pFile, int i, Task_t *pTask,
+                            int lastWriter) {
+  const lumpinfo_t *pInfo = pFile->pWad->LumpInfo(i);
+  LumpImage_t image;
+  double start = BeginStage();
+  int result = ReadWadLump(pArena, pFile, i, pTask, lastWriter, &image);
+  EndStage(STAGE_READ, start, pInfo->size,
+           result == LUMP_IMAGE ? image.width * image.height : 0);
+  switch (result) {
+    case LUMP_NOT_IMAGE:
+      if (!g_bQuiet)
+        Msg("\tskipping %s @ %d  size %d (not an image?)\n",
+            pInfo->name, pInfo->filepos, pInfo->size);
+      return NULL;
+    case LUMP_TRUNCATED:
+      if (!g_bQuiet)
+        Msg("\tskipping %s @ %d  size %d (truncated miptex)\n",
+            pInfo->name, pInfo->filepos, pInfo->size);
+      return NULL;
+    case LUMP_UNCHANGED:
+      if (!g_bQuiet) Msg("\t%s (unchanged)\n", pInfo->name);
+      return NULL;
+  }
+
+  if (!g_bQuiet) Msg("\t%s\n", pInfo->name);
+
+  const char *texName = pTask->texName;
+  OutputJob_t *pJob =
+      EncodeOutputFiles(pArena,
+                        g_Run.pBaseDir,       // base directory
+                        pFile->subDir,        // subdir under materials
+                        texName,              // filename (w/o extension)
+                        texName[0] == '{',    // allow transparency?
+                        image.pPixels, image.width, image.height, image.pPalette,
+                        g_Run.bVTex, g_Run.pVTFcmdexe,
+                        g_Run.matkeys, g_Run.matvals, g_Run.pairs);
+  pJob->bNewline = true;
+
+  pTask->bConverted = true;
+  return pJob;
+}
+
+// An uncompressed 8 bit BMP, of a size the RGBA image will fit in memory.
+bool BMPFormatOk(const BITMAPINFOHEADER &bih) {
+  return bih.biSize == sizeof(bih) && bih.biPlanes == 1 && bih.biBitCount == 8 &&
+         bih.biCompression == BI_RGB && bih.biHeight >= 0 && bih.biWidth >= 0 &&
+         (!bih.biHeight || bih.biWidth <= 0x7fffffff / 4 / bih.biHeight);
+}
+
+OutputJob_t *ConvertBMPFile(arena_t *pArena, InputFile_t *pFile) {
+  const char *pFilename = pFile->filename;
+  const char *pSubDir = pFile->subDir;
+  if (!g_bQuiet) Msg("[%s]\n", pFilename);
+
+  // First make directories under materialsrc and materials if they don't exist.
+  EnsureDirectoriesExist(g_Run.pBaseDir, pSubDir);
+
+  // Read in the 8-bit BMP file.
+  double start = BeginStage();
+  FILE *fp = fopen(pFilename, "rb");
+  if (!fp)
+    Error("ProcessBMPFile( %s ) can't open the file for reading.\n", pFilename);
+
+  BITMAPFILEHEADER bfh;
+  BITMAPINFOHEADER bih;
+
+  SafeRead(fp, &bfh, sizeof(bfh));
+  SafeRead(fp, &bih, sizeof(bih));
+
+  // Make sure it's an 8-bit one like we want.
+  if (!BMPFormatOk(bih)) {
+    Error("ProcessBMPFile( %s ) - invalid format.\n", pFilename);
+  }
+
+  int nColorsUsed = 256;
+  if (bih.biClrUsed != 0) {
+    nColorsUsed = bih.biClrUsed;
+    if (nColorsUsed > 256)
+      Error("ProcessBMPFile( %s ) - bih.biClrUsed = %d.\n", pFilename,
+            bih.biClrUsed);
+  }
+
+  RGBQUAD quadPalette[256];
+  SafeRead(fp, quadPalette, sizeof(quadPalette[0]) * nColorsUsed);
+
+  // Usually, bfOffBits is the same place we are at now, but sometimes it's a
+  // little different.
+  fseek(fp, bfh.bfOffBits, SEEK_SET);
+
+  // Now read the bitmap data.
+  byte *pixelData = (byte *)Arena_Alloc(pArena, bih.biWidth * bih.biHeight);
+  SafeRead(fp, pixelData, bih.biWidth * bih.biHeight);
+
+  fclose(fp);
+
+  // Convert the palette.
+  byte palette[256][3];
+  for (int i = 0; i < 256; i++) {
+    palette[i][0] = quadPalette[i].rgbRed;
+    palette[i][1] = quadPalette[i].rgbGreen;
+    palette[i][2] = quadPalette[i].rgbBlue;
+  }
+
+  // Unflip the pixel data.
+  FlipRows(pixelData, bih.biWidth, bih.biHeight);
+  EndStage(STAGE_READ, start, bfh.bfOffBits + bih.biWidth * bih.biHeight,
+           bih.biWidth * bih.biHeight);
+
+  char baseFilename[512];
+  GetBaseFilename(pFilename, baseFilename);
+
+  // Save it out.
+  return EncodeOutputFiles(pArena,
+                           g_Run.pBaseDir,          // base directory
+                           pSubDir,                 // subdir under materials
+                           baseFilename,            // filename (w/o extension)
+                           g_bBMPAllowTranslucent,  // allow transparency
+                           pixelData, bih.biWidth, bih.biHeight, (byte *)palette,
+                           g_Run.bVTex, g_Run.pVTFcmdexe, g_Run.matkeys, g_Run.matvals,
+                           g_Run.pairs);
+}
+
+OutputJob_t *ConvertSPRFrame(arena_t *pArena, InputFile_t *pFile, int frameNum,
+                             int frameOfs) {
+  dspriteframe_t frame;
+  memcpy(&frame, pFile->pSprite + frameOfs, sizeof(frame));
+  const byte *frameData = pFile->pSprite + frameOfs + sizeof(frame);
+
+  Msg("\tFrame %d   ", frameNum);
+
+  char baseFilename[512];
+  GetBaseFilename(pFile->filename, baseFilename);
+
+  // The TGA file for this frame.
+  bool bAlphatest, bResized;
+  int newWidth, newHeight;
+  char frameName[512];
+  _snprintf(frameName, sizeof(frameName), "%s%03d", baseFilename, frameNum);
+  OutputJob_t *pJob = NewOutputJob(g_Run.pBaseDir, pFile->subDir, frameName);
+  pJob->width = frame.width;
+  pJob->height = frame.height;
+  _snprintf(pJob->tga.filename, sizeof(pJob->tga.filename),
+            "%s\\materialsrc\\%s\\%s.tga", g_Run.pBaseDir, pFile->subDir,
+            frameName);
+  RGBAColor *pRGB = ConvertTexture(pArena, g_bBMPAllowTranslucent, frameData, frame.width,
+                                   frame.height, pFile->pPalette,
+                                   true,   // allow power-of-2
+                                   false,  // sprites don't tile
+                                   &bAlphatest, &bResized, &newWidth, &newHeight);
+  EncodeTGAFile(&pJob->tga, pRGB, newWidth, newHeight, bAlphatest || g_bDecal);
+
+  pJob->bNewline = true;
+  return pJob;
+}
+
+// The .txt and .vmt for a sprite whose frames have all been written.
+void FinishSPRFile(InputFile_t *pFile) {
+  const char *pBaseDir = g_Run.pBaseDir;
+  const char *pSubDir = pFile->subDir;
+  char baseFilename[512];
+  GetBaseFilename(pFile->filename, baseFilename);
+
+  //
+  // Generate a .txt file for the sprite.
+  //
+  char txtFilename[512];
+  sprintf(txtFilename, "%s\\materialsrc\\%s\\%s.txt", pBaseDir, pSubDir,
+          baseFilename);
+
+  FILE *fp = fopen(txtFilename, "wt");
+  if (!fp) Error("\tProcessSPRFile: can't open %s for writing.\n", txtFilename);
+
+  fprintf(fp, "\"startframe\" \"0\"\n");
+  fprintf(fp, "\"endframe\" \"%d\"\n", pFile->numFrames - 1);
+  fprintf(fp, "\"nomip\" \"1\"\n");
+  fprintf(fp, "\"nolod\" \"1\"\n");
+  fclose(fp);
+
+  //
+  // Run VTEX on the .txt file?
+  //
+  // if (bVTex) {
+  //   RunVTexOnFile(pBaseDir, txtFilename);
+  // }
+
+  //
+  // Generate a .vmt file.
+  //
+  char vmtFilename[512];
+  _snprintf(vmtFilename, sizeof(vmtFilename), "%s\\materials\\%s\\%s.vmt",
+            pBaseDir, pSubDir, baseFilename);
+  fp = fopen(vmtFilename, "wt");
+  if (!fp) Error("\tProcessSPRFile: can't open %s for writing.\n", vmtFilename);
+
+  if (g_pShader == g_pDefaultShader)
+    fprintf(fp, "\"UnlitGeneric\"\n");
+  else
+    fprintf(fp, "\"%s\"\n", g_pShader);
 
   fprintf(fp, "{\n");
   fprintf(fp, "\t\"$spriteorientation\" \"vp_parallel\"\n");
   fprintf(fp, "\t\"$spriteorigin\" \"[ 0.50 0.50 ]\"\n");
   fprintf(fp, "\t\"$basetexture\" \"%s/%s\"\n", pSubDir, baseFilename);
 
-  for (i = 0; i < g_NumVMTParams; i++) {
+  for (int i = 0; i < g_NumVMTParams; i++) {
     fprintf(fp, "\t\"%s\" \"%s\"\n", g_VMTParams[i].m_szParam,
             g_VMTParams[i].m_szValue);
   }
@@ -926,6 +1713,793 @@ void ProcessSPRFile(const char *pBaseDir, const char *pSubDir,  const char *pFil
   fclose(fp);
 }
 
+// Called in file order once a file's tasks have all been printed.  The
+// manifest is updated in task order, so the last of any repeated name wins
+// like it does on disk.
+void FinishFile(InputFile_t *pFile) {
+  SpewBufferPrint(&pFile->trailer);
+  SpewBufferFree(&pFile->trailer);
+
+  if (pFile->type == INPUT_WAD) {
+    int nConverted = 0, nUnchanged = 0;
+    for (int task = pFile->firstTask; task < pFile->firstTask + pFile->nTasks; task++) {
+      Task_t *pTask = &g_Run.tasks[task];
+      if (pTask->bConverted) {
+        pFile->pManifest->entries[pTask->texName] = pTask->inputHash;
+        pFile->pManifest->bChanged = true;
+        nConverted++;
+      } else if (pTask->texName[0]) {
+        nUnchanged++;
+      }
+    }
+
+    // With -vtfbatch, vtfcmd hasn't run yet, so it's saved after that.
+    ManifestFile_t *pManifest = pFile->pManifest;
+    if (--pManifest->nFilesLeft == 0 && pManifest->bChanged && !g_bVTFBatch) {
+      SaveManifest(pManifest->filename, pManifest->entries);
+      pManifest->bChanged = false;
+    }
+    if (!g_bQuiet && nUnchanged)
+      printf("\t%d converted, %d unchanged since the last run\n", nConverted, nUnchanged);
+
+    delete pFile->pWad;
+    pFile->pWad = NULL;
+  } else if (pFile->type == INPUT_SPR) {
+    if (pFile->bComplete) FinishSPRFile(pFile);
+    free(pFile->pSprite);
+    pFile->pSprite = NULL;
+  }
+}
+
+// Prints whatever is next in order and has finished, under the lock.
+void PrintFinishedTasks() {
+  while (g_Run.printFile < (int)g_Run.files.size()) {
+    InputFile_t *pFile = g_Run.files[g_Run.printFile];
+    if (!pFile->bStarted) {
+      SpewBufferPrint(&pFile->header);
+      SpewBufferFree(&pFile->header);
+      pFile->bStarted = true;
+    }
+
+    int endTask = pFile->firstTask + pFile->nTasks;
+    while (g_Run.nextPrint < endTask && g_Run.tasks[g_Run.nextPrint].bDone) {
+      SpewBufferPrint(&g_Run.tasks[g_Run.nextPrint].spew);
+      SpewBufferFree(&g_Run.tasks[g_Run.nextPrint].spew);
+      g_Run.nextPrint++;
+    }
+    if (g_Run.nextPrint < endTask) return;
+
+    FinishFile(pFile);
+    g_Run.printFile++;
+  }
+}
+
+// Under the lock.  Wakes anything waiting on the task or on its turn to print.
+void FinishTask(int task) {
+  g_Run.tasks[task].bDone = true;
+  PrintFinishedTasks();
+  ThreadWake();
+}
+
+// Writes what the conversion threads queue up, one texture at a time, into
+// the task's own spew so it prints in order with the rest.
+void WriterThread(void *param) {
+  for (;;) {
+    OutputJob_t *pJob = (OutputJob_t *)WQ_Pop(&g_Run.writeQueue);
+    if (!pJob) return;
+
+    int task = pJob->task;
+    SpewCapture(&g_Run.tasks[task].spew);
+    if (g_Run.bStageTimes) g_pStageTimes = &g_Run.tasks[task].times;
+    WriteOutputFiles(pJob);
+    g_pStageTimes = NULL;
+    SpewCapture(NULL);
+    FreeOutputJob(pJob);
+
+    ThreadLock();
+    g_Run.nWritten++;
+    FinishTask(task);
+    ThreadUnlock();
+  }
+}
+
+// What's on disk for a task's files comes from the last of the earlier tasks
+// with its name that wrote them or found them unchanged, rather than from
+// what the manifest says.  -1 if there isn't one.  They must all be done.
+int FindLastWriter(const Task_t *pTask) {
+  for (int t = pTask->prevSameName; t != -1; t = g_Run.tasks[t].prevSameName) {
+    if (g_Run.tasks[t].bConverted || g_Run.tasks[t].texName[0]) return t;
+  }
+  return -1;
+}
+
+void RunTask(int threadnum, int task) {
+  Task_t *pTask = &g_Run.tasks[task];
+  InputFile_t *pFile = g_Run.files[pTask->file];
+  arena_t *pArena = &g_Run.arenas[threadnum];
+
+  // This thread most likely does the next lump after this one, so have it
+  // read in while this one is converted.
+  if (pFile->type == INPUT_WAD && task + 1 < pFile->firstTask + pFile->nTasks)
+    pFile->pWad->PrefetchLumpNum(g_Run.tasks[task + 1].item);
+
+  // Two tasks with the same name write the same files, so the later one
+  // waits and overwrites them just like a single thread would.
+  if (pTask->prevSameName != -1) WaitForTask(pTask->prevSameName);
+  int lastWriter = FindLastWriter(pTask);
+
+  SpewCapture(&pTask->spew);
+  if (g_Run.bStageTimes) g_pStageTimes = &pTask->times;
+  OutputJob_t *pJob;
+  if (pFile->type == INPUT_WAD) {
+    pJob = ConvertWadLump(pArena, pFile, pTask->item, pTask, lastWriter);
+  } else if (pFile->type == INPUT_BMP) {
+    pJob = ConvertBMPFile(pArena, pFile);
+    pTask->bConverted = true;
+  } else {
+    pJob = ConvertSPRFrame(pArena, pFile, pTask->item,
+                           pFile->frameOfs[task - pFile->firstTask]);
+    pTask->bConverted = true;
+  }
+  g_pStageTimes = NULL;
+  SpewCapture(NULL);
+
+  // The job holds everything the writers need, so the scratch can go.
+  Arena_Reset(pArena);
+
+  // Waits here while the writers are a queue behind.  The task is the
+  // writer's from here on, so the wait is the thread's.
+  if (pJob) {
+    pJob->task = task;
+    pTask->width = pJob->width;
+    pTask->height = pJob->height;
+    pTask->bQueued = true;
+    if (g_Run.bStageTimes) g_pStageTimes = &g_Run.threadTimes[threadnum];
+    double start = BeginStage();
+    WQ_Push(&g_Run.writeQueue, pJob);
+    EndStage(STAGE_QUEUE_WAIT, start, 0, 0);
+    g_pStageTimes = NULL;
+    return;
+  }
+
+  ThreadLock();
+  FinishTask(task);
+  ThreadUnlock();
+}
+
+void PrintJSONString(FILE *fp, const char *pString) {
+  fputc('"', fp);
+  for (const unsigned char *p = (const unsigned char *)pString; *p; p++) {
+    if (*p == '"' || *p == '\\')
+      fprintf(fp, "\\%c", *p);
+    else if (*p < 0x20 || *p >= 0x7f)
+      fprintf(fp, "\\u%04x", *p);  // names are Latin-1
+    else
+      fputc(*p, fp);
+  }
+  fputc('"', fp);
+}
+
+#define STATS_SLOWEST 10  // textures -stats lists
+
+// The name a task's files were written under.
+void GetTaskName(const Task_t &task, char name[512]) {
+  const InputFile_t *pFile = g_Run.files[task.file];
+  if (pFile->type == INPUT_WAD) {
+    strcpy(name, task.texName);
+  } else {
+    GetBaseFilename(pFile->filename, name);
+    if (pFile->type == INPUT_SPR) sprintf(name + strlen(name), "%03d", task.item);
+  }
+}
+
+double TaskSeconds(const Task_t &task) {
+  double seconds = 0;
+  for (int i = 0; i < NUM_STAGES; i++) seconds += task.times.seconds[i];
+  return seconds;
+}
+
+bool SlowerTask(int a, int b) {
+  return TaskSeconds(g_Run.tasks[a]) > TaskSeconds(g_Run.tasks[b]);
+}
+
+double PerSecond(long long count, double seconds) {
+  return seconds > 0 ? count / seconds : 0;
+}
+
+// The stage totals and the slowest textures, and the same as JSON if
+// -statsjson asked for it.  The stages are summed over every thread, so the
+// seconds are thread seconds and the rates are what one thread gets through.
+void PrintStageStats(double walltime, const char *pJSONFilename) {
+  StageTimes_t total = g_Run.runTimes;
+  for (size_t i = 0; i < g_Run.threadTimes.size(); i++)
+    AddStageTimes(&total, g_Run.threadTimes[i]);
+  std::vector<int> slowest;
+  for (size_t i = 0; i < g_Run.tasks.size(); i++) {
+    AddStageTimes(&total, g_Run.tasks[i].times);
+    if (g_Run.tasks[i].bConverted) slowest.push_back((int)i);
+  }
+  if (slowest.size() > STATS_SLOWEST) {
+    std::partial_sort(slowest.begin(), slowest.begin() + STATS_SLOWEST, slowest.end(),
+                      SlowerTask);
+    slowest.resize(STATS_SLOWEST);
+  } else {
+    std::sort(slowest.begin(), slowest.end(), SlowerTask);
+  }
+
+  printf("%-20s %9s %7s %9s %9s %10s\n", "stage", "seconds", "calls", "MB", "MB/s",
+         "Mpixels/s");
+  for (int i = 0; i < NUM_STAGES; i++) {
+    if (!total.calls[i]) continue;
+    printf("%-20s %9.3f %7d", g_pStageNames[i], total.seconds[i], total.calls[i]);
+    if (total.bytes[i]) {
+      printf(" %9.2f %9.1f", total.bytes[i] / (1024.0 * 1024.0),
+             PerSecond(total.bytes[i], total.seconds[i]) / (1024.0 * 1024.0));
+    } else if (total.pixels[i]) {
+      printf(" %9s %9s", "", "");
+    }
+    if (total.pixels[i])
+      printf(" %10.1f", PerSecond(total.pixels[i], total.seconds[i]) / 1000000.0);
+    printf("\n");
+  }
+  if (!slowest.empty()) printf("slowest textures:\n");
+  for (size_t i = 0; i < slowest.size(); i++) {
+    const Task_t &task = g_Run.tasks[slowest[i]];
+    char name[512];
+    GetTaskName(task, name);
+    printf("%9.4f  %s (%dx%d) from %s\n", TaskSeconds(task), name, task.width, task.height,
+           g_Run.files[task.file]->filename);
+  }
+
+  if (!pJSONFilename) return;
+  FILE *fp = fopen(pJSONFilename, "wt");
+  if (!fp) Error("Can't open %s for writing.\n", pJSONFilename);
+  fprintf(fp, "{\n  \"threads\": %d,\n  \"writers\": %d,\n  \"seconds\": %.6f,\n", numthreads,
+          g_Run.nWriters, walltime);
+  fprintf(fp, "  \"textures\": %d,\n  \"stages\": {", g_Run.nWritten);
+  for (int i = 0; i < NUM_STAGES; i++) {
+    fprintf(fp, "%s\n    ", i ? "," : "");
+    PrintJSONString(fp, g_pStageNames[i]);
+    fprintf(fp,
+            ": {\"seconds\": %.6f, \"calls\": %d, \"bytes\": %lld, \"pixels\": %lld, "
+            "\"bytes_per_sec\": %.0f, \"pixels_per_sec\": %.0f}",
+            total.seconds[i], total.calls[i], total.bytes[i], total.pixels[i],
+            PerSecond(total.bytes[i], total.seconds[i]),
+            PerSecond(total.pixels[i], total.seconds[i]));
+  }
+  fprintf(fp, "\n  },\n  \"slowest\": [");
+  for (size_t i = 0; i < slowest.size(); i++) {
+    const Task_t &task = g_Run.tasks[slowest[i]];
+    char name[512];
+    GetTaskName(task, name);
+    fprintf(fp, "%s\n    {\"file\": ", i ? "," : "");
+    PrintJSONString(fp, g_Run.files[task.file]->filename);
+    fprintf(fp, ", \"name\": ");
+    PrintJSONString(fp, name);
+    fprintf(fp, ", \"width\": %d, \"height\": %d, \"seconds\": %.6f, \"stages\": {",
+            task.width, task.height, TaskSeconds(task));
+    bool bFirst = true;
+    for (int j = 0; j < NUM_STAGES; j++) {
+      if (!task.times.calls[j]) continue;
+      fprintf(fp, "%s", bFirst ? "" : ", ");
+      PrintJSONString(fp, g_pStageNames[j]);
+      fprintf(fp, ": %.6f", task.times.seconds[j]);
+      bFirst = false;
+    }
+    fprintf(fp, "}}");
+  }
+  fprintf(fp, "\n  ]\n}\n");
+  if (fclose(fp)) Error("Error writing %s.\n", pJSONFilename);
+}
+
+// Whatever is left of the files, tasks and manifests once a run is over.
+void FreeRun() {
+  for (size_t i = 0; i < g_Run.files.size(); i++) {
+    InputFile_t *pFile = g_Run.files[i];
+    SpewBufferFree(&pFile->header);
+    SpewBufferFree(&pFile->trailer);
+    delete pFile->pWad;
+    free(pFile->pSprite);
+    delete pFile;
+  }
+  g_Run.files.clear();
+  for (size_t i = 0; i < g_Run.tasks.size(); i++) SpewBufferFree(&g_Run.tasks[i].spew);
+  g_Run.tasks.clear();
+  g_Run.lastWithName.clear();
+  for (std::map<std::string, ManifestFile_t *>::iterator it = g_Run.manifests.begin();
+       it != g_Run.manifests.end(); ++it) {
+    delete it->second;
+  }
+  g_Run.manifests.clear();
+}
+
+// Converts everything the Add*File calls set up.
+void RunTasks(bool bStats, const char *pStatsJSON) {
+  double start = I_FloatTime();
+  g_Run.printFile = 0;
+  g_Run.nextPrint = 0;
+
+  // files with nothing to do at the front print straight away
+  PrintFinishedTasks();
+
+  // Per-texture vtfcmd runs on the writers, so there are enough of them to
+  // keep the process pool full.
+  ThreadSetDefault();
+  g_Run.nWriters = 2;
+  if (g_Run.pVTFcmdexe && !g_bVTFBatch) {
+    int nProcesses = maxprocesses > 0 ? maxprocesses : numthreads;
+    if (nProcesses > g_Run.nWriters) g_Run.nWriters = nProcesses;
+  }
+  g_Run.nWritten = 0;
+  g_Run.nWritersInError = 0;
+  WQ_Init(&g_Run.writeQueue, max(4, numthreads * 2));
+  g_Run.arenas.resize(numthreads);
+  for (int i = 0; i < numthreads; i++) Arena_Init(&g_Run.arenas[i]);
+  g_Run.threadTimes.assign(numthreads, StageTimes_t());
+
+  SetSpewErrorWait(WaitToReportTaskError);
+  std::vector<void *> writers;
+  for (int i = 0; i < g_Run.nWriters; i++) writers.push_back(ThreadBegin(WriterThread, NULL));
+  RunThreadsOnStealing((int)g_Run.tasks.size(), RunTask);
+  for (int i = 0; i < g_Run.nWriters; i++) WQ_Push(&g_Run.writeQueue, NULL);
+  for (int i = 0; i < g_Run.nWriters; i++) ThreadEnd(writers[i]);
+  SetSpewErrorWait(NULL);
+
+  if (g_bVTFBatch && g_Run.pVTFcmdexe) {
+    if (g_Run.bStageTimes) g_pStageTimes = &g_Run.runTimes;
+    FlushVTFCmdQueue(g_Run.pVTFcmdexe);
+    g_pStageTimes = NULL;
+  }
+
+  // Anything -vtfbatch held back.
+  for (std::map<std::string, ManifestFile_t *>::iterator it = g_Run.manifests.begin();
+       it != g_Run.manifests.end(); ++it) {
+    if (it->second->bChanged) SaveManifest(it->second->filename, it->second->entries);
+  }
+
+  if (bStats) {
+    threadstats_t stats;
+    GetThreadStats(&stats);
+    printf("%d tasks from %d files on %d threads in %.2f seconds\n", stats.work,
+           (int)g_Run.files.size(), stats.threads, stats.walltime);
+    printf("%.1f%% parallel efficiency (%.2f of %.2f thread seconds busy), %d steals\n",
+           stats.walltime > 0 ? 100.0 * stats.busytime / (stats.walltime * stats.threads) : 100.0,
+           stats.busytime, stats.walltime * stats.threads, stats.steals);
+    printf("%d textures written on %d writer threads, which held conversion up %d times\n",
+           g_Run.nWritten, g_Run.nWriters, g_Run.writeQueue.stalls);
+  }
+  WQ_Free(&g_Run.writeQueue);
+
+  int nAllocs = 0, nHeapAllocs = 0;
+  size_t peak = 0;
+  for (size_t i = 0; i < g_Run.arenas.size(); i++) {
+    nAllocs += g_Run.arenas[i].allocs;
+    nHeapAllocs += g_Run.arenas[i].heapallocs;
+    if (g_Run.arenas[i].peak > peak) peak = g_Run.arenas[i].peak;
+    Arena_Free(&g_Run.arenas[i]);
+  }
+  g_Run.arenas.clear();
+  if (bStats) {
+    printf("%d scratch buffers from %d heap allocations, at most %d KB per thread\n",
+           nAllocs, nHeapAllocs, (int)((peak + 1023) / 1024));
+    PrintStageStats(I_FloatTime() - start, pStatsJSON);
+  }
+  g_Run.threadTimes.clear();
+
+  FreeRun();
+}
+
+//-----------------------------------------------------------------------------
+// -plan sets the run up as usual, then goes through the tasks in order with
+// the rules a real run uses to skip them, but only works out what would be
+// written.  Nothing is converted and nothing goes to disk.  The time is
+// estimated from how long this machine takes to convert a made-up texture
+// with the same options, so it's rough, and doesn't include vtfcmd.
+//-----------------------------------------------------------------------------
+
+#define PLAN_DISK_BYTES_PER_SEC (100.0 * 1024 * 1024)
+
+enum { PLAN_CONVERT, PLAN_UNCHANGED, PLAN_SKIP };
+
+struct PlanItem_t {
+  int action;
+  const char *pReason;  // why it's skipped
+  char name[512];
+  int width;
+  int height;
+  int outWidth;  // of the VTF, resized to powers of two
+  int outHeight;
+  bool bAlpha;
+  long long bytes;  // of the images, the small text files aren't counted
+  std::vector<std::string> outputs;
+};
+
+void AddPlanOutput(PlanItem_t *pItem, const char *pFormat, const char *pSubDir,
+                   const char *pName) {
+  char filename[1024];
+  _snprintf(filename, sizeof(filename), pFormat, g_Run.pBaseDir, pSubDir, pName);
+  filename[sizeof(filename) - 1] = 0;
+  pItem->outputs.push_back(filename);
+}
+
+void PlanPowerOf2(PlanItem_t *pItem) {
+  pItem->outWidth = pItem->width;
+  while ((pItem->outWidth & (pItem->outWidth - 1))) ++pItem->outWidth;
+  pItem->outHeight = pItem->height;
+  while ((pItem->outHeight & (pItem->outHeight - 1))) ++pItem->outHeight;
+}
+
+// The TGA is written at the power of two size unless vtfcmd is to resize it.
+int TGAPixels(const PlanItem_t *pItem) {
+  if (g_nResample == RESAMPLE_VTFCMD) return pItem->width * pItem->height;
+  return pItem->outWidth * pItem->outHeight;
+}
+
+// The files EncodeOutputFiles and WriteOutputFiles would make.
+void PlanOutputFiles(PlanItem_t *pItem, const char *pSubDir, const char *pName,
+                     bool bAllowTranslucent, const byte *pPixels, int width, int height) {
+  pItem->action = PLAN_CONVERT;
+  strncpy(pItem->name, pName, sizeof(pItem->name) - 1);
+  pItem->width = width;
+  pItem->height = height;
+  pItem->bAlpha =
+      g_bDecal || (bAllowTranslucent && memchr(pPixels, 255, width * height) != NULL);
+
+  PlanPowerOf2(pItem);
+
+  if (g_bWriteTGA) {
+    AddPlanOutput(pItem, "%s\\materialsrc\\%s\\%s.tga", pSubDir, pName);
+    pItem->bytes += sizeof(TGAHeader_t) + TGAPixels(pItem) * (pItem->bAlpha ? 4 : 3);
+  }
+  AddPlanOutput(pItem, "%s\\materials\\%s\\%s.vmt", pSubDir, pName);
+  if (g_bWriteVTF) {
+    AddPlanOutput(pItem, "%s\\materials\\%s\\%s.vtf", pSubDir, pName);
+    pItem->bytes += VTF_FileSize(VTFFormatFor(pItem->bAlpha, pItem->bAlpha && !g_bDecal),
+                                 pItem->outWidth, pItem->outHeight, 0);
+  } else if (g_Run.pVTFcmdexe) {
+    AddPlanOutput(pItem, "%s\\materials\\%s\\%s.vtf", pSubDir, pName);
+  }
+  if (pItem->outWidth != width || pItem->outHeight != height)
+    AddPlanOutput(pItem, "%s\\materials\\%s\\%s.resizeinfo", pSubDir, pName);
+}
+
+void PlanWadLump(arena_t *pArena, InputFile_t *pFile, Task_t *pTask, PlanItem_t *pItem) {
+  const lumpinfo_t *pInfo = pFile->pWad->LumpInfo(pTask->item);
+  strncpy(pItem->name, pInfo->name, sizeof(pInfo->name));
+
+  LumpImage_t image;
+  switch (ReadWadLump(pArena, pFile, pTask->item, pTask, FindLastWriter(pTask), &image)) {
+    case LUMP_NOT_IMAGE:
+      pItem->action = PLAN_SKIP;
+      pItem->pReason = "not an image?";
+      return;
+    case LUMP_TRUNCATED:
+      pItem->action = PLAN_SKIP;
+      pItem->pReason = "truncated miptex";
+      return;
+    case LUMP_UNCHANGED:
+      pItem->action = PLAN_UNCHANGED;
+      return;
+  }
+
+  PlanOutputFiles(pItem, pFile->subDir, pTask->texName, pTask->texName[0] == '{',
+                  image.pPixels, image.width, image.height);
+  pTask->bConverted = true;
+}
+
+// Only the headers are needed, and the pixels with -transparent.
+void PlanBMPFile(arena_t *pArena, InputFile_t *pFile, PlanItem_t *pItem) {
+  char baseFilename[512];
+  GetBaseFilename(pFile->filename, baseFilename);
+  strcpy(pItem->name, baseFilename);
+  pItem->action = PLAN_SKIP;
+
+  FILE *fp = fopen(pFile->filename, "rb");
+  if (!fp) {
+    pItem->pReason = "can't open the file";
+    return;
+  }
+
+  BITMAPFILEHEADER bfh;
+  BITMAPINFOHEADER bih;
+  if (fread(&bfh, sizeof(bfh), 1, fp) != 1 || fread(&bih, sizeof(bih), 1, fp) != 1 ||
+      !BMPFormatOk(bih)) {
+    pItem->pReason = "invalid format";
+    fclose(fp);
+    return;
+  }
+
+  byte *pPixels = (byte *)Arena_Alloc(pArena, bih.biWidth * bih.biHeight);
+  memset(pPixels, 0, bih.biWidth * bih.biHeight);
+  if (g_bBMPAllowTranslucent) {
+    fseek(fp, bfh.bfOffBits, SEEK_SET);
+    if (fread(pPixels, 1, bih.biWidth * bih.biHeight, fp) !=
+        (size_t)(bih.biWidth * bih.biHeight)) {
+      pItem->pReason = "file read failure";
+      fclose(fp);
+      return;
+    }
+  }
+  fclose(fp);
+
+  PlanOutputFiles(pItem, pFile->subDir, baseFilename, g_bBMPAllowTranslucent, pPixels,
+                  bih.biWidth, bih.biHeight);
+}
+
+// Just the frame's TGA; the sprite's .txt and .vmt come once they're done.
+void PlanSPRFrame(InputFile_t *pFile, int frameNum, int frameOfs, PlanItem_t *pItem) {
+  dspriteframe_t frame;
+  memcpy(&frame, pFile->pSprite + frameOfs, sizeof(frame));
+  const byte *pPixels = pFile->pSprite + frameOfs + sizeof(frame);
+
+  char baseFilename[512];
+  GetBaseFilename(pFile->filename, baseFilename);
+  _snprintf(pItem->name, sizeof(pItem->name), "%s%03d", baseFilename, frameNum);
+
+  pItem->action = PLAN_CONVERT;
+  pItem->width = frame.width;
+  pItem->height = frame.height;
+  PlanPowerOf2(pItem);
+  if (g_nResample == RESAMPLE_VTFCMD) {
+    pItem->outWidth = frame.width;  // nothing resizes sprites after this
+    pItem->outHeight = frame.height;
+  }
+  pItem->bAlpha = g_bDecal || (g_bBMPAllowTranslucent &&
+                               memchr(pPixels, 255, frame.width * frame.height) != NULL);
+  AddPlanOutput(pItem, "%s\\materialsrc\\%s\\%s.tga", pFile->subDir, pItem->name);
+  pItem->bytes = sizeof(TGAHeader_t) + TGAPixels(pItem) * (pItem->bAlpha ? 4 : 3);
+}
+
+// Seconds per pixel to convert and encode a texture with these options, from
+// timing a made-up one for a few milliseconds.
+double TimeConversion(arena_t *pArena, bool bAlpha) {
+  const int size = 256;
+  byte *pPixels = new byte[size * size];
+  byte palette[768];
+  unsigned seed = 12345;
+  for (int i = 0; i < 768; i++) {
+    seed = seed * 1103515245 + 12345;
+    palette[i] = (byte)(seed >> 16);
+  }
+  for (int i = 0; i < size * size; i++) {
+    seed = seed * 1103515245 + 12345;
+    pPixels[i] = (byte)(seed >> 16);
+    if (pPixels[i] == 255) pPixels[i] = 0;
+  }
+  // holes for the flood fill to fill, as a '{' texture has
+  if (bAlpha) {
+    for (int y = 0; y < size; y++) {
+      for (int x = 0; x < size; x++) {
+        if (((x >> 3) + (y >> 3)) & 1) pPixels[y * size + x] = 255;
+      }
+    }
+  }
+
+  int nReps = 0;
+  double start = I_FloatTime(), elapsed;
+  do {
+    OutputJob_t *pJob = EncodeOutputFiles(pArena, "", "", "plan", bAlpha, pPixels, size, size,
+                                          palette, false, NULL, NULL, NULL, 0);
+    FreeOutputJob(pJob);
+    Arena_Reset(pArena);
+    nReps++;
+    elapsed = I_FloatTime() - start;
+  } while (elapsed < 0.005 || nReps < 2);
+
+  delete[] pPixels;
+  return elapsed / ((double)nReps * size * size);
+}
+
+void PrintJSONOutputs(const std::vector<std::string> &outputs) {
+  printf("[");
+  for (size_t i = 0; i < outputs.size(); i++) {
+    if (i) printf(", ");
+    PrintJSONString(stdout, outputs[i].c_str());
+  }
+  printf("]");
+}
+
+// The text a file's setup left in its header and trailer, which with -planjson
+// is only its warnings.
+std::string GetFileMessages(const InputFile_t *pFile) {
+  std::string messages;
+  if (pFile->header.pData) messages.append(pFile->header.pData, pFile->header.nLength);
+  if (pFile->trailer.pData) messages.append(pFile->trailer.pData, pFile->trailer.nLength);
+  return messages;
+}
+
+void PlanTasks(bool bJSON) {
+  ThreadSetDefault();
+  arena_t arena;
+  Arena_Init(&arena);
+
+  std::vector<PlanItem_t> items(g_Run.tasks.size());
+  for (size_t task = 0; task < g_Run.tasks.size(); task++) {
+    Task_t *pTask = &g_Run.tasks[task];
+    InputFile_t *pFile = g_Run.files[pTask->file];
+    PlanItem_t *pItem = &items[task];
+    if (pFile->type == INPUT_WAD) {
+      PlanWadLump(&arena, pFile, pTask, pItem);
+    } else if (pFile->type == INPUT_BMP) {
+      PlanBMPFile(&arena, pFile, pItem);
+      pTask->bConverted = pItem->action == PLAN_CONVERT;
+    } else {
+      PlanSPRFrame(pFile, pTask->item, pFile->frameOfs[task - pFile->firstTask], pItem);
+      pTask->bConverted = true;
+    }
+    pTask->bDone = true;
+    Arena_Reset(&arena);
+  }
+
+  // the sprites' own .txt and .vmt
+  std::vector<std::vector<std::string> > fileOutputs(g_Run.files.size());
+  for (size_t file = 0; file < g_Run.files.size(); file++) {
+    InputFile_t *pFile = g_Run.files[file];
+    if (pFile->type != INPUT_SPR || !pFile->bComplete) continue;
+    PlanItem_t item;
+    char baseFilename[512];
+    GetBaseFilename(pFile->filename, baseFilename);
+    AddPlanOutput(&item, "%s\\materialsrc\\%s\\%s.txt", pFile->subDir, baseFilename);
+    AddPlanOutput(&item, "%s\\materials\\%s\\%s.vmt", pFile->subDir, baseFilename);
+    fileOutputs[file] = item.outputs;
+  }
+
+  // Names written more than once, the last of them winning.
+  std::vector<std::vector<int> > collisions;
+  std::vector<std::string> collisionNames;
+  for (std::map<std::string, int>::iterator it = g_Run.lastWithName.begin();
+       it != g_Run.lastWithName.end(); ++it) {
+    std::vector<int> writers;
+    for (int t = it->second; t != -1; t = g_Run.tasks[t].prevSameName) {
+      if (items[t].action != PLAN_SKIP) writers.insert(writers.begin(), t);
+    }
+    if (writers.size() < 2) continue;
+    collisions.push_back(writers);
+    collisionNames.push_back(it->first);
+  }
+
+  int nConvert = 0, nUnchanged = 0, nSkipped = 0, nOutputs = 0, nAlpha = 0;
+  long long pixelsIn = 0, pixelsOut = 0, alphaPixels = 0, bytes = 0;
+  for (size_t task = 0; task < items.size(); task++) {
+    const PlanItem_t &item = items[task];
+    if (item.action == PLAN_UNCHANGED) nUnchanged++;
+    if (item.action == PLAN_SKIP) nSkipped++;
+    if (item.action != PLAN_CONVERT) continue;
+    nConvert++;
+    nOutputs += (int)item.outputs.size();
+    pixelsIn += (long long)item.width * item.height;
+    pixelsOut += (long long)item.outWidth * item.outHeight;
+    bytes += item.bytes;
+    if (item.bAlpha) {
+      nAlpha++;
+      alphaPixels += (long long)item.width * item.height;
+    }
+  }
+  for (size_t file = 0; file < fileOutputs.size(); file++)
+    nOutputs += (int)fileOutputs[file].size();
+
+  // Writing overlaps converting, so it's whichever takes longer.
+  double secondsPerPixel = TimeConversion(&arena, false);
+  double secondsPerAlphaPixel = TimeConversion(&arena, true);
+  double cpuSeconds = (pixelsIn - alphaPixels) * secondsPerPixel +
+                      alphaPixels * secondsPerAlphaPixel;
+  double diskSeconds = bytes / PLAN_DISK_BYTES_PER_SEC;
+  double seconds = cpuSeconds / numthreads;
+  if (diskSeconds > seconds) seconds = diskSeconds;
+  Arena_Free(&arena);
+
+  if (bJSON) {
+    printf("{\n  \"inputs\": [\n");
+    for (size_t file = 0; file < g_Run.files.size(); file++) {
+      const InputFile_t *pFile = g_Run.files[file];
+      static const char *pTypes[] = {"wad", "bmp", "spr"};
+      printf("    {\"file\": ");
+      PrintJSONString(stdout, pFile->filename);
+      printf(", \"type\": \"%s\", \"subdir\": ", pTypes[pFile->type]);
+      PrintJSONString(stdout, pFile->subDir);
+      printf(", \"warnings\": ");
+      PrintJSONString(stdout, GetFileMessages(pFile).c_str());
+      printf(", \"outputs\": ");
+      PrintJSONOutputs(fileOutputs[file]);
+      printf(", \"textures\": [");
+      for (int task = pFile->firstTask; task < pFile->firstTask + pFile->nTasks; task++) {
+        const PlanItem_t &item = items[task];
+        printf("%s\n      {\"name\": ", task > pFile->firstTask ? "," : "");
+        PrintJSONString(stdout, item.name);
+        if (item.action == PLAN_SKIP) {
+          printf(", \"action\": \"skip\", \"reason\": ");
+          PrintJSONString(stdout, item.pReason);
+          printf("}");
+        } else if (item.action == PLAN_UNCHANGED) {
+          printf(", \"action\": \"unchanged\"}");
+        } else {
+          printf(", \"action\": \"convert\", \"width\": %d, \"height\": %d, "
+                 "\"outwidth\": %d, \"outheight\": %d, \"alpha\": %s, \"bytes\": %lld, "
+                 "\"outputs\": ",
+                 item.width, item.height, item.outWidth, item.outHeight,
+                 item.bAlpha ? "true" : "false", item.bytes);
+          PrintJSONOutputs(item.outputs);
+          printf("}");
+        }
+      }
+      printf("%s]}%s\n", pFile->nTasks ? "\n    " : "",
+             file + 1 < g_Run.files.size() ? "," : "");
+    }
+    printf("  ],\n  \"collisions\": [");
+    for (size_t i = 0; i < collisions.size(); i++) {
+      printf("%s\n    {\"name\": ", i ? "," : "");
+      PrintJSONString(stdout, collisionNames[i].c_str());
+      printf(", \"writers\": [");
+      for (size_t j = 0; j < collisions[i].size(); j++) {
+        const Task_t &task = g_Run.tasks[collisions[i][j]];
+        printf("%s{\"file\": ", j ? ", " : "");
+        PrintJSONString(stdout, g_Run.files[task.file]->filename);
+        printf(", \"name\": ");
+        PrintJSONString(stdout, items[collisions[i][j]].name);
+        printf("}");
+      }
+      printf("]}");
+    }
+    printf("%s],\n", collisions.empty() ? "" : "\n  ");
+    printf("  \"totals\": {\"files\": %d, \"textures\": %d, \"convert\": %d, "
+           "\"unchanged\": %d, \"skipped\": %d, \"alpha\": %d, \"pixels_in\": %lld, "
+           "\"pixels_out\": %lld, \"output_files\": %d, \"image_bytes\": %lld, "
+           "\"threads\": %d, \"ns_per_pixel\": %.2f, \"ns_per_alpha_pixel\": %.2f, "
+           "\"estimated_seconds\": %.3f}\n}\n",
+           (int)g_Run.files.size(), (int)items.size(), nConvert, nUnchanged, nSkipped,
+           nAlpha, pixelsIn, pixelsOut, nOutputs, bytes, numthreads,
+           secondsPerPixel * 1e9, secondsPerAlphaPixel * 1e9, seconds);
+  } else {
+    for (size_t file = 0; file < g_Run.files.size(); file++) {
+      InputFile_t *pFile = g_Run.files[file];
+      SpewBufferPrint(&pFile->header);
+      if (pFile->type == INPUT_BMP) printf("[%s]\n", pFile->filename);
+      for (int task = pFile->firstTask; task < pFile->firstTask + pFile->nTasks; task++) {
+        const PlanItem_t &item = items[task];
+        if (item.action == PLAN_SKIP) {
+          printf("\tskipping %s (%s)\n", item.name, item.pReason);
+        } else if (item.action == PLAN_UNCHANGED) {
+          printf("\t%s (unchanged)\n", item.name);
+        } else {
+          printf("\t%s %dx%d", item.name, item.width, item.height);
+          if (item.outWidth != item.width || item.outHeight != item.height)
+            printf(" -> %dx%d", item.outWidth, item.outHeight);
+          printf("%s, %lld bytes\n", item.bAlpha ? " alpha" : "", item.bytes);
+          for (size_t i = 0; i < item.outputs.size(); i++)
+            printf("\t\t%s\n", item.outputs[i].c_str());
+        }
+      }
+      SpewBufferPrint(&pFile->trailer);
+      for (size_t i = 0; i < fileOutputs[file].size(); i++)
+        printf("\t\t%s\n", fileOutputs[file][i].c_str());
+    }
+
+    if (!collisions.empty()) {
+      printf("\n%d names are written more than once, the last listed wins:\n",
+             (int)collisions.size());
+      for (size_t i = 0; i < collisions.size(); i++) {
+        printf("\t%s\n", collisionNames[i].c_str());
+        for (size_t j = 0; j < collisions[i].size(); j++) {
+          const Task_t &task = g_Run.tasks[collisions[i][j]];
+          printf("\t\t%s in %s\n", items[collisions[i][j]].name,
+                 g_Run.files[task.file]->filename);
+        }
+      }
+    }
+
+    printf("\n%d files, %d textures: %d to convert (%d with alpha), %d unchanged, %d skipped\n",
+           (int)g_Run.files.size(), (int)items.size(), nConvert, nAlpha, nUnchanged,
+           nSkipped);
+    printf("%lld pixels in, %lld out, %d files to write with %.1f MB of images\n",
+           pixelsIn, pixelsOut, nOutputs, bytes / (1024.0 * 1024.0));
+    printf("about %.1f seconds on %d threads, at %.1f ns a pixel (%.1f with alpha)%s\n",
+           seconds, numthreads, secondsPerPixel * 1e9, secondsPerAlphaPixel * 1e9,
+           g_Run.pVTFcmdexe ? ", plus vtfcmd" : "");
+  }
+
+  FreeRun();
+}
+
 void ExtractDirectory(const char *pFilename, char *prefix) {
   const char *pSlash = strrchr(pFilename, '/');
   if (strrchr(pFilename, '\\') > pSlash) pSlash = strrchr(pFilename, '\\');
@@ -990,6 +2564,78 @@ bool DragAndDropCheck(const char **pBaseDir, const char **pSubDir,
   return true;
 }
 
+// Expands a wildcard into a malloc'd list of malloc'd filenames.
+char **FindFiles(const char *pWildcard, int *pCount) {
+  char prefix[512];
+  ExtractDirectory(pWildcard, prefix);
+
+  int nFiles = 0, nMaxFiles = 0;
+  char **ppFiles = NULL;
+
+  _finddata_t findData;
+  long handle = _findfirst(pWildcard, &findData);
+  if (handle != -1) {
+    do {
+      if (!(findData.attrib & _A_SUBDIR)) {
+        if (nFiles == nMaxFiles) {
+          nMaxFiles = nMaxFiles ? nMaxFiles * 2 : 64;
+          ppFiles = (char **)realloc(ppFiles, nMaxFiles * sizeof(char *));
+        }
+        ppFiles[nFiles] = (char *)malloc(strlen(prefix) + strlen(findData.name) + 2);
+        sprintf(ppFiles[nFiles], "%s\\%s", prefix, findData.name);
+        nFiles++;
+      }
+    } while (_findnext(handle, &findData) == 0);
+
+    _findclose(handle);
+  }
+
+  *pCount = nFiles;
+  return ppFiles;
+}
+
+void FreeFiles(char **ppFiles, int nFiles) {
+  for (int i = 0; i < nFiles; i++) free(ppFiles[i]);
+  free(ppFiles);
+}
+
+// Checks every wad matching the wildcard in one go, so the threads can work
+// across all of them.  Returns the number of problems found.
+int CheckWadFiles(const char *pWadFilenames, bool bListCRCs) {
+  int nWads;
+  char **ppWads = FindFiles(pWadFilenames, &nWads);
+  if (!nWads) {
+    printf("No wads match %s\n", pWadFilenames);
+    return 1;
+  }
+
+  int nProblems = CheckWads(nWads, ppWads, bListCRCs);
+  FreeFiles(ppWads, nWads);
+  return nProblems;
+}
+
+// Lists every wad in the index that has the texture, and whether the index
+// still matches the wad.  Returns false if it isn't in any of them.
+bool FindInIndex(const char *pIndexFilename, const char *pTexName) {
+  WadIndex index;
+  if (!index.Open(pIndexFilename)) Error("%s\n", index.GetError());
+
+  int nCount;
+  int first = index.Find(pTexName, &nCount);
+  if (first == -1) {
+    printf("%s isn't in any wad in %s\n", pTexName, pIndexFilename);
+    return false;
+  }
+
+  for (int i = first; i < first + nCount; i++) {
+    const wadindexentry_t *pEntry = index.Entry(i);
+    printf("%s: lump %d, %d bytes%s\n", index.WadName(pEntry->wad),
+           pEntry->lump, pEntry->size,
+           index.IsWadCurrent(pEntry->wad) ? "" : " (wad has changed, rebuild the index)");
+  }
+  return true;
+}
+
 void ParseMaterial(const char *g_pMaterialtxt, char ***key, char **value, int *pairs) {
   FILE *fp = fopen(g_pMaterialtxt, "r");
   if (!fp) {
@@ -1020,9 +2666,6 @@ void ParseMaterial(const char *g_pMaterialtxt, char ***key, char **value, int *p
       (*pairs)++;
     }
   }
-  for (int i = 0; i < *pairs; i++) {
-    printf("%s %c\n", (*key)[i], (*value)[i]);
-  }
 }
 
 int main(int argc, char **argv) {
@@ -1034,6 +2677,17 @@ int main(int argc, char **argv) {
   bool bWriteBMP = false;
   bool bPowerOf2 = true;
   bool bAutoDir = false;
+  bool bCheck = false;
+  bool bCheckCRCs = false;
+  bool bRepack = false;
+  bool bSortNames = false;
+  bool bStats = false;
+  const char *pStatsJSON = NULL;
+  bool bPlan = false;
+  bool bPlanJSON = false;
+  const char *pMakeIndex = NULL;
+  const char *pIndex = NULL;
+  const char *pFindTex = NULL;
 
   bool bVTex = false;
   const char *pBaseDir = NULL;
@@ -1107,6 +2761,63 @@ int main(int argc, char **argv) {
       } else if (stricmp(argv[i], "-materials") == 0) {
         g_pMaterialtxt = argv[i + 1];
         ++i;
+      } else if (stricmp(argv[i], "-makeindex") == 0) {
+        pMakeIndex = argv[i + 1];
+        ++i;
+      } else if (stricmp(argv[i], "-index") == 0) {
+        pIndex = argv[i + 1];
+        ++i;
+      } else if (stricmp(argv[i], "-find") == 0) {
+        pFindTex = argv[i + 1];
+        ++i;
+      } else if (stricmp(argv[i], "-threads") == 0) {
+        numthreads = atoi(argv[i + 1]);
+        ++i;
+      } else if (stricmp(argv[i], "-vtfjobs") == 0) {
+        maxprocesses = atoi(argv[i + 1]);
+        ++i;
+      } else if (stricmp(argv[i], "-statsjson") == 0) {
+        pStatsJSON = argv[i + 1];
+        bStats = true;
+        ++i;
+      } else if (stricmp(argv[i], "-vtftimeout") == 0) {
+        g_nVTFTimeout = atoi(argv[i + 1]);
+        ++i;
+      } else if (stricmp(argv[i], "-vtfformat") == 0) {
+        g_nVTFFormat = VTF_FormatForName(argv[i + 1]);
+        if (g_nVTFFormat == IMAGE_FORMAT_NONE) {
+          printf("Unknown -vtfformat %s.\n", argv[i + 1]);
+          return PrintUsage(argv[0]);
+        }
+        ++i;
+      } else if (stricmp(argv[i], "-resample") == 0) {
+        g_nResample = ResampleFilterForName(argv[i + 1]);
+        if (g_nResample < RESAMPLE_VTFCMD) {
+          printf("Unknown -resample %s.\n", argv[i + 1]);
+          return PrintUsage(argv[0]);
+        }
+        ++i;
+      } else if (stricmp(argv[i], "-vtfalphaformat") == 0) {
+        g_nVTFAlphaFormat = VTF_FormatForName(argv[i + 1]);
+        if (g_nVTFAlphaFormat == IMAGE_FORMAT_NONE) {
+          printf("Unknown -vtfalphaformat %s.\n", argv[i + 1]);
+          return PrintUsage(argv[0]);
+        }
+        ++i;
+      } else if (stricmp(argv[i], "-vtfalphatestformat") == 0) {
+        g_nVTFAlphatestFormat = VTF_FormatForName(argv[i + 1]);
+        if (g_nVTFAlphatestFormat == IMAGE_FORMAT_NONE) {
+          printf("Unknown -vtfalphatestformat %s.\n", argv[i + 1]);
+          return PrintUsage(argv[0]);
+        }
+        ++i;
+      } else if (stricmp(argv[i], "-dxt") == 0) {
+        if (stricmp(argv[i + 1], "fast") && stricmp(argv[i + 1], "quality")) {
+          printf("Unknown -dxt %s.\n", argv[i + 1]);
+          return PrintUsage(argv[0]);
+        }
+        g_bDXTQuality = stricmp(argv[i + 1], "quality") == 0;
+        ++i;
       }
     }
 
@@ -1119,8 +2830,31 @@ int main(int argc, char **argv) {
       //if (g_pShader == g_pDefaultShader) g_pShader = "decalmodulate";
     } else if (stricmp(argv[i], "-quiet") == 0) {
       g_bQuiet = true;
+    } else if (stricmp(argv[i], "-force") == 0) {
+      g_bForce = true;
     } else if (stricmp(argv[i], "-vtex") == 0) {
       bVTex = true;
+    } else if (stricmp(argv[i], "-check") == 0) {
+      bCheck = true;
+    } else if (stricmp(argv[i], "-checkcrcs") == 0) {
+      bCheck = bCheckCRCs = true;
+    } else if (stricmp(argv[i], "-repack") == 0) {
+      bRepack = true;
+    } else if (stricmp(argv[i], "-sortnames") == 0) {
+      bSortNames = true;
+    } else if (stricmp(argv[i], "-vtfbatch") == 0) {
+      g_bVTFBatch = true;
+    } else if (stricmp(argv[i], "-vtf") == 0) {
+      g_bWriteVTF = true;
+    } else if (stricmp(argv[i], "-notga") == 0) {
+      g_bWriteTGA = false;
+    } else if (stricmp(argv[i], "-stats") == 0) {
+      bStats = true;
+    } else if (stricmp(argv[i], "-plan") == 0) {
+      bPlan = true;
+    } else if (stricmp(argv[i], "-planjson") == 0) {
+      bPlan = bPlanJSON = true;
+      g_bQuiet = true;  // nothing but the JSON on stdout
     }
   }
 
@@ -1132,11 +2866,66 @@ int main(int argc, char **argv) {
     }
   }
 
+  if (bCheck) {
+    if (!pWadFilenames) {
+      printf("-check needs -wadfile.\n");
+      return PrintUsage(argv[0]);
+    }
+    int nProblems = CheckWadFiles(pWadFilenames, bCheckCRCs);
+    PrintExitStuff();
+    return nProblems ? 1 : 0;
+  }
+
+  if (bRepack) {
+    if (!pWadFilenames) {
+      printf("-repack needs -wadfile.\n");
+      return PrintUsage(argv[0]);
+    }
+    int nWads, nFailed = 0;
+    char **ppWads = FindFiles(pWadFilenames, &nWads);
+    for (int i = 0; i < nWads; i++) nFailed += !RepackWad(ppWads[i], bSortNames);
+    FreeFiles(ppWads, nWads);
+    PrintExitStuff();
+    return nFailed ? 1 : 0;
+  }
+
+  if (pMakeIndex) {
+    if (!pWadFilenames) {
+      printf("-makeindex needs -wadfile.\n");
+      return PrintUsage(argv[0]);
+    }
+    int nWads;
+    char **ppWads = FindFiles(pWadFilenames, &nWads);
+    int nBad = WadIndex_Build(pMakeIndex, nWads, ppWads);
+    FreeFiles(ppWads, nWads);
+    PrintExitStuff();
+    return nBad ? 1 : 0;
+  }
+
+  if (pFindTex) {
+    if (!pIndex) {
+      printf("-find needs -index.\n");
+      return PrintUsage(argv[0]);
+    }
+    bool bFound = FindInIndex(pIndex, pFindTex);
+    PrintExitStuff();
+    return bFound ? 0 : 1;
+  }
+
   if (!pBaseDir || (!pWadFilenames && !pBMPFilenames && !pSPRFilenames)) {
     printf("Missing a parameter.\n");
     return PrintUsage(argv[0]);
   }
 
+  if (g_bWriteVTF && pVTFcmdexe) {
+    printf("-vtf and -vtfcmd both write the .vtf files, use one or the other.\n");
+    return PrintUsage(argv[0]);
+  }
+  if (!g_bWriteTGA && pVTFcmdexe) {
+    printf("-vtfcmd reads the .tga files, so it can't be used with -notga.\n");
+    return PrintUsage(argv[0]);
+  }
+
   char **matkeys = NULL;
   char *matvals = NULL;
   int pairs = 0;
@@ -1145,61 +2934,35 @@ int main(int argc, char **argv) {
     ParseMaterial(g_pMaterialtxt, &matkeys, &matvals, &pairs);
   }
 
-  char prefix[512];
-  // Scan through each wadfile.
-  if (pWadFilenames) {
-    ExtractDirectory(pWadFilenames, prefix);
-
-    _finddata_t findData;
-    long handle = _findfirst(pWadFilenames, &findData);
-    if (handle != -1) {
-      do {
-        if (!(findData.attrib & _A_SUBDIR)) {
-          char fullFilename[512];
-          sprintf(fullFilename, "%s\\%s", prefix, findData.name);
-          ProcessWadFile(fullFilename, pBaseDir, pSubDir, pOnlyTex, bVTex, pVTFcmdexe, matkeys, matvals, pairs);
-        }
-      } while (_findnext(handle, &findData) == 0);
-
-      _findclose(handle);
+  g_Run.bPlan = bPlan;
+  g_Run.bStageTimes = bStats && !bPlan;
+  g_Run.pBaseDir = pBaseDir;
+  g_Run.pOnlyTex = pOnlyTex;
+  g_Run.bVTex = bVTex;
+  g_Run.pVTFcmdexe = pVTFcmdexe;
+  g_Run.matkeys = matkeys;
+  g_Run.matvals = matvals;
+  g_Run.pairs = pairs;
+
+  // Every wad, then every bmp, then every sprite, all converted together.
+  if (g_Run.bStageTimes) g_pStageTimes = &g_Run.runTimes;
+  const char *pWildcards[3] = {pWadFilenames, pBMPFilenames, pSPRFilenames};
+  for (int type = INPUT_WAD; type <= INPUT_SPR; type++) {
+    if (!pWildcards[type]) continue;
+    int nFiles;
+    char **ppFiles = FindFiles(pWildcards[type], &nFiles);
+    for (int i = 0; i < nFiles; i++) {
+      if (type == INPUT_WAD) AddWadFile(ppFiles[i], pSubDir);
+      else if (type == INPUT_BMP) AddBMPFile(ppFiles[i], pSubDir);
+      else AddSPRFile(ppFiles[i], pSubDir);
     }
+    FreeFiles(ppFiles, nFiles);
   }
-
-  // Process BMP files.
-  if (pBMPFilenames) {
-    ExtractDirectory(pBMPFilenames, prefix);
-
-    _finddata_t findData;
-    long handle = _findfirst(pBMPFilenames, &findData);
-    if (handle != -1) {
-      do {
-        if (!(findData.attrib & _A_SUBDIR)) {
-          char fullFilename[512];
-          sprintf(fullFilename, "%s\\%s", prefix, findData.name);
-          ProcessBMPFile(pBaseDir, pSubDir, fullFilename, bVTex, pVTFcmdexe, matkeys, matvals, pairs);
-        }
-      } while (_findnext(handle, &findData) == 0);
-
-      _findclose(handle);
-    }
-  }
-
-  if (pSPRFilenames) {
-    ExtractDirectory(pSPRFilenames, prefix);
-
-    _finddata_t findData;
-    long handle = _findfirst(pSPRFilenames, &findData);
-    if (handle != -1) {
-      do {
-        if (!(findData.attrib & _A_SUBDIR)) {
-          char fullFilename[512];
-          sprintf(fullFilename, "%s\\%s", prefix, findData.name);
-          ProcessSPRFile(pBaseDir, pSubDir, fullFilename, bVTex);
-        }
-      } while (_findnext(handle, &findData) == 0);
-
-      _findclose(handle);
-    }
+  g_pStageTimes = NULL;
+  if (bPlan) {
+    PlanTasks(bPlanJSON);
+  } else {
+    RunTasks(bStats, pStatsJSON);
   }
 
   PrintExitStuff();
@@ -0,0 +1,728 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Benchmarks for the wad library and the xwad conversion path.
+//
+//=============================================================================//
+
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <direct.h>
+
+#include "goldsrc_standin.h"
+
+#include "wadlib.h"
+#include "goldsrc_bspfile.h"
+#include "lzsslib.h"
+#include "wadindex.h"
+#include "procpool.h"
+
+// goldsrc_standin's Error() calls this on the way out.
+void PrintExitStuff() {}
+
+static double g_flTicksPerSecond = 0;
+
+static long long GetTicks() {
+  LARGE_INTEGER now;
+  QueryPerformanceCounter(&now);
+  return now.QuadPart;
+}
+
+static double SecondsSince(long long start) {
+  if (!g_flTicksPerSecond) {
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    g_flTicksPerSecond = (double)freq.QuadPart;
+  }
+  return (GetTicks() - start) / g_flTicksPerSecond;
+}
+
+// Results go here so the timed loops can't be optimized away.
+volatile int g_nSink;
+
+// Fixed seed so runs can be compared between commits.
+static unsigned int g_nRandom = 0x2545F491;
+
+static unsigned int RandomInt() {
+  g_nRandom ^= g_nRandom << 13;
+  g_nRandom ^= g_nRandom >> 17;
+  g_nRandom ^= g_nRandom << 5;
+  return g_nRandom;
+}
+
+// Something that looks like a texture name: 3-15 characters, upper case
+// because that's how the old linear search expected to find them.
+static void RandomLumpName(char name[16]) {
+  static const char chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_{+-~";
+  int len = 3 + RandomInt() % 13;
+  memset(name, 0, 16);
+  for (int i = 0; i < len; i++) name[i] = chars[RandomInt() % (sizeof(chars) - 1)];
+}
+
+//-----------------------------------------------------------------------------
+// names: W_CheckNumForName against the old linear directory scan
+//-----------------------------------------------------------------------------
+
+// The W_CheckNumForName that shipped with xwad, kept here as the reference.
+static int LinearCheckNumForName(char *name) {
+  char cleanname[16];
+  CleanupName(name, cleanname);
+
+  int v1 = *(int *)cleanname;
+  int v2 = *(int *)&cleanname[4];
+  int v3 = *(int *)&cleanname[8];
+  int v4 = *(int *)&cleanname[12];
+
+  lumpinfo_t *lump_p = lumpinfo;
+  for (int i = 0; i < numlumps; i++, lump_p++) {
+    if (*(int *)lump_p->name == v1 && *(int *)&lump_p->name[4] == v2 &&
+        *(int *)&lump_p->name[8] == v3 && *(int *)&lump_p->name[12] == v4)
+      return i;
+  }
+  return -1;
+}
+
+// A wad that only has a directory, which is all the name lookups look at.
+static void WriteNameOnlyWad(const char *pFilename, int count, char (*names)[16]) {
+  FILE *fp = SafeOpenWrite((char *)pFilename);
+
+  wadinfo_t hdr;
+  memcpy(hdr.identification, "WAD3", 4);
+  hdr.numlumps = LittleLong(count);
+  hdr.infotableofs = LittleLong(sizeof(hdr));
+  SafeWrite(fp, &hdr, sizeof(hdr));
+
+  for (int i = 0; i < count; i++) {
+    lumpinfo_t info;
+    memset(&info, 0, sizeof(info));
+    info.filepos = LittleLong(sizeof(hdr));
+    memcpy(info.name, names[i], sizeof(info.name));
+    SafeWrite(fp, &info, sizeof(info));
+  }
+  fclose(fp);
+}
+
+static void BenchNames() {
+  static const int lumpCounts[] = {5000, 10000, 20000, 50000};
+  const char *pTempWad = "xwadbench_names.wad";
+
+  printf("names: W_CheckNumForName, half hits and half misses\n");
+  printf("%8s %16s %16s %10s\n", "lumps", "linear/sec", "hashed/sec", "speedup");
+
+  for (int c = 0; c < (int)(sizeof(lumpCounts) / sizeof(lumpCounts[0])); c++) {
+    int count = lumpCounts[c];
+    char (*names)[16] = (char (*)[16])malloc(count * 16);
+    for (int i = 0; i < count; i++) RandomLumpName(names[i]);
+    WriteNameOnlyWad(pTempWad, count, names);
+    W_OpenWad(pTempWad);
+
+    // Every other query is a name that (almost certainly) isn't there.
+    const int nQueries = 1 << 16;
+    char (*queries)[16] = (char (*)[16])malloc(nQueries * 16);
+    for (int i = 0; i < nQueries; i++) {
+      if (i & 1)
+        RandomLumpName(queries[i]);
+      else
+        memcpy(queries[i], names[RandomInt() % count], 16);
+    }
+
+    // The linear scan is slow enough that a slice of the queries will do.
+    int nLinear = nQueries / 16;
+    int nFound = 0;
+    long long start = GetTicks();
+    for (int i = 0; i < nLinear; i++) nFound += LinearCheckNumForName(queries[i]) != -1;
+    double flLinear = nLinear / SecondsSince(start);
+
+    int nRepeats = 16;
+    int nHashFound = 0;
+    start = GetTicks();
+    for (int r = 0; r < nRepeats; r++)
+      for (int i = 0; i < nQueries; i++) nHashFound += W_CheckNumForName(queries[i]) != -1;
+    double flHashed = (double)nQueries * nRepeats / SecondsSince(start);
+    g_nSink += nFound + nHashFound;
+
+    // Both have to agree on the answers for the numbers to mean anything.
+    for (int i = 0; i < nLinear; i++) {
+      if (LinearCheckNumForName(queries[i]) != W_CheckNumForName(queries[i]))
+        Error("names: lookup mismatch for %.16s\n", queries[i]);
+    }
+
+    printf("%8d %16.0f %16.0f %9.1fx\n", count, flLinear, flHashed, flHashed / flLinear);
+
+    W_CloseWad();
+    free(queries);
+    free(names);
+  }
+
+  remove(pTempWad);
+}
+
+//-----------------------------------------------------------------------------
+// lzss: CMP_LZSS throughput and ratio on the lumps of real wads
+//-----------------------------------------------------------------------------
+
+static void BenchLZSS(int nWads, char **ppWads) {
+  printf("lzss: LZSS_Compress / LZSS_Decompress on every stored lump\n");
+  printf("%-24s %7s %10s %10s %7s %12s %12s\n", "wad", "lumps", "in MB", "out MB",
+         "ratio", "comp MB/s", "decomp MB/s");
+
+  double flTotalIn = 0, flTotalOut = 0, flTotalComp = 0, flTotalDecomp = 0;
+  int nTotalLumps = 0;
+
+  for (int w = 0; w < nWads; w++) {
+    WadReader wad;
+    if (!wad.Open(ppWads[w])) Error("%s\n", wad.GetError());
+
+    double flIn = 0, flOut = 0, flComp = 0, flDecomp = 0;
+    int nLumps = 0;
+    for (int i = 0; i < wad.NumLumps(); i++) {
+      const lumpinfo_t *pInfo = wad.LumpInfo(i);
+      if (pInfo->compression != CMP_NONE || pInfo->size <= 0) continue;
+
+      byte *pRaw = (byte *)wad.LoadLumpNum(i);
+      byte *pPacked = (byte *)malloc(LZSS_BOUND(pInfo->size));
+      byte *pUnpacked = (byte *)malloc(pInfo->size);
+
+      long long start = GetTicks();
+      int packed = LZSS_Compress(pRaw, pInfo->size, pPacked, LZSS_BOUND(pInfo->size));
+      flComp += SecondsSince(start);
+      if (!packed) Error("lzss: %s didn't fit in LZSS_BOUND\n", pInfo->name);
+
+      // Decompression is quick enough that it needs a few goes to time.
+      const int nDecompRepeats = 4;
+      start = GetTicks();
+      for (int r = 0; r < nDecompRepeats; r++) {
+        if (!LZSS_Decompress(pPacked, packed, pUnpacked, pInfo->size))
+          Error("lzss: %s failed to decompress\n", pInfo->name);
+      }
+      flDecomp += SecondsSince(start) / nDecompRepeats;
+
+      if (memcmp(pRaw, pUnpacked, pInfo->size))
+        Error("lzss: %s didn't survive the round trip\n", pInfo->name);
+
+      flIn += pInfo->size;
+      flOut += packed;
+      nLumps++;
+
+      free(pUnpacked);
+      free(pPacked);
+      free(pRaw);
+    }
+
+    const char *pName = strrchr(ppWads[w], '\\');
+    if (strrchr(ppWads[w], '/') > pName) pName = strrchr(ppWads[w], '/');
+    pName = pName ? pName + 1 : ppWads[w];
+
+    printf("%-24.24s %7d %10.2f %10.2f %6.1f%% %12.1f %12.1f\n", pName, nLumps,
+           flIn / (1 << 20), flOut / (1 << 20), flIn ? 100.0 * flOut / flIn : 0.0,
+           flComp ? flIn / (1 << 20) / flComp : 0.0,
+           flDecomp ? flIn / (1 << 20) / flDecomp : 0.0);
+
+    flTotalIn += flIn;
+    flTotalOut += flOut;
+    flTotalComp += flComp;
+    flTotalDecomp += flDecomp;
+    nTotalLumps += nLumps;
+  }
+
+  if (nWads > 1) {
+    printf("%-24s %7d %10.2f %10.2f %6.1f%% %12.1f %12.1f\n", "total", nTotalLumps,
+           flTotalIn / (1 << 20), flTotalOut / (1 << 20),
+           flTotalIn ? 100.0 * flTotalOut / flTotalIn : 0.0,
+           flTotalComp ? flTotalIn / (1 << 20) / flTotalComp : 0.0,
+           flTotalDecomp ? flTotalIn / (1 << 20) / flTotalDecomp : 0.0);
+  }
+}
+
+//-----------------------------------------------------------------------------
+// index: WadIndex::Find across a library against opening every wad
+//-----------------------------------------------------------------------------
+
+static void BenchIndex() {
+  const int nWads = 200;
+  const int nLumpsPerWad = 500;
+  const char *pIndex = "xwadbench_index.wix";
+
+  printf("index: finding a texture in %d wads of %d lumps\n", nWads, nLumpsPerWad);
+
+  char **ppWads = (char **)malloc(nWads * sizeof(char *));
+  char (*names)[16] = (char (*)[16])malloc(nWads * nLumpsPerWad * 16);
+  for (int w = 0; w < nWads; w++) {
+    ppWads[w] = (char *)malloc(64);
+    sprintf(ppWads[w], "xwadbench_index%03d.wad", w);
+    for (int i = 0; i < nLumpsPerWad; i++) RandomLumpName(names[w * nLumpsPerWad + i]);
+    WriteNameOnlyWad(ppWads[w], nLumpsPerWad, names + w * nLumpsPerWad);
+  }
+
+  long long start = GetTicks();
+  WadIndex_Build(pIndex, nWads, ppWads);
+  double flBuild = SecondsSince(start);
+
+  // A second build finds every wad unchanged and only rewrites the index.
+  start = GetTicks();
+  WadIndex_Build(pIndex, nWads, ppWads);
+  double flRebuild = SecondsSince(start);
+
+  const int nQueries = 1 << 14;
+  char (*queries)[16] = (char (*)[16])malloc(nQueries * 16);
+  for (int i = 0; i < nQueries; i++) {
+    if (i & 1)
+      RandomLumpName(queries[i]);
+    else
+      memcpy(queries[i], names[RandomInt() % (nWads * nLumpsPerWad)], 16);
+  }
+
+  start = GetTicks();
+  WadIndex index;
+  if (!index.Open(pIndex)) Error("%s\n", index.GetError());
+  double flOpen = SecondsSince(start);
+
+  int nFound = 0;
+  start = GetTicks();
+  for (int i = 0; i < nQueries; i++) {
+    int nCount;
+    nFound += index.Find(queries[i], &nCount) != -1;
+  }
+  double flIndexed = SecondsSince(start) / nQueries;
+
+  // The old way: open wads in order until one has it.  Slow, so fewer queries.
+  int nOpenQueries = 64;
+  int nOpenFound = 0;
+  start = GetTicks();
+  for (int i = 0; i < nOpenQueries; i++) {
+    for (int w = 0; w < nWads; w++) {
+      WadReader wad;
+      if (!wad.Open(ppWads[w])) Error("%s\n", wad.GetError());
+      if (wad.CheckNumForName(queries[i]) != -1) {
+        nOpenFound++;
+        break;
+      }
+    }
+  }
+  double flOpened = SecondsSince(start) / nOpenQueries;
+
+  // Both have to agree on which queries are there at all.
+  for (int i = 0; i < nOpenQueries; i++) {
+    int nCount, nHave = 0;
+    for (int w = 0; w < nWads && !nHave; w++) {
+      WadReader wad;
+      wad.Open(ppWads[w]);
+      nHave = wad.CheckNumForName(queries[i]) != -1;
+    }
+    if (nHave != (index.Find(queries[i], &nCount) != -1))
+      Error("index: lookup mismatch for %.16s\n", queries[i]);
+  }
+  g_nSink += nFound + nOpenFound;
+
+  printf("build %.1f ms, rebuild unchanged %.1f ms, open %.3f ms\n", flBuild * 1000,
+         flRebuild * 1000, flOpen * 1000);
+  printf("%-24s %12.2f us/lookup\n", "index", flIndexed * 1e6);
+  printf("%-24s %12.2f us/lookup\n", "opening wads", flOpened * 1e6);
+
+  index.Close();
+  remove(pIndex);
+  for (int w = 0; w < nWads; w++) {
+    remove(ppWads[w]);
+    free(ppWads[w]);
+  }
+  free(ppWads);
+  free(queries);
+  free(names);
+}
+
+//-----------------------------------------------------------------------------
+// corpus: a made-up set of wads, bmps and sprites, converted end to end
+//-----------------------------------------------------------------------------
+
+struct CorpusOptions_t {
+  unsigned int seed;
+  int nWads;
+  int nLumps;        // per wad
+  int minSize;       // of either side, a multiple of 16
+  int maxSize;
+  int pow2Percent;   // of textures with power of two sides
+  int transparentPercent;
+  int nBMPs;
+  int nSPRs;
+  int nFrames;       // per sprite
+  int nRuns;
+  int nThreads;      // for xwad, 0 for its default
+  bool bStats;       // pass -stats through and print what it says
+  const char *pXwad;
+};
+
+static double RandomFraction() { return RandomInt() / 4294967296.0; }
+
+// Log uniform between the smallest and largest sizes, so small textures are
+// as common as big ones, then either left a multiple of 16 or snapped to a
+// power of two.
+static int RandomSide(const CorpusOptions_t &options) {
+  double flMin = log((double)options.minSize), flMax = log((double)options.maxSize);
+  int side = (int)exp(flMin + RandomFraction() * (flMax - flMin));
+  if ((int)(RandomInt() % 100) < options.pow2Percent) {
+    int pow2 = 16;
+    while (pow2 * 2 <= side) pow2 *= 2;
+    if (side - pow2 > pow2 * 2 - side && pow2 * 2 <= options.maxSize) pow2 *= 2;
+    return pow2;
+  }
+  side = (side + 8) & ~15;
+  return side < 16 ? 16 : side;
+}
+
+static void RandomPalette(byte palette[768]) {
+  for (int i = 0; i < 768; i++) palette[i] = (byte)RandomInt();
+  palette[255 * 3 + 0] = 0;  // the usual transparent blue
+  palette[255 * 3 + 1] = 0;
+  palette[255 * 3 + 2] = 255;
+}
+
+// Noisy diagonal bands, so the encoders have edges to work on, and never
+// index 255.  Transparent ones get round holes of 255 in them for the flood
+// fill to work through.
+static void MakeTexture(byte *pixels, int width, int height, bool bTransparent) {
+  int base = RandomInt() % 8 * 30;
+  for (int y = 0; y < height; y++)
+    for (int x = 0; x < width; x++)
+      pixels[y * width + x] = (byte)(base + (((x + y) >> 3) + (RandomInt() & 3)) % 30);
+
+  if (!bTransparent) return;
+  int minSide = width < height ? width : height;
+  int nHoles = 1 + RandomInt() % 4;
+  for (int i = 0; i < nHoles; i++) {
+    int cx = RandomInt() % width, cy = RandomInt() % height;
+    int r = minSide / 8 + RandomInt() % (minSide / 4 + 1);
+    for (int y = cy - r; y <= cy + r; y++) {
+      for (int x = cx - r; x <= cx + r; x++) {
+        if (x >= 0 && y >= 0 && x < width && y < height &&
+            (x - cx) * (x - cx) + (y - cy) * (y - cy) <= r * r)
+          pixels[y * width + x] = 255;
+      }
+    }
+  }
+}
+
+// Adds the file to the corpus hash and total size, so two runs can be seen
+// to have converted the same thing.
+static void HashCorpusFile(const char *pFilename, unsigned long long *pHash,
+                           double *pBytes) {
+  void *pData;
+  int length = LoadFile((char *)pFilename, &pData);
+  unsigned long long hashes[2] = {*pHash, W_HashData(pData, length)};
+  *pHash = W_HashData(hashes, sizeof(hashes));
+  *pBytes += length;
+  free(pData);
+}
+
+// A WAD3 of miptexes laid out the way Half-Life's tools write them: the four
+// mips, then the palette with its count in front.
+static void WriteCorpusWad(const char *pFilename, int wadNum, const CorpusOptions_t &options) {
+  int maxPixels = options.maxSize * options.maxSize;
+  byte *pLump = (byte *)malloc(sizeof(miptex_t) + maxPixels * 85 / 64 + 2 + 768 + 2);
+  byte *pPixels = (byte *)malloc(maxPixels);
+
+  WadWriter wad;
+  wad.Open(pFilename, false);
+  for (int i = 0; i < options.nLumps; i++) {
+    int width = RandomSide(options), height = RandomSide(options);
+    bool bTransparent = (int)(RandomInt() % 100) < options.transparentPercent;
+    MakeTexture(pPixels, width, height, bTransparent);
+
+    miptex_t *pMip = (miptex_t *)pLump;
+    memset(pMip, 0, sizeof(*pMip));
+    sprintf(pMip->name, "%sw%02dt%04d", bTransparent ? "{" : "", wadNum, i);
+    pMip->width = LittleLong(width);
+    pMip->height = LittleLong(height);
+    int ofs = sizeof(miptex_t);
+    for (int mip = 0; mip < MIPLEVELS; mip++) {
+      pMip->offsets[mip] = LittleLong(ofs);
+      int step = 1 << mip;
+      for (int y = 0; y < height; y += step)
+        for (int x = 0; x < width; x += step) pLump[ofs++] = pPixels[y * width + x];
+    }
+    *(short *)(pLump + ofs) = LittleShort(256);
+    RandomPalette(pLump + ofs + 2);
+    ofs += 2 + 768 + 2;
+    pLump[ofs - 2] = pLump[ofs - 1] = 0;
+
+    wad.AddLump(pMip->name, pLump, ofs, TYP_MIPTEX3, CMP_NONE);
+  }
+  wad.Commit(1);
+
+  free(pPixels);
+  free(pLump);
+}
+
+// An uncompressed 8 bit bmp.  The sides are multiples of 16, so the rows
+// need no padding.
+static void WriteCorpusBMP(const char *pFilename, const CorpusOptions_t &options) {
+  int width = RandomSide(options), height = RandomSide(options);
+  byte *pPixels = (byte *)malloc(width * height);
+  MakeTexture(pPixels, width, height, false);
+
+  byte palette[768];
+  RandomPalette(palette);
+  RGBQUAD quads[256];
+  for (int i = 0; i < 256; i++) {
+    quads[i].rgbRed = palette[i * 3 + 0];
+    quads[i].rgbGreen = palette[i * 3 + 1];
+    quads[i].rgbBlue = palette[i * 3 + 2];
+    quads[i].rgbReserved = 0;
+  }
+
+  BITMAPFILEHEADER bfh;
+  BITMAPINFOHEADER bih;
+  memset(&bfh, 0, sizeof(bfh));
+  memset(&bih, 0, sizeof(bih));
+  bfh.bfType = 0x4d42;  // BM
+  bfh.bfOffBits = sizeof(bfh) + sizeof(bih) + sizeof(quads);
+  bfh.bfSize = bfh.bfOffBits + width * height;
+  bih.biSize = sizeof(bih);
+  bih.biWidth = width;
+  bih.biHeight = height;
+  bih.biPlanes = 1;
+  bih.biBitCount = 8;
+  bih.biCompression = BI_RGB;
+  bih.biSizeImage = width * height;
+
+  FILE *fp = SafeOpenWrite((char *)pFilename);
+  SafeWrite(fp, &bfh, sizeof(bfh));
+  SafeWrite(fp, &bih, sizeof(bih));
+  SafeWrite(fp, quads, sizeof(quads));
+  SafeWrite(fp, pPixels, width * height);
+  fclose(fp);
+  free(pPixels);
+}
+
+// A version 2 sprite of single frames, all the same size.
+static void WriteCorpusSPR(const char *pFilename, const CorpusOptions_t &options) {
+  int width = RandomSide(options), height = RandomSide(options);
+  byte *pPixels = (byte *)malloc(width * height);
+
+  // dsprite_t as xwad reads it
+  int header[10];
+  header[0] = LittleLong(('P' << 24) | ('S' << 16) | ('D' << 8) | 'I');
+  header[1] = LittleLong(2);  // version
+  header[2] = LittleLong(2);  // vp parallel
+  header[3] = LittleLong(0);  // normal
+  float flRadius = LittleFloat((float)sqrt((double)(width * width + height * height)) / 2);
+  memcpy(&header[4], &flRadius, sizeof(flRadius));
+  header[5] = LittleLong(width);
+  header[6] = LittleLong(height);
+  header[7] = LittleLong(options.nFrames);
+  header[8] = 0;  // beam length
+  header[9] = 0;  // synchronized
+
+  FILE *fp = SafeOpenWrite((char *)pFilename);
+  SafeWrite(fp, header, sizeof(header));
+  short nColors = LittleShort(256);
+  byte palette[768];
+  RandomPalette(palette);
+  SafeWrite(fp, &nColors, sizeof(nColors));
+  SafeWrite(fp, palette, sizeof(palette));
+
+  for (int i = 0; i < options.nFrames; i++) {
+    // the frame type, then dspriteframe_t
+    int frame[5] = {LittleLong(0), LittleLong(-width / 2), LittleLong(height / 2),
+                    LittleLong(width), LittleLong(height)};
+    MakeTexture(pPixels, width, height, (int)(RandomInt() % 100) < options.transparentPercent);
+    SafeWrite(fp, frame, sizeof(frame));
+    SafeWrite(fp, pPixels, width * height);
+  }
+  fclose(fp);
+  free(pPixels);
+}
+
+// Writes the corpus into pDir and converts it there with xwad, a few times
+// over, into pDir\out.  The same seed and options always make the same files.
+static void BenchCorpus(const char *pDir, const CorpusOptions_t &options) {
+  g_nRandom = 0x2545F491 ^ (options.seed * 0x9E3779B9);
+  if (!g_nRandom) g_nRandom = 1;
+
+  _mkdir(pDir);
+  char filename[1024];
+  unsigned long long hash = 0;
+  double flBytes = 0;
+  long long start = GetTicks();
+  for (int i = 0; i < options.nWads; i++) {
+    sprintf(filename, "%s\\corpus%02d.wad", pDir, i);
+    WriteCorpusWad(filename, i, options);
+    HashCorpusFile(filename, &hash, &flBytes);
+  }
+  for (int i = 0; i < options.nBMPs; i++) {
+    sprintf(filename, "%s\\corpus%03d.bmp", pDir, i);
+    WriteCorpusBMP(filename, options);
+    HashCorpusFile(filename, &hash, &flBytes);
+  }
+  for (int i = 0; i < options.nSPRs; i++) {
+    sprintf(filename, "%s\\corpus%02d.spr", pDir, i);
+    WriteCorpusSPR(filename, options);
+    HashCorpusFile(filename, &hash, &flBytes);
+  }
+  int nTextures = options.nWads * options.nLumps + options.nBMPs + options.nSPRs * options.nFrames;
+  printf("corpus: seed %u, %d textures, %.2f MB, hash %016llx, made in %.2f s\n", options.seed,
+         nTextures, flBytes / (1 << 20), hash, SecondsSince(start));
+
+  char baseDir[1024], wads[1024], bmps[1024], sprs[1024], threads[16];
+  sprintf(baseDir, "%s\\out", pDir);
+  sprintf(wads, "%s\\*.wad", pDir);
+  sprintf(bmps, "%s\\*.bmp", pDir);
+  sprintf(sprs, "%s\\*.spr", pDir);
+  sprintf(threads, "%d", options.nThreads);
+
+  // -force so later runs convert everything again rather than finding it
+  // unchanged.
+  const char *args[16];
+  int nArgs = 0;
+  args[nArgs++] = options.pXwad;
+  args[nArgs++] = "-quiet";
+  args[nArgs++] = "-force";
+  args[nArgs++] = "-basedir";
+  args[nArgs++] = baseDir;
+  if (options.nWads) {
+    args[nArgs++] = "-wadfile";
+    args[nArgs++] = wads;
+  }
+  if (options.nBMPs) {
+    args[nArgs++] = "-bmpfile";
+    args[nArgs++] = bmps;
+  }
+  if (options.nSPRs) {
+    args[nArgs++] = "-sprfile";
+    args[nArgs++] = sprs;
+  }
+  if (options.nThreads) {
+    args[nArgs++] = "-threads";
+    args[nArgs++] = threads;
+  }
+  if (options.bStats) args[nArgs++] = "-stats";
+
+  printf("%5s %10s %12s %10s %12s\n", "run", "seconds", "textures/s", "MB/s", "peak RSS MB");
+  double flBest = 0;
+  int bestPeak = 0;
+  for (int run = 0; run < options.nRuns; run++) {
+    procresult_t result;
+    start = GetTicks();
+    bool bOk = RunProcess(nArgs, args, 0, &result) != 0;
+    double flSeconds = SecondsSince(start);
+    if (!bOk) {
+      printf("%s", result.output);
+      Error("corpus: %s failed with exit code %d\n", options.pXwad, result.exitcode);
+    }
+    printf("%5d %10.3f %12.1f %10.2f %12.1f\n", run + 1, flSeconds, nTextures / flSeconds,
+           flBytes / (1 << 20) / flSeconds, result.peakmemorykb / 1024.0);
+    if (options.bStats) printf("%s", result.output);
+    if (run == 0 || flSeconds < flBest) {
+      flBest = flSeconds;
+      bestPeak = result.peakmemorykb;
+    }
+    FreeProcResult(&result);
+  }
+  if (options.nRuns > 1) {
+    printf("%5s %10.3f %12.1f %10.2f %12.1f\n", "best", flBest, nTextures / flBest,
+           flBytes / (1 << 20) / flBest, bestPeak / 1024.0);
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    printf(
+        "%s <benchmark>\n"
+        "\tnames\n"
+        "\t\tW_CheckNumForName against a linear scan, 5k to 50k lumps.\n"
+        "\tlzss <wad> [wad...]\n"
+        "\t\tCMP_LZSS compression ratio and throughput on each lump.\n"
+        "\tindex\n"
+        "\t\tWadIndex lookups across 200 wads against opening each one.\n"
+        "\tcorpus <dir> [options]\n"
+        "\t\twrites made-up wads, bmps and sprites into dir and converts\n"
+        "\t\tthem there with xwad, reporting textures/s, MB/s and peak RSS.\n"
+        "\t\t-xwad <exe>            (default xwad.exe)\n"
+        "\t\t-seed <n>              (default 1)\n"
+        "\t\t-wads <n> -lumps <n>   wads and lumps in each (default 4, 256)\n"
+        "\t\t-sizes <min> <max>     texture sides (default 16 512)\n"
+        "\t\t-pow2 <percent>        power of two sides (default 80)\n"
+        "\t\t-transparent <percent> '{' textures with holes (default 20)\n"
+        "\t\t-bmps <n>              (default 32)\n"
+        "\t\t-sprs <n> -frames <n>  sprites and frames in each (default 4, 8)\n"
+        "\t\t-runs <n>              conversions to time (default 3)\n"
+        "\t\t-threads <n>           passed to xwad\n"
+        "\t\t-stats                 passed to xwad, and its report printed\n",
+        argv[0]);
+    return 1;
+  }
+
+  if (stricmp(argv[1], "names") == 0) {
+    BenchNames();
+  } else if (stricmp(argv[1], "index") == 0) {
+    BenchIndex();
+  } else if (stricmp(argv[1], "lzss") == 0 && argc > 2) {
+    BenchLZSS(argc - 2, argv + 2);
+  } else if (stricmp(argv[1], "corpus") == 0 && argc > 2) {
+    CorpusOptions_t options;
+    options.seed = 1;
+    options.nWads = 4;
+    options.nLumps = 256;
+    options.minSize = 16;
+    options.maxSize = 512;
+    options.pow2Percent = 80;
+    options.transparentPercent = 20;
+    options.nBMPs = 32;
+    options.nSPRs = 4;
+    options.nFrames = 8;
+    options.nRuns = 3;
+    options.nThreads = 0;
+    options.bStats = false;
+    options.pXwad = "xwad.exe";
+    for (int i = 3; i < argc; i++) {
+      bool bValue = i + 1 < argc;
+      if (stricmp(argv[i], "-stats") == 0) {
+        options.bStats = true;
+      } else if (stricmp(argv[i], "-xwad") == 0 && bValue) {
+        options.pXwad = argv[++i];
+      } else if (stricmp(argv[i], "-seed") == 0 && bValue) {
+        options.seed = (unsigned int)strtoul(argv[++i], NULL, 0);
+      } else if (stricmp(argv[i], "-wads") == 0 && bValue) {
+        options.nWads = atoi(argv[++i]);
+      } else if (stricmp(argv[i], "-lumps") == 0 && bValue) {
+        options.nLumps = atoi(argv[++i]);
+      } else if (stricmp(argv[i], "-sizes") == 0 && i + 2 < argc) {
+        options.minSize = atoi(argv[++i]);
+        options.maxSize = atoi(argv[++i]);
+      } else if (stricmp(argv[i], "-pow2") == 0 && bValue) {
+        options.pow2Percent = atoi(argv[++i]);
+      } else if (stricmp(argv[i], "-transparent") == 0 && bValue) {
+        options.transparentPercent = atoi(argv[++i]);
+      } else if (stricmp(argv[i], "-bmps") == 0 && bValue) {
+        options.nBMPs = atoi(argv[++i]);
+      } else if (stricmp(argv[i], "-sprs") == 0 && bValue) {
+        options.nSPRs = atoi(argv[++i]);
+      } else if (stricmp(argv[i], "-frames") == 0 && bValue) {
+        options.nFrames = atoi(argv[++i]);
+      } else if (stricmp(argv[i], "-runs") == 0 && bValue) {
+        options.nRuns = atoi(argv[++i]);
+      } else if (stricmp(argv[i], "-threads") == 0 && bValue) {
+        options.nThreads = atoi(argv[++i]);
+      } else {
+        printf("Unknown corpus option '%s'.\n", argv[i]);
+        return 1;
+      }
+    }
+    if (options.minSize < 16 || options.maxSize > 4096 || options.minSize > options.maxSize ||
+        (options.minSize | options.maxSize) & 15) {
+      printf("-sizes must be multiples of 16 from 16 to 4096.\n");
+      return 1;
+    }
+    if (options.nWads < 0 || options.nLumps < 1 || options.nBMPs < 0 || options.nSPRs < 0 ||
+        options.nFrames < 1 || options.nRuns < 1) {
+      printf("Counts can't be negative, and -lumps, -frames and -runs need at least 1.\n");
+      return 1;
+    }
+    BenchCorpus(argv[2], options);
+  } else {
+    printf("Unknown benchmark '%s'.\n", argv[1]);
+    return 1;
+  }
+  return 0;
+}